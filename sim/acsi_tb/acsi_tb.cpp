@@ -0,0 +1,440 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+
+#include "Vacsi_tb.h"
+#include "verilated.h"
+
+#include "sdcard.h"
+#include "trace.h"
+#include "bench.h"
+#include "eventlog.h"
+
+static Vacsi_tb *tb;
+static TraceWindow trace("acsi_tb");
+static SimBench bench("acsi_tb", 32000000);
+static EventLog elog("acsi_tb");
+static double simulation_time;
+static SdCardModel *sd;
+
+// trace triggers: +trigger=acsi-cmd|sd-cmd:<n>, +trace_stop=sd-cmd:<n>
+static bool trig_acsi_cmd = false;
+static int trig_sd_cmd = -1, stop_sd_cmd = -1;
+
+#define TICKLEN   (1.0/64000000)
+
+// 1MB of ST RAM, word addressed
+static std::vector<uint16_t> ram(512*1024);
+
+// The MMU runs one DMA bus cycle of +dma_ns=<ns> (default 500ns, a
+// full 68000 bus cycle) per word while the DMA requests the bus. The
+// rising edge of rdy_i at its end makes the DMA take or give a word.
+static struct {
+  int cycle;            // clocks per bus cycle
+  int cnt;              // clock within the current cycle, 0 = idle
+  uint32_t addr;        // dma address register
+  bool to_disk;         // direction, ram is read
+  unsigned long words;
+  double first_word;    // time of the first word of a command
+} mmu;
+
+static void mmu_clock(void) {
+  if(!mmu.cnt && (tb->cpu_sel || !tb->rdy_o)) return;
+
+  mmu.cnt++;
+  if(mmu.cnt == 1) {
+    tb->rdy_i = 0;
+    if(mmu.to_disk) tb->ram_din = ram[(mmu.addr >> 1) % ram.size()];
+  }
+  if(mmu.cnt == mmu.cycle/2) {
+    tb->rdy_i = 1;
+    if(!mmu.to_disk) ram[(mmu.addr >> 1) % ram.size()] = tb->cpu_dout;
+    if(mmu.first_word < 0) mmu.first_word = simulation_time;
+    mmu.addr += 2;
+    mmu.words++;
+  }
+  if(mmu.cnt >= mmu.cycle) mmu.cnt = 0;
+}
+
+static void sd_command(int cmd, unsigned long arg) {
+  if(cmd == trig_sd_cmd) trace.trigger();
+  if(cmd == stop_sd_cmd) trace.stop();
+}
+
+void tick(int c) {
+  tb->clk = c;
+  tb->eval();
+  if(c) {
+    bench.cycle();
+    mmu_clock();
+  }
+
+  sd->tick(tb);
+
+  elog.now = 1000000000000 * simulation_time;
+  trace.dump(elog.now);
+  simulation_time += TICKLEN;
+}
+
+void run(int ticks) {
+  for(int i=0;i<ticks;i++) {
+    tick(1);
+    tick(0);
+  }
+}
+
+void wait_ms(int ms) { run(32000*ms); }
+
+void wait_clk8() {
+  run(1);
+  while(!tb->clk_en) run(1);
+}
+
+// cpu access to $ff8604 (a1 = 0) and $ff8606 (a1 = 1)
+void cpu_write(int a1, int val) {
+  wait_clk8();
+
+  tb->cpu_a1 = a1;
+  tb->cpu_sel = 1;
+  tb->cpu_rw = 0;
+  tb->cpu_din = val;
+
+  wait_clk8();
+  tb->cpu_sel = 0;
+}
+
+int cpu_read(int a1) {
+  wait_clk8();
+
+  tb->cpu_a1 = a1;
+  tb->cpu_sel = 1;
+  tb->cpu_rw = 1;
+
+  wait_clk8();
+  int val = tb->cpu_dout;
+  tb->cpu_sel = 0;
+  return val;
+}
+
+// ----------------------------- MCU -----------------------------
+// The MCU talks to the sd card controller via SPI like the firmware
+// does, each byte takes the time of a +spi_mhz=<f> (default 20) SPI
+// transfer. ACSI sectors are not translated, the sd card image is the
+// hard disk image.
+
+static int spi_byte_clocks;
+
+unsigned char mcu_write_byte(unsigned char byte, char start) {
+  tb->mcu_dout = byte;
+  if(start) tb->mcu_start = 1;
+  tb->mcu_strobe = 1;
+  run(1);
+  tb->mcu_strobe = 0;
+  tb->mcu_start = 0;
+  run(spi_byte_clocks - 1);
+  return tb->mcu_din;
+}
+
+unsigned char mcu_read_byte(void) {
+  return mcu_write_byte(0x00, 0);
+}
+
+// answer a request of the sd card controller
+void mcu_service(void) {
+  tb->sd_iack = 1;
+  run(1);
+  tb->sd_iack = 0;
+
+  mcu_write_byte(0x01, 1);
+  unsigned char request = mcu_read_byte();
+  unsigned long sector = 0;
+  for(int i=0;i<4;i++)
+    sector = (sector << 8) | mcu_read_byte();
+
+  // drives 2 and 3 are the acsi targets
+  if(request & 0x0c) {
+    mcu_write_byte(0x02, 1);
+    for(int i=0;i<4;i++) mcu_write_byte((sector >> 8*(3-i))&0xff, 0);
+
+    // wait while the core does its io like the firmware
+    while(mcu_read_byte() & 1);
+  }
+}
+
+bool mcu_wait_card(int timeout_ms) {
+  for(int ms=0;ms<timeout_ms;ms++) {
+    unsigned char status = mcu_write_byte(0x01, 1);
+    for(int i=0;i<5;i++) mcu_read_byte();
+    if((status & 0xf0) == 0x80) return true;
+    wait_ms(1);
+  }
+  return false;
+}
+
+void mcu_insert(int drive, unsigned long size) {
+  mcu_write_byte(0x04, 1);
+  mcu_write_byte(drive, 0);
+  for(int i=0;i<4;i++) mcu_write_byte((size >> 8*(3-i))&0xff, 0);
+}
+
+// ----------------------------- ACSI -----------------------------
+
+// run until the acsi raises its interrupt while serving the
+// MCU, returns false on timeout
+bool wait_irq(double timeout_ms) {
+  double t_end = simulation_time + timeout_ms / 1000.0;
+  while(!tb->acsi_irq) {
+    if(simulation_time > t_end) return false;
+    if(tb->sd_irq) mcu_service();
+    else           run(1);
+  }
+  return true;
+}
+
+// send a command to target 0 with the dma set up for the given
+// number of sectors, returns the acsi status byte or -1 on timeout
+int acsi_command(const uint8_t *cmd, int len, bool icd, bool to_disk, int sectors,
+		 uint32_t addr, double timeout_ms) {
+  int dir = to_disk?0x100:0x000;
+
+  mmu.addr = addr;
+  mmu.to_disk = to_disk;
+
+  // toggle the direction to reset the fifo, then set the sector count
+  cpu_write(1, dir ^ 0x190);
+  cpu_write(1, dir | 0x090);
+  cpu_write(0, sectors);
+
+  if(trig_acsi_cmd) trace.trigger();
+
+  // first byte with A1 low, an icd command has the command code
+  // in the following byte
+  cpu_write(1, dir | 0x088);
+  cpu_write(0, icd?0x1f:cmd[0]);
+  if(!wait_irq(1)) return -1;
+
+  cpu_write(1, dir | 0x08a);
+  for(int i=icd?0:1;i<len;i++) {
+    cpu_write(0, cmd[i]);
+    if(i < len-1 && !wait_irq(1)) return -1;
+  }
+
+  // the last byte starts the transfer, the acsi interrupts at its end
+  if(!wait_irq(timeout_ms)) return -1;
+  return cpu_read(0) & 0xff;
+}
+
+// ---------------------------- checks ----------------------------
+
+static int errors = 0;
+
+static bool check(const char *what, uint32_t addr, unsigned long lba, int sectors,
+		  const std::vector<uint8_t> *expect) {
+  for(int s=0;s<sectors;s++) {
+    const uint8_t *ref = expect?&(*expect)[512*s]:sd->image.read(lba + s);
+    for(int i=0;i<512;i+=2) {
+      uint16_t w = ram[((addr >> 1) + 256*s + i/2) % ram.size()];
+      if((w >> 8) != ref[i] || (w & 0xff) != ref[i+1]) {
+	printf("%s: mismatch in sector %lu at byte %d: %04x, expected %02x%02x\n",
+	       what, lba + s, i, w, ref[i], ref[i+1]);
+	errors++;
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+// -------------------------- throughput --------------------------
+
+static FILE *csv;
+
+static void result(const char *op, int sectors, double t0, double t_end) {
+  double us = 1e6*(t_end - t0);
+  double setup = (mmu.first_word >= 0)?1e6*(mmu.first_word - t0):0;
+  double per_sector = us / sectors;
+  double bus = 256 * mmu.cycle / 32.0;   // dma bus time per sector in us
+
+  printf("%-8s %4d sectors %10.1fus %8.3f MB/s, first word after %7.1fus, "
+	 "%7.1fus/sector, overhead %7.1fus/sector\n", op, sectors, us,
+	 512.0 * sectors / us, setup, per_sector, per_sector - bus);
+
+  if(csv) fprintf(csv, "%s,%d,%.3f,%.0f,%.3f,%.3f\n", op, sectors, us,
+		  512e6 * sectors / us, setup, per_sector - bus);
+}
+
+bool transfer(const char *op, const uint8_t *cmd, int len, bool icd, bool to_disk,
+	      int sectors, uint32_t addr) {
+  mmu.first_word = -1;
+  double t0 = simulation_time;
+  int status = acsi_command(cmd, len, icd, to_disk, sectors, addr, 100 + 10*sectors);
+  double t_end = simulation_time;
+
+  if(status < 0) {
+    printf("%s of %d sectors timed out\n", op, sectors);
+    errors++;
+    return false;
+  }
+  if(status & 0x02) {
+    printf("%s of %d sectors failed, status %02x\n", op, sectors, status);
+    errors++;
+    return false;
+  }
+  result(op, sectors, t0, t_end);
+  return true;
+}
+
+void test(int sectors, unsigned long lba) {
+  uint8_t cmd[10];
+
+  // READ(6) into ram at $10000
+  cmd[0] = 0x08; cmd[1] = (lba >> 16) & 0x1f; cmd[2] = lba >> 8; cmd[3] = lba;
+  cmd[4] = sectors; cmd[5] = 0;
+  if(transfer("READ(6)", cmd, 6, false, false, sectors, 0x10000))
+    check("READ(6)", 0x10000, lba, sectors, NULL);
+
+  // WRITE(6) a pattern from $40000 behind the sectors just read
+  unsigned long wlba = lba + 256;
+  std::vector<uint8_t> pattern(512*sectors);
+  for(size_t i=0;i<pattern.size();i++)
+    pattern[i] = (i * 7 + (i >> 9) * 13 + sectors) & 0xff;
+  for(size_t i=0;i<pattern.size();i+=2)
+    ram[(0x40000 >> 1) + i/2] = (pattern[i] << 8) | pattern[i+1];
+
+  cmd[0] = 0x0a; cmd[1] = (wlba >> 16) & 0x1f; cmd[2] = wlba >> 8; cmd[3] = wlba;
+  cmd[4] = sectors; cmd[5] = 0;
+  if(transfer("WRITE(6)", cmd, 6, false, true, sectors, 0x40000)) {
+    for(int s=0;s<sectors;s++)
+      if(memcmp(sd->image.read(wlba + s), &pattern[512*s], 512)) {
+	printf("WRITE(6): sector %lu not written correctly\n", wlba + s);
+	errors++;
+	break;
+      }
+  }
+
+  // READ(10) it back into $80000
+  memset(cmd, 0, sizeof(cmd));
+  cmd[0] = 0x28;
+  cmd[2] = wlba >> 24; cmd[3] = wlba >> 16; cmd[4] = wlba >> 8; cmd[5] = wlba;
+  cmd[7] = sectors >> 8; cmd[8] = sectors;
+  if(transfer("READ(10)", cmd, 10, true, false, sectors, 0x80000))
+    check("READ(10)", 0x80000, wlba, sectors, &pattern);
+}
+
+// create a hard disk image with a known pattern if there's none
+static void create_image(const char *name, unsigned long sectors) {
+  if(access(name, F_OK) == 0) return;
+
+  printf("Creating %s with %lu sectors\n", name, sectors);
+  FILE *f = fopen(name, "wb");
+  if(!f) { perror(name); exit(-1); }
+  uint8_t sector[512];
+  for(unsigned long s=0;s<sectors;s++) {
+    for(int i=0;i<512;i++) sector[i] = (s * 31 + i * 3 + (i >> 7)) & 0xff;
+    memcpy(sector, &s, sizeof(s));     // sector number first
+    fwrite(sector, 1, 512, f);
+  }
+  fclose(f);
+}
+
+int main(int argc, char **argv) {
+  // Initialize Verilators variables
+  Verilated::commandArgs(argc, argv);
+
+  // +image=<file> is the hard disk image, acsi.img is created if missing
+  const char *arg = Verilated::commandArgsPlusMatch("image=");
+  const char *image = arg[0]?strdup(arg+7):"acsi.img";
+  if(!arg[0]) create_image(image, 4096);
+  sd = new SdCardModel(image);
+
+  // +lba=<n> is the first sector read, +sizes=<n>,... the number of
+  // sectors per transfer
+  arg = Verilated::commandArgsPlusMatch("lba=");
+  unsigned long lba = arg[0]?strtoul(arg+5, NULL, 0):100;
+  arg = Verilated::commandArgsPlusMatch("sizes=");
+  std::vector<int> sizes;
+  if(arg[0]) {
+    for(char *p = strdup(arg+7); p && *p; ) {
+      sizes.push_back(atoi(p));
+      p = strchr(p, ',');
+      if(p) p++;
+    }
+  } else
+    sizes = { 1, 16, 128 };
+
+  arg = Verilated::commandArgsPlusMatch("dma_ns=");
+  mmu.cycle = (arg[0]?atoi(arg+8):500) * 32 / 1000;
+  if(mmu.cycle < 2) mmu.cycle = 2;
+  arg = Verilated::commandArgsPlusMatch("spi_mhz=");
+  spi_byte_clocks = 8 * 32.0 / (arg[0]?atof(arg+9):20) + 0.5;
+  if(spi_byte_clocks < 2) spi_byte_clocks = 2;
+
+  // +csv=<file> stores the throughput results
+  arg = Verilated::commandArgsPlusMatch("csv=");
+  if(arg[0]) {
+    if(!(csv = fopen(arg+5, "w"))) { perror(arg+5); exit(-1); }
+    fprintf(csv, "command,sectors,us,bytes_per_s,first_word_us,overhead_us_per_sector\n");
+  }
+
+  Verilated::traceEverOn(true);
+  simulation_time = 0;
+
+  // Create an instance of our module under test
+  tb = new Vacsi_tb;
+
+  trace.open(tb);
+  sd->attach(elog);
+  elog.setup();
+  trig_acsi_cmd = trace.trigger_param("acsi-cmd");
+  if(trace.trigger_param("sd-cmd")) trig_sd_cmd = atoi(trace.trigger_param("sd-cmd"));
+  if(trace.stop_param("sd-cmd"))    stop_sd_cmd = atoi(trace.stop_param("sd-cmd"));
+  bench.start();
+
+  tb->reset = 1;
+  tb->cpu_sel = 0;
+  tb->cpu_rw = 1;
+  tb->cpu_a1 = 0;
+  tb->cpu_din = 0;
+  tb->rdy_i = 1;
+  tb->ram_din = 0;
+  tb->mcu_dout = 0;
+  tb->mcu_start = 0;
+  tb->mcu_strobe = 0;
+  tb->sd_iack = 0;
+
+  tb->sdcmd_in = 1; tb->sddat_in = 15;  // inputs of sd card
+  sd->cmd_cb = sd_command;
+
+  run(10);
+  tb->reset = 0;
+
+  if(!mcu_wait_card(100)) {
+    printf("SD card not ready\n");
+    errors++;
+  } else {
+    // image of acsi target 0
+    mcu_insert(2, 512 * sd->image.size());
+    run(100);
+
+    for(int n : sizes) {
+      if(n < 1 || n > 255 || lba + 256 + n > sd->image.size()) {
+	printf("Skipping transfers of %d sectors\n", n);
+	continue;
+      }
+      test(n, lba);
+    }
+  }
+
+  printf("%lu DMA words, %lu sectors read and %lu written by the sd card\n",
+	 mmu.words, sd->blocks_read, sd->blocks_written);
+  if(errors) printf("%d error(s)\n", errors);
+  else       printf("All transfers ok\n");
+
+  if(csv) fclose(csv);
+
+  trace.close();
+  bench.stop();
+  return errors?1:0;
+}
@@ -0,0 +1,140 @@
+// acsi_tb.v
+//
+// ACSI hard disk path of the core: the DMA controller with its ACSI
+// target and sector buffer and the sd card controller. The CPU, the
+// MMU's DMA bus cycles, the MCU and the sd card itself are simulated
+// in C++.
+
+module acsi_tb(
+  input 	   clk,
+  input 	   reset,
+  output 	   clk_en,
+
+  // cpu access to the dma registers $ff8604/$ff8606
+  input [15:0] 	   cpu_din,
+  input 	   cpu_sel,
+  input 	   cpu_a1,
+  input 	   cpu_rw,
+  output [15:0]    cpu_dout,
+
+  output 	   acsi_irq,
+
+  // dma bus cycles done by the mmu
+  input 	   rdy_i,
+  output 	   rdy_o,
+  input [15:0] 	   ram_din,
+
+  // mcu interface of the sd card controller
+  input 	   mcu_strobe,
+  input 	   mcu_start,
+  input [7:0] 	   mcu_dout,
+  output [7:0] 	   mcu_din,
+
+  output 	   sd_irq,
+  input 	   sd_iack,
+  output 	   sd_busy,
+
+  output 	   sdclk,
+  output 	   sdcmd,
+  input 	   sdcmd_in,
+  output [3:0] 	   sddat,
+  input [3:0] 	   sddat_in
+);
+
+reg [1:0] cnt_8mhz;  
+always @(posedge clk)
+  cnt_8mhz <= cnt_8mhz + 2'd1; 
+
+assign clk_en = cnt_8mhz == 2'd0;
+
+wire [1:0]  acsi_rd_req;
+wire [1:0]  acsi_wr_req;
+wire [31:0] acsi_lba;
+wire	    sd_done;
+wire	    sd_rd_byte_strobe;
+wire [7:0]  sd_rd_byte;
+wire [7:0]  sd_wr_byte;
+wire [8:0]  sd_byte_addr;
+wire [31:0] sd_img_size;
+wire [3:0]  sd_img_mounted;
+
+dma dma (
+	.clk          ( clk               ),
+	.clk_en       ( clk_en            ),
+	.reset        ( reset             ),
+
+	.cpu_din      ( cpu_din           ),
+	.cpu_sel      ( cpu_sel           ),
+	.cpu_a1       ( cpu_a1            ),
+	.cpu_rw       ( cpu_rw            ),
+	.cpu_dout     ( cpu_dout          ),
+
+	.img_mounted  ( sd_img_mounted[3:2] ),
+	.img_size     ( sd_img_size       ),
+	.acsi_rd_req  ( acsi_rd_req       ),
+	.acsi_wr_req  ( acsi_wr_req       ),
+	.acsi_lba     ( acsi_lba          ),
+ 	.sd_done      ( sd_done           ),
+ 	.sd_busy      ( sd_busy           ),
+	.sd_rd_byte_strobe ( sd_rd_byte_strobe ),
+	.sd_rd_byte   ( sd_rd_byte        ),
+	.sd_wr_byte   ( sd_wr_byte        ),
+	.sd_byte_addr ( sd_byte_addr      ),
+
+	.acsi_irq     ( acsi_irq          ),
+
+	// no fdc
+	.fdc_drq      ( 1'b0              ),
+	.fdc_addr     (                   ),
+	.fdc_sel      (                   ),
+	.fdc_rw       (                   ),
+	.fdc_din      (                   ),
+	.fdc_dout     ( 8'h00             ),
+
+	.rdy_i        ( rdy_i             ),
+	.rdy_o        ( rdy_o             ),
+	.ram_din      ( ram_din           ),
+
+    .hdd_leds     (                   )
+);
+
+sd_card #(
+    .CLK_DIV(3'd1),                    // for 32 Mhz clock
+    .SIMULATE(1'b1)
+) sd_card (
+    .rstn(!reset),
+    .clk(clk),
+
+    // SD card signals
+    .sdclk(sdclk),
+    .sdcmd(sdcmd),
+    .sdcmd_in(sdcmd_in),
+    .sddat(sddat),
+    .sddat_in(sddat_in),
+
+    // MCU interface
+    .data_strobe(mcu_strobe),
+    .data_start(mcu_start),
+    .data_in(mcu_dout),
+    .data_out(mcu_din),
+
+    .image_size(sd_img_size),
+    .image_mounted(sd_img_mounted),
+
+    .irq(sd_irq),
+    .iack(sd_iack),
+	   
+    // the two acsi targets are drives 2 and 3 as in the top level
+    .rstart({acsi_rd_req, 2'b00}), 
+    .wstart({acsi_wr_req, 2'b00}), 
+    .rsector(acsi_lba),
+    .rbusy(sd_busy),
+    .rdone(sd_done),
+		 
+    .inbyte(sd_wr_byte),
+    .outen(sd_rd_byte_strobe),
+    .outaddr(sd_byte_addr),
+    .outbyte(sd_rd_byte)
+);
+
+endmodule
@@ -0,0 +1,406 @@
+/*
+  atarist_tb.cpp
+
+  Full system simulation of the MiSTeryNano Atari ST core. SDRAM, SPI
+  flash and SD card are modelled in C++, the BL616 MCU is replaced by a
+  few lines handling the sd_card.v requests. The floppy image is used
+  directly as the SD card image, so floppy sectors map 1:1 to SD card
+  sectors.
+
+  Plusargs:
+    +tos=<file>          TOS image, default tos.img
+    +floppy=<file>       floppy image inserted into drive A:
+    +ste                 STE instead of ST
+    +blitter             enable the blitter
+    +mono                monochrome monitor
+    +extra_ram           enable 8MB memory configuration
+    +runtime=<ms>        emulated time to run, default 2000
+    +until=floppy        stop at the first floppy read
+    +direct_rom          feed the ROM directly instead of via SPI flash
+    +fastforward=<ms>    no output and no tracing up to the given time
+    +headless            no output, no tracing and no video at all
+    +sdl                 live display with keyboard and mouse, needs
+                         "make SDL=1", runs until the window is closed
+
+  The fast forward and headless modes imply +direct_rom as simulating
+  the flash interface requires a three times faster base clock.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Vatarist_tb.h"
+#include "verilated.h"
+
+#include "sdcard.h"
+#include "sdram.h"
+#include "spi_flash.h"
+#include "trace.h"
+#include "bench.h"
+#include "eventlog.h"
+
+#ifdef SDL_VIEW
+#include "sdl_view.h"
+#include "atari_st.h"      // USB HID to ST matrix, shared with the MCU firmware
+
+static SdlView view("atarist_tb");
+static bool sdl;
+#endif
+
+static Vatarist_tb *tb;
+static TraceWindow trace("atarist_tb");
+static SimBench bench("atarist_tb", 32000000);
+static EventLog elog("atarist_tb");
+static SdramModel sdram;
+static SpiFlashModel flash;
+static SdCardModel *sd;
+
+// 32 MHz cycle = 6 steps of the 192 MHz base clock, the flash runs at 96 MHz
+#define STEP_PS_X6  31250
+
+static uint64_t steps;     // base clock steps simulated so far
+static uint64_t cycles;    // 32 MHz clock cycles simulated so far
+static bool quiet;
+
+// ROM contents for +direct_rom
+static unsigned short rom[128*1024];
+
+// milestones in emulated cycles, 0 = not reached yet
+static uint64_t first_rom_fetch, first_floppy_read;
+static unsigned long floppy_reads;
+
+// run options
+static const char *floppy;
+static bool headless, until_floppy;
+static double fastforward, runtime;
+
+// last complete frame as rgb888
+#define MAX_W  1024
+#define MAX_H  640
+static unsigned char frame[2][MAX_W*MAX_H*3];
+static int frame_w, frame_h, line_x, line_y, frame_cur, frames;
+static int last_hs, last_vs;
+
+static double ms(uint64_t c) { return c / 32000.0; }
+
+static const char *plusarg(const char *name) {
+  const char *arg = Verilated::commandArgsPlusMatch(name);
+  if(!arg[0]) return NULL;
+  return arg + 1 + strlen(name);
+}
+
+static void set_quiet(bool q) {
+  quiet = q;
+  sd->verbose = sd->image.verbose = q?0:1;
+}
+
+static void video(void) {
+  // one pixel every 4 clocks, i.e. ST low resolution
+  if(tb->blank_n && !(cycles & 3) && line_x < MAX_W && line_y < MAX_H) {
+    unsigned char *p = frame[frame_cur] + 3*(MAX_W*line_y + line_x);
+    p[0] = tb->r * 17; p[1] = tb->g * 17; p[2] = tb->b * 17;
+    line_x++;
+  }
+
+  if(tb->hsync_n != last_hs) {
+    last_hs = tb->hsync_n;
+    if(!last_hs) {
+      if(line_x) line_y++;
+      line_x = 0;
+    }
+  }
+
+  if(tb->vsync_n != last_vs) {
+    last_vs = tb->vsync_n;
+    if(!last_vs) {
+      if(line_y) {
+	frame_h = line_y;
+	frame_cur ^= 1;
+	frames++;
+	if(!quiet) printf("[%.3f ms] Frame %d\n", ms(cycles), frames);
+      }
+      line_y = 0;
+    }
+  }
+
+  if(line_x > frame_w) frame_w = line_x;
+}
+
+static void write_frame(const char *name) {
+  if(!frames) { printf("No complete video frame\n"); return; }
+
+  FILE *f = fopen(name, "wb");
+  if(!f) { perror(name); return; }
+  fprintf(f, "P6\n%d %d\n255\n", frame_w, frame_h);
+  for(int y=0;y<frame_h;y++)
+    fwrite(frame[frame_cur^1] + 3*MAX_W*y, 3, frame_w, f);
+  fclose(f);
+  printf("Last frame (%dx%d) written to %s\n", frame_w, frame_h, name);
+}
+
+// evaluate the model after a clock change and run the C++ side
+static void eval(int n) {
+  tb->eval();
+
+  sdram.tick(tb);
+  if(tb->direct_rom) {
+    if(!tb->rom_n) tb->rom_din = rom[tb->rom_addr & 0x1ffff];
+  } else
+    flash.tick(tb);
+  sd->tick(tb);
+
+  steps += n;
+  elog.now = steps * STEP_PS_X6 / 6;
+  trace.dump(elog.now);
+}
+
+// one full 32 MHz clock cycle
+static void cycle(void) {
+  for(int c=1;c>=0;c--) {
+    if(tb->direct_rom) {
+      tb->clk_32 = c;
+      eval(3);
+    } else {
+      // two 96 MHz flash clocks per 32 MHz half cycle
+      for(int i=0;i<3;i++) {
+	tb->flash_clk = !tb->flash_clk;
+	if(i == 2) tb->clk_32 = c;
+	eval(1);
+      }
+    }
+
+    if(c) {
+      cycles++;
+      bench.cycle();
+
+      if(!first_rom_fetch && !tb->rom_n && tb->resb)
+	first_rom_fetch = cycles;
+
+      if(!quiet) video();
+
+#ifdef SDL_VIEW
+      // 16 MHz pixels for colour, 32 MHz for mono
+      if(sdl && (tb->mono_detect?!(cycles & 1):true))
+	view.pixel(tb->hsync_n, tb->vsync_n, tb->r * 17, tb->g * 17, tb->b * 17);
+#endif
+    }
+  }
+}
+
+static void run(int n) {
+  while(n--) cycle();
+}
+
+/* ------------------------ MCU ------------------------ */
+
+static unsigned char mcu_write_byte(unsigned char byte, char start) {
+  tb->mcu_dout = byte;
+  if(start) tb->mcu_start = 1;
+  tb->mcu_sdc_strobe = 1;
+  run(1);
+  tb->mcu_sdc_strobe = 0;
+  run(1);
+  tb->mcu_start = 0;
+  return tb->mcu_sdc_din;
+}
+
+static unsigned char mcu_read_byte(void) {
+  return mcu_write_byte(0x00, 0);
+}
+
+// card status as reported by sd_card.v, 8 = ready
+static int mcu_card_status(void) {
+  return (mcu_write_byte(0x01, 1) >> 4) & 15;
+}
+
+static void mcu_insert(int drive, uint32_t size) {
+  mcu_write_byte(0x04, 1);
+  mcu_write_byte(drive, 0);
+  for(int i=0;i<4;i++) mcu_write_byte((size >> 8*(3-i))&0xff, 0);
+}
+
+// handle a request raised via sdc_irq
+static void mcu_poll(void) {
+  tb->sdc_iack = 1;
+  run(1);
+  tb->sdc_iack = 0;
+
+  mcu_write_byte(0x01, 1);
+  unsigned char request = mcu_read_byte();
+  uint32_t sector = 0;
+  for(int i=0;i<4;i++) sector = (sector << 8) | mcu_read_byte();
+
+  if(!request) return;
+
+  if(request & 3) {
+    if(!first_floppy_read) first_floppy_read = cycles;
+    floppy_reads++;
+  }
+
+  if(!quiet) printf("[%.3f ms] MCU request %x for sector %u\n", ms(cycles), request, sector);
+
+  // floppy and image sectors are identical, just pass it back
+  mcu_write_byte(0x02, 1);
+  for(int i=0;i<4;i++) mcu_write_byte((sector >> 8*(3-i))&0xff, 0);
+}
+
+#ifdef SDL_VIEW
+static void mcu_hid_write_byte(unsigned char byte, char start) {
+  tb->mcu_dout = byte;
+  if(start) tb->mcu_start = 1;
+  tb->mcu_hid_strobe = 1;
+  run(1);
+  tb->mcu_hid_strobe = 0;
+  run(1);
+  tb->mcu_start = 0;
+}
+
+// forward keyboard and mouse events like the firmware's usb_host.c
+static void mcu_hid(void) {
+  SdlView::Event ev;
+  while(view.input(ev)) {
+    if(ev.type == SdlView::Event::KEY) {
+      unsigned char code = MISS;
+      if(ev.code < sizeof(keymap_atarist))     code = keymap_atarist[ev.code];
+      else if(ev.code >= 0xe0 && ev.code < 0xe8) code = modifier_atarist[ev.code - 0xe0];
+      if(code == MISS) continue;
+
+      mcu_hid_write_byte(0x01, 1);
+      mcu_hid_write_byte((ev.pressed?0x00:0x80) | code, 0);
+    } else {
+      mcu_hid_write_byte(0x02, 1);
+      mcu_hid_write_byte(ev.buttons, 0);
+      mcu_hid_write_byte(ev.dx, 0);
+      mcu_hid_write_byte(ev.dy, 0);
+    }
+  }
+}
+#endif
+
+static bool load_rom(const char *name, bool ste) {
+  FILE *file = fopen(name, "rb");
+  if(!file) { perror(name); return false; }
+  unsigned char buf[256*1024];
+  size_t len = fread(buf, 1, sizeof(buf), file);
+  fclose(file);
+
+  for(size_t i=0;i<len/2;i++)
+    rom[i] = (buf[2*i] << 8) | buf[2*i+1];
+
+  memcpy(flash.mem + (ste?0x140000:0x100000), buf, len);
+  printf("Loaded %zu bytes TOS from %s\n", len, name);
+  return true;
+}
+
+static void simulate(void) {
+  tb->porb = 0;
+  tb->resb = 0;
+  tb->sdcmd_in = 1;
+  tb->sddat_in = 15;
+  run(10);
+
+  // wait for sdram, flash and sd card to become ready
+  tb->porb = 1;
+  bench.start();
+  while(!tb->ram_ready || (!tb->direct_rom && !tb->flash_ready))
+    run(100);
+  if(floppy) {
+    while(mcu_card_status() != 8) run(1000);
+    mcu_insert(0, 512 * sd->image.size());
+  }
+  printf("[%.3f ms] Memories ready, releasing reset\n", ms(cycles));
+
+  tb->resb = 1;
+
+  while(ms(cycles) < runtime && !Verilated::gotFinish()) {
+    if(tb->sdc_irq) mcu_poll();
+    else cycle();
+
+    if(fastforward > 0 && ms(cycles) >= fastforward) {
+      printf("[%.3f ms] Fast forward done\n", ms(cycles));
+      set_quiet(false);
+      fastforward = 0;
+    }
+
+    if(until_floppy && first_floppy_read) break;
+
+#ifdef SDL_VIEW
+    // look for host input once per emulated millisecond
+    if(sdl && !(cycles % 32000)) {
+      if(view.closed()) break;
+      mcu_hid();
+    }
+#endif
+  }
+
+  trace.close();
+  bench.stop();
+}
+
+int main(int argc, char **argv) {
+  // Initialize Verilators variables
+  Verilated::commandArgs(argc, argv);
+
+  const char *arg;
+  // plusarg values only live until the next query
+  const char *tos = strdup((arg = plusarg("tos="))?arg:"tos.img");
+  if((arg = plusarg("floppy="))) floppy = strdup(arg);
+  headless = plusarg("headless")?true:false;
+  fastforward = (arg = plusarg("fastforward="))?strtod(arg, NULL):0;
+  runtime = (arg = plusarg("runtime="))?strtod(arg, NULL):2000;
+  until_floppy = (arg = plusarg("until=")) && !strcmp(arg, "floppy");
+
+  if(plusarg("sdl")) {
+#ifdef SDL_VIEW
+    sdl = !headless;
+    if(!plusarg("runtime=")) runtime = 1e12;
+#else
+    printf("Built without SDL, ignoring +sdl\n");
+#endif
+  }
+
+  tb = new Vatarist_tb;
+  sd = new SdCardModel(floppy?floppy:"/dev/null");
+
+  tb->ste = plusarg("ste")?1:0;
+  tb->blitter_en = plusarg("blitter")?1:0;
+  tb->mono_detect = plusarg("mono")?0:1;
+  tb->enable_extra_ram = plusarg("extra_ram")?1:0;
+  tb->floppy_protected = 0;
+  tb->direct_rom = (plusarg("direct_rom") || headless || fastforward > 0)?1:0;
+
+  if(!load_rom(tos, tb->ste)) return -1;
+
+  set_quiet(headless || fastforward > 0);
+
+  if(!headless) {
+    if(fastforward > 0) trace.from_ms = fastforward;
+    Verilated::traceEverOn(true);
+    trace.open(tb);
+    sd->attach(elog);
+    elog.setup();
+  }
+
+#ifdef SDL_VIEW
+  if(sdl) view.run(simulate);
+  else
+#endif
+    simulate();
+
+  if(first_rom_fetch)
+    printf("First ROM fetch after %lu cycles (%.3f ms)\n", (unsigned long)first_rom_fetch, ms(first_rom_fetch));
+  if(first_floppy_read)
+    printf("First floppy read after %lu cycles (%.3f ms), %lu sectors read\n",
+	   (unsigned long)first_floppy_read, ms(first_floppy_read), floppy_reads);
+  else if(floppy)
+    printf("No floppy access within %.3f ms\n", ms(cycles));
+  sdram.report();
+  printf("LEDs: %x\n", tb->leds);
+
+  if(!headless) write_frame("video.ppm");
+
+  delete sd;
+  delete tb;
+  return 0;
+}
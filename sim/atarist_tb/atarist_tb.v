@@ -0,0 +1,324 @@
+// ====================================================================
+//
+// atarist_tb.v - full system testbench
+//
+// The complete atarist.v core as wired in top.sv together with the
+// SDRAM controller, the SPI flash controller, the SD card interface
+// and the HID interface. SDRAM, flash and SD card themselves as well
+// as the MCU are modelled in C++. The video and HDMI path is not
+// included, the ST video signals are exported directly.
+//
+//============================================================================
+
+module atarist_tb (
+    input	  clk_32,
+    input	  flash_clk,
+    input	  resb,
+    input	  porb,
+
+    // system configuration, usually set by the MCU via sysctrl.v
+    input	  ste,
+    input	  blitter_en,
+    input	  enable_extra_ram,
+    input	  mono_detect,
+    input [1:0]   floppy_protected,
+
+    // bypass the flash and take the ROM data directly from rom_din
+    input	  direct_rom,
+    output	  rom_n,
+    output [23:1] rom_addr,
+    input [15:0]  rom_din,
+
+    // ST video and audio
+    output [3:0]  r,
+    output [3:0]  g,
+    output [3:0]  b,
+    output	  hsync_n,
+    output	  vsync_n,
+    output	  de,
+    output	  blank_n,
+    output [14:0] audio_l,
+    output [14:0] audio_r,
+    output [3:0]  leds,
+
+    // interface to sdram
+    output	  sd_clk,
+    output	  sd_cke,
+    inout [31:0]  sd_data,
+    input [31:0]  sd_data_in,
+    output [10:0] sd_addr,
+    output [3:0]  sd_dqm,
+    output [1:0]  sd_ba,
+    output	  sd_cs,
+    output	  sd_we,
+    output	  sd_ras,
+    output	  sd_cas,
+    output	  ram_ready,
+
+    // interface to spi flash
+    output	  mspi_cs,
+    inout	  mspi_di,
+    inout	  mspi_hold,
+    inout	  mspi_wp,
+    inout	  mspi_do,
+    input [1:0]	  mspi_din,
+    output	  flash_ready,
+
+    // sd card
+    output	  sdclk,
+    output	  sdcmd,
+    input	  sdcmd_in,
+    output [3:0]  sddat,
+    input [3:0]	  sddat_in,
+
+    // mcu interface of sd_card.v and hid.v
+    input	  mcu_sdc_strobe,
+    input	  mcu_hid_strobe,
+    input	  mcu_start,
+    input [7:0]	  mcu_dout,
+    output [7:0]  mcu_sdc_din,
+    output	  sdc_irq,
+    input	  sdc_iack
+);
+
+/* -------------------- flash -------------------- */
+
+wire [15:0] flash_dout;
+
+flash flash (
+    .clk(flash_clk),
+    .resetn(porb),
+    .ready(flash_ready),
+    .busy(),
+
+    // cpu expects ROM to start at $fc0000 and it is in fact is at $100000 in
+    // ST mode and at $140000 in STE mode
+    .address( { 4'b0010, ste, rom_addr[17:1] } ),
+    .cs( !rom_n && !direct_rom ),
+    .dout(flash_dout),
+
+    .mspi_din(mspi_din),
+    .mspi_cs(mspi_cs),
+    .mspi_di(mspi_di),
+    .mspi_hold(mspi_hold),
+    .mspi_wp(mspi_wp),
+    .mspi_do(mspi_do)
+);
+
+wire [15:0] rom_dout = direct_rom?rom_din:flash_dout;
+
+/* -------------------- RAM -------------------- */
+
+wire ras_n, cash_n, casl_n;
+wire [23:1] ram_a;
+wire we_n;
+wire [15:0] mdout;   // out to ram
+wire [15:0] mdin;    // in from ram
+wire refresh;
+
+sdram sdram (
+    .clk(clk_32),
+    .reset_n(porb),
+    .ready(ram_ready),
+
+    .sd_clk(sd_clk),
+    .sd_cke(sd_cke),
+    .sd_data(sd_data),
+    .sd_data_in(sd_data_in),
+    .sd_addr(sd_addr),
+    .sd_dqm(sd_dqm),
+    .sd_ba(sd_ba),
+    .sd_cs(sd_cs),
+    .sd_we(sd_we),
+    .sd_ras(sd_ras),
+    .sd_cas(sd_cas),
+
+    .refresh(refresh),
+    .din(mdout),
+    .dout(mdin),
+    .addr(ram_a[22:1]),
+    .ds( { cash_n, casl_n } ),
+    .cs( !ras_n && !ram_a[23] ),
+    .we( !we_n )
+);
+
+/* -------------------- SD card -------------------- */
+
+wire [1:0]  sd_rd;
+wire [1:0]  sd_wr;
+wire [7:0]  sd_rd_data;
+wire [7:0]  sd_wr_data;
+wire [31:0] sd_lba;
+wire [8:0]  sd_byte_index;
+wire	    sd_rd_byte_strobe;
+wire	    sd_busy, sd_done;
+wire [31:0] sd_img_size;
+wire [3:0]  sd_img_mounted;
+
+wire [1:0]  acsi_rd_req;
+wire [1:0]  acsi_wr_req;
+wire [31:0] acsi_lba;
+wire [7:0]  acsi_sd_wr_byte;
+
+// differentiate between floppy and acsi requests
+reg  is_acsi_D;
+wire is_acsi = (acsi_rd_req != 0) ||  (acsi_wr_req != 0) || is_acsi_D;
+
+always @(posedge clk_32) begin
+   if(acsi_rd_req || acsi_wr_req) is_acsi_D <= 1'b1;
+   if(sd_rd || sd_wr)             is_acsi_D <= 1'b0;
+end
+
+sd_card #(
+    .CLK_DIV(3'd1),
+    .SIMULATE(1'b1)
+) sd_card (
+    .rstn(porb),
+    .clk(clk_32),
+
+    .sdclk(sdclk),
+    .sdcmd(sdcmd),
+    .sdcmd_in(sdcmd_in),
+    .sddat(sddat),
+    .sddat_in(sddat_in),
+
+    .data_strobe(mcu_sdc_strobe),
+    .data_start(mcu_start),
+    .data_in(mcu_dout),
+    .data_out(mcu_sdc_din),
+
+    .image_size(sd_img_size),
+    .image_mounted(sd_img_mounted),
+
+    .irq(sdc_irq),
+    .iack(sdc_iack),
+
+    .rstart( { acsi_rd_req, sd_rd} ),
+    .wstart( { acsi_wr_req, sd_wr } ),
+    .rsector( is_acsi?acsi_lba:sd_lba),
+    .rbusy(sd_busy),
+    .rdone(sd_done),
+
+    .inbyte(is_acsi?acsi_sd_wr_byte:sd_wr_data),
+    .outen(sd_rd_byte_strobe),
+    .outaddr(sd_byte_index),
+    .outbyte(sd_rd_data)
+);
+
+/* -------------------- HID -------------------- */
+
+// keyboard matrix and mouse as sent by the MCU
+wire [7:0] keyboard[14:0];
+wire [14:0] keyboard_matrix_out;
+wire [7:0] keyboard_matrix_in =
+	      (!keyboard_matrix_out[0]?keyboard[0]:8'hff)&
+	      (!keyboard_matrix_out[1]?keyboard[1]:8'hff)&
+	      (!keyboard_matrix_out[2]?keyboard[2]:8'hff)&
+	      (!keyboard_matrix_out[3]?keyboard[3]:8'hff)&
+	      (!keyboard_matrix_out[4]?keyboard[4]:8'hff)&
+	      (!keyboard_matrix_out[5]?keyboard[5]:8'hff)&
+	      (!keyboard_matrix_out[6]?keyboard[6]:8'hff)&
+	      (!keyboard_matrix_out[7]?keyboard[7]:8'hff)&
+	      (!keyboard_matrix_out[8]?keyboard[8]:8'hff)&
+	      (!keyboard_matrix_out[9]?keyboard[9]:8'hff)&
+	      (!keyboard_matrix_out[10]?keyboard[10]:8'hff)&
+	      (!keyboard_matrix_out[11]?keyboard[11]:8'hff)&
+	      (!keyboard_matrix_out[12]?keyboard[12]:8'hff)&
+	      (!keyboard_matrix_out[13]?keyboard[13]:8'hff)&
+	      (!keyboard_matrix_out[14]?keyboard[14]:8'hff);
+
+wire [5:0] hid_mouse;
+
+hid hid (
+        .clk(clk_32),
+        .reset(!porb),
+
+        .data_in_strobe(mcu_hid_strobe),
+        .data_in_start(mcu_start),
+        .data_in(mcu_dout),
+        .data_out(),
+
+        // no db9 joystick
+        .db9_port(6'b000000),
+        .irq(),
+        .iack(1'b0),
+
+        .mouse(hid_mouse),
+        .keyboard(keyboard),
+        .joystick0(),
+        .joystick1()
+);
+
+/* -------------------- Atari ST -------------------- */
+
+atarist atarist (
+    .clk_32(clk_32),
+    .resb(resb),
+    .porb(porb),
+
+    .hsync_n(hsync_n),
+    .vsync_n(vsync_n),
+    .blank_n(blank_n),
+    .de(de),
+    .r(r),
+    .g(g),
+    .b(b),
+    .mono_detect(mono_detect),
+
+    // mouse on joy0, no joysticks
+    .keyboard_matrix_out(keyboard_matrix_out),
+    .keyboard_matrix_in(keyboard_matrix_in),
+    .joy0(hid_mouse),
+    .joy1(5'b00000),
+
+    .audio_mix_l(audio_l),
+    .audio_mix_r(audio_r),
+
+    .midi_rx(1'b1),
+    .midi_tx(),
+
+    .sd_img_mounted(sd_img_mounted),
+    .sd_img_size(sd_img_size),
+
+    .acsi_rd_req(acsi_rd_req),
+    .acsi_wr_req(acsi_wr_req),
+    .acsi_sd_lba(acsi_lba),
+    .acsi_sd_done(sd_done),
+    .acsi_sd_busy(sd_busy),
+    .acsi_sd_rd_byte_strobe(sd_rd_byte_strobe),
+    .acsi_sd_rd_byte(sd_rd_data),
+    .acsi_sd_wr_byte(acsi_sd_wr_byte),
+    .acsi_sd_byte_addr(sd_byte_index),
+
+    .sd_lba(sd_lba),
+    .sd_rd(sd_rd),
+    .sd_wr(sd_wr),
+    .sd_ack(sd_busy),
+    .sd_buff_addr(sd_byte_index),
+    .sd_dout(sd_rd_data),
+    .sd_din(sd_wr_data),
+    .sd_dout_strobe(sd_rd_byte_strobe),
+
+    .rom_n(rom_n),
+    .rom_addr(rom_addr),
+    .rom_data_out(rom_dout),
+
+    .blitter_en(blitter_en),
+    .ste(ste),
+    .enable_extra_ram(enable_extra_ram),
+    .floppy_protected(floppy_protected),
+    .cubase_en(1'b0),
+
+    .ram_ras_n(ras_n),
+    .ram_cash_n(cash_n),
+    .ram_casl_n(casl_n),
+    .ram_ref(refresh),
+    .ram_addr(ram_a),
+    .ram_we_n(we_n),
+    .ram_data_in(mdout),
+    .ram_data_out(mdin),
+
+    .leds(leds)
+);
+
+endmodule
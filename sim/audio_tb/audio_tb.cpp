@@ -0,0 +1,404 @@
+/*
+  audio_tb.cpp
+
+  YM2149 and STE DMA sound through gstmcu, the shifter and jt49. The
+  testbench takes the place of the 68000: it sets up the video, plays
+  a short tune on the YM by register writes once per frame and starts
+  a repeating DMA sound frame prepared in the RAM model. The mixed
+  audio_l/audio_r is written as WAV at the shifter's 50 kHz base rate:
+
+    +frames=<n>      video frames to run, default 10
+    +rate=<n>        DMA sound rate 6, 12, 25 or 50 kHz, default 50
+    +mono            8 bit mono instead of stereo samples
+    +samples=<n>     samples in the DMA sound frame, default 1000
+    +mode=pal|ntsc   video timing, default pal
+    +hscroll=<n>     STE fine scroll, fetches an extra video word per line
+    +load=<n>        percentage of CPU bus cycles doing RAM reads, default 0.
+                     Disk DMA uses the same bus slots, so this also
+                     stands for a running floppy or ACSI transfer
+    +noym            don't play the YM tune
+    +csv=<file>      per frame statistics
+    +wav=<file>|off  see audio_capture.h
+
+  The DMA sound words fetched in each frame are compared with the
+  words the selected rate consumes. A sample clock finding the
+  shifter's fifo empty while DMA sound runs is an underrun and fails
+  the run.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <vector>
+
+#include "Vaudio_tb.h"
+#include "verilated.h"
+
+#include "trace.h"
+#include "bench.h"
+#include "audio_capture.h"
+
+static Vaudio_tb *tb;
+static TraceWindow trace("audio_tb");
+static SimBench bench("audio_tb", 32000000);
+static AudioCapture audio("audio");
+static uint64_t tickcount, clocks;
+
+#define TICKLEN_PS  15625   // 64 MHz half clock ticks
+
+// trace trigger: +trigger=underrun
+static bool trig_underrun = false;
+
+// the shifter's base sample clock is 32 MHz / 640
+#define SAMPLE_DIV  640
+
+// 4 MB of RAM, word addressed like ram_a
+#define RAM_WORDS   0x200000
+static uint16_t ram[RAM_WORDS];
+
+#define SND_BASE    0x010000
+#define VIDEO_BASE  0x1f8000
+
+// per frame statistics, a frame ends with the falling edge of vsync
+struct Frame {
+  uint64_t clocks;
+  unsigned long snd_words, video_words, bus_cycles;
+  int fifo_min;
+  unsigned long underruns;
+};
+static std::vector<Frame> frames;
+static Frame cur;
+static bool counting;       // statistics are only taken while DMA sound runs
+static bool frame_start;    // set at vsync, consumed by the YM player
+static uint64_t frame_clocks;
+
+static bool armed;          // fifo has been filled since sound was started
+static unsigned long underruns;
+
+static int last_vs = 1, last_dcyc = 1, last_sload = 1;
+
+static void frame_done(void) {
+  if(counting) {
+    cur.clocks = clocks - frame_clocks;
+    frames.push_back(cur);
+  }
+  memset(&cur, 0, sizeof(cur));
+  cur.fifo_min = 7;
+  frame_clocks = clocks;
+  frame_start = true;
+}
+
+// everything watched on the rising clock edge
+static void monitor(void) {
+  if(tb->VSYNC_N != last_vs) {
+    last_vs = tb->VSYNC_N;
+    if(!last_vs) frame_done();
+  }
+  if(tb->DCYC_N != last_dcyc) {
+    last_dcyc = tb->DCYC_N;
+    if(!last_dcyc) cur.video_words++;
+  }
+  // the shifter takes a sound word on the rising edge of sload
+  if(tb->SLOAD_N != last_sload) {
+    last_sload = tb->SLOAD_N;
+    if(last_sload) cur.snd_words++;
+  }
+
+  if(!tb->snd_on)
+    armed = false;
+  else if(!tb->snd_fifo_empty)
+    armed = true;
+
+  if(armed) {
+    if(tb->snd_fifo_level < cur.fifo_min) cur.fifo_min = tb->snd_fifo_level;
+
+    // the sample clock is a register, the fifo is read on the next edge
+    if(tb->snd_sample && tb->snd_fifo_empty) {
+      if(underruns++ < 10)
+	printf("[%.3f ms] DMA sound fifo underrun in frame %zu\n", clocks / 32000.0, frames.size());
+      cur.underruns++;
+      if(trig_underrun) trace.trigger();
+    }
+  }
+
+  if(!(clocks % SAMPLE_DIV))
+    audio.sample(tb->audio_l, tb->audio_r);
+}
+
+static void tick(int c) {
+  tb->clk32 = c;
+  tb->eval();
+  if(c) {
+    bench.cycle();
+    clocks++;
+    monitor();
+
+    // the RAM returns the addressed word within the cycle
+    tb->ram_dout = ram[tb->ram_a & (RAM_WORDS-1)];
+  }
+  trace.dump(TICKLEN_PS * tickcount++);
+}
+
+static void cycle(void) {
+  tick(1);
+  tick(0);
+}
+
+// one 68000 word access, started on an 8 MHz edge. Returns the 32 MHz
+// cycles spent waiting for dtack
+static int bus_cycle(uint32_t addr, bool write, uint16_t data) {
+  while(!tb->MHZ8_EN1) cycle();
+
+  tb->A = (addr & 0xffffff) >> 1;
+  tb->RW = !write;
+  tb->DIN = data;
+  tb->AS_N = 0;
+  tb->UDS_N = 0;
+  tb->LDS_N = 0;
+
+  int wait = 0;
+  while(tb->DTACK_N && wait < 1000) { cycle(); wait++; }
+  if(wait == 1000) printf("No DTACK for $%06x\n", addr);
+
+  // S5 to S7, then the bus is released for one 8 MHz clock
+  for(int i=0;i<6;i++) cycle();
+  tb->AS_N = 1;
+  tb->UDS_N = 1;
+  tb->LDS_N = 1;
+  tb->RW = 1;
+  for(int i=0;i<4;i++) cycle();
+
+  return wait;
+}
+
+static void write_reg(uint32_t addr, uint16_t data) {
+  bus_cycle(addr, true, data);
+}
+
+// the YM is selected at $ff8800 and written at $ff8802, both in the
+// upper byte
+static void ym_write(int reg, int val) {
+  write_reg(0xff8800, reg << 8);
+  write_reg(0xff8802, val << 8);
+}
+
+// tone period for the 2 MHz YM clock
+static int ym_period(double hz) {
+  return (int)(2000000 / (16 * hz) + 0.5);
+}
+
+// a C major arpeggio on channel A over a bass on channel B, one step
+// per frame. Channel C plays the envelope
+static void ym_tune(int step) {
+  static const double arp[] = { 261.63, 329.63, 392.00, 523.25 };
+  static const double bass[] = { 65.41, 98.00 };
+
+  if(!step) {
+    ym_write(7, 0x38);    // tones on, noise off
+    ym_write(8, 0x0c);
+    ym_write(9, 0x0a);
+    ym_write(10, 0x10);   // envelope
+    ym_write(11, 0x00);
+    ym_write(12, 0x08);
+    ym_write(4, ym_period(196.00) & 0xff);
+    ym_write(5, ym_period(196.00) >> 8);
+  }
+
+  int a = ym_period(arp[step % 4]);
+  ym_write(0, a & 0xff);
+  ym_write(1, a >> 8);
+
+  if(!(step % 8)) {
+    int b = ym_period(bass[(step / 8) % 2]);
+    ym_write(2, b & 0xff);
+    ym_write(3, b >> 8);
+    ym_write(13, 0x0e);   // retrigger the envelope
+  }
+}
+
+// a sine per channel, 8 bit signed samples with the left one in the
+// upper byte
+static uint32_t prepare_sound(int samples, bool mono, int rate_hz) {
+  uint8_t *bytes = (uint8_t*)calloc(2*samples, 1);
+  int len = 0;
+  for(int i=0;i<samples;i++) {
+    bytes[len++] = (int8_t)(100 * sin(2*M_PI * 440 * i / rate_hz));
+    if(!mono) bytes[len++] = (int8_t)(100 * sin(2*M_PI * 660 * i / rate_hz));
+  }
+  len = (len + 1) & ~1;   // the frame is made of words
+
+  for(int i=0;i<len;i+=2)
+    ram[(SND_BASE + i)/2] = (bytes[i] << 8) | bytes[i+1];
+  free(bytes);
+
+  return SND_BASE + len;
+}
+
+static void write_addr(uint32_t reg, uint32_t addr) {
+  write_reg(reg,   (addr >> 16) & 0x3f);
+  write_reg(reg+2, (addr >>  8) & 0xff);
+  write_reg(reg+4,  addr        & 0xfe);
+}
+
+static void report(double rate_hz, int bytes_per_sample, const char *csv_name) {
+  if(frames.empty()) {
+    printf("No complete frame with DMA sound\n");
+    return;
+  }
+
+  FILE *csv = NULL;
+  if(csv_name) {
+    if(!(csv = fopen(csv_name, "w"))) { perror(csv_name); exit(-1); }
+    fprintf(csv, "frame,clocks,snd_words,video_words,bus_cycles,fifo_min,underruns\n");
+  }
+
+  unsigned long min = ~0ul, max = 0, sum = 0, video = 0, bus = 0;
+  uint64_t total_clocks = 0;
+  int fifo_min = 7;
+  for(size_t i=0;i<frames.size();i++) {
+    const Frame &f = frames[i];
+    if(f.snd_words < min) min = f.snd_words;
+    if(f.snd_words > max) max = f.snd_words;
+    if(f.fifo_min < fifo_min) fifo_min = f.fifo_min;
+    sum += f.snd_words;
+    video += f.video_words;
+    bus += f.bus_cycles;
+    total_clocks += f.clocks;
+
+    if(csv)
+      fprintf(csv, "%zu,%llu,%lu,%lu,%lu,%d,%lu\n", i, (unsigned long long)f.clocks, f.snd_words,
+	      f.video_words, f.bus_cycles, f.fifo_min, f.underruns);
+  }
+  if(csv) fclose(csv);
+
+  size_t n = frames.size();
+  double frame_hz = 32000000.0 * n / total_clocks;
+  double needed = rate_hz * bytes_per_sample / 2 / frame_hz;
+
+  printf("DMA sound over %zu frames at %.2f Hz:\n", n, frame_hz);
+  printf("  words per frame     min %lu, avg %.1f, max %lu, needed %.1f\n", min, (double)sum / n, max, needed);
+  printf("  bandwidth           %.1f kB/s of %.1f kB/s played\n",
+	 2.0 * sum / n * frame_hz / 1000, rate_hz * bytes_per_sample / 1000);
+  printf("  video words/frame   %.1f\n", (double)video / n);
+  printf("  CPU cycles/frame    %.1f\n", (double)bus / n);
+  printf("  fifo minimum        %d words\n", fifo_min);
+  printf("  underruns           %lu\n", underruns);
+}
+
+int main(int argc, char **argv) {
+  // Initialize Verilators variables
+  Verilated::commandArgs(argc, argv);
+
+  const char *arg = Verilated::commandArgsPlusMatch("frames=");
+  int run_frames = arg[0]?atoi(arg+8):10;
+  arg = Verilated::commandArgsPlusMatch("rate=");
+  int rate = arg[0]?atoi(arg+6):50;
+  arg = Verilated::commandArgsPlusMatch("samples=");
+  int samples = arg[0]?atoi(arg+9):1000;
+  arg = Verilated::commandArgsPlusMatch("hscroll=");
+  int hscroll = arg[0]?atoi(arg+9):0;
+  arg = Verilated::commandArgsPlusMatch("load=");
+  int load = arg[0]?atoi(arg+6):0;
+  arg = Verilated::commandArgsPlusMatch("csv=");
+  const char *csv_name = arg[0]?arg+5:NULL;
+  bool mono = Verilated::commandArgsPlusMatch("mono")[0];
+  bool ym = !Verilated::commandArgsPlusMatch("noym")[0];
+
+  bool ntsc = false;
+  arg = Verilated::commandArgsPlusMatch("mode=");
+  if(arg[0]) {
+    if(!strcmp(arg+6, "ntsc")) ntsc = true;
+    else if(strcmp(arg+6, "pal")) { printf("Unknown video mode %s\n", arg+6); exit(-1); }
+  }
+
+  // sound mode register: bit 7 mono, bits 1:0 rate
+  int mode_bits;
+  switch(rate) {
+  case 6:  mode_bits = 0; break;
+  case 12: mode_bits = 1; break;
+  case 25: mode_bits = 2; break;
+  case 50: mode_bits = 3; break;
+  default: printf("Unsupported DMA sound rate %d kHz\n", rate); exit(-1);
+  }
+  double rate_hz = 32000000.0 / SAMPLE_DIV / (1 << (3-mode_bits));
+  printf("DMA sound %s at %.0f Hz, %s, %d%% bus load\n", mono?"mono":"stereo",
+	 rate_hz, ntsc?"ntsc":"pal", load);
+
+  uint32_t snd_end = prepare_sound(samples, mono, rate_hz);
+  for(int i=0;i<0x4000;i++) ram[VIDEO_BASE/2 + i] = i * 0x9e37;
+
+  Verilated::traceEverOn(true);
+
+  // Create an instance of our module under test
+  tb = new Vaudio_tb;
+
+  // a full run traced would be gigabytes, by default only the setup
+  // and the first frame are
+  trace.to_ms = 25;
+  trace.open(tb);
+  trig_underrun = trace.trigger_param("underrun");
+  audio.setup(32000000 / SAMPLE_DIV, 15);
+  bench.start();
+
+  tb->ste = 1;
+  tb->AS_N = 1;
+  tb->UDS_N = 1;
+  tb->LDS_N = 1;
+  tb->RW = 1;
+  tb->porb = 0;
+  tb->resb = 0;
+  for(int i=0;i<100;i++) cycle();
+  tb->porb = 1;
+  for(int i=0;i<100;i++) cycle();
+  tb->resb = 1;
+
+  // set up the video after the first vsync to not bring the shifter
+  // out of sync
+  frame_start = false;
+  while(!frame_start) cycle();
+
+  write_reg(0xff8000, 0x0008);              // memory config, bank 0 2MB
+  write_reg(0xff8200, VIDEO_BASE >> 16);
+  write_reg(0xff8202, (VIDEO_BASE >> 8) & 0xff);
+  write_reg(0xff8260, 0x0000);              // 320x200
+  write_reg(0xff820a, ntsc?0x0000:0x0200);
+  if(hscroll) write_reg(0xff8264, hscroll & 15);
+
+  write_addr(0xff8902, SND_BASE);
+  write_addr(0xff890e, snd_end);
+  write_reg(0xff8920, (mono?0x80:0x00) | mode_bits);
+  write_reg(0xff8900, 0x0003);              // play, repeat
+
+  // statistics start with the first full frame
+  frame_start = false;
+  while(!frame_start) cycle();
+  counting = true;
+
+  srand(1);
+  int step = 0;
+  while(frames.size() < (size_t)run_frames) {
+    if(frame_start) {
+      frame_start = false;
+      if(ym) ym_tune(step++);
+    }
+
+    if(load && rand() % 100 < load) {
+      bus_cycle(2 * (rand() % 0x40000), false, 0);
+      cur.bus_cycles++;
+    } else
+      for(int i=0;i<16;i++) cycle();
+  }
+
+  report(rate_hz, mono?1:2, csv_name);
+
+  trace.close();
+  bench.stop();
+  audio.close();
+
+  unsigned long words = 0;
+  for(auto &f : frames) words += f.snd_words;
+  bool failed = underruns || !words;
+  printf("%s\n", failed?"FAILED":"PASSED");
+  return failed?1:0;
+}
@@ -0,0 +1,248 @@
+// ====================================================================
+//
+// audio_tb.v
+//
+// YM2149 and STE DMA sound testbench. The gstmcu, the shifter and
+// jt49 are connected like in atarist.v. The CPU bus and the RAM are
+// driven by the C++ side, so register writes, extra bus load and the
+// RAM contents are under full control of the testbench. The audio
+// mix is the one of atarist.v.
+//
+//============================================================================
+
+module audio_tb (
+    input	  clk32,
+    input	  resb,
+    input	  porb,
+
+    // CPU bus, driven by audio_tb.cpp
+    input	  AS_N,
+    input	  RW,
+    input	  UDS_N,
+    input	  LDS_N,
+    input [23:1]  A,
+    input [15:0]  DIN,
+    output [15:0] DOUT,
+    output	  DTACK_N,
+    output	  MHZ8_EN1,
+
+    input	  ste,
+
+    // RAM, read by the C++ model
+    output [23:1] ram_a,
+    output	  ram_cs,
+    output	  REF,
+    input [15:0]  ram_dout,
+
+    // video and dma sound slots
+    output	  VSYNC_N,
+    output	  HSYNC_N,
+    output	  DCYC_N,
+    output	  SLOAD_N,
+    output	  SINT,
+
+    // sound dma state taken from inside the chips
+    output	  snd_on,
+    output	  snd_fifo_empty,
+    output [2:0]  snd_fifo_level,
+    output	  snd_sample,
+
+    // the mix as it leaves atarist.v
+    output [14:0] audio_l,
+    output [14:0] audio_r
+   );
+
+wire        cmpcs_n, latch, st_de, rdat_n, wdat_n, sreq, we_n, BLANK_N;
+wire        RAS0_N, RAS1_N, SNDIR, SNDCS;
+wire [15:0] mcu_dout, shifter_dout, snd_data_out;
+wire [7:0]  dma_snd_l, dma_snd_r;
+
+assign ram_cs = !(RAS0_N && RAS1_N);
+assign DOUT = !rdat_n ? shifter_dout : mcu_dout;
+
+gstmcu gstmcu (
+    .clk32(clk32),
+    .resb(resb),
+    .porb(porb),
+    .FC0(1'b1),
+    .FC1(1'b0),
+    .FC2(1'b1),      // supervisor data
+    .AS_N(AS_N),
+    .RW(RW),
+    .UDS_N(UDS_N),
+    .LDS_N(LDS_N),
+    .VMA_N(1'b1),
+    .MFPINT_N(1'b1),
+    .A(A),
+    .ADDR(ram_a),
+    .DIN(DIN),
+    .DOUT(mcu_dout),
+    .OE_L(),
+    .OE_H(),
+    .CLK_O(),
+    .MHZ8(),
+    .MHZ8_EN1(MHZ8_EN1),
+    .MHZ8_EN2(),
+    .MHZ4(),
+    .MHZ4_EN(),
+    .BR_N_I(1'b1),
+    .BR_N_O(),
+    .BG_N(1'b1),
+    .BGACK_N_I(1'b1),
+    .BGACK_N_O(),
+    .RDY_N_I(1'b1),
+    .RDY_N_O(),
+    .BERR_N(),
+    .IPL0_N(),
+    .IPL1_N(),
+    .IPL2_N(),
+    .DTACK_N_I(1'b0),
+    .DTACK_N_O(DTACK_N),
+    .IACK_N(),
+    .ROM0_N(),
+    .ROM1_N(),
+    .ROM2_N(),
+    .ROM3_N(),
+    .ROM4_N(),
+    .ROM5_N(),
+    .ROM6_N(),
+    .ROMP_N(),
+    .RAM_N(),
+    .RAS0_N(RAS0_N),
+    .RAS1_N(RAS1_N),
+    .CAS0L_N(),
+    .CAS0H_N(),
+    .CAS1L_N(),
+    .CAS1H_N(),
+    .RAM_LDS(),
+    .RAM_UDS(),
+    .REF(REF),
+    .VPA_N(),
+    .MFPCS_N(),
+    .SNDIR(SNDIR),
+    .SNDCS(SNDCS),
+    .N6850(),
+    .FCS_N(),
+    .RTCCS_N(),
+    .RTCRD_N(),
+    .RTCWR_N(),
+    .LATCH(latch),
+    .HSYNC_N(HSYNC_N),
+    .VSYNC_N(VSYNC_N),
+    .DE(st_de),
+    .BLANK_N(BLANK_N),
+    .RDAT_N(rdat_n),
+    .WE_N(we_n),
+    .WDAT_N(wdat_n),
+    .CMPCS_N(cmpcs_n),
+    .DCYC_N(DCYC_N),
+    .SREQ(sreq),
+    .SLOAD_N(SLOAD_N),
+    .SINT(SINT),
+
+    .BUTTON_N(),
+    .JOYWE_N(),
+    .JOYRL_N(),
+    .JOYWL(),
+    .JOYRH_N(),
+
+    .st(!ste),
+    .extra_ram(1'b0),
+    .tos192k(1'b0),
+    .turbo(1'b0),
+    .viking_at_e8(1'b0),
+    .viking_at_c0(1'b0),
+    .bus_cycle()
+);
+
+gstshifter gstshifter (
+    .clk32(clk32),
+    .ste(ste),
+    .resb(resb),
+
+    // CPU/RAM interface
+    .CS(~cmpcs_n),
+    .A(A[6:1]),
+    .DIN(DIN),
+    .DOUT(shifter_dout),
+    .LATCH(latch),
+    .RDAT_N(rdat_n),
+    .WDAT_N(wdat_n),
+    .RW(RW),
+    .MDIN(ram_dout),
+    .MDOUT(),
+
+    // VIDEO
+    .MONO_OUT(),
+    .LOAD_N(DCYC_N),
+    .DE(st_de),
+    .BLANK_N(BLANK_N),
+    .R(),
+    .G(),
+    .B(),
+
+    // DMA SOUND
+    .SLOAD_N(SLOAD_N),
+    .SREQ(sreq),
+    .audio_left(dma_snd_l),
+    .audio_right(dma_snd_r)
+);
+
+// the fifo isn't visible at the shifter's ports. A sample clock with
+// the fifo empty while dma sound is running is an underrun
+assign snd_on = gstmcu.sndon;
+assign snd_fifo_empty = gstshifter.fifo_empty;
+assign snd_fifo_level = gstshifter.writeP - gstshifter.readP;
+assign snd_sample = gstshifter.aclk_en;
+
+/* ------------------------------------ PSG ------------------------------------- */
+
+wire [9:0] ym_audio_out;
+
+reg clk_2_en;
+always @(posedge clk32) begin
+	reg [3:0] cnt;
+	clk_2_en <= (cnt == 0);
+	cnt <= cnt + 1'd1;
+end
+
+jt49_bus jt49_bus (
+ .rst_n(resb),
+ .clk(clk32),
+ .clk_en(clk_2_en),
+ .bdir(SNDIR),
+ .bc1(SNDCS),
+ .din(DIN[15:8]),
+
+ .sel(1'b1),
+ .dout(),
+ .sound(ym_audio_out),
+ .A(),
+ .B(),
+ .C(),
+ .sample(),
+
+ .IOA_in(8'hff),
+ .IOA_out(),
+ .IOA_oe(),
+
+ .IOB_in(8'hff),
+ .IOB_out(),
+ .IOB_oe()
+ );
+
+/* ------------------------------------ mix ------------------------------------- */
+
+// same as atarist.v, YM and STE channels are expanded to 14 bits and added
+wire [9:0] ym_audio_out_signed = ym_audio_out - 10'h200;
+wire [7:0] ste_audio_out_l_signed = dma_snd_l - 8'h80;
+wire [7:0] ste_audio_out_r_signed = dma_snd_r - 8'h80;
+
+assign audio_l =
+        { ym_audio_out_signed[9], ym_audio_out_signed, ym_audio_out_signed[9:6]} +
+        { ste_audio_out_l_signed[7], ste_audio_out_l_signed, ste_audio_out_l_signed[7:2] };
+assign audio_r =
+        { ym_audio_out_signed[9], ym_audio_out_signed, ym_audio_out_signed[9:6]} +
+        { ste_audio_out_r_signed[7], ste_audio_out_r_signed, ste_audio_out_r_signed[7:2] };
+
+endmodule
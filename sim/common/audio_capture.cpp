@@ -0,0 +1,69 @@
+/*
+  audio_capture.cpp
+
+  WAV audio capture for the verilator testbenches
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "verilated.h"
+#include "audio_capture.h"
+
+AudioCapture::AudioCapture(const char *name) : name(name) {
+  file = NULL;
+  samples = 0;
+  rate = bits = 0;
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p+2, v >> 16); }
+
+// canonical 44 byte header of a 16 bit stereo PCM file
+static void wav_header(uint8_t *h, int rate, uint32_t data_len) {
+  memcpy(h, "RIFF", 4);
+  put32(h+4, 36 + data_len);
+  memcpy(h+8, "WAVEfmt ", 8);
+  put32(h+16, 16);
+  put16(h+20, 1);           // PCM
+  put16(h+22, 2);           // channels
+  put32(h+24, rate);
+  put32(h+28, 4 * rate);    // bytes per second
+  put16(h+32, 4);           // bytes per frame
+  put16(h+34, 16);          // bits per sample
+  memcpy(h+36, "data", 4);
+  put32(h+40, data_len);
+}
+
+bool AudioCapture::setup(int rate, int bits) {
+  this->rate = rate;
+  this->bits = bits;
+
+  const char *arg = Verilated::commandArgsPlusMatch("wav=");
+  std::string file_name = arg[0]?arg+5:name + ".wav";
+  if(file_name == "off") return false;
+
+  file = fopen(file_name.c_str(), "wb");
+  if(!file) { perror(file_name.c_str()); exit(-1); }
+
+  // the sizes are filled in by close()
+  uint8_t h[44];
+  wav_header(h, rate, 0);
+  fwrite(h, 1, sizeof(h), file);
+
+  printf("Capturing audio at %d Hz to %s\n", rate, file_name.c_str());
+  return true;
+}
+
+void AudioCapture::close(void) {
+  if(!file) return;
+
+  uint8_t h[44];
+  wav_header(h, rate, 4 * samples);
+  fseek(file, 0, SEEK_SET);
+  fwrite(h, 1, sizeof(h), file);
+  fclose(file);
+  file = NULL;
+
+  printf("%llu audio samples (%.2f s) written\n", (unsigned long long)samples, (double)samples / rate);
+}
@@ -0,0 +1,60 @@
+/*
+  audio_capture.h
+
+  Audio capture for the verilator testbenches. The testbench passes
+  the core's audio output at a fixed sample rate, the samples are
+  written as a 16 bit stereo WAV file. Controlled by plusargs:
+
+    +wav=<file>|off         output file, default <name>.wav
+
+  Samples are signed and scaled to 16 bit by the bits given to
+  setup():
+
+    static AudioCapture audio("audio");
+    audio.setup(50000, 15);
+    ...
+    audio.sample(tb->audio_l, tb->audio_r);
+    ...
+    audio.close();
+*/
+
+#ifndef AUDIO_CAPTURE_H
+#define AUDIO_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+class AudioCapture {
+public:
+  AudioCapture(const char *name = "audio");
+  ~AudioCapture() { close(); }
+
+  // parse plusargs and write the header, false if capturing is off
+  bool setup(int rate, int bits);
+
+  // one stereo sample, bits wide two's complement
+  void sample(uint32_t l, uint32_t r) {
+    if(!file) return;
+    int16_t s[2] = { scale(l), scale(r) };
+    fwrite(s, sizeof(s), 1, file);
+    samples++;
+  }
+
+  // fill in the sizes of the header and close the file
+  void close(void);
+
+  uint64_t samples;
+
+private:
+  int16_t scale(uint32_t v) {
+    // sign extend and move the msb to bit 15
+    return (int16_t)(v << (32 - bits) >> 16);
+  }
+
+  std::string name;
+  FILE *file;
+  int rate, bits;
+};
+
+#endif // AUDIO_CAPTURE_H
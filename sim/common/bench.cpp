@@ -0,0 +1,63 @@
+/*
+  bench.cpp
+
+  Simulation speed measurement for the verilator testbenches
+*/
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "verilated.h"
+#include "bench.h"
+
+SimBench::SimBench(const char *name, double clock_hz) {
+  this->name = name;
+  this->clock_hz = clock_hz;
+  cycles = 0;
+  running = false;
+}
+
+void SimBench::start(void) {
+  cycles = 0;
+  running = true;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+}
+
+void SimBench::stop(void) {
+  struct timespec t1;
+  struct rusage ru;
+
+  if(!running) return;
+  running = false;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  getrusage(RUSAGE_SELF, &ru);
+
+  double wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  double sim = cycles / clock_hz;
+  double rate = wall > 0 ? cycles / wall : 0;
+  long rss = ru.ru_maxrss;     // kB on linux
+
+  printf("Simulated %llu cycles (%.3f ms) in %.3f s, %.0f cycles/s, speed factor %.0f, peak RSS %ld kB\n",
+	 (unsigned long long)cycles, 1000*sim, wall, rate, sim > 0 ? wall/sim : 0, rss);
+
+#if VM_TRACE
+  const char *traced = "true";
+#else
+  const char *traced = "false";
+#endif
+
+  const char *arg = Verilated::commandArgsPlusMatch("bench=");
+  if(!arg[0]) return;
+
+  const char *file = arg + 7;   // skip "+bench="
+  FILE *f = fopen(file, "w");
+  if(!f) { perror(file); return; }
+
+  fprintf(f, "{ \"testbench\": \"%s\", \"trace\": %s, \"threads\": %u, "
+	  "\"cycles\": %llu, \"sim_ms\": %.3f, \"wall_s\": %.3f, "
+	  "\"cycles_per_s\": %.0f, \"peak_rss_kb\": %ld }\n",
+	  name, traced, Verilated::threadContextp()->threads(),
+	  (unsigned long long)cycles, 1000*sim, wall, rate, rss);
+  fclose(f);
+}
@@ -0,0 +1,44 @@
+/*
+  bench.h
+
+  Simulation speed measurement for the verilator testbenches. The
+  testbench counts the cycles of its main clock over the measured
+  part of the run:
+
+    static SimBench bench("floppy_tb", 32000000);
+    ...
+    bench.start();            // after setting up model and trace
+    ...
+    if(c) bench.cycle();      // in tick() on the rising clock edge
+    ...
+    bench.stop();             // after trace.close()
+
+  stop() prints the simulated cycles per second, the wall time and
+  the peak RSS. With +bench=<file> the same values are also written
+  to <file> as a single line of JSON for "make bench".
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+class SimBench {
+public:
+  SimBench(const char *name, double clock_hz);
+
+  void start(void);
+  void stop(void);
+
+  void cycle(void) { cycles++; }
+
+private:
+  const char *name;
+  double clock_hz;
+  uint64_t cycles;
+  struct timespec t0;
+  bool running;
+};
+
+#endif // BENCH_H
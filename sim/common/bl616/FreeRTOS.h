@@ -0,0 +1,36 @@
+/*
+  FreeRTOS.h
+
+  Host version of the FreeRTOS API used by the BL616 firmware, for
+  the co-simulation in fw_tb. The functions are implemented by the
+  scheduler in ../bl616_shim.cpp.
+*/
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>      // the SDK provides printf everywhere
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE                 ((BaseType_t)0)
+#define pdTRUE                  ((BaseType_t)1)
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+#define errQUEUE_FULL           ((BaseType_t)0)
+
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ      ((TickType_t)1000)
+#define configMAX_PRIORITIES    (32)
+
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+// there's no preemption, a task woken from an interrupt runs once
+// the interrupted one blocks
+#define portYIELD_FROM_ISR(x)   ((void)(x))
+
+#endif // FREERTOS_H
@@ -0,0 +1,10 @@
+/*
+  bflb_dma.h
+
+  Included by the firmware's spi.c, DMA isn't used there.
+*/
+
+#ifndef BFLB_DMA_H
+#define BFLB_DMA_H
+
+#endif // BFLB_DMA_H
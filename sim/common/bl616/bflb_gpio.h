@@ -0,0 +1,97 @@
+/*
+  bflb_gpio.h
+
+  Host version of the BL616 SDK GPIO and interrupt API. Chip select
+  and interrupt line of the SPI connection to the FPGA are mapped to
+  the simulated model by ../bl616_shim.cpp, all other pins only keep
+  their state.
+*/
+
+#ifndef BFLB_GPIO_H
+#define BFLB_GPIO_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct bflb_device_s {
+  const char *name;
+  int irq_num;
+  void *user_data;
+};
+
+struct bflb_device_s *bflb_device_get_by_name(const char *name);
+
+#define GPIO_PIN_0 0
+#define GPIO_PIN_1 1
+#define GPIO_PIN_2 2
+#define GPIO_PIN_3 3
+#define GPIO_PIN_4 4
+#define GPIO_PIN_5 5
+#define GPIO_PIN_6 6
+#define GPIO_PIN_7 7
+#define GPIO_PIN_8 8
+#define GPIO_PIN_9 9
+#define GPIO_PIN_10 10
+#define GPIO_PIN_11 11
+#define GPIO_PIN_12 12
+#define GPIO_PIN_13 13
+#define GPIO_PIN_14 14
+#define GPIO_PIN_15 15
+#define GPIO_PIN_16 16
+#define GPIO_PIN_17 17
+#define GPIO_PIN_18 18
+#define GPIO_PIN_19 19
+#define GPIO_PIN_20 20
+#define GPIO_PIN_21 21
+#define GPIO_PIN_22 22
+#define GPIO_PIN_23 23
+#define GPIO_PIN_24 24
+#define GPIO_PIN_25 25
+#define GPIO_PIN_26 26
+#define GPIO_PIN_27 27
+#define GPIO_PIN_28 28
+#define GPIO_PIN_29 29
+#define GPIO_PIN_30 30
+#define GPIO_PIN_31 31
+#define GPIO_PIN_32 32
+#define GPIO_PIN_33 33
+#define GPIO_PIN_34 34
+#define GPIO_PIN_MAX 35
+
+// configuration flags, only stored
+#define GPIO_INPUT      (0 << 5)
+#define GPIO_OUTPUT     (1 << 5)
+#define GPIO_ANALOG     (2 << 5)
+#define GPIO_ALTERNATE  (3 << 5)
+#define GPIO_FLOAT      (0 << 7)
+#define GPIO_PULLUP     (1 << 7)
+#define GPIO_PULLDOWN   (2 << 7)
+#define GPIO_SMT_DIS    (0 << 9)
+#define GPIO_SMT_EN     (1 << 9)
+#define GPIO_DRV_0      (0 << 10)
+#define GPIO_DRV_1      (1 << 10)
+#define GPIO_DRV_2      (2 << 10)
+#define GPIO_DRV_3      (3 << 10)
+#define GPIO_FUNC_SPI0  (1 << 0)
+
+#define GPIO_INT_TRIG_MODE_SYNC_LOW_LEVEL  2
+
+void bflb_gpio_init(struct bflb_device_s *dev, uint8_t pin, uint32_t cfgset);
+void bflb_gpio_deinit(struct bflb_device_s *dev, uint8_t pin);
+void bflb_gpio_set(struct bflb_device_s *dev, uint8_t pin);
+void bflb_gpio_reset(struct bflb_device_s *dev, uint8_t pin);
+int  bflb_gpio_read(struct bflb_device_s *dev, uint8_t pin);
+
+void bflb_gpio_int_init(struct bflb_device_s *dev, uint8_t pin, uint8_t trig_mode);
+void bflb_gpio_irq_attach(uint8_t pin, void (*callback)(uint8_t pin));
+void bflb_irq_enable(int irq);
+void bflb_irq_disable(int irq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BFLB_GPIO_H
@@ -0,0 +1,25 @@
+/*
+  bflb_mtimer.h
+
+  Host version of the BL616 SDK timer API, the delays block the
+  calling task for the given simulation time.
+*/
+
+#ifndef BFLB_MTIMER_H
+#define BFLB_MTIMER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void bflb_mtimer_delay_us(uint32_t us);
+void bflb_mtimer_delay_ms(uint32_t ms);
+uint64_t bflb_mtimer_get_time_us(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BFLB_MTIMER_H
@@ -0,0 +1,53 @@
+/*
+  bflb_spi.h
+
+  Host version of the BL616 SDK SPI API. A byte sent is shifted
+  through the SPI pins of the simulated model, see ../bl616_shim.cpp.
+*/
+
+#ifndef BFLB_SPI_H
+#define BFLB_SPI_H
+
+#include <stddef.h>
+#include "bflb_gpio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPI_ROLE_MASTER         0
+#define SPI_ROLE_SLAVE          1
+
+#define SPI_MODE0               0
+#define SPI_MODE1               1
+#define SPI_MODE2               2
+#define SPI_MODE3               3
+
+#define SPI_DATA_WIDTH_8BIT     1
+#define SPI_BIT_LSB             0
+#define SPI_BIT_MSB             1
+#define SPI_BYTE_LSB            0
+#define SPI_BYTE_MSB            1
+
+#define SPI_CMD_SET_DATA_WIDTH  0x01
+
+struct bflb_spi_config_s {
+  uint32_t freq;
+  uint8_t role;
+  uint8_t mode;
+  uint8_t data_width;
+  uint8_t bit_order;
+  uint8_t byte_order;
+  uint8_t tx_fifo_threshold;
+  uint8_t rx_fifo_threshold;
+};
+
+void bflb_spi_init(struct bflb_device_s *dev, const struct bflb_spi_config_s *config);
+int bflb_spi_feature_control(struct bflb_device_s *dev, int cmd, size_t arg);
+uint32_t bflb_spi_poll_send(struct bflb_device_s *dev, uint32_t data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BFLB_SPI_H
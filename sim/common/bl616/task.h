@@ -0,0 +1,33 @@
+/*
+  task.h
+
+  Host version of the FreeRTOS task API, see FreeRTOS.h
+*/
+
+#ifndef TASK_H
+#define TASK_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bl616_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+// the stack depth is ignored, host code needs much more
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth,
+		       void *parms, UBaseType_t priority, TaskHandle_t *handle);
+void vTaskStartScheduler(void);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TASK_H
@@ -0,0 +1,523 @@
+/*
+  bl616_shim.cpp
+
+  FreeRTOS and BL616 SDK functions for the host build of the MCU
+  firmware, see bl616_shim.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "bl616_shim.h"
+#include "bl616/FreeRTOS.h"
+#include "bl616/task.h"
+#include "bl616/queue.h"
+#include "bl616/semphr.h"
+#include "bl616/timers.h"
+#include "bl616/bflb_gpio.h"
+#include "bl616/bflb_spi.h"
+#include "bl616/bflb_mtimer.h"
+
+// pins of the M0S dock as used by the firmware's spi.c
+#define PIN_CSN   12
+#define PIN_IRQ   14
+
+// host code needs far more stack than the firmware requests
+#define STACK_SIZE  (256*1024)
+
+#define NEVER     UINT64_MAX
+
+struct bl616_task {
+  enum { HELD, READY, RUNNING, DELAY, NOTIFY, MUTEX, QUEUE, SPI, DONE } state;
+  const char *name;
+  void (*code)(void *);
+  void *arg;
+  int priority;
+  ucontext_t ctx;
+  void *stack;
+  uint64_t wake;            // end of a delay or timeout
+  bool timed_out;
+  uint32_t notify;
+  uint8_t spi_rx;
+};
+
+struct bl616_mutex {
+  bl616_task *owner;
+  std::deque<bl616_task*> waiters;
+};
+
+struct bl616_queue {
+  size_t length, item_size;
+  std::deque<std::vector<uint8_t>> items;
+  std::deque<bl616_task*> readers;
+};
+
+struct bl616_timer {
+  const char *name;
+  uint64_t period;
+  bool reload, active;
+  uint64_t expiry;
+  void *id;
+  TimerCallbackFunction_t callback;
+};
+
+enum { EV_SPI, EV_IRQ, EV_COUNT };
+
+static const char *event_format[EV_COUNT] = {
+  "SPI target %u command %u, %u bytes",
+  "Interrupt"
+};
+
+// the firmware calls plain C functions
+static Bl616Shim *shim;
+
+Bl616Shim::Bl616Shim(double tick_hz) {
+  shim = this;
+  hz = tick_hz;
+  gpio_ns = 100;
+  spi_gap_ns = 100;
+  spi_bytes = spi_transactions = interrupts = 0;
+  last_irq = 0;
+  now = 0;
+
+  irq_enabled = false;
+  isr = NULL;
+  current = NULL;
+  scheduler_started = false;
+  ready = 0;
+  next_event = NEVER;
+
+  ss = 1; sck = 0; mosi = 0; irq_n = 1;
+  memset(pins, 0, sizeof(pins));
+  spi.phase = -1;
+  spi.half = 1;
+  spi.task = NULL;
+  gap_until = 0;
+  transaction_bytes = 0;
+  transaction_target = transaction_cmd = 0;
+
+  log = NULL;
+  ev_base = 0;
+}
+
+Bl616Shim::~Bl616Shim() {
+  for(auto t : tasks) {
+    munmap(t->stack, STACK_SIZE);
+    delete t;
+  }
+  if(shim == this) shim = NULL;
+}
+
+void Bl616Shim::attach(EventLog &l) {
+  log = &l;
+  ev_base = log->define("mcu", event_format[0]);
+  for(int i=1;i<EV_COUNT;i++) log->define("mcu", event_format[i]);
+}
+
+bl616_task *Bl616Shim::create_task(void (*code)(void *), const char *name, void *arg, int priority) {
+  bl616_task *t = new bl616_task();
+  t->name = name;
+  t->code = code;
+  t->arg = arg;
+  t->priority = priority;
+  t->wake = NEVER;
+  t->timed_out = false;
+  t->notify = 0;
+  t->spi_rx = 0;
+
+  // gcc nested functions as used by sdc_readdir() place trampolines
+  // on the stack, so it has to be executable
+  t->stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(t->stack == MAP_FAILED) { perror("mmap"); exit(-1); }
+
+  getcontext(&t->ctx);
+  t->ctx.uc_stack.ss_sp = t->stack;
+  t->ctx.uc_stack.ss_size = STACK_SIZE;
+  t->ctx.uc_link = &sched_ctx;
+  makecontext(&t->ctx, (void (*)())task_entry, 1, (int)tasks.size());
+  tasks.push_back(t);
+
+  // like FreeRTOS tasks created before the scheduler runs wait for it
+  t->state = bl616_task::HELD;
+  if(scheduler_started) wake(t);
+  return t;
+}
+
+void Bl616Shim::task_entry(int index) {
+  bl616_task *t = shim->tasks[index];
+  t->code(t->arg);
+  t->state = bl616_task::DONE;
+}
+
+void Bl616Shim::start(void (*entry)(void *), void *arg) {
+  wake(create_task(entry, "main", arg, 0));
+}
+
+void Bl616Shim::start_scheduler(void) {
+  scheduler_started = true;
+  for(auto t : tasks)
+    if(t->state == bl616_task::HELD) wake(t);
+
+  // main() never returns from vTaskStartScheduler()
+  if(current) {
+    current->state = bl616_task::DONE;
+    block();
+  }
+}
+
+void Bl616Shim::wake(bl616_task *t) {
+  t->state = bl616_task::READY;
+  t->wake = NEVER;
+  ready++;
+}
+
+void Bl616Shim::block(void) {
+  swapcontext(&current->ctx, &sched_ctx);
+}
+
+void Bl616Shim::schedule(void) {
+  // timers due, their callbacks run outside of any task
+  for(auto t : timers) {
+    if(t->active && now >= t->expiry) {
+      if(t->reload) t->expiry = now + (t->period?t->period:1);
+      else          t->active = false;
+      t->callback(t);
+    }
+  }
+
+  // low level interrupt, the handler disables it until it's processed
+  if(!irq_n && irq_enabled && isr) {
+    interrupts++;
+    last_irq = now;
+    if(log) log->log(ev_base + EV_IRQ);
+    isr(PIN_IRQ);
+  }
+
+  // delays and timeouts
+  for(auto t : tasks) {
+    if(now >= t->wake && (t->state == bl616_task::DELAY ||
+			  t->state == bl616_task::NOTIFY ||
+			  t->state == bl616_task::QUEUE)) {
+      t->timed_out = t->state != bl616_task::DELAY;
+      wake(t);
+    }
+  }
+
+  // run the ready tasks, highest priority first, until all are blocked
+  while(ready) {
+    bl616_task *run = NULL;
+    for(auto t : tasks)
+      if(t->state == bl616_task::READY && (!run || t->priority > run->priority))
+	run = t;
+
+    ready--;
+    run->state = bl616_task::RUNNING;
+    current = run;
+    swapcontext(&sched_ctx, &run->ctx);
+    current = NULL;
+
+    if(run->state == bl616_task::RUNNING) {
+      // returned from its function
+      run->state = bl616_task::DONE;
+    }
+  }
+
+  update_next_event();
+}
+
+void Bl616Shim::update_next_event(void) {
+  next_event = NEVER;
+  for(auto t : tasks)
+    if((t->state == bl616_task::DELAY || t->state == bl616_task::NOTIFY ||
+	t->state == bl616_task::QUEUE) && t->wake < next_event)
+      next_event = t->wake;
+  for(auto t : timers)
+    if(t->active && t->expiry < next_event)
+      next_event = t->expiry;
+}
+
+void Bl616Shim::delay(uint64_t ticks) {
+  if(!current) return;
+  current->state = bl616_task::DELAY;
+  current->wake = now + (ticks?ticks:1);
+  block();
+}
+
+uint32_t Bl616Shim::notify_take(bool clear, uint64_t timeout) {
+  bl616_task *t = current;
+  if(!t) return 0;
+
+  if(!t->notify && timeout) {
+    t->state = bl616_task::NOTIFY;
+    t->wake = (timeout == NEVER)?NEVER:now + timeout;
+    block();
+  }
+
+  uint32_t value = t->notify;
+  if(value) t->notify = clear?0:value-1;
+  return value;
+}
+
+void Bl616Shim::notify_give(bl616_task *t) {
+  t->notify++;
+  if(t->state == bl616_task::NOTIFY) wake(t);
+}
+
+bool Bl616Shim::mutex_take(bl616_mutex *m) {
+  if(!m->owner) {
+    m->owner = current;
+    return true;
+  }
+  if(!current) return false;
+
+  // mutex is handed over by mutex_give()
+  m->waiters.push_back(current);
+  current->state = bl616_task::MUTEX;
+  block();
+  return true;
+}
+
+void Bl616Shim::mutex_give(bl616_mutex *m) {
+  if(m->waiters.empty()) {
+    m->owner = NULL;
+    return;
+  }
+  m->owner = m->waiters.front();
+  m->waiters.pop_front();
+  wake(m->owner);
+}
+
+bool Bl616Shim::queue_send(bl616_queue *q, const void *item) {
+  if(q->items.size() >= q->length) return false;
+  const uint8_t *p = (const uint8_t*)item;
+  q->items.push_back(std::vector<uint8_t>(p, p + q->item_size));
+
+  if(!q->readers.empty()) {
+    bl616_task *t = q->readers.front();
+    q->readers.pop_front();
+    if(t->state == bl616_task::QUEUE) wake(t);
+  }
+  return true;
+}
+
+bool Bl616Shim::queue_receive(bl616_queue *q, void *item, uint64_t timeout) {
+  while(q->items.empty()) {
+    if(!timeout || !current) return false;
+
+    q->readers.push_back(current);
+    current->state = bl616_task::QUEUE;
+    current->wake = (timeout == NEVER)?NEVER:now + timeout;
+    current->timed_out = false;
+    block();
+
+    if(current->timed_out) {
+      for(auto it = q->readers.begin(); it != q->readers.end(); ++it)
+	if(*it == current) { q->readers.erase(it); break; }
+      return false;
+    }
+  }
+
+  memcpy(item, q->items.front().data(), q->item_size);
+  q->items.pop_front();
+  return true;
+}
+
+void Bl616Shim::timer_start(bl616_timer *t) {
+  t->active = true;
+  t->expiry = now + (t->period?t->period:1);
+  if(t->expiry < next_event) next_event = t->expiry;
+}
+
+void Bl616Shim::gpio_write(int pin, int value) {
+  if(pin < 0 || pin >= 64) return;
+  pins[pin] = value;
+  if(pin != PIN_CSN || ss == value) return;
+
+  ss = value;
+  if(!ss) {
+    transaction_bytes = 0;
+  } else {
+    spi_transactions++;
+    if(log) log->log(ev_base + EV_SPI, transaction_target, transaction_cmd, transaction_bytes);
+  }
+
+  // the chip select has to stay high for the fpga to notice
+  if(current) delay(gpio_ns * 1e-9 * hz);
+}
+
+int Bl616Shim::gpio_read(int pin) {
+  if(pin == PIN_IRQ) return irq_n;
+  return (pin >= 0 && pin < 64)?pins[pin]:0;
+}
+
+void Bl616Shim::spi_config(uint32_t freq) {
+  spi.half = hz / (2.0 * freq) + 0.5;
+  if(spi.half < 1) spi.half = 1;
+  printf("MCU SPI clock %.2f MHz\n", hz / (2.0 * spi.half) / 1e6);
+}
+
+uint8_t Bl616Shim::spi_transfer(uint8_t byte) {
+  if(!current) return 0;
+
+  if(transaction_bytes == 0) transaction_target = byte;
+  if(transaction_bytes == 1) transaction_cmd = byte;
+  transaction_bytes++;
+
+  spi.tx = byte;
+  spi.rx = 0;
+  spi.task = current;
+  spi.phase = 0;
+  spi.next = (gap_until > now)?gap_until:now+1;
+
+  current->state = bl616_task::SPI;
+  block();
+  return current->spi_rx;
+}
+
+// shift one bit per half clock: mode 1 sets up data with the rising
+// edge, both sides sample with the falling one
+void Bl616Shim::spi_clk(int miso) {
+  if(now < spi.next) return;
+
+  if(spi.phase == 16) {
+    spi.phase = -1;
+    spi.task->spi_rx = spi.rx;
+    spi_bytes++;
+    gap_until = now + (uint64_t)(spi_gap_ns * 1e-9 * hz);
+    wake(spi.task);
+    return;
+  }
+
+  if(!(spi.phase & 1)) {
+    mosi = (spi.tx >> (7 - spi.phase/2)) & 1;
+    sck = 1;
+  } else {
+    sck = 0;
+    spi.rx = (spi.rx << 1) | (miso & 1);
+  }
+  spi.phase++;
+  spi.next = now + spi.half;
+}
+
+// ------------------------ C API used by the firmware ------------------------
+
+static uint64_t ticks_of(TickType_t t) {
+  return (t == portMAX_DELAY)?NEVER:shim->ms_ticks(t * 1000 / configTICK_RATE_HZ);
+}
+
+extern "C" {
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth,
+		       void *parms, UBaseType_t priority, TaskHandle_t *handle) {
+  bl616_task *t = shim->create_task(code, name, parms, priority);
+  if(handle) *handle = t;
+  return pdPASS;
+}
+
+void vTaskStartScheduler(void) { shim->start_scheduler(); }
+void vTaskDelay(TickType_t ticks) { shim->delay(ticks_of(ticks)); }
+TickType_t xTaskGetTickCount(void) { return shim->now * configTICK_RATE_HZ / shim->hz; }
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+  return shim->notify_take(clear_on_exit, ticks_of(ticks_to_wait));
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+  shim->notify_give(task);
+  if(woken) *woken = pdTRUE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  bl616_queue *q = new bl616_queue();
+  q->length = length;
+  q->item_size = item_size;
+  return q;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+  return shim->queue_send(queue, item)?pdPASS:errQUEUE_FULL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+  return shim->queue_receive(queue, buffer, ticks_of(ticks_to_wait))?pdTRUE:pdFALSE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  return new bl616_mutex();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks_to_wait) {
+  return shim->mutex_take(mutex)?pdTRUE:pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+  shim->mutex_give(mutex);
+  return pdTRUE;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload,
+			   void *id, TimerCallbackFunction_t callback) {
+  bl616_timer *t = new bl616_timer();
+  t->name = name;
+  t->period = ticks_of(period);
+  t->reload = auto_reload;
+  t->active = false;
+  t->expiry = NEVER;
+  t->id = id;
+  t->callback = callback;
+  shim->timers.push_back(t);
+  return t;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait) {
+  if(timer) shim->timer_start(timer);
+  return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait) {
+  if(timer) timer->active = false;
+  return pdPASS;
+}
+
+struct bflb_device_s *bflb_device_get_by_name(const char *name) {
+  static struct bflb_device_s gpio = { "gpio", 1, NULL };
+  static struct bflb_device_s spi0 = { "spi0", 2, NULL };
+  if(!strcmp(name, "gpio")) return &gpio;
+  if(!strcmp(name, "spi0")) return &spi0;
+  fprintf(stderr, "MCU: no device %s\n", name);
+  return NULL;
+}
+
+void bflb_gpio_init(struct bflb_device_s *dev, uint8_t pin, uint32_t cfgset) { }
+void bflb_gpio_deinit(struct bflb_device_s *dev, uint8_t pin) { }
+void bflb_gpio_set(struct bflb_device_s *dev, uint8_t pin) { shim->gpio_write(pin, 1); }
+void bflb_gpio_reset(struct bflb_device_s *dev, uint8_t pin) { shim->gpio_write(pin, 0); }
+int bflb_gpio_read(struct bflb_device_s *dev, uint8_t pin) { return shim->gpio_read(pin); }
+
+void bflb_gpio_int_init(struct bflb_device_s *dev, uint8_t pin, uint8_t trig_mode) { }
+
+void bflb_gpio_irq_attach(uint8_t pin, void (*callback)(uint8_t pin)) {
+  if(pin == PIN_IRQ) shim->isr = callback;
+}
+
+void bflb_irq_enable(int irq) { shim->irq_enabled = true; }
+void bflb_irq_disable(int irq) { shim->irq_enabled = false; }
+
+void bflb_spi_init(struct bflb_device_s *dev, const struct bflb_spi_config_s *config) {
+  shim->spi_config(config->freq);
+}
+
+int bflb_spi_feature_control(struct bflb_device_s *dev, int cmd, size_t arg) { return 0; }
+
+uint32_t bflb_spi_poll_send(struct bflb_device_s *dev, uint32_t data) {
+  return shim->spi_transfer(data);
+}
+
+void bflb_mtimer_delay_us(uint32_t us) { shim->delay(us * shim->hz / 1e6); }
+void bflb_mtimer_delay_ms(uint32_t ms) { shim->delay(shim->ms_ticks(ms)); }
+uint64_t bflb_mtimer_get_time_us(void) { return shim->now * 1e6 / shim->hz; }
+
+}
@@ -0,0 +1,140 @@
+/*
+  bl616_shim.h
+
+  Runs the BL616 MCU firmware (bl616/misterynano_fw) on the host
+  against a verilated FPGA top. The firmware sources are compiled for
+  the host with the FreeRTOS and SDK headers in common/bl616 whose
+  functions are implemented here:
+
+  - FreeRTOS tasks are coroutines on the testbench thread. The ready
+    one with the highest priority runs until it blocks in a delay,
+    mutex, queue, task notification, SPI transfer or chip select
+    change. The firmware's own code thus takes no simulation time.
+  - bflb_spi_poll_send() shifts a byte through the SPI pins in mode 1
+    at the rate set by bflb_spi_init(), as mcu_spi.v expects it.
+  - GPIO 12 is the chip select, GPIO 14 the low active interrupt
+    line, as on the M0S dock. While the line is low and the interrupt
+    enabled, the handler attached by the firmware is called, which
+    wakes its spi_task.
+
+  The top module has to provide spi_io_ss, spi_io_clk, spi_io_din,
+  spi_io_dout and spi_irq_n:
+
+    static Bl616Shim mcu(64000000);    // rate tick() is called at
+    mcu.attach(elog);                  // optional, "mcu" events
+    mcu.start(fw_main);                // firmware entry task
+    ...
+    tb->eval();
+    mcu.tick(tb);
+
+  The entry task plays the firmware's main(): tasks it creates only
+  start once it calls vTaskStartScheduler().
+*/
+
+#ifndef BL616_SHIM_H
+#define BL616_SHIM_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <ucontext.h>
+
+#include "eventlog.h"
+
+struct bl616_task;
+struct bl616_mutex;
+struct bl616_queue;
+struct bl616_timer;
+
+class Bl616Shim {
+public:
+  Bl616Shim(double tick_hz);
+  ~Bl616Shim();
+
+  // start the firmware with the given entry task
+  void start(void (*entry)(void *), void *arg = NULL);
+
+  // record SPI transactions and interrupts in the event log
+  void attach(EventLog &log);
+
+  // time a GPIO write takes and gap between two SPI bytes in ns
+  double gpio_ns, spi_gap_ns;
+
+  // statistics
+  uint64_t spi_bytes, spi_transactions, interrupts;
+
+  // tick count of the last interrupt taken by the firmware
+  uint64_t last_irq;
+
+  // ticks since start
+  uint64_t now;
+
+  template<class T> void tick(T *tb) {
+    now++;
+    if(spi.phase >= 0) spi_clk(tb->spi_io_dout);
+    irq_n = tb->spi_irq_n;
+    if(ready || now >= next_event || (!irq_n && irq_enabled && isr))
+      schedule();
+    tb->spi_io_ss = ss;
+    tb->spi_io_clk = sck;
+    tb->spi_io_din = mosi;
+  }
+
+  // called by the firmware through the C API in common/bl616
+  bl616_task *create_task(void (*code)(void *), const char *name, void *arg, int priority);
+  void start_scheduler(void);
+  void delay(uint64_t ticks);
+  uint32_t notify_take(bool clear, uint64_t timeout);
+  void notify_give(bl616_task *task);
+  bool mutex_take(bl616_mutex *mutex);
+  void mutex_give(bl616_mutex *mutex);
+  bool queue_send(bl616_queue *queue, const void *item);
+  bool queue_receive(bl616_queue *queue, void *item, uint64_t timeout);
+  void timer_start(bl616_timer *timer);
+  void gpio_write(int pin, int value);
+  int gpio_read(int pin);
+  void spi_config(uint32_t freq);
+  uint8_t spi_transfer(uint8_t byte);
+
+  double hz;                  // tick rate
+  uint64_t ms_ticks(uint64_t ms) { return ms * hz / 1000; }
+
+  bool irq_enabled;
+  void (*isr)(uint8_t pin);
+  std::vector<bl616_timer*> timers;
+
+private:
+  static void task_entry(int index);
+  void schedule(void);
+  void block(void);
+  void wake(bl616_task *task);
+  void spi_clk(int miso);
+  void update_next_event(void);
+
+  std::vector<bl616_task*> tasks;
+  bl616_task *current;
+  ucontext_t sched_ctx;
+  bool scheduler_started;
+  int ready;                  // number of ready tasks
+  uint64_t next_event;        // earliest task timeout or timer
+
+  // pins
+  int ss, sck, mosi, irq_n;
+  int pins[64];
+
+  struct {
+    int phase;                // 0..15 half bits, -1 if idle
+    uint64_t next;            // tick of the next half bit
+    int half;                 // ticks per half bit
+    uint8_t tx, rx;
+    bl616_task *task;
+  } spi;
+  uint64_t gap_until;         // no new byte before this tick
+  int transaction_bytes;
+  uint8_t transaction_target, transaction_cmd;
+
+  EventLog *log;
+  int ev_base;
+};
+
+#endif // BL616_SHIM_H
@@ -0,0 +1,52 @@
+/*
+  checkpoint.cpp
+
+  Save and restore of verilated models and testbench state
+*/
+
+#include <string.h>
+
+#include "checkpoint.h"
+
+Checkpoint::Checkpoint(const char *name) : name(name) {
+  restored = false;
+  save_ms = -1;
+}
+
+// value of +<name>=<value>, matched exactly so +save doesn't take +save_at
+static const char *plusarg(const char *arg, const char *name) {
+  size_t len = strlen(name);
+  if(arg[0] != '+' || strncmp(arg+1, name, len) || arg[len+1] != '=') return NULL;
+  return arg+len+2;
+}
+
+void Checkpoint::args(int argc, char **argv) {
+  const char *val;
+  for(int i=1;i<argc;i++) {
+    if((val = plusarg(argv[i], "save_at")))
+      save_ms = atof(val);
+    else if((val = plusarg(argv[i], "save")))
+      save_file = val;
+    else if((val = plusarg(argv[i], "restore")))
+      restore_file = val;
+  }
+
+#ifndef SAVABLE
+  if(save_ms >= 0 || !restore_file.empty()) {
+    printf("Checkpoints need a model built with SAVABLE=1\n");
+    exit(-1);
+  }
+#endif
+
+  if(save_ms >= 0 && save_file.empty()) {
+    char str[32];
+    snprintf(str, sizeof(str), "_%gms.ckpt", save_ms);
+    save_file = name + str;
+  }
+}
+
+uint64_t Checkpoint::layout(void) {
+  uint64_t n = regions.size();
+  for(Region &r : regions) n = 31*n + r.size;
+  return n;
+}
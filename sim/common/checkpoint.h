@@ -0,0 +1,113 @@
+/*
+  checkpoint.h
+
+  Save and restore the state of a verilated model together with the
+  state kept on the C++ side of the testbench (RAM and ROM arrays,
+  simulation time, bus state machines, ...):
+
+    +save_at=<ms>     save a checkpoint once simulation time reaches <ms>
+    +save=<file>      name of the saved checkpoint, default <name>_<ms>ms.ckpt
+    +restore=<file>   continue from a checkpoint instead of starting at reset
+
+  The model needs to be verilated with --savable (SAVABLE=1 in the
+  Makefiles). The testbench registers its own state and polls between
+  clock cycles at points where no state is kept in local variables:
+
+    static Checkpoint ckpt("ram_tb");
+    ...
+    ckpt.args(argc, argv);
+    ckpt.add(ram, sizeof(ram));
+    ckpt.add(simulation_time);
+    if(!ckpt.restore(tb)) reset();
+    ...
+    while(...) {
+      tick(1); tick(0);
+      ckpt.poll(tb, 1000*simulation_time);
+    }
+
+  A checkpoint can only be restored into the same build of the model.
+*/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef SAVABLE
+#include "verilated_save.h"
+#endif
+
+class Checkpoint {
+public:
+  Checkpoint(const char *name);
+
+  // parse +save_at, +save and +restore
+  void args(int argc, char **argv);
+
+  // register C++ side state to be saved along with the model
+  void add(void *data, size_t size) { regions.push_back(Region{ data, size }); }
+  template<class T> void add(T &var) { add(&var, sizeof(var)); }
+
+  // restore model and registered state if +restore was given
+  template<class M> bool restore(M *model) {
+    if(restore_file.empty()) return false;
+#ifdef SAVABLE
+    VerilatedRestore os;
+    os.open(restore_file.c_str());
+    if(!os.isOpen()) { perror(restore_file.c_str()); exit(-1); }
+    os >> *model;
+    uint64_t n;
+    os.read(&n, sizeof(n));
+    if(n != layout()) {
+      printf("Checkpoint %s doesn't match this testbench\n", restore_file.c_str());
+      exit(-1);
+    }
+    for(Region &r : regions) os.read(r.data, r.size);
+    os.close();
+    printf("Restored checkpoint %s\n", restore_file.c_str());
+#endif
+    restored = true;
+    return true;
+  }
+
+  // save if the requested time has been reached
+  template<class M> void poll(M *model, double ms) {
+    if(save_ms >= 0 && ms >= save_ms) save(model, ms);
+  }
+
+  template<class M> void save(M *model, double ms) {
+    save_ms = -1;
+#ifdef SAVABLE
+    VerilatedSave os;
+    os.open(save_file.c_str());
+    if(!os.isOpen()) { perror(save_file.c_str()); exit(-1); }
+    os << *model;
+    uint64_t n = layout();
+    os.write(&n, sizeof(n));
+    for(Region &r : regions) os.write(r.data, r.size);
+    os.close();
+    printf("Saved checkpoint %s at %.3fms\n", save_file.c_str(), ms);
+#endif
+  }
+
+  // true if the run continues from a checkpoint
+  bool restored;
+
+  // pending save time, < 0 if none
+  double save_ms;
+
+private:
+  struct Region { void *data; size_t size; };
+
+  // fingerprint of the registered state to catch mismatching files
+  uint64_t layout(void);
+
+  std::string name, save_file, restore_file;
+  std::vector<Region> regions;
+};
+
+#endif // CHECKPOINT_H
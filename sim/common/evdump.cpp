@@ -0,0 +1,125 @@
+/*
+  evdump.cpp
+
+  Offline decoder for the binary event logs written by EventLog, see
+  eventlog.h. Renders the records as text or CSV:
+
+    evdump [-c] [-f <cat>,<cat>] [-t <from_ms>:<to_ms>] <file.evl>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "eventlog.h"
+
+static void usage(const char *prg) {
+  fprintf(stderr, "Usage: %s [-c] [-f <cat>,<cat>] [-t <from_ms>:<to_ms>] <file.evl>\n", prg);
+  fprintf(stderr, "  -c   write CSV instead of text\n");
+  fprintf(stderr, "  -f   only show events of the given categories\n");
+  fprintf(stderr, "  -t   only show events within the given time span\n");
+  exit(-1);
+}
+
+// the formats come from the file, only accept conversions of up to
+// three unsigned ints like EventLog::log() passes
+static bool format_ok(const char *fmt) {
+  int args = 0;
+  while(*fmt) {
+    if(*fmt++ != '%') continue;
+    if(*fmt == '%') { fmt++; continue; }
+    fmt += strspn(fmt, "-+ #0");
+    fmt += strspn(fmt, "0123456789");
+    if(*fmt == '.') fmt += 1 + strspn(fmt+1, "0123456789");
+    if(!*fmt || !strchr("cdiouxX", *fmt++) || ++args > 3) return false;
+  }
+  return true;
+}
+
+// csv fields may contain commas, quote them
+static void csv_string(const char *str) {
+  putchar('"');
+  for(;*str;str++) {
+    if(*str == '"') putchar('"');
+    putchar(*str);
+  }
+  putchar('"');
+}
+
+int main(int argc, char **argv) {
+  bool csv = false;
+  std::string cats;
+  double from = 0, to = -1;
+
+  int opt;
+  while((opt = getopt(argc, argv, "cf:t:")) != -1) {
+    switch(opt) {
+    case 'c': csv = true; break;
+    case 'f': cats = std::string(",") + optarg + ","; break;
+    case 't': {
+      const char *colon = strchr(optarg, ':');
+      from = atof(optarg);
+      if(colon && colon[1]) to = atof(colon+1);
+      break;
+    }
+    default: usage(argv[0]);
+    }
+  }
+  if(optind != argc-1) usage(argv[0]);
+
+  FILE *file = fopen(argv[optind], "rb");
+  if(!file) { perror(argv[optind]); return -1; }
+
+  EventLogHeader hdr;
+  if(fread(&hdr, sizeof(hdr), 1, file) != 1 || strcmp(hdr.magic, EVENTLOG_MAGIC)) {
+    fprintf(stderr, "%s is no event log\n", argv[optind]);
+    return -1;
+  }
+
+  std::vector<EventLogDef> defs(hdr.defs);
+  if(fread(defs.data(), sizeof(EventLogDef), hdr.defs, file) != hdr.defs) {
+    fprintf(stderr, "%s: truncated\n", argv[optind]);
+    return -1;
+  }
+
+  std::vector<bool> show(hdr.defs), valid(hdr.defs);
+  for(uint32_t i=0;i<hdr.defs;i++) {
+    defs[i].category[sizeof(defs[i].category)-1] = 0;
+    defs[i].format[sizeof(defs[i].format)-1] = 0;
+    valid[i] = format_ok(defs[i].format);
+    if(!valid[i]) fprintf(stderr, "Event %u has an invalid format, showing its arguments only\n", i);
+    show[i] = cats.empty() || cats.find(std::string(",") + defs[i].category + ",") != std::string::npos;
+  }
+
+  if(csv) printf("time_ps,category,a,b,c,text\n");
+  else if(hdr.total > hdr.records)
+    printf("%llu events logged, showing the last %u\n", (unsigned long long)hdr.total, hdr.records);
+
+  EventLogRecord r;
+  char text[256];
+  while(fread(&r, sizeof(r), 1, file) == 1) {
+    if(r.id >= hdr.defs || !show[r.id]) continue;
+
+    double ms = r.time / 1e9;
+    if(ms < from) continue;
+    if(to >= 0 && ms > to) break;
+
+    if(valid[r.id])
+      snprintf(text, sizeof(text), defs[r.id].format, r.arg[0], r.arg[1], r.arg[2]);
+    else
+      snprintf(text, sizeof(text), "event %u: %08x %08x %08x", r.id, r.arg[0], r.arg[1], r.arg[2]);
+    if(csv) {
+      printf("%llu,%s,%u,%u,%u,", (unsigned long long)r.time, defs[r.id].category,
+	     r.arg[0], r.arg[1], r.arg[2]);
+      csv_string(text);
+      putchar('\n');
+    } else
+      printf("@%.6f %-6s %s\n", ms, defs[r.id].category, text);
+  }
+
+  fclose(file);
+  return 0;
+}
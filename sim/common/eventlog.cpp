@@ -0,0 +1,113 @@
+/*
+  eventlog.cpp
+
+  Binary event recorder for the verilator testbenches
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "verilated.h"
+#include "eventlog.h"
+
+// logs to be written if the simulation ends via exit()
+static std::vector<EventLog*> active_logs;
+
+static void write_all(void) {
+  while(!active_logs.empty()) active_logs.back()->write();
+}
+
+EventLog::EventLog(const char *name) : name(name) {
+  now = 0;
+  pos = 0;
+  total = 0;
+  active = false;
+  memset(enabled, 0, sizeof(enabled));
+}
+
+int EventLog::define(const char *category, const char *format) {
+  if(defs.size() == MAX_EVENTS) {
+    printf("EventLog: too many event types\n");
+    exit(-1);
+  }
+
+  EventLogDef def;
+  memset(&def, 0, sizeof(def));
+  strncpy(def.category, category, sizeof(def.category)-1);
+  strncpy(def.format, format, sizeof(def.format)-1);
+  defs.push_back(def);
+  return defs.size()-1;
+}
+
+// value of +<name>=<value>, NULL if not given
+static const char *plusarg(const char *name) {
+  const char *arg = Verilated::commandArgsPlusMatch(name);
+  if(!arg[0]) return NULL;
+  return arg + 1 + strlen(name);
+}
+
+bool EventLog::setup(void) {
+  const char *arg;
+
+  // the ring takes 24 bytes per event, only allocated on request
+  std::string cats = (arg = plusarg("log="))?arg:"off";
+  if(cats == "off") return false;
+
+  size_t size = 1024*1024;
+  if((arg = plusarg("log_size="))) size = strtoul(arg, NULL, 0);
+  if(!size) return false;
+  if((arg = plusarg("log_file="))) name = arg;
+  else                             name += ".evl";
+
+  // enable all event types of the selected categories
+  int n = 0;
+  for(size_t i=0;i<defs.size();i++) {
+    if(cats == "all") enabled[i] = true;
+    else {
+      std::string list = "," + cats + ",";
+      enabled[i] = list.find(std::string(",") + defs[i].category + ",") != std::string::npos;
+    }
+    if(enabled[i]) n++;
+  }
+  if(!n) {
+    printf("EventLog: no events match +log=%s\n", cats.c_str());
+    return false;
+  }
+
+  ring.resize(size);
+  printf("Logging %d event types into %s\n", n, name.c_str());
+
+  if(active_logs.empty()) atexit(write_all);
+  active_logs.push_back(this);
+  active = true;
+  return true;
+}
+
+void EventLog::write(void) {
+  if(!active) return;
+  active = false;
+  for(auto it = active_logs.begin(); it != active_logs.end(); it++)
+    if(*it == this) { active_logs.erase(it); break; }
+
+  FILE *file = fopen(name.c_str(), "wb");
+  if(!file) { perror(name.c_str()); return; }
+
+  EventLogHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  strcpy(hdr.magic, EVENTLOG_MAGIC);
+  hdr.defs = defs.size();
+  hdr.records = (total < ring.size())?total:ring.size();
+  hdr.total = total;
+  fwrite(&hdr, sizeof(hdr), 1, file);
+  fwrite(defs.data(), sizeof(EventLogDef), defs.size(), file);
+
+  // oldest record first
+  if(total >= ring.size())
+    fwrite(&ring[pos], sizeof(EventLogRecord), ring.size() - pos, file);
+  fwrite(ring.data(), sizeof(EventLogRecord), pos, file);
+  fclose(file);
+
+  printf("%llu events logged, last %u written to %s\n", (unsigned long long)total,
+	 hdr.records, name.c_str());
+}
@@ -0,0 +1,107 @@
+/*
+  eventlog.h
+
+  Binary event recorder for the verilator testbenches. Printing every
+  bus cycle makes a simulation I/O bound while the log is usually only
+  needed around a failure. Events are thus stored as fixed size
+  records in a ring buffer which keeps the most recent ones and is
+  written to a file when the simulation ends, also when it ends via
+  exit(). The file is rendered as text or CSV by the evdump tool:
+
+    $ make -C .. evdump
+    $ ../common/evdump ram_tb.evl
+    $ ../common/evdump -c -f rom,ram -t 10:20 ram_tb.evl > log.csv
+
+  Each event type belongs to a category and has a printf style format
+  taking up to three unsigned 32 bit arguments. Nothing is recorded
+  unless categories are selected by plusargs:
+
+    +log=<cat>,<cat>|all|off    categories to record, default off
+    +log_size=<n>               ring buffer size in events, default 1M
+    +log_file=<name>            output file, default <name>.evl
+
+    static EventLog elog("ram_tb");
+    static const int ev_rom = elog.define("rom", "CPU ROM read at 0x%08x = 0x%04x");
+    ...
+    elog.setup();
+    ...
+    elog.now = <time in ps>;
+    elog.log(ev_rom, addr, data);
+*/
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// file layout: header, event definitions, records oldest first
+struct EventLogHeader {
+  char magic[8];          // "EVLOG01"
+  uint32_t defs;          // number of EventLogDef entries
+  uint32_t records;       // number of EventLogRecord entries
+  uint64_t total;         // events logged, more than records if the ring wrapped
+};
+
+struct EventLogDef {
+  char category[16];
+  char format[112];
+};
+
+struct EventLogRecord {
+  uint64_t time;          // ps
+  uint32_t id;
+  uint32_t arg[3];
+};
+
+#define EVENTLOG_MAGIC  "EVLOG01"
+
+class EventLog {
+public:
+  EventLog(const char *name);
+  ~EventLog() { write(); }
+
+  enum { MAX_EVENTS = 64 };
+
+  // register an event type, returns its id for log()
+  int define(const char *category, const char *format);
+
+  // parse plusargs and allocate the ring buffer, false if logging is off
+  bool setup(void);
+
+  // current simulation time in ps, set by the testbench
+  uint64_t now;
+
+  void log(int id, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+    if(!enabled[id]) return;
+    EventLogRecord &r = ring[pos];
+    r.time = now;
+    r.id = id;
+    r.arg[0] = a;
+    r.arg[1] = b;
+    r.arg[2] = c;
+    if(++pos == ring.size()) pos = 0;
+    total++;
+  }
+
+  // true if events of this type are recorded at all
+  bool on(int id) const { return enabled[id]; }
+
+  // true between a successful setup() and write()
+  bool recording(void) const { return active; }
+
+  // write the buffer, done automatically at the end of the simulation
+  void write(void);
+
+private:
+  std::string name;
+  std::vector<EventLogDef> defs;
+  std::vector<EventLogRecord> ring;
+  bool enabled[MAX_EVENTS];
+  size_t pos;
+  uint64_t total;
+  bool active;
+};
+
+#endif // EVENTLOG_H
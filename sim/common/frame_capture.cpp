@@ -0,0 +1,229 @@
+/*
+  frame_capture.cpp
+
+  Multi frame video capture for the verilator testbenches
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "verilated.h"
+#include "frame_capture.h"
+
+FrameCapture::FrameCapture(const char *name) : name(name) {
+  state = OFF;
+  width = height = 0;
+  seen = 0;
+  frames = 1;
+  fps_num = 50;
+  fps_den = 1;
+  skip = captured = 0;
+  last_hs = last_vs = 1;
+  line_w = lines = 0;
+  line_start = 0;
+  finish = false;
+  y4m = NULL;
+  y4m_w = y4m_h = 0;
+}
+
+// value of +<name>=<value>, NULL if not given
+static const char *plusarg(const char *name) {
+  const char *arg = Verilated::commandArgsPlusMatch(name);
+  if(!arg[0]) return NULL;
+  return arg + 1 + strlen(name);
+}
+
+bool FrameCapture::setup(int fps_num, int fps_den) {
+  const char *arg;
+  this->fps_num = fps_num;
+  this->fps_den = fps_den;
+
+  format = (arg = plusarg("capture="))?arg:"png";
+  if(format == "off") return false;
+  if(format != "png" && format != "y4m") {
+    printf("Unknown capture format %s\n", format.c_str());
+    exit(-1);
+  }
+
+  if((arg = plusarg("capture_file="))) name = arg;
+  if((arg = plusarg("frames=")))       frames = atoi(arg);
+  if((arg = plusarg("skip=")))         skip = atoi(arg);
+  if(frames < 1 || skip < 0) {
+    printf("Need at least one frame to capture and no negative skip\n");
+    exit(-1);
+  }
+
+  if(format == "y4m") {
+    std::string file = name + ".y4m";
+    y4m = fopen(file.c_str(), "wb");
+    if(!y4m) { perror(file.c_str()); exit(-1); }
+  }
+
+  printf("Capturing %d frame%s as %s\n", frames, (frames == 1)?"":"s", format.c_str());
+
+  state = WAITING;
+  thread = std::thread(&FrameCapture::encoder, this);
+  return true;
+}
+
+void FrameCapture::line_done(void) {
+  if(state != CAPTURING) return;
+
+  int w = (cur.size() - line_start) / 3;
+  if(!w) return;
+
+  // all lines of a frame have the width of the first one
+  if(!lines) line_w = w;
+  cur.resize(line_start + 3*line_w, 0);
+
+  lines++;
+  line_start = cur.size();
+}
+
+void FrameCapture::frame_done(void) {
+  if(state == WAITING) {
+    // the first vsync starts the first complete frame
+    state = CAPTURING;
+  } else if(state == CAPTURING) {
+    line_done();
+
+    if(lines) {
+      width = line_w;
+      height = lines;
+      seen++;
+
+      if(skip)
+	skip--;
+      else {
+	std::lock_guard<std::mutex> guard(lock);
+	queue.push_back(Frame { line_w, lines, std::move(cur) });
+	cond.notify_one();
+
+	if(++captured == frames) state = DONE;
+      }
+    }
+  }
+
+  cur.clear();
+  cur.reserve(3*width*height);
+  line_start = 0;
+  lines = 0;
+}
+
+void FrameCapture::close(void) {
+  if(state == OFF) return;
+
+  if(state != DONE)
+    printf("Captured %d of %d frames\n", captured, frames);
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    finish = true;
+    cond.notify_one();
+  }
+  thread.join();
+
+  if(y4m) { fclose(y4m); y4m = NULL; }
+  state = OFF;
+}
+
+void FrameCapture::encoder(void) {
+  int index = 0;
+
+  for(;;) {
+    Frame f;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      cond.wait(guard, [this] { return finish || !queue.empty(); });
+      if(queue.empty()) return;
+      f = std::move(queue.front());
+      queue.pop_front();
+    }
+
+    if(format == "png") write_png(f, index);
+    else                write_y4m(f);
+    index++;
+  }
+}
+
+static void png_chunk(FILE *file, const char *type, const uint8_t *data, uint32_t len) {
+  uint8_t hdr[8] = { (uint8_t)(len>>24), (uint8_t)(len>>16), (uint8_t)(len>>8), (uint8_t)len,
+		     (uint8_t)type[0], (uint8_t)type[1], (uint8_t)type[2], (uint8_t)type[3] };
+  uLong crc = crc32(0, hdr+4, 4);
+  if(len) crc = crc32(crc, data, len);
+  uint8_t tail[4] = { (uint8_t)(crc>>24), (uint8_t)(crc>>16), (uint8_t)(crc>>8), (uint8_t)crc };
+
+  fwrite(hdr, 1, 8, file);
+  if(len) fwrite(data, 1, len, file);
+  fwrite(tail, 1, 4, file);
+}
+
+void FrameCapture::write_png(const Frame &f, int index) {
+  char file[256];
+  snprintf(file, sizeof(file), "%s_%04d.png", name.c_str(), index);
+
+  // every row is prefixed by filter type 0
+  std::vector<uint8_t> raw((3*f.w + 1) * f.h);
+  for(int y=0;y<f.h;y++) {
+    raw[(3*f.w + 1)*y] = 0;
+    memcpy(&raw[(3*f.w + 1)*y + 1], &f.rgb[3*f.w*y], 3*f.w);
+  }
+
+  uLongf zlen = compressBound(raw.size());
+  std::vector<uint8_t> z(zlen);
+  if(compress2(z.data(), &zlen, raw.data(), raw.size(), Z_BEST_SPEED) != Z_OK) {
+    printf("PNG compression failed\n");
+    return;
+  }
+
+  FILE *out = fopen(file, "wb");
+  if(!out) { perror(file); return; }
+
+  static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  fwrite(sig, 1, 8, out);
+
+  uint8_t ihdr[13] = { (uint8_t)(f.w>>24), (uint8_t)(f.w>>16), (uint8_t)(f.w>>8), (uint8_t)f.w,
+		       (uint8_t)(f.h>>24), (uint8_t)(f.h>>16), (uint8_t)(f.h>>8), (uint8_t)f.h,
+		       8, 2, 0, 0, 0 };   // 8 bit rgb
+  png_chunk(out, "IHDR", ihdr, 13);
+  png_chunk(out, "IDAT", z.data(), zlen);
+  png_chunk(out, "IEND", NULL, 0);
+  fclose(out);
+
+  printf("Frame %d (%dx%d) written to %s\n", index, f.w, f.h, file);
+}
+
+static uint8_t clamp(int v) {
+  return (v < 0)?0:(v > 255)?255:v;
+}
+
+void FrameCapture::write_y4m(const Frame &f) {
+  // the stream has the geometry of its first frame
+  if(!y4m_w) {
+    y4m_w = f.w;
+    y4m_h = f.h;
+    fprintf(y4m, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n", y4m_w, y4m_h, fps_num, fps_den);
+  } else if(f.w != y4m_w || f.h != y4m_h)
+    printf("Frame geometry changed to %dx%d, cropping/padding to %dx%d\n", f.w, f.h, y4m_w, y4m_h);
+
+  // BT.601 full range
+  std::vector<uint8_t> yuv(3*y4m_w*y4m_h, 0);
+  uint8_t *py = yuv.data(), *pu = py + y4m_w*y4m_h, *pv = pu + y4m_w*y4m_h;
+  for(int y=0;y<y4m_h;y++) {
+    for(int x=0;x<y4m_w;x++) {
+      int r = 0, g = 0, b = 0;
+      if(x < f.w && y < f.h) {
+	const uint8_t *p = &f.rgb[3*(f.w*y + x)];
+	r = p[0]; g = p[1]; b = p[2];
+      }
+      int i = y4m_w*y + x;
+      py[i] = clamp(( 77*r + 150*g +  29*b + 128) >> 8);
+      pu[i] = clamp(((-43*r -  85*g + 128*b + 128) >> 8) + 128);
+      pv[i] = clamp(((128*r - 107*g -  21*b + 128) >> 8) + 128);
+    }
+  }
+
+  fputs("FRAME\n", y4m);
+  fwrite(yuv.data(), 1, yuv.size(), y4m);
+}
@@ -0,0 +1,112 @@
+/*
+  frame_capture.h
+
+  Multi frame video capture for the verilator testbenches. The video
+  output of the core is fed pixel by pixel. The frame geometry is taken
+  from the sync signals: a line consists of all pixels while hsync is
+  inactive and a frame of all lines while vsync is inactive. Complete
+  frames are queued to a background thread which writes them as PNG
+  files or as a single Y4M stream, so the simulation only pays for
+  storing the pixels. Controlled by plusargs:
+
+    +capture=png|y4m|off    output format, default png
+    +capture_file=<name>    base name, default video
+    +frames=<n>             number of frames to write, default 1
+    +skip=<n>               frames to skip before capturing
+
+  PNG frames are written as <name>_0000.png, <name>_0001.png, ...,
+  a Y4M stream with the frame rate given to setup() as <name>.y4m.
+  The testbench stops waiting if no frame completes for a while, e.g.
+  because there's no vsync:
+
+    static FrameCapture capture;
+    capture.setup(50);
+    ...
+    capture.pixel(tb->HSYNC_N, tb->VSYNC_N, r, g, b);
+    ...
+    if(capture.done()) ...
+    if(capture.seen hasn't changed for long) ...
+    capture.close();
+*/
+
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class FrameCapture {
+public:
+  FrameCapture(const char *name = "video");
+  ~FrameCapture() { close(); }
+
+  // parse plusargs and start the encoder, false if capturing is off.
+  // The frame rate fps_num/fps_den is stored in Y4M streams
+  bool setup(int fps_num = 50, int fps_den = 1);
+
+  // one pixel of the core's video output
+  void pixel(int hsync_n, int vsync_n, uint8_t r, uint8_t g, uint8_t b) {
+    if(hsync_n != last_hs) {
+      last_hs = hsync_n;
+      if(!hsync_n) line_done();
+    }
+    if(vsync_n != last_vs) {
+      last_vs = vsync_n;
+      if(!vsync_n) frame_done();
+    }
+    if(hsync_n && vsync_n && state == CAPTURING) {
+      cur.push_back(r);
+      cur.push_back(g);
+      cur.push_back(b);
+    }
+  }
+
+  // true once all requested frames have been captured or if capturing is off
+  bool done(void) { return state >= DONE; }
+
+  // wait for the encoder to write all queued frames
+  void close(void);
+
+  int width, height;      // geometry of the last complete frame
+  int seen;               // complete frames incl. skipped ones
+
+private:
+  struct Frame {
+    int w, h;
+    std::vector<uint8_t> rgb;
+  };
+
+  void line_done(void);
+  void frame_done(void);
+  void encoder(void);
+  void write_png(const Frame &f, int index);
+  void write_y4m(const Frame &f);
+
+  enum { WAITING, CAPTURING, DONE, OFF } state;
+  std::string name, format;
+  int frames, skip, captured;
+  int fps_num, fps_den;
+
+  int last_hs, last_vs;
+  int line_w, lines;         // geometry of the frame being captured
+  size_t line_start;         // offset of the current line in cur
+  std::vector<uint8_t> cur;
+
+  // frames handed to the encoder thread
+  std::deque<Frame> queue;
+  std::mutex lock;
+  std::condition_variable cond;
+  std::thread thread;
+  bool finish;
+
+  FILE *y4m;
+  int y4m_w, y4m_h;
+};
+
+#endif // FRAME_CAPTURE_H
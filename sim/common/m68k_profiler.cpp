@@ -0,0 +1,298 @@
+/*
+  m68k_profiler.cpp
+
+  Instruction level profiler for the fx68k CPU
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "verilated.h"
+#include "m68k_profiler.h"
+
+M68kProfiler::M68kProfiler() {
+  enabled = false;
+  name = "profile";
+  interval = 1000;
+
+  last_as = 1;
+  cyc_fc = cyc_rw = 0;
+  cyc_addr = 0;
+  cyc_data = 0;
+
+  cycles = fetches = next_sample = 0;
+  last_pc = 0;
+  last_time = 0;
+
+  // odd addresses never form a pushed return address
+  wr[0] = wr[1] = Write { 1, 0, 0 };
+  pending.valid = false;
+  base = 0;
+}
+
+// value of +<name>=<value>, NULL if not given
+static const char *plusarg(const char *name) {
+  const char *arg = Verilated::commandArgsPlusMatch(name);
+  if(!arg[0]) return NULL;
+  return arg + 1 + strlen(name);
+}
+
+bool M68kProfiler::setup(int argc, char **argv) {
+  // +profile is a prefix of the other options, so the plusarg lookup
+  // may return +profile_interval instead. Look for it in argv itself
+  bool profile = false;
+  for(int i=1;i<argc;i++) {
+    if(!strcmp(argv[i], "+profile"))
+      profile = true;
+    else if(!strncmp(argv[i], "+profile=", 9)) {
+      profile = true;
+      if(argv[i][9]) name = argv[i]+9;
+    }
+  }
+  if(!profile) return false;
+
+  const char *arg;
+  if((arg = plusarg("profile_interval="))) interval = strtoull(arg, NULL, 0);
+  if(!interval) interval = 1000;
+  if((arg = plusarg("symbols=")) && !load_symbols(arg)) exit(-1);
+
+  printf("Profiling the CPU into %s.txt\n", name.c_str());
+  enabled = true;
+  return true;
+}
+
+// parse a hex number with optional $, 0x or A: (vasm) prefix
+static bool parse_hex(std::string s, uint32_t &value) {
+  if(s.compare(0, 2, "A:") == 0 || s.compare(0, 2, "0x") == 0) s = s.substr(2);
+  else if(s[0] == '$') s = s.substr(1);
+  if(s.size() < 4 || s.size() > 8) return false;
+  for(char c : s) if(!isxdigit(c)) return false;
+  value = strtoul(s.c_str(), NULL, 16) & 0xffffff;
+  return true;
+}
+
+static bool is_ident(const std::string &s) {
+  if(s.empty() || !(isalpha(s[0]) || s[0] == '_' || s[0] == '.')) return false;
+  for(char c : s) if(!(isalnum(c) || c == '_' || c == '.' || c == '$')) return false;
+  return true;
+}
+
+bool M68kProfiler::load_symbols(const char *file) {
+  std::ifstream in(file);
+  if(!in) { perror(file); return false; }
+
+  // accepted lines:
+  //   <addr> <name>           vasm "Symbols by value", plain maps
+  //   <name> A:<addr>         vasm "Symbols by name"
+  //   <addr> <type> <name>    nm style
+  //   <name> = <addr>
+  std::string line;
+  while(std::getline(in, line)) {
+    std::istringstream ss(line);
+    std::vector<std::string> t;
+    std::string tok;
+    while(ss >> tok) t.push_back(tok);
+
+    uint32_t addr;
+    if(t.size() == 2 && parse_hex(t[0], addr) && is_ident(t[1]))
+      symbols[addr] = t[1];
+    else if(t.size() == 2 && t[1].compare(0, 2, "A:") == 0 && is_ident(t[0]) && parse_hex(t[1], addr))
+      symbols[addr] = t[0];
+    else if(t.size() == 3 && t[1].size() == 1 && parse_hex(t[0], addr) && is_ident(t[2]))
+      symbols[addr] = t[2];
+    else if(t.size() == 3 && t[1] == "=" && is_ident(t[0]) && parse_hex(t[2], addr))
+      symbols[addr] = t[0];
+  }
+
+  printf("Loaded %zu symbols from %s\n", symbols.size(), file);
+  return true;
+}
+
+std::string M68kProfiler::symbol(uint32_t addr, bool offset) {
+  char str[32];
+  auto it = symbols.upper_bound(addr);
+  if(it == symbols.begin()) {
+    snprintf(str, sizeof(str), "$%06x", addr);
+    return str;
+  }
+  --it;
+  if(!offset || it->first == addr) return it->second;
+  snprintf(str, sizeof(str), "+$%x", addr - it->first);
+  return it->second + str;
+}
+
+void M68kProfiler::bus_cycle(void) {
+  if(cyc_rw && (cyc_fc == 2 || cyc_fc == 6))
+    fetch(cyc_addr);
+  else if(!cyc_rw && (cyc_fc == 1 || cyc_fc == 5)) {
+    wr[0] = wr[1];
+    wr[1] = Write { cyc_addr, cyc_data, fetches };
+
+    // JSR fetches the target before pushing the return address
+    uint32_t ret;
+    if(pending.valid && pushed_return(pending.site, ret)) {
+      call(pending.site, pending.target, ret);
+      pending.valid = false;
+    }
+  }
+}
+
+// the last two writes pushed a return address close to site
+bool M68kProfiler::pushed_return(uint32_t site, uint32_t &ret) {
+  if(wr[0].fetch + 2 < fetches) return false;
+
+  if(wr[1].addr == wr[0].addr + 2)      ret = (wr[0].data<<16) | wr[1].data;
+  else if(wr[0].addr == wr[1].addr + 2) ret = (wr[1].data<<16) | wr[0].data;
+  else return false;
+  ret &= 0xffffff;
+
+  return ret + 8 >= site && ret <= site + 4;
+}
+
+void M68kProfiler::fetch(uint32_t addr) {
+  if(fetches) {
+    hist[last_pc].cycles += cycles - last_time;
+    if(addr != last_pc + 2) jump(last_pc, addr);
+  }
+  hist[addr].fetches++;
+
+  last_pc = addr;
+  last_time = cycles;
+  fetches++;
+  if(pending.valid && fetches > pending.fetch + 2) pending.valid = false;
+
+  if(cycles >= next_sample) {
+    sample();
+    next_sample = cycles + interval;
+  }
+}
+
+void M68kProfiler::jump(uint32_t site, uint32_t target) {
+  pending.valid = false;
+
+  // return to an address on the shadow stack, possibly skipping frames
+  for(int i=stack.size()-1;i>=0 && i>=(int)stack.size()-16;i--) {
+    if(stack[i].ret == target) {
+      stack.resize(i);
+      return;
+    }
+  }
+
+  // BSR pushes the return address before fetching the target
+  uint32_t ret;
+  if(pushed_return(site, ret)) {
+    call(site, target, ret);
+    return;
+  }
+
+  pending.valid = true;
+  pending.site = site;
+  pending.target = target;
+  pending.fetch = fetches;
+}
+
+void M68kProfiler::call(uint32_t site, uint32_t target, uint32_t ret) {
+  if(stack.empty()) base = site;
+  if(stack.size() < 256) stack.push_back(Frame { target, ret });
+  calls[std::make_pair(site, target)]++;
+
+  // the writes are used up
+  wr[0].addr = wr[1].addr = 1;
+}
+
+void M68kProfiler::sample(void) {
+  std::vector<uint32_t> key;
+  if(!stack.empty()) key.push_back(base);
+  for(auto &f : stack) key.push_back(f.target);
+
+  // with symbols all addresses of a function give the same sample,
+  // the leaf is omitted if it's the function called last
+  uint32_t pc = last_pc;
+  auto it = symbols.upper_bound(pc);
+  if(it != symbols.begin()) pc = (--it)->first;
+  if(key.empty() || symbol(key.back(), false) != symbol(pc, false)) key.push_back(pc);
+
+  samples[key]++;
+}
+
+void M68kProfiler::report(void) {
+  if(!enabled) return;
+
+  std::string file = name + ".txt";
+  FILE *out = fopen(file.c_str(), "w");
+  if(!out) { perror(file.c_str()); return; }
+
+  uint64_t total = 0, ncalls = 0;
+  for(auto &h : hist) total += h.second.cycles;
+  for(auto &c : calls) ncalls += c.second;
+  if(!total) total = 1;
+
+  fprintf(out, "68000 profile: %llu clock cycles, %llu instruction fetches, %llu calls\n",
+	  (unsigned long long)cycles, (unsigned long long)fetches, (unsigned long long)ncalls);
+
+  // per symbol
+  std::map<std::string, Entry> per_sym;
+  for(auto &h : hist) {
+    Entry &e = per_sym[symbol(h.first, false)];
+    e.fetches += h.second.fetches;
+    e.cycles += h.second.cycles;
+  }
+  std::vector<std::pair<std::string, Entry>> syms(per_sym.begin(), per_sym.end());
+  std::sort(syms.begin(), syms.end(), [](const std::pair<std::string, Entry> &a,
+					 const std::pair<std::string, Entry> &b) {
+	      return a.second.cycles > b.second.cycles; });
+
+  fprintf(out, "\nTime per symbol:\n%12s %7s %10s  %s\n", "cycles", "%", "fetches", "symbol");
+  for(auto &s : syms)
+    fprintf(out, "%12llu %6.2f%% %10llu  %s\n", (unsigned long long)s.second.cycles,
+	    100.0 * s.second.cycles / total, (unsigned long long)s.second.fetches, s.first.c_str());
+
+  // hottest fetch addresses
+  std::vector<std::pair<uint32_t, Entry>> addrs(hist.begin(), hist.end());
+  std::sort(addrs.begin(), addrs.end(), [](const std::pair<uint32_t, Entry> &a,
+					   const std::pair<uint32_t, Entry> &b) {
+	      return a.second.cycles > b.second.cycles; });
+  if(addrs.size() > 50) addrs.resize(50);
+
+  fprintf(out, "\nHottest fetch addresses:\n%8s %12s %7s %10s  %s\n", "address", "cycles", "%", "fetches", "symbol");
+  for(auto &a : addrs)
+    fprintf(out, "  %06x %12llu %6.2f%% %10llu  %s\n", a.first, (unsigned long long)a.second.cycles,
+	    100.0 * a.second.cycles / total, (unsigned long long)a.second.fetches,
+	    symbol(a.first, true).c_str());
+
+  // calls by caller and callee
+  std::map<std::pair<std::string,std::string>, uint64_t> per_call;
+  for(auto &c : calls)
+    per_call[std::make_pair(symbol(c.first.first, true), symbol(c.first.second, false))] += c.second;
+
+  fprintf(out, "\nCalls:\n%10s  %s\n", "count", "caller -> callee");
+  for(auto &c : per_call)
+    fprintf(out, "%10llu  %s -> %s\n", (unsigned long long)c.second,
+	    c.first.first.c_str(), c.first.second.c_str());
+  fclose(out);
+
+  // call graph samples for flamegraph.pl
+  std::map<std::string, uint64_t> folded;
+  for(auto &s : samples) {
+    std::string stack;
+    for(size_t i=0;i<s.first.size();i++) {
+      if(i) stack += ";";
+      stack += symbol(s.first[i], false);
+    }
+    folded[stack] += s.second;
+  }
+
+  file = name + ".folded";
+  out = fopen(file.c_str(), "w");
+  if(!out) { perror(file.c_str()); return; }
+  for(auto &f : folded)
+    fprintf(out, "%s %llu\n", f.first.c_str(), (unsigned long long)f.second);
+  fclose(out);
+
+  printf("CPU profile written to %s.txt and %s.folded\n", name.c_str(), name.c_str());
+}
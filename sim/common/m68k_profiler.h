@@ -0,0 +1,118 @@
+/*
+  m68k_profiler.h
+
+  Instruction level profiler for the fx68k CPU. It only watches the
+  CPU bus: program space reads (function code 2 or 6) are instruction
+  fetches, the clock cycles between two fetches are accounted to the
+  address of the first one. As the 68000 prefetches two words ahead,
+  the histogram shows the cost of an instruction a few bytes after
+  it, which doesn't matter once it's summed up per symbol.
+
+  Calls are detected by a non sequential fetch together with two word
+  writes pushing a return address near the jumping instruction
+  (JSR/BSR), returns by a jump to an address on the resulting shadow
+  call stack. Exceptions aren't tracked, their handlers show up as part
+  of the interrupted function in the call graph.
+
+  Controlled by plusargs:
+
+    +profile[=<name>]          enable, write <name>.txt and <name>.folded,
+                               default name is profile
+    +symbols=<file>            vasm listing (-L) or symbol map of the code
+    +profile_interval=<n>      clock cycles between call graph samples,
+                               default 1000
+
+  The .txt report lists the time spent per symbol and address and the
+  detected calls, the .folded file holds the call graph samples in the
+  format used by flamegraph.pl.
+
+    static M68kProfiler prof;
+    prof.setup(argc, argv);
+    ...
+    tb->eval();
+    if(clk) prof.tick(tb);
+    ...
+    prof.report();
+*/
+
+#ifndef M68K_PROFILER_H
+#define M68K_PROFILER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+class M68kProfiler {
+public:
+  M68kProfiler();
+
+  // parse plusargs and load symbols, false if profiling is off
+  bool setup(int argc, char **argv);
+
+  // load symbols from a vasm listing or "<addr> <name>" map
+  bool load_symbols(const char *name);
+
+  // to be called on every rising cpu clock edge
+  template<class T> void tick(T *tb) {
+    if(enabled)
+      clk(tb->AS_N, tb->RW, (tb->FC2<<2)|(tb->FC1<<1)|tb->FC0, tb->A, tb->DIN);
+  }
+
+  void clk(int as_n, int rw, int fc, uint32_t addr, uint16_t dout) {
+    cycles++;
+    if(!as_n) {
+      if(last_as) { cyc_addr = addr & 0xffffff; cyc_fc = fc; cyc_rw = rw; }
+      if(!rw) cyc_data = dout;
+    } else if(!last_as)
+      bus_cycle();
+    last_as = as_n;
+  }
+
+  // write the report files
+  void report(void);
+
+private:
+  void bus_cycle(void);
+  void fetch(uint32_t addr);
+  void jump(uint32_t site, uint32_t target);
+  bool pushed_return(uint32_t site, uint32_t &ret);
+  void call(uint32_t site, uint32_t target, uint32_t ret);
+  void sample(void);
+  std::string symbol(uint32_t addr, bool offset);
+
+  bool enabled;
+  std::string name;
+  uint64_t interval;
+
+  // current bus cycle
+  int last_as, cyc_fc, cyc_rw;
+  uint32_t cyc_addr;
+  uint16_t cyc_data;
+
+  uint64_t cycles, fetches, next_sample;
+  uint32_t last_pc;
+  uint64_t last_time;
+
+  struct Entry { uint64_t fetches, cycles; };
+  std::unordered_map<uint32_t, Entry> hist;
+
+  // the last two data writes, a call pushes the return address with them
+  struct Write { uint32_t addr; uint16_t data; uint64_t fetch; } wr[2];
+
+  // jump not yet identified as call, the 68000 may push after fetching the target
+  struct { bool valid; uint32_t site, target; uint64_t fetch; } pending;
+
+  // shadow call stack, base is the caller of its first entry
+  struct Frame { uint32_t target, ret; };
+  std::vector<Frame> stack;
+  uint32_t base;
+
+  std::map<std::pair<uint32_t,uint32_t>, uint64_t> calls;   // (site, target)
+  std::map<std::vector<uint32_t>, uint64_t> samples;        // call targets + pc
+
+  std::map<uint32_t, std::string> symbols;
+};
+
+#endif // M68K_PROFILER_H
@@ -0,0 +1,204 @@
+#!/bin/sh
+#
+# regress.sh [-u] [-s] [-j <jobs>] [<scenario pattern> ...]
+#
+# Builds every testbench named in regress/scenarios once without
+# tracing and runs the scenarios listed there in parallel, each in a
+# directory of its own below regress/run. The output files of each
+# scenario are hashed and compared with regress/golden, scenarios
+# without outputs are recorded as "<name> - exit0". Scenarios
+# whose inputs (e.g. a TOS image) are missing are skipped. Inputs the
+# testbench's Makefile knows how to make (e.g. sd.img) are made first.
+# The run fails if a scenario fails, has no golden hashes yet or was
+# skipped.
+#
+#   -u   update mode: write the hashes of all scenarios that ran
+#        successfully to the golden file instead of comparing
+#   -s   don't fail because of skipped scenarios
+#   -j   number of parallel runs, default is the number of cpus
+#
+# Patterns are shell globs selecting scenarios by name, e.g. "video_*".
+# REGRESS_TIMEOUT limits the run time of a scenario in seconds.
+#
+
+SIM=$(cd "$(dirname "$0")/.." && pwd)
+LIST=${REGRESS_LIST:-$SIM/regress/scenarios}
+GOLDEN=${REGRESS_GOLDEN:-$SIM/regress/golden}
+RUN=$SIM/regress/run
+
+# executable and inputs of a testbench
+tb_exe() {
+  awk -v d="$1" '$1 == "testbench" && $2 == d { print $3 }' "$LIST"
+}
+tb_inputs() {
+  awk -v d="$1" '$1 == "testbench" && $2 == d { for(i = 4; i <= NF; i++) print $i }' "$LIST"
+}
+
+# first input of a testbench which doesn't exist
+tb_missing() {
+  for f in $(tb_inputs "$1"); do
+    [ -e "$SIM/$1/$f" ] || { echo "$f"; return; }
+  done
+}
+
+# --- run a single scenario, called in parallel by xargs ---
+if [ "$1" = "--one" ]; then
+  set -f
+  set -- $2
+  name=$2 dir=$3 outputs=$4
+  shift 4
+
+  set +f
+
+  wd=$RUN/$name
+  rm -rf "$wd"
+  mkdir -p "$wd"
+
+  missing=$(tb_missing "$dir")
+  if [ -n "$missing" ]; then
+    echo "skipped: $dir/$missing missing" > "$wd/result"
+    exit 0
+  fi
+  if [ -f "$RUN/build-$dir.failed" ]; then
+    echo "failed: build of $dir" > "$wd/result"
+    exit 0
+  fi
+
+  # the sd card models keep writes in memory, so linking is safe
+  for f in $(tb_inputs "$dir"); do
+    ln -s "$SIM/$dir/$f" "$wd/$(basename "$f")"
+  done
+  exe=$(tb_exe "$dir")
+
+  start=$(date +%s)
+  ( cd "$wd" && timeout "${REGRESS_TIMEOUT:-3600}" "$SIM/$dir/$exe" "$@" > log 2>&1 )
+  status=$?
+  secs=$(( $(date +%s) - start ))
+
+  if [ $status -ne 0 ]; then
+    echo "failed: exit status $status after ${secs}s, see $wd/log" > "$wd/result"
+    exit 0
+  fi
+
+  : > "$wd/hashes"
+  if [ "$outputs" = "-" ]; then
+    # nothing to hash, record the successful exit so -u has an entry
+    echo "$name - exit0" > "$wd/hashes"
+  else
+    for f in $(echo "$outputs" | tr ',' ' '); do
+      if [ ! -f "$wd/$f" ]; then
+	echo "failed: no $f written, see $wd/log" > "$wd/result"
+	exit 0
+      fi
+      echo "$name $f $(sha256sum < "$wd/$f" | cut -d' ' -f1)" >> "$wd/hashes"
+    done
+  fi
+  echo "ok: ${secs}s" > "$wd/result"
+  exit 0
+fi
+
+# --- driver ---
+UPDATE=0
+ALLOW_SKIP=0
+JOBS=$(nproc)
+while getopts usj: opt; do
+  case $opt in
+    u) UPDATE=1 ;;
+    s) ALLOW_SKIP=1 ;;
+    j) JOBS=$OPTARG ;;
+    *) sed -n '3,22s/^# \{0,1\}//p' "$0"; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+mkdir -p "$RUN"
+rm -f "$RUN"/build-*.failed "$RUN/selected"
+
+# the IKBD ROM is loaded from ../../src relative to the working directory
+ln -sfn ../../src "$SIM/regress/src"
+
+# select the scenarios
+grep '^scenario ' "$LIST" | while read -r kw name rest; do
+  if [ $# -eq 0 ]; then
+    echo "$kw $name $rest"
+  else
+    for pat in "$@"; do
+      case $name in $pat) echo "$kw $name $rest"; break ;; esac
+    done
+  fi
+done > "$RUN/selected"
+
+if [ ! -s "$RUN/selected" ]; then
+  echo "No scenarios selected"
+  exit 1
+fi
+
+# build every testbench needed once
+for dir in $(awk '{ print $3 }' "$RUN/selected" | sort -u); do
+  for f in $(tb_inputs "$dir"); do
+    [ -e "$SIM/$dir/$f" ] || make -C "$SIM/$dir" "$f" > "$RUN/input-$dir.log" 2>&1
+  done
+  [ -n "$(tb_missing "$dir")" ] && continue
+  echo "Building $dir"
+  if ! make -C "$SIM/$dir" TRACE=0 > "$RUN/build-$dir.log" 2>&1; then
+    echo "  failed, see $RUN/build-$dir.log"
+    touch "$RUN/build-$dir.failed"
+  fi
+done
+
+echo "Running $(wc -l < "$RUN/selected") scenarios, $JOBS in parallel"
+xargs -P "$JOBS" -I{} sh "$0" --one "{}" < "$RUN/selected"
+
+# compare with the golden hashes
+pass=0 fail=0 new=0 skip=0
+: > "$RUN/hashes"
+for name in $(awk '{ print $2 }' "$RUN/selected"); do
+  wd=$RUN/$name
+  result=$(cat "$wd/result" 2>/dev/null || echo "failed: no result")
+
+  case $result in
+    ok*)
+      cat "$wd/hashes" >> "$RUN/hashes"
+      grep "^$name " "$GOLDEN" 2>/dev/null | sort > "$wd/golden"
+      sort "$wd/hashes" > "$wd/hashes.sorted"
+      if [ $UPDATE = 1 ]; then
+	status=updated
+	pass=$((pass + 1))
+      elif [ ! -s "$wd/golden" ]; then
+	status="new (no golden hashes)"
+	new=$((new + 1))
+      elif cmp -s "$wd/golden" "$wd/hashes.sorted"; then
+	status=pass
+	pass=$((pass + 1))
+      else
+	status="FAIL: $(diff "$wd/golden" "$wd/hashes.sorted" | awk '/^[<>]/ { print $3 }' | sort -u | tr '\n' ' ')differ"
+	fail=$((fail + 1))
+      fi
+      ;;
+    skipped*)
+      status=$result
+      skip=$((skip + 1))
+      ;;
+    *)
+      status="FAIL: ${result#failed: }"
+      fail=$((fail + 1))
+      ;;
+  esac
+  printf "%-24s %s\n" "$name" "$status"
+done
+
+if [ $UPDATE = 1 ]; then
+  # keep the entries of scenarios which didn't run successfully
+  grep -v '^#' "$GOLDEN" 2>/dev/null | while read -r name rest; do
+    grep -q "^$name " "$RUN/hashes" || echo "$name $rest"
+  done > "$RUN/golden.keep"
+  ( sed -n '/^#/p' "$GOLDEN" 2>/dev/null
+    sort "$RUN/golden.keep" "$RUN/hashes" ) > "$RUN/golden.new"
+  mv "$RUN/golden.new" "$GOLDEN"
+  echo "$pass scenarios written to $GOLDEN"
+fi
+
+echo "$pass passed, $fail failed, $new new, $skip skipped"
+
+# nothing compared is no pass
+[ $fail -eq 0 ] && [ $new -eq 0 ] && { [ $skip -eq 0 ] || [ $ALLOW_SKIP = 1 ] || [ $UPDATE = 1 ]; }
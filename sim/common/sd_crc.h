@@ -0,0 +1,77 @@
+/*
+  sd_crc.h
+
+  Table driven CRCs for the SD card models.
+
+  In 4 bit mode every data line carries its own CRC16. Instead of
+  splitting the data into four bit streams, all four CRCs are kept
+  bit-sliced in one 64 bit word: nibble n holds bit n of the CRCs of
+  DAT3..DAT0. A sector byte carries two consecutive nibbles, so the
+  four CRCs are advanced by one byte with a single 256 entry table
+  lookup.
+
+  A nice side effect of this layout is that the 64 bit word in big
+  endian byte order is exactly the 8 byte CRC trailer as it's being
+  sent over the four data lines after the 512 data bytes.
+*/
+
+#ifndef SD_CRC_H
+#define SD_CRC_H
+
+#include <stdint.h>
+
+struct SdCrcTables {
+  uint8_t  crc7[256];
+  uint64_t crc16x4[256];
+
+  constexpr SdCrcTables() : crc7(), crc16x4() {
+    for(int i=0;i<256;i++) {
+      // x^7 + x^3 + 1, result in bits 7..1
+      uint8_t c = i;
+      for(int b=0;b<8;b++) c = (c & 0x80)?((c << 1) ^ 0x12):(c << 1);
+      crc7[i] = c;
+
+      // x^16 + x^12 + x^5 + 1 on four lanes, two bits per lane
+      uint64_t s = (uint64_t)i << 56;
+      for(int b=0;b<2;b++) {
+	uint64_t fb = s >> 60;
+	s = (s << 4) ^ fb ^ (fb << 20) ^ (fb << 48);
+      }
+      crc16x4[i] = s;
+    }
+  }
+};
+
+static constexpr SdCrcTables sd_crc_tables;
+
+// CRC7 over command/response bytes, returned in bits 7..1 as sent on the wire
+static inline uint8_t sd_crc7(const uint8_t *data, int len, uint8_t crc = 0) {
+  while(len--) crc = sd_crc_tables.crc7[crc ^ *data++];
+  return crc;
+}
+
+// four lane CRC16 over nibble interleaved data, high nibble first
+static inline uint64_t sd_crc16x4(const uint8_t *data, int len, uint64_t crc = 0) {
+  while(len--) crc = (crc << 8) ^ sd_crc_tables.crc16x4[(crc >> 56) ^ *data++];
+  return crc;
+}
+
+// write/read the 8 byte crc trailer following the data
+static inline void sd_crc16x4_store(uint64_t crc, uint8_t *dst) {
+  for(int i=0;i<8;i++) dst[i] = crc >> (56-8*i);
+}
+
+static inline uint64_t sd_crc16x4_load(const uint8_t *src) {
+  uint64_t crc = 0;
+  for(int i=0;i<8;i++) crc = (crc << 8) | src[i];
+  return crc;
+}
+
+// extract the CRC16 of a single data line (0 = DAT0)
+static inline uint16_t sd_crc16x4_lane(uint64_t crc, int lane) {
+  uint16_t c = 0;
+  for(int i=15;i>=0;i--) c = (c << 1) | ((crc >> (4*i + lane)) & 1);
+  return c;
+}
+
+#endif // SD_CRC_H
@@ -0,0 +1,150 @@
+/*
+  sd_image.cpp
+
+  Memory mapped SD card image with copy-on-write overlay
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sd_image.h"
+
+const uint8_t SdImage::zero[512] = { 0 };
+
+SdImage::SdImage(const char *name) {
+  this->name = name;
+  verbose = 1;
+  sidecar = NULL;
+  fd = sidecar_fd = -1;
+  base = NULL;
+  map_len = 0;
+  sectors = 0;
+  sidecar_map = NULL;
+  sidecar_len = 0;
+  overlay = NULL;
+  dirty_map = NULL;
+}
+
+SdImage::~SdImage() {
+  if(sidecar_map) munmap(sidecar_map, sidecar_len);
+  if(base && base != zero) munmap(base, map_len);
+  if(sidecar_fd >= 0) close(sidecar_fd);
+  if(fd >= 0) close(fd);
+  free(sidecar);
+}
+
+void SdImage::use_sidecar(const char *name) {
+  if(base) { printf("SdImage: sidecar must be set before first access\n"); return; }
+
+  free(sidecar);
+  if(name)
+    sidecar = strdup(name);
+  else if(asprintf(&sidecar, "%s.cow", this->name) < 0)
+    sidecar = NULL;
+}
+
+void SdImage::open(void) {
+  struct stat st;
+
+  fd = ::open(name, O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) < 0) { perror("OPEN ERROR"); exit(-1); }
+  if(verbose) printf("Image size is %lld\n", (long long)st.st_size);
+
+  // the mapping of the last page reads as zeros beyond the end of file
+  sectors = (st.st_size + 511) / 512;
+  if(st.st_size % 512)
+    printf("SdImage: %s ends with a partial sector, padded with zeros\n", name);
+  map_len = 512ull*sectors;
+  if(!map_len) {
+    // nothing to map, every read returns zeros
+    base = (uint8_t*)zero;
+    return;
+  }
+
+  if(!sidecar) {
+    // the kernel does the copy-on-write for us
+    base = (uint8_t*)mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    if(base == MAP_FAILED) { perror("mmap()"); exit(-1); }
+
+    mem_dirty_map.assign((sectors + 63) / 64, 0);
+    dirty_map = mem_dirty_map.data();
+    return;
+  }
+
+  base = (uint8_t*)mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+  if(base == MAP_FAILED) { perror("mmap()"); exit(-1); }
+
+  // sidecar: page aligned dirty bitmap followed by sparse sector data
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t map_bytes = ((sectors + 63) / 64) * 8;
+  size_t hdr_len = (map_bytes + page - 1) & ~(page - 1);
+  sidecar_len = hdr_len + map_len;
+
+  sidecar_fd = ::open(sidecar, O_RDWR | O_CREAT, 0644);
+  if(sidecar_fd < 0 || fstat(sidecar_fd, &st) < 0) { perror("sidecar"); exit(-1); }
+
+  if((size_t)st.st_size != sidecar_len) {
+    // missing or belonging to another image: start from scratch
+    if(ftruncate(sidecar_fd, 0) < 0 || ftruncate(sidecar_fd, sidecar_len) < 0) {
+      perror("ftruncate()");
+      exit(-1);
+    }
+  }
+
+  sidecar_map = (uint8_t*)mmap(NULL, sidecar_len, PROT_READ | PROT_WRITE,
+			       MAP_SHARED, sidecar_fd, 0);
+  if(sidecar_map == MAP_FAILED) { perror("mmap()"); exit(-1); }
+
+  dirty_map = (uint64_t*)sidecar_map;
+  overlay = sidecar_map + hdr_len;
+
+  // pick up sectors written in an earlier run
+  for(unsigned long w=0;w<(sectors + 63) / 64;w++)
+    for(uint64_t bits = dirty_map[w]; bits; bits &= bits - 1)
+      dirty_list.push_back(64*w + __builtin_ctzll(bits));
+
+  if(!dirty_list.empty())
+    printf("Sidecar %s holds %lu modified sectors\n", sidecar, (unsigned long)dirty_list.size());
+}
+
+void SdImage::write(unsigned long sector, const uint8_t *data) {
+  if(!base) open();
+  if(sector >= sectors) {
+    printf("SdImage: write to sector %lu beyond end of image\n", sector);
+    return;
+  }
+
+  if(!is_dirty(sector)) {
+    dirty_map[sector >> 6] |= 1ull << (sector & 63);
+    dirty_list.push_back(sector);
+  }
+
+  memcpy((sidecar_map?overlay:base) + 512ull*sector, data, 512);
+}
+
+void SdImage::reset(void) {
+  if(!base || base == zero) return;
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  for(unsigned long sector : dirty_list) {
+    dirty_map[sector >> 6] &= ~(1ull << (sector & 63));
+
+    if(!sidecar_map) {
+      // map the pristine page over the private copy
+      size_t ofs = (512ull*sector) & ~(page - 1);
+      size_t len = (map_len - ofs < page)?(map_len - ofs):page;
+      if(mmap(base + ofs, len, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, fd, ofs) == MAP_FAILED) {
+	perror("mmap()");
+	exit(-1);
+      }
+    }
+  }
+  dirty_list.clear();
+}
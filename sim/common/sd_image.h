@@ -0,0 +1,79 @@
+/*
+  sd_image.h
+
+  Memory mapped SD card image for the simulated SD cards.
+
+  The image file itself is never modified. Written sectors go into
+  a copy-on-write overlay which is either kept in memory or, for
+  long write heavy runs on big images, in a sparse sidecar file:
+
+    image.img       pristine card image, mapped read only
+    image.img.cow   bitmap of dirty sectors followed by sector data
+
+  A sidecar file left over from an earlier run is picked up again
+  so consecutive runs can build on each others writes. reset()
+  drops all writes in O(number of dirty sectors). A partial sector at
+  the end of the image file is padded with zeros.
+*/
+
+#ifndef SD_IMAGE_H
+#define SD_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class SdImage {
+public:
+  SdImage(const char *name);
+  ~SdImage();
+
+  // keep the overlay in a sidecar file instead of memory. Must be
+  // set before the first access. NULL uses "<name>.cow".
+  void use_sidecar(const char *name = NULL);
+
+  // 0 = silent, 1 = print the image size when opening
+  int verbose;
+
+  // pointer to the 512 bytes of a sector, all zero beyond the end
+  const uint8_t *read(unsigned long sector) {
+    if(!base) open();
+    if(sector >= sectors) return zero;
+    if(sidecar_map && is_dirty(sector)) return overlay + 512ull*sector;
+    return base + 512ull*sector;
+  }
+
+  void write(unsigned long sector, const uint8_t *data);
+
+  // forget all writes
+  void reset(void);
+
+  unsigned long size(void) { if(!base) open(); return sectors; }
+  size_t dirty(void) { return dirty_list.size(); }
+
+private:
+  void open(void);
+  bool is_dirty(unsigned long sector) {
+    return (dirty_map[sector >> 6] >> (sector & 63)) & 1;
+  }
+
+  const char *name;
+  char *sidecar;
+  int fd, sidecar_fd;
+
+  uint8_t *base;            // image, MAP_PRIVATE in memory mode
+  size_t map_len;
+  unsigned long sectors;
+
+  uint8_t *sidecar_map;     // whole sidecar file if used
+  size_t sidecar_len;
+  uint8_t *overlay;         // sector data within sidecar
+
+  uint64_t *dirty_map;
+  std::vector<uint64_t> mem_dirty_map;
+  std::vector<unsigned long> dirty_list;
+
+  static const uint8_t zero[512];
+};
+
+#endif // SD_IMAGE_H
@@ -0,0 +1,349 @@
+/*
+  sdcard.cpp
+
+  SD card model shared by the verilator testbenches. Implements the
+  commands issued by sd_rw.v: CMD0/2/3/6/7/8/16/17/24/41/55 and the
+  multi block transfers CMD12/18/23/25
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdcard.h"
+#include "sd_crc.h"
+
+#define OCR  0xc0ff8000  // not busy, CCS=1(SDHC card), all voltage, not dual-voltage card
+#define RCA  0x0013
+
+#define WR_ACK_TOKEN  0b00101000  // start bit 0, ack ok 010, stopbit 1, busy 000
+#define WR_CRC_TOKEN  0b01011000  // start bit 0, crc error 101, stopbit 1, busy 000
+
+// total cid respose is 136 bits / 17 bytes
+static const unsigned char cid[17] = "\x3f" "\x02TMS" "A08G" "\x14\x39\x4a\x67" "\xc7\x00\xe4";
+
+// events shown if verbose or recorded if an event log is attached
+enum { EV_CMD, EV_BUS_WIDTH, EV_BLOCK_LEN, EV_READ_SINGLE, EV_READ_MULTI,
+       EV_WRITE_SINGLE, EV_WRITE_MULTI, EV_READ_START, EV_COUNT };
+
+static const char *event_format[EV_COUNT] = {
+  "%cCMD %2u, ARG %08x",
+  "Set bus width to %u",
+  "Set block len to %u",
+  "Request to read single block %u",
+  "Request to read multiple block %u",
+  "Request to write single block %u",
+  "Request to write multiple block %u",
+  "READ-4 START %u"
+};
+
+SdCardModel::SdCardModel(const char *image) : image(image) {
+  verbose = 1;
+  log = NULL;
+  ev_base = 0;
+  write_cb = NULL;
+  cmd_cb = NULL;
+  crc_errors = 0;
+  blocks_read = blocks_written = 0;
+
+  // write postamble (ack + busy) as used before multi block support
+  read_latency = 0;
+  read_gap = 2;
+  ack_delay = 68;
+  write_busy = 111;
+  stop_busy = 16;
+
+  last_sdclk = -1;
+  last_was_acmd = 0;
+  cmd_in = ~0ull;
+  resp_bits = resp_pos = 0;
+  rd_data = NULL;
+  rd_pos = -1;
+  rd_wait = 0;
+  rd_sector = 0;
+  rd_multi = false;
+  rd_stopped = false;
+  wr_state = WR_IDLE;
+  wr_pos = 0;
+  wr_token = WR_ACK_TOKEN;
+  wr_sector = 0;
+  wr_multi = false;
+  block_count = blocks_left = 0;
+}
+
+SdCardModel::~SdCardModel() {
+}
+
+void SdCardModel::attach(EventLog &log) {
+  this->log = &log;
+  ev_base = log.define("sd", event_format[0]);
+  for(int i=1;i<EV_COUNT;i++) log.define("sd", event_format[i]);
+}
+
+void SdCardModel::event(int ev, uint32_t a, uint32_t b, uint32_t c) {
+  if(log && log->recording())
+    log->log(ev_base + ev, a, b, c);
+  else if(verbose) {
+    printf(event_format[ev], a, b, c);
+    printf("\n");
+  }
+}
+
+// prepare a 48 bit response with crc7
+void SdCardModel::reply(int cmd, unsigned long arg) {
+  resp[0] = cmd & 0x3f;
+  resp[1] = arg >> 24;
+  resp[2] = arg >> 16;
+  resp[3] = arg >> 8;
+  resp[4] = arg;
+  resp[5] = sd_crc7(resp, 5) | 1;
+  resp_bits = 48;
+  resp_pos = 0;
+}
+
+void SdCardModel::read_sector(unsigned long sector) {
+  rd_sector = sector;
+  rd_data = image.read(sector);
+
+  uint64_t crc = sd_crc16x4(rd_data, 512);
+  sd_crc16x4_store(crc, rd_crc);
+  if(verbose)
+    printf("CRC = %04x/%04x/%04x/%04x\n",
+	   sd_crc16x4_lane(crc, 0), sd_crc16x4_lane(crc, 1),
+	   sd_crc16x4_lane(crc, 2), sd_crc16x4_lane(crc, 3));
+  rd_pos = 0;
+}
+
+// a full sector incl. crc has been received from the host
+void SdCardModel::write_done(void) {
+  uint64_t crc = sd_crc16x4(rbuf, 512);
+  uint64_t s_crc = sd_crc16x4_load(rbuf+512);
+
+  if(crc != s_crc) {
+    // a real card rejects the block
+    crc_errors++;
+    printf("WR CRC mismatch on sector %lu: %016llx != %016llx\n",
+	   wr_sector, (unsigned long long)crc, (unsigned long long)s_crc);
+    wr_token = WR_CRC_TOKEN;
+    return;
+  }
+
+  wr_token = WR_ACK_TOKEN;
+  image.write(wr_sector, rbuf);
+  blocks_written++;
+  if(write_cb) write_cb(wr_sector, rbuf);
+}
+
+// CMD12: end a multi block transfer
+void SdCardModel::stop(void) {
+  if(rd_pos >= 0) {
+    // reading stops right away, the lines are released on the next clock
+    rd_pos = -1;
+    rd_stopped = true;
+  } else if(wr_multi && wr_state == WR_START) {
+    // card is busy programming the last block
+    wr_state = WR_BUSY;
+    wr_pos = write_busy - stop_busy;
+  } else if(wr_multi && wr_state == WR_DATA) {
+    printf("CMD12 during block transfer\n");
+    wr_state = WR_IDLE;
+  }
+
+  rd_multi = wr_multi = false;
+}
+
+void SdCardModel::command(int cmd, unsigned long arg) {
+  // r1 reply:
+  // bit 7 - 0
+  // bit 6 - parameter error
+  // bit 5 - address error
+  // bit 4 - erase sequence error
+  // bit 3 - com crc error
+  // bit 2 - illegal command
+  // bit 1 - erase reset
+  // bit 0 - in idle state
+
+  event(EV_CMD, last_was_acmd?'A':' ', cmd, arg);
+  if(cmd_cb) cmd_cb(cmd, arg);
+
+  switch(cmd) {
+  case 0:  // Go Idle State
+    break;
+  case 8:  // Send Interface Condition Command
+    reply(8, arg);
+    break;
+  case 55: // Application Specific Command
+    reply(55, 0);
+    break;
+  case 41: // Send Host Capacity Support
+    reply(63, OCR);
+    break;
+  case 2:  // Send CID
+    memcpy(resp, cid, 16);
+    resp[16] = sd_crc7(resp, 16) | 1;  // Adjust CRC
+    resp_bits = 136;
+    resp_pos = 0;
+    break;
+  case 3:  // Send Relative Address
+    reply(3, (RCA<<16) | 0);  // status = 0
+    break;
+  case 7:  // select card
+    reply(7, 0);    // may indicate busy
+    break;
+  case 6:  // set bus width
+    event(EV_BUS_WIDTH, arg);
+    reply(6, 0);
+    break;
+  case 12: // stop transmission
+    reply(12, 0);
+    stop();
+    break;
+  case 16: // set block len (should be 512)
+    event(EV_BLOCK_LEN, arg);
+    reply(16, 0);    // ok
+    break;
+  case 23: // set block count, as ACMD23 only a pre-erase hint
+    if(!last_was_acmd) block_count = arg & 0xffff;
+    reply(23, 0);
+    break;
+  case 17:  // read block
+  case 18:  // read multiple blocks
+    event((cmd == 17)?EV_READ_SINGLE:EV_READ_MULTI, arg);
+    reply(cmd, 0);    // ok
+    rd_multi = (cmd == 18);
+    blocks_left = rd_multi?block_count:0;
+    block_count = 0;
+    read_sector(arg);
+    rd_wait = read_latency;
+    break;
+  case 24:  // write block
+  case 25:  // write multiple blocks
+    event((cmd == 24)?EV_WRITE_SINGLE:EV_WRITE_MULTI, arg);
+    reply(cmd, 0);    // ok
+    wr_multi = (cmd == 25);
+    blocks_left = wr_multi?block_count:0;
+    block_count = 0;
+    wr_sector = arg;
+    wr_state = WR_START;
+    break;
+  default:
+    printf("unexpected command\n");
+  }
+
+  last_was_acmd = (cmd == 55);
+}
+
+// rising sd card clock edge
+void SdCardModel::clk(int sdcmd, int sddat, unsigned char &sdcmd_in, unsigned char &sddat_in) {
+  // ------------------- data lines -------------------
+  switch(wr_state) {
+  case WR_IDLE:
+    break;
+
+  case WR_START:
+    // wait for start bit on dat0
+    if(!(sddat & 1)) {
+      wr_state = WR_DATA;
+      wr_pos = 0;
+    }
+    break;
+
+  case WR_DATA:
+    // 1024 * 4 bit + 4 * 16 bit crc, high nibble first
+    if(!(wr_pos & 1)) rbuf[wr_pos>>1] = sddat << 4;
+    else              rbuf[wr_pos>>1] |= sddat & 15;
+    if(++wr_pos == 2*520) {
+      write_done();
+      wr_state = WR_ACK;
+      wr_pos = 0;
+    }
+    break;
+
+  case WR_ACK:
+    // crc status token on dat0, its last three bits already signal busy
+    if(wr_pos < ack_delay) sddat_in = 15;
+    else                   sddat_in = (wr_token >> (7+ack_delay-wr_pos)) & 1;
+
+    if(++wr_pos == ack_delay+8) {
+      wr_state = WR_BUSY;
+      wr_pos = 0;
+    }
+    break;
+
+  case WR_BUSY:
+    // busy on dat0, then release the lines
+    if(wr_pos < write_busy) {
+      sddat_in = 0;
+      wr_pos++;
+      break;
+    }
+
+    sddat_in = 15;
+    wr_state = WR_IDLE;
+    if(wr_multi) {
+      if(wr_token == WR_ACK_TOKEN) wr_sector++;
+      if(!blocks_left || --blocks_left) wr_state = WR_START;
+      else                              wr_multi = false;
+    }
+    break;
+  }
+
+  if(rd_stopped) {
+    sddat_in = 15;
+    rd_stopped = false;
+  }
+
+  // sending 4 bits: start bit, 1024 data nibbles + 16 crc nibbles, end bit
+  if(rd_pos >= 0) {
+    if(rd_wait) {
+      rd_wait--;
+    } else {
+      if(rd_pos == 0) {
+	sddat_in = 0;
+	event(EV_READ_START, rd_sector);
+      } else if(rd_pos <= 2*520) {
+	int ofs = (rd_pos-1)>>1;
+	uint8_t byte = (ofs < 512)?rd_data[ofs]:rd_crc[ofs-512];
+	sddat_in = (rd_pos & 1)?(byte >> 4):(byte & 15);
+      } else
+	sddat_in = 15;
+
+      if(++rd_pos > 2*520+1) {
+	blocks_read++;
+	rd_pos = -1;
+	if(rd_multi) {
+	  if(!blocks_left || --blocks_left) {
+	    read_sector(rd_sector + 1);
+	    rd_wait = read_gap;
+	  } else
+	    rd_multi = false;
+	}
+      }
+    }
+  }
+
+  // ------------------- command line -------------------
+  cmd_in = ((cmd_in << 1) | sdcmd) & 0xffffffffffffull;
+
+  if(resp_pos < resp_bits) {
+    sdcmd_in = (resp[resp_pos>>3] >> (7-(resp_pos&7))) & 1;
+    resp_pos++;
+  } else
+    sdcmd_in = 1;
+
+  // check if bit 47 is 0, 46 is 1 and 0 is 1
+  if((cmd_in & 0xc00000000001ull) == 0x400000000001ull) {
+    unsigned char c[5];
+    for(int i=0;i<5;i++) c[i] = cmd_in >> (40-8*i);
+    unsigned char crc7 = cmd_in & 0xfe;
+
+    int cmd = c[0] & 0x3f;
+    unsigned long arg = (cmd_in >> 8) & 0xffffffff;
+
+    if(crc7 == sd_crc7(c, 5))
+      command(cmd, arg);
+    else
+      printf("CMD %02x, ARG %08lx, CRC7 %02x != %02x!!\n", c[0], arg, crc7, sd_crc7(c, 5));
+
+    cmd_in = ~0ull;
+  }
+}
@@ -0,0 +1,120 @@
+/*
+  sdcard.h
+
+  C++ model of a SD card in 4 bit mode as seen by sd_rw.v. Single
+  (CMD17/CMD24) and multi block (CMD18/CMD25, ended by CMD12 or a
+  preceding CMD23 block count) transfers are supported. The model
+  can be attached to any verilated top which exposes the usual sdclk,
+  sdcmd, sdcmd_in, sddat and sddat_in signals:
+
+    SdCardModel sd("sd.img");
+    sd.image.use_sidecar();    // optional, keep writes in sd.img.cow
+    ...
+    tb->eval();
+    sd.tick(tb);
+
+  Commands are printed if verbose is set. With an EventLog attached
+  they are recorded in its "sd" category instead, if the log is
+  switched on by e.g. +log=sd:
+
+    sd.attach(elog);
+
+  All state is kept per instance. The work is only done on the rising
+  sd clock edge, all other calls return after a single compare.
+*/
+
+#ifndef SDCARD_H
+#define SDCARD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sd_image.h"
+#include "eventlog.h"
+
+class SdCardModel {
+public:
+  SdCardModel(const char *image);
+  ~SdCardModel();
+
+  // card contents, written sectors end up in its overlay
+  SdImage image;
+
+  // 0 = silent, 1 = print commands, 2 = also dump sector data
+  int verbose;
+
+  // record commands in the event log instead of printing them
+  void attach(EventLog &log);
+
+  // called with the contents of every completely received sector
+  void (*write_cb)(unsigned long sector, const unsigned char *data);
+
+  // called for every command received, e.g. to trigger tracing
+  void (*cmd_cb)(int cmd, unsigned long arg);
+
+  // number of written sectors whose crc didn't match
+  int crc_errors;
+
+  // transfer statistics
+  unsigned long blocks_read, blocks_written;
+
+  // timing in sd clocks, may be changed at any time
+  int read_latency;     // end of read command to first start bit (Nac)
+  int read_gap;         // end bit to next start bit in CMD18
+  int ack_delay;        // end of written block to crc status token
+  int write_busy;       // busy after each written block
+  int stop_busy;        // busy after CMD12 ending a write
+
+  // attach to a verilated top
+  template<class T> void tick(T *tb) {
+    tick(tb->sdclk, tb->sdcmd, tb->sddat, tb->sdcmd_in, tb->sddat_in);
+  }
+
+  void tick(int sdclk, int sdcmd, int sddat,
+	    unsigned char &sdcmd_in, unsigned char &sddat_in) {
+    if(sdclk == last_sdclk) return;
+    last_sdclk = sdclk;
+    if(sdclk) clk(sdcmd, sddat, sdcmd_in, sddat_in);
+  }
+
+private:
+  void clk(int sdcmd, int sddat, unsigned char &sdcmd_in, unsigned char &sddat_in);
+  void command(int cmd, unsigned long arg);
+  void reply(int cmd, unsigned long arg);
+  void read_sector(unsigned long sector);
+  void stop(void);
+  void write_done(void);
+  void event(int ev, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0);
+
+  EventLog *log;
+  int ev_base;
+
+  int last_sdclk;
+  int last_was_acmd;
+
+  // command line: bits received from the host and response bits sent back
+  uint64_t cmd_in;
+  unsigned char resp[17];
+  int resp_bits, resp_pos;
+
+  // data lines
+  const uint8_t *rd_data;           // sector being sent, directly from the image
+  uint8_t rd_crc[8];                // four 16 bit crcs
+  int rd_pos;                       // nibble position of read transfer, -1 = idle
+  int rd_wait;                      // clocks to wait before next start bit
+  unsigned long rd_sector;
+  bool rd_multi;
+  bool rd_stopped;                  // CMD12 ended the read, release the lines
+
+  enum { WR_IDLE, WR_START, WR_DATA, WR_ACK, WR_BUSY } wr_state;
+  int wr_pos;
+  int wr_token;
+  unsigned long wr_sector;
+  bool wr_multi;
+
+  unsigned long block_count;        // set by CMD23 for the next transfer
+  unsigned long blocks_left;        // of current multi block transfer, 0 = until CMD12
+  unsigned char rbuf[520];
+};
+
+#endif // SDCARD_H
@@ -0,0 +1,173 @@
+/*
+  sdl_view.cpp
+
+  Live SDL2 display for the verilator testbenches
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <SDL.h>
+
+#include "sdl_view.h"
+
+SdlView::SdlView(const char *title, int scale) : title(title), scale(scale) {
+  frames = dropped = 0;
+  frame[0].w = frame[0].h = frame[1].w = frame[1].h = 0;
+  back = 0;
+  front = 1;
+  full = false;
+  x = y = 0;
+  last_hs = last_vs = 1;
+  head = tail = 0;
+  quit = sim_done = false;
+}
+
+void SdlView::frame_done(void) {
+  if(y) {
+    frame[back].h = (y < MAX_H)?y:MAX_H;
+    frames++;
+
+    // hand the frame over if the display has taken the previous one,
+    // otherwise drop it and draw the next one into the same buffer
+    if(!full.load(std::memory_order_acquire)) {
+      front.store(back, std::memory_order_relaxed);
+      back ^= 1;
+      full.store(true, std::memory_order_release);
+    } else
+      dropped++;
+  }
+  frame[back].w = 0;
+  y = 0;
+}
+
+void SdlView::push(const Event &ev) {
+  unsigned h = head.load(std::memory_order_relaxed);
+  if(h - tail.load(std::memory_order_acquire) >= QUEUE) return;  // full, drop event
+  queue[h % QUEUE] = ev;
+  head.store(h + 1, std::memory_order_release);
+}
+
+bool SdlView::input(Event &ev) {
+  unsigned t = tail.load(std::memory_order_relaxed);
+  if(t == head.load(std::memory_order_acquire)) return false;
+  ev = queue[t % QUEUE];
+  tail.store(t + 1, std::memory_order_release);
+  return true;
+}
+
+void SdlView::run(void (*sim)(void)) {
+  std::thread thread([this, sim] { sim(); sim_done = true; });
+  display();
+  quit = true;
+  thread.join();
+  printf("SDL: %lu frames, %lu not displayed\n", frames, dropped);
+}
+
+void SdlView::display(void) {
+  if(SDL_Init(SDL_INIT_VIDEO) < 0) {
+    printf("SDL_Init() failed: %s\n", SDL_GetError());
+    return;
+  }
+
+  SDL_Window *win = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+				     scale*416, scale*280, SDL_WINDOW_RESIZABLE);
+  SDL_Renderer *ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
+  SDL_Texture *tex = NULL;
+  int tex_w = 0, tex_h = 0;
+  bool stopped = false;
+  uint8_t buttons = 0;
+
+  while(!quit) {
+    SDL_Event ev;
+    while(SDL_PollEvent(&ev)) {
+      Event e = { };
+      switch(ev.type) {
+      case SDL_QUIT:
+	quit = true;
+	break;
+
+      case SDL_KEYDOWN:
+      case SDL_KEYUP:
+	// F11 releases a grabbed mouse
+	if(ev.key.keysym.scancode == SDL_SCANCODE_F11) {
+	  SDL_SetRelativeMouseMode(SDL_FALSE);
+	  break;
+	}
+	// SDL scancodes are the USB HID usage codes
+	if(ev.key.repeat || ev.key.keysym.scancode > 0xff) break;
+	e.type = Event::KEY;
+	e.code = ev.key.keysym.scancode;
+	e.pressed = (ev.type == SDL_KEYDOWN);
+	push(e);
+	break;
+
+      case SDL_MOUSEBUTTONDOWN:
+      case SDL_MOUSEBUTTONUP:
+	// the first click into the window grabs the mouse
+	if(!SDL_GetRelativeMouseMode()) {
+	  if(ev.type == SDL_MOUSEBUTTONDOWN) SDL_SetRelativeMouseMode(SDL_TRUE);
+	  break;
+	}
+	if(ev.button.button == SDL_BUTTON_LEFT || ev.button.button == SDL_BUTTON_RIGHT) {
+	  uint8_t bit = (ev.button.button == SDL_BUTTON_LEFT)?1:2;
+	  if(ev.type == SDL_MOUSEBUTTONDOWN) buttons |= bit;
+	  else                               buttons &= ~bit;
+	  e.type = Event::MOUSE;
+	  e.buttons = buttons;
+	  push(e);
+	}
+	break;
+
+      case SDL_MOUSEMOTION:
+	if(!SDL_GetRelativeMouseMode()) break;
+	e.type = Event::MOUSE;
+	e.buttons = buttons;
+	e.dx = (ev.motion.xrel < -127)?-127:(ev.motion.xrel > 127)?127:ev.motion.xrel;
+	e.dy = (ev.motion.yrel < -127)?-127:(ev.motion.yrel > 127)?127:ev.motion.yrel;
+	push(e);
+	break;
+      }
+    }
+
+    if(full.load(std::memory_order_acquire)) {
+      const Frame &f = frame[front.load(std::memory_order_relaxed)];
+
+      if(f.w != tex_w || f.h != tex_h) {
+	if(tex) SDL_DestroyTexture(tex);
+	tex_w = f.w; tex_h = f.h;
+	tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, tex_w, tex_h);
+	SDL_RenderSetLogicalSize(ren, tex_w, tex_h);
+      }
+
+      void *pixels;
+      int pitch;
+      if(tex && !SDL_LockTexture(tex, NULL, &pixels, &pitch)) {
+	for(int row=0;row<tex_h;row++)
+	  memcpy((uint8_t*)pixels + row*pitch, f.pix + MAX_W*row, 4*tex_w);
+	SDL_UnlockTexture(tex);
+      }
+
+      // the simulation may now reuse this buffer
+      full.store(false, std::memory_order_release);
+
+      SDL_RenderClear(ren);
+      if(tex) SDL_RenderCopy(ren, tex, NULL, NULL);
+      SDL_RenderPresent(ren);
+    } else
+      SDL_Delay(5);
+
+    // keep the last frame visible after the simulation has ended
+    if(sim_done && !stopped) {
+      std::string t = std::string(title) + " (stopped)";
+      SDL_SetWindowTitle(win, t.c_str());
+      stopped = true;
+    }
+  }
+
+  if(tex) SDL_DestroyTexture(tex);
+  SDL_DestroyRenderer(ren);
+  SDL_DestroyWindow(win);
+  SDL_Quit();
+}
@@ -0,0 +1,104 @@
+/*
+  sdl_view.h
+
+  Live SDL2 display for the verilator testbenches. The simulation runs
+  on its own thread and feeds the video output of the core pixel by
+  pixel. Completed frames are handed to the display thread through a
+  lock-free double buffer, so a slow display only drops frames and
+  never stalls the simulation. Keyboard and mouse events of the window
+  are queued the other way round, keys as USB HID usage codes.
+
+    static SdlView view("atarist_tb");
+    ...
+    // simulation thread, once per pixel
+    view.pixel(tb->hsync_n, tb->vsync_n, r, g, b);
+    SdlView::Event ev;
+    while(view.input(ev)) ...;
+    ...
+    // main thread
+    view.run(simulate);
+
+  Only built with "make SDL=1" which defines SDL_VIEW.
+*/
+
+#ifndef SDL_VIEW_H
+#define SDL_VIEW_H
+
+#include <stdint.h>
+#include <atomic>
+
+class SdlView {
+public:
+  SdlView(const char *title, int scale = 2);
+
+  struct Event {
+    enum { KEY, MOUSE } type;
+    uint8_t code;          // KEY: USB HID usage, e.g. 0x04 = 'a'
+    bool pressed;          // KEY: pressed or released
+    uint8_t buttons;       // MOUSE: bit 0 = left, bit 1 = right
+    int8_t dx, dy;         // MOUSE: relative movement
+  };
+
+  // simulation thread: one pixel of the core's video output. A new
+  // line starts at the end of hsync, a new frame at the start of vsync
+  void pixel(int hsync_n, int vsync_n, uint8_t r, uint8_t g, uint8_t b) {
+    if(hsync_n != last_hs) {
+      last_hs = hsync_n;
+      if(hsync_n) { if(x) y++; x = 0; }
+    }
+    if(vsync_n != last_vs) {
+      last_vs = vsync_n;
+      if(!vsync_n) frame_done();
+    }
+    if(x < MAX_W && y < MAX_H) {
+      frame[back].pix[MAX_W*y + x] = (r<<16) | (g<<8) | b;
+      if(x >= frame[back].w) frame[back].w = x+1;
+    }
+    x++;
+  }
+
+  // simulation thread: next queued input event, false if none
+  bool input(Event &ev);
+
+  // simulation thread: true once the window has been closed
+  bool closed(void) { return quit.load(std::memory_order_relaxed); }
+
+  // run sim() on a thread of its own and the display on the calling
+  // one. Returns once the simulation has finished and the window has
+  // been closed
+  void run(void (*sim)(void));
+
+  unsigned long frames, dropped;
+
+private:
+  enum { MAX_W = 1024, MAX_H = 640, QUEUE = 256 };
+
+  struct Frame {
+    int w, h;
+    uint32_t pix[MAX_W*MAX_H];
+  };
+
+  void frame_done(void);
+  void push(const Event &ev);
+  void display(void);
+
+  const char *title;
+  int scale;
+
+  // double buffer: the simulation draws into frame[back], the display
+  // owns frame[front] while full is set
+  Frame frame[2];
+  int back;
+  std::atomic<int> front;
+  std::atomic<bool> full;
+
+  int x, y, last_hs, last_vs;
+
+  // single producer/single consumer event queue
+  Event queue[QUEUE];
+  std::atomic<unsigned> head, tail;
+
+  std::atomic<bool> quit, sim_done;
+};
+
+#endif // SDL_VIEW_H
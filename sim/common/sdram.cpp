@@ -0,0 +1,218 @@
+/*
+  sdram.cpp
+
+  Cycle accurate C++ model of the Tang Nano 20k SDRAM
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "sdram.h"
+
+SdramModel::SdramModel(size_t size) {
+  this->size = size;
+  mem = (uint8_t*)calloc(1, size);
+  if(!mem) { perror("SdramModel"); exit(-1); }
+  verbose = 1;
+
+  clk_mhz = 32;
+  cas_latency = 2;
+  t_rcd = 1;          // 15ns
+  t_rc = 2;           // 60ns
+  t_rp = 1;           // 15ns
+  t_rfc = 2;          // 60ns
+  t_wr = 1;           // 2 clocks incl. the write itself
+  refresh_rows = 4096;
+  refresh_ms = 64;
+  poison = false;
+  access_bytes = 2;
+
+  source = 0;
+  for(int i=0;i<MAX_SOURCES;i++) names[i] = NULL;
+  names[0] = "all";
+
+  memset(&st, 0, sizeof(st));
+  for(int b=0;b<4;b++) st.bank[b].last_row = -1;
+}
+
+SdramModel::~SdramModel() {
+  free(mem);
+}
+
+bool SdramModel::load(const char *name, size_t offset) {
+  FILE *file = fopen(name, "rb");
+  if(!file) { perror(name); return false; }
+  size_t len = (offset < size)?fread(mem + offset, 1, size - offset, file):0;
+  fclose(file);
+  printf("Loaded %zu bytes from %s into SDRAM at $%06zx\n", len, name, offset);
+  return true;
+}
+
+void SdramModel::violation(const char *fmt, ...) {
+  st.violations++;
+  if(!verbose || st.violations > 20) return;
+
+  va_list args;
+  va_start(args, fmt);
+  printf("SDRAM @%.3fus: ", st.clk / clk_mhz);
+  vprintf(fmt, args);
+  printf("\n");
+  va_end(args);
+
+  if(st.violations == 20) printf("SDRAM: further violations not shown\n");
+}
+
+void SdramModel::clk(int cs, int ras, int cas, int we, int ba, int addr, int dqm,
+		     uint32_t din, uint32_t &dout) {
+  st.clk++;
+
+  // drive read data once the cas latency has passed
+  bool driven = false;
+  for(int i=0;i<MAX_READS;i++) {
+    if(st.rd[i].valid && st.rd[i].due == st.clk) {
+      dout = st.rd[i].data;
+      st.rd[i].valid = false;
+      driven = true;
+    }
+  }
+  if(!driven && poison) dout = 0xdeadbeef;
+
+  // command on the bus, chip select is active low
+  int cmd = cs?0xf:((ras?4:0) | (cas?2:0) | (we?1:0));
+  ba &= 3;
+
+  switch(cmd) {
+  case 0x3: {    // ACTIVE
+    int row = addr & 0x7ff;
+    if(st.bank[ba].open)
+      violation("ACTIVE on bank %d with row %d still open", ba, st.bank[ba].row);
+    else if(st.bank[ba].activated && st.clk - st.bank[ba].activated < (uint64_t)t_rc)
+      violation("ACTIVE on bank %d violates tRC", ba);
+    else if(st.clk < st.bank[ba].closed + t_rp)
+      violation("ACTIVE on bank %d violates tRP", ba);
+    if(st.refreshes && st.clk < st.last_refresh + t_rfc)
+      violation("ACTIVE violates tRFC");
+
+    // would the access hit the same row with an open page policy?
+    if(st.bank[ba].last_row == row) st.row_same++;
+    else                            st.row_other++;
+
+    st.bank[ba].open = true;
+    st.bank[ba].row = st.bank[ba].last_row = row;
+    st.bank[ba].activated = st.clk;
+    st.busy_until = st.clk + t_rcd;
+    break;
+  }
+
+  case 0x5:      // READ
+  case 0x4: {    // WRITE
+    bool write = (cmd == 0x4);
+    if(!st.bank[ba].open) {
+      violation("%s on closed bank %d", write?"WRITE":"READ", ba);
+      break;
+    }
+    if(st.clk < st.bank[ba].activated + t_rcd)
+      violation("%s on bank %d violates tRCD", write?"WRITE":"READ", ba);
+
+    size_t a = ((size_t)ba<<21) + (st.bank[ba].row<<10) + ((addr & 0xff)<<2);
+    int src = (source >= 0 && source < MAX_SOURCES)?source:0;
+
+    if(a + 4 <= size) {
+      if(write) {
+	if(verbose > 1) printf("SDRAM WRITE %06zx = %08x/%x\n", a, din, dqm);
+	if(!(dqm & 1)) mem[a+3] = (din >>  0) & 0xff;
+	if(!(dqm & 2)) mem[a+2] = (din >>  8) & 0xff;
+	if(!(dqm & 4)) mem[a+1] = (din >> 16) & 0xff;
+	if(!(dqm & 8)) mem[a+0] = (din >> 24) & 0xff;
+	st.writes[src]++;
+      } else {
+	uint32_t data = (mem[a+0]<<24)+(mem[a+1]<<16)+(mem[a+2]<<8)+(mem[a+3]<<0);
+	if(verbose > 1) printf("SDRAM READ %06zx = %08x\n", a, data);
+	int i;
+	for(i=0;i<MAX_READS && st.rd[i].valid;i++);
+	if(i == MAX_READS)
+	  violation("READ dropped, %d reads already in flight", MAX_READS);
+	else {
+	  st.rd[i].valid = true;
+	  st.rd[i].due = st.clk + cas_latency;
+	  st.rd[i].data = data;
+	}
+	st.reads[src]++;
+      }
+    }
+
+    // A10 = auto precharge
+    if(addr & 0x400) {
+      st.bank[ba].open = false;
+      st.bank[ba].closed = st.clk + (write?t_wr:0);
+    }
+    st.busy_until = st.clk + (write?t_wr:cas_latency);
+    break;
+  }
+
+  case 0x2:      // PRECHARGE, A10 = all banks
+    for(int b=0;b<4;b++) {
+      if((addr & 0x400) || b == ba) {
+	st.bank[b].open = false;
+	st.bank[b].closed = st.clk;
+      }
+    }
+    break;
+
+  case 0x1: {    // AUTO REFRESH
+    for(int b=0;b<4;b++)
+      if(st.bank[b].open) violation("AUTO REFRESH with bank %d open", b);
+
+    // the refresh_rows'th refresh before this one must not be older
+    // than refresh_ms
+    uint64_t window = refresh_ms * 1000 * clk_mhz;
+    int n = (refresh_rows < 8192)?refresh_rows:8192;
+    uint64_t &oldest = st.refresh_log[st.refresh_pos % n];
+    if(st.refreshes >= (unsigned long)n && st.clk - oldest > window) st.refresh_late++;
+    oldest = st.clk;
+    st.refresh_pos++;
+
+    if(st.refreshes && st.clk - st.last_refresh > st.refresh_gap_max)
+      st.refresh_gap_max = st.clk - st.last_refresh;
+    st.last_refresh = st.clk;
+    st.refreshes++;
+    st.busy_until = st.clk + t_rfc - 1;
+    break;
+  }
+
+  default:       // NOP, INHIBIT, LOAD MODE, BURST TERMINATE
+    if(st.clk > st.busy_until) st.idle++;
+    break;
+  }
+}
+
+void SdramModel::report(FILE *out) {
+  if(!st.clk) return;
+
+  double us = st.clk / clk_mhz;
+  fprintf(out, "SDRAM: %llu clocks (%.3f ms), %.1f%% busy\n", (unsigned long long)st.clk,
+	  us / 1000, 100.0 * (st.clk - st.idle) / st.clk);
+
+  fprintf(out, "  %-10s %10s %10s %8s\n", "source", "reads", "writes", "MB/s");
+  for(int i=0;i<MAX_SOURCES;i++) {
+    if(!st.reads[i] && !st.writes[i]) continue;
+    char name[16];
+    if(names[i]) snprintf(name, sizeof(name), "%s", names[i]);
+    else         snprintf(name, sizeof(name), "source %d", i);
+    fprintf(out, "  %-10s %10lu %10lu %8.2f\n", name, st.reads[i], st.writes[i],
+	    (st.reads[i] + st.writes[i]) * access_bytes / us);
+  }
+
+  unsigned long rows = st.row_same + st.row_other;
+  if(rows)
+    fprintf(out, "  rows: %lu activations, %.1f%% same row as previous access to bank\n",
+	    rows, 100.0 * st.row_same / rows);
+
+  fprintf(out, "  refresh: %lu, max gap %.2f us, %lu late\n", st.refreshes,
+	  st.refresh_gap_max / clk_mhz, st.refresh_late);
+  if(st.refreshes && us - st.last_refresh / clk_mhz > 1000 * refresh_ms)
+    fprintf(out, "  refresh: none within the last %.0f ms\n", refresh_ms);
+
+  fprintf(out, "  protocol violations: %lu\n", st.violations);
+}
@@ -0,0 +1,128 @@
+/*
+  sdram.h
+
+  Cycle accurate C++ model of the 8MB SDRAM of the Tang Nano 20k as
+  driven by sdram.v: four banks of 2048 rows with 256 columns each and
+  a 32 bit data bus with byte masks. It can be attached to any
+  verilated top exposing the sd_* signals of sdram.v:
+
+    static SdramModel sdram;
+    ...
+    tb->eval();
+    sdram.tick(tb);
+    ...
+    sdram.report();
+
+  Commands are taken on the rising clock edge. Read data appears on
+  sd_data_in after the CAS latency and only for one clock, so a
+  controller sampling at the wrong time reads garbage if poison is
+  set. The state of each bank is tracked and protocol violations
+  (access to a closed bank, activating an open bank, tRCD/tRC/tRP/tRFC
+  and the refresh interval) are counted and reported.
+
+  Instead of logging every access the model collects statistics. The
+  testbench may set source to tell apart requesters like CPU and
+  video, all accesses are then accounted to that source.
+
+  Memory contents are kept in a plain array which the testbench may
+  fill directly, e.g. to preload a RAM image.
+*/
+
+#ifndef SDRAM_H
+#define SDRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+class SdramModel {
+public:
+  SdramModel(size_t size = 8*1024*1024);
+  ~SdramModel();
+
+  // memory contents, big endian as seen from the 32 bit bus
+  uint8_t *mem;
+  size_t size;
+
+  // 0 = silent, 1 = print protocol violations, 2 = also every access
+  int verbose;
+
+  // timing in clocks, the defaults fit sdram.v at 32 MHz. With a read
+  // every clock up to cas_latency reads are in flight, so cas_latency
+  // may not exceed MAX_READS
+  enum { MAX_READS = 4 };
+  double clk_mhz;
+  int cas_latency;
+  int t_rcd, t_rc, t_rp, t_rfc, t_wr;
+
+  // every row needs to be refreshed within refresh_ms, i.e.
+  // refresh_rows auto refreshes are needed in that time
+  int refresh_rows;
+  double refresh_ms;
+
+  // drive 0xdeadbeef on sd_data_in whenever no read data is due
+  bool poison;
+
+  // bytes actually used per access, sdram.v uses 16 of the 32 bits
+  int access_bytes;
+
+  // requester of the following accesses, set by the testbench
+  enum { MAX_SOURCES = 8 };
+  int source;
+  void source_name(int id, const char *name) { if(id >= 0 && id < MAX_SOURCES) names[id] = name; }
+
+  // load a file into memory at the given byte offset
+  bool load(const char *name, size_t offset = 0);
+
+  // print the collected statistics
+  void report(FILE *out = stdout);
+
+  template<class T> void tick(T *tb) {
+    if((int)tb->sd_clk == st.last_clk) return;
+    st.last_clk = tb->sd_clk;
+    if(st.last_clk)
+      clk(tb->sd_cs, tb->sd_ras, tb->sd_cas, tb->sd_we, tb->sd_ba, tb->sd_addr,
+	  tb->sd_dqm, tb->sd_data, tb->sd_data_in);
+  }
+
+  // complete state, e.g. to be saved in a checkpoint together with mem
+  struct State {
+    int last_clk;
+    uint64_t clk;                 // rising clock edges seen
+
+    struct {
+      bool open;
+      int row, last_row;
+      uint64_t activated, closed;
+    } bank[4];
+
+    // read data waiting for the cas latency
+    struct {
+      bool valid;
+      uint64_t due;
+      uint32_t data;
+    } rd[MAX_READS];
+
+    uint64_t busy_until;          // last clock occupied by the current command
+    uint64_t last_refresh;
+    uint64_t refresh_log[8192];   // clocks of the last refresh_rows refreshes
+    unsigned long refresh_pos;
+
+    // statistics
+    unsigned long reads[MAX_SOURCES], writes[MAX_SOURCES];
+    unsigned long row_same, row_other;
+    unsigned long refreshes, refresh_late;
+    uint64_t refresh_gap_max;
+    unsigned long idle;
+    unsigned long violations;
+  } st;
+
+private:
+  void clk(int cs, int ras, int cas, int we, int ba, int addr, int dqm,
+	   uint32_t din, uint32_t &dout);
+  void violation(const char *fmt, ...);
+
+  const char *names[MAX_SOURCES];
+};
+
+#endif // SDRAM_H
@@ -0,0 +1,159 @@
+/*
+  spi_flash.cpp
+
+  C++ model of the Tang Nano 20k SPI flash
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spi_flash.h"
+
+SpiFlashModel::SpiFlashModel(size_t size) {
+  this->size = size;
+  mem = (uint8_t*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED) { perror("SpiFlashModel"); exit(-1); }
+  memset(mem, 0xff, size);
+  verbose = 0;
+
+  dummy_fast = 8;
+  dummy_dio = 0;
+  dummy_qio = 4;
+  data_delay = 1;
+
+  memset(&st, 0, sizeof(st));
+  st.state = -1;
+}
+
+SpiFlashModel::~SpiFlashModel() {
+  munmap(mem, size);
+}
+
+bool SpiFlashModel::load(const char *name, size_t offset) {
+  int fd = open(name, O_RDONLY);
+  if(fd < 0) { perror(name); return false; }
+
+  struct stat sb;
+  fstat(fd, &sb);
+  size_t len = (offset < size)?sb.st_size:0;
+  if(len > size - offset) len = size - offset;
+
+  // the file is mapped privately over the erased flash, so writes by
+  // the testbench never reach it. Only page aligned offsets can be
+  // mapped, others are read the traditional way
+  long page = sysconf(_SC_PAGESIZE);
+  if(len && !(offset % page)) {
+    size_t map_len = (len + page - 1) & ~(page - 1);
+    if(map_len > size - offset) map_len = size - offset;
+    if(mmap(mem + offset, map_len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED) {
+      perror(name);
+      close(fd);
+      return false;
+    }
+    // the rest of the last page reads as zero from the file
+    memset(mem + offset + len, 0xff, map_len - len);
+  } else if(len)
+    len = pread(fd, mem + offset, len, 0);
+
+  close(fd);
+  printf("Loaded %zu bytes from %s into flash at $%06zx\n", len, name, offset);
+  return true;
+}
+
+void SpiFlashModel::report(FILE *out) {
+  fprintf(out, "Flash: %lu reads (%lu continued), %lu bytes", st.reads, st.continued, st.bytes);
+  if(st.unknown) fprintf(out, ", %lu unknown commands", st.unknown);
+  fprintf(out, "\n");
+}
+
+void SpiFlashModel::clk(int cs, int io, unsigned char &dout) {
+  if(cs) { st.state = -1; return; }
+
+  // in continuous read mode the command byte is skipped
+  if(st.state == -1) {
+    st.state = 0;
+    if(st.cont) {
+      st.cmd = st.cont;
+      st.state = 8;
+      st.continued++;
+    }
+  }
+
+  int s = st.state++;
+
+  // command is always sent in single bit spi mode on IO0
+  if(s < 8) {
+    st.cmd = ((st.cmd << 1)|(io & 1)) & 0xff;
+    if(s < 7) return;
+
+    st.width = st.mode_clks = st.dummy_clks = 0;
+    switch(st.cmd) {
+    case 0x03: st.width = 1; break;
+    case 0x0b: st.width = 1; st.dummy_clks = dummy_fast; break;
+    case 0xbb: st.width = 2; st.mode_clks = 4; st.dummy_clks = dummy_dio; break;
+    case 0xeb:
+      if(st.sr2 & 0x02) { st.width = 4; st.mode_clks = 2; st.dummy_clks = dummy_qio; }
+      else {
+	st.unknown++;
+	if(verbose) printf("SPI cmd $eb ignored, QE is not set\n");
+      }
+      break;
+    case 0x06: case 0x50: st.wel = true; break;
+    case 0x31: break;
+    default:
+      st.unknown++;
+      if(verbose) printf("SPI cmd $%02x ignored\n", st.cmd);
+    }
+    st.addr_clks = 24 / (st.width?st.width:1);
+    return;
+  }
+  s -= 8;
+
+  // write status register 2, only the QE bit is used
+  if(st.cmd == 0x31 && s < 8) {
+    st.mode = ((st.mode << 1)|(io & 1)) & 0xff;
+    if(s == 7 && st.wel) {
+      st.sr2 = st.mode;
+      st.wel = false;
+      if(verbose) printf("SPI status register 2 = $%02x\n", st.sr2);
+    }
+  }
+
+  // anything but the supported reads is ignored
+  if(!st.width) return;
+
+  int mask = (1 << st.width) - 1;
+
+  if(s < st.addr_clks) {
+    st.addr = ((st.addr << st.width)|(io & mask)) & 0xffffff;
+    if(s == st.addr_clks-1 && !st.mode_clks) st.mode = 0;
+  } else if(s < st.addr_clks + st.mode_clks)
+    st.mode = ((st.mode << st.width)|(io & mask)) & 0xff;
+
+  // address and mode complete
+  if(s == st.addr_clks + st.mode_clks - 1) {
+    st.reads++;
+    if(verbose) printf("SPI cmd $%02x, addr %06x, M=%02x\n", st.cmd, st.addr, st.mode);
+
+    // M[5:4] = 10 keeps the flash in continuous read mode
+    if(st.mode_clks)
+      st.cont = ((st.mode & 0x30) == 0x20)?st.cmd:0;
+  }
+
+  // return data after the dummy clocks, msb first. Single bit data
+  // comes on IO1 (DO)
+  s -= st.addr_clks + st.mode_clks + st.dummy_clks + data_delay;
+  if(s >= 0) {
+    int per_byte = 8 / st.width;
+    if(!(s % per_byte)) st.bytes++;
+    int byte = mem[(st.addr + s/per_byte) % size];
+    int bits = (byte >> (8 - st.width*(1 + s % per_byte))) & mask;
+    if(st.width == 1) dout = (dout & ~2) | (bits << 1);
+    else              dout = (dout & ~mask) | bits;
+  }
+}
@@ -0,0 +1,108 @@
+/*
+  spi_flash.h
+
+  C++ model of the W25Q64 SPI NOR flash of the Tang Nano 20k. It
+  implements the read commands in single, dual and quad IO mode:
+
+    $03  read                   1-1-1, no dummy clocks
+    $0b  fast read              1-1-1, dummy_fast dummy clocks
+    $bb  fast read dual IO      1-2-2, 4 mode clocks, dummy_dio dummy clocks
+    $eb  fast read quad IO      1-4-4, 2 mode clocks, dummy_qio dummy clocks
+
+  Quad IO needs the QE bit in status register 2 which is cleared
+  initially like on most W25Q64 and set by a write enable ($06 or $50)
+  followed by a write of status register 2 ($31).
+
+  Mode bits M[5:4] = 10 in a dual or quad IO read enable the
+  "continuous read mode": the following read skips the command byte
+  and starts directly with the address. Any other mode bits leave it
+  again, as does the sequence of 1's flash_dspi.v sends after reset.
+  Other commands are ignored.
+
+  The flash contents are kept in an anonymous mapping which load()
+  maps image files into, so even large images are only paged in where
+  they are actually read. The testbench may also write to mem directly.
+
+  The model attaches to a verilated top exposing flash_clk and the
+  mspi_* signals of flash_dspi.v:
+
+    static SpiFlashModel flash;
+    flash.load("tos.img", 0x100000);
+    ...
+    tb->eval();
+    flash.tick(tb);
+
+  Other tops call clk() on every rising edge of the flash clock.
+*/
+
+#ifndef SPI_FLASH_H
+#define SPI_FLASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+class SpiFlashModel {
+public:
+  SpiFlashModel(size_t size = 8*1024*1024);
+  ~SpiFlashModel();
+
+  // flash contents, erased state is 0xff
+  uint8_t *mem;
+  size_t size;
+
+  // 0 = silent, 1 = print every command
+  int verbose;
+
+  // dummy clocks between the address/mode phase and the first data
+  // clock, the defaults are the datasheet values
+  int dummy_fast, dummy_dio, dummy_qio;
+
+  // further clocks until the data is seen by the host. The flash
+  // controllers in src/tangnano20k sample the data one clock after
+  // the flash has driven it
+  int data_delay;
+
+  // map a file into flash at the given byte offset
+  bool load(const char *name, size_t offset = 0);
+
+  // print the collected statistics
+  void report(FILE *out = stdout);
+
+  // one rising edge of the flash clock. io carries the levels of IO0
+  // (DI) to IO3 (HOLD) as driven by the host, the levels driven by the
+  // flash are returned in the same bits of dout
+  void clk(int cs, int io, unsigned char &dout);
+
+  template<class T> void tick(T *tb) {
+    if((int)tb->flash_clk == st.last_clk) return;
+    st.last_clk = tb->flash_clk;
+    if(st.last_clk) clk(tb->mspi_cs, (tb->mspi_di?1:0)|(tb->mspi_do?2:0), tb->mspi_din);
+  }
+
+  // complete state, e.g. to be saved in a checkpoint together with mem
+  struct State {
+    int last_clk;
+    int state;        // clock within current command, -1 = deselected
+    int cont;         // command continued without command byte, 0 = none
+    int cmd, mode;
+    uint32_t addr;
+
+    // status register 2 and write enable latch
+    int sr2;
+    bool wel;
+
+    // bus width of address and data and the clocks of the address,
+    // mode and dummy phases of the current command, width 0 if it's
+    // no read
+    int width, addr_clks, mode_clks, dummy_clks;
+
+    // statistics
+    unsigned long reads;       // read commands incl. continued ones
+    unsigned long continued;   // reads without command byte
+    unsigned long bytes;       // bytes returned
+    unsigned long unknown;     // ignored commands
+  } st;
+};
+
+#endif // SPI_FLASH_H
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# sweep.sh <prj>
+#
+# Builds the testbench in the current directory without tracing for
+# 1, 2, 4 and 8 verilator threads, each with and without hierarchical
+# partitioning (HIER=1, see hier.vlt), and runs its "bench" scenario
+# with every build. The results including the speedup over the single
+# threaded flat build go to sweep.json, the fastest configuration is
+# stored in threads.mk which the Makefile includes for later builds.
+#
+# SWEEP_THREADS and SWEEP_HIER limit the configurations, SWEEP_ARGS
+# is passed to the testbench, e.g. to shorten the run.
+#
+
+PRJ=$1
+THREADS_LIST=${SWEEP_THREADS:-"1 2 4 8"}
+HIER_LIST=${SWEEP_HIER:-"0 1"}
+CPUS=$(nproc)
+
+rm -rf sweep
+mkdir -p sweep
+
+for hier in $HIER_LIST; do
+  for threads in $THREADS_LIST; do
+    cfg=t$threads
+    [ "$hier" = 1 ] && cfg=${cfg}_hier
+
+    # more threads than cpus only measures the scheduler
+    if [ "$threads" -gt "$CPUS" ]; then
+      echo "Skipping $cfg, host has $CPUS cpus"
+      continue
+    fi
+
+    echo "Building and running $cfg"
+    if make TRACE=0 THREADS=$threads HIER=$hier OBJ_DIR=obj_dir_$cfg EXE=${PRJ}_$cfg \
+	 BENCH_OUT=sweep/$cfg.json BENCH_ARGS="$SWEEP_ARGS" bench > sweep/$cfg.build.log 2>&1; then
+      rate=$(sed -n 's/.*"cycles_per_s": \([0-9.]*\).*/\1/p' sweep/$cfg.json)
+      echo "$threads $hier $rate" >> sweep/results
+      echo "  $rate cycles/s"
+    else
+      echo "  failed, see sweep/$cfg.build.log"
+    fi
+  done
+done
+
+if [ ! -s sweep/results ]; then
+  echo "No configuration could be measured"
+  exit 1
+fi
+
+# the first measured configuration (normally 1 thread, flat) is the base
+awk -v prj="$PRJ" -v cpus="$CPUS" '
+  NR == 1 { base = $3 }
+  { t[NR] = $1; h[NR] = $2; r[NR] = $3; if($3 > r[best]) best = NR }
+  END {
+    printf("{ \"testbench\": \"%s\", \"cpus\": %d,\n", prj, cpus)
+    printf("  \"best\": { \"threads\": %d, \"hier\": %s },\n", t[best], h[best] ? "true" : "false")
+    printf("  \"results\": [\n")
+    for(i = 1; i <= NR; i++)
+      printf("    { \"threads\": %d, \"hier\": %s, \"cycles_per_s\": %d, \"speedup\": %.2f }%s\n",
+	     t[i], h[i] ? "true" : "false", r[i], r[i] / base, i < NR ? "," : "")
+    printf("] }\n")
+
+    printf("# written by sweep.sh, fastest configuration on this host\n") > "threads.mk"
+    printf("THREADS ?= %d\nHIER ?= %d\n", t[best], h[best]) > "threads.mk"
+  }' sweep/results > sweep.json
+
+cat sweep.json
+echo "Using $(sed -n 's/ ?= /=/p' threads.mk | tr '\n' ' ')for further builds"
@@ -0,0 +1,203 @@
+/*
+  trace.cpp
+
+  Triggered waveform capture for the verilator testbenches
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// value of +<name>=<value>, NULL if not given
+static const char *plusarg(const char *name, std::string &value) {
+  std::string prefix = std::string(name) + "=";
+  const char *arg = Verilated::commandArgsPlusMatch(prefix.c_str());
+  if(!arg[0]) return NULL;
+  value = arg + 1 + prefix.size();
+  return value.c_str();
+}
+
+#if VM_TRACE && !VM_TRACE_FST
+bool TraceBuffer::open(const std::string &name) {
+  // every (re-)open by the tracer starts a new segment
+  if(fd < 0) segments.emplace_back();
+  return true;
+}
+
+ssize_t TraceBuffer::write(const char *bufp, ssize_t len) {
+  if(fd >= 0) return ::write(fd, bufp, len);
+  segments.back().append(bufp, len);
+  return len;
+}
+#endif
+
+TraceWindow::TraceWindow(const char *name) : name(name) {
+  from_ms = 0;
+  to_ms = -1;
+  state = OFF;
+  auto_start = true;
+  now = from = 0;
+  to = UINT64_MAX;
+  pre = post = seg_ticks = seg_cnt = 0;
+#if VM_TRACE
+  trace = NULL;
+#endif
+}
+
+const char *TraceWindow::match(const std::string &cond, const char *name) {
+  size_t len = strlen(name);
+  if(cond.compare(0, len, name)) return NULL;
+  if(cond.size() == len) return "";
+  if(cond[len] != ':') return NULL;
+  return cond.c_str() + len + 1;
+}
+
+bool TraceWindow::setup(void) {
+  std::string arg;
+
+  format = "vcd";
+  plusarg("trace", format);
+  if(format == "off") return false;
+  if(format != "vcd" && format != "fst") {
+    printf("Unknown trace format %s\n", format.c_str());
+    exit(-1);
+  }
+
+#if !VM_TRACE
+  if(Verilated::commandArgsPlusMatch("trace=")[0])
+    printf("Built without tracing, ignoring +trace=%s\n", format.c_str());
+  return false;
+#else
+  file = name + "." + format;
+  plusarg("tracefile", file);
+  plusarg("trigger", trigger_cond);
+  plusarg("trace_stop", stop_cond);
+  if(plusarg("pre", arg))        pre = strtoul(arg.c_str(), NULL, 0);
+  if(plusarg("post", arg))       post = strtoul(arg.c_str(), NULL, 0);
+  if(plusarg("trace_from", arg)) from_ms = strtod(arg.c_str(), NULL);
+  else if(trigger_cond.size())   from_ms = 0;   // the trigger replaces the default start
+  if(plusarg("trace_to", arg))   to_ms = strtod(arg.c_str(), NULL);
+
+  from = from_ms * 1e9;
+  if(to_ms >= 0) to = to_ms * 1e9;
+
+#if VM_TRACE_FST
+  if(format == "vcd") {
+    printf("Model was verilated with --trace-fst, writing FST\n");
+    format = "fst";
+  }
+  if(pre) {
+    printf("Pre-trigger buffer needs a VCD trace, ignoring +pre\n");
+    pre = 0;
+  }
+#endif
+
+  // keep two segments of at least pre ticks each
+  seg_ticks = pre;
+
+  auto_start = trigger_cond.empty();
+  if(!auto_start)
+    printf("Tracing to %s on %s\n", file.c_str(), trigger_cond.c_str());
+
+  state = WAITING;
+  return true;
+#endif
+}
+
+void TraceWindow::start(void) {
+#if VM_TRACE
+#if VM_TRACE_FST
+  // the fst writer opens the file itself, so only do this on trigger
+#else
+  trace->open(file.c_str());
+  // close the segment holding the header only
+  trace->openNext(false);
+#endif
+#endif
+}
+
+void TraceWindow::dump_tick(uint64_t time) {
+#if VM_TRACE
+#if !VM_TRACE_FST
+  if(state == WAITING) {
+    // start a new segment (beginning with a full dump) every seg_ticks
+    // and drop the ones older than needed
+    if(++seg_cnt >= seg_ticks) {
+      seg_cnt = 0;
+      trace->openNext(false);
+      while(buffer.segments.size() > 3)
+	buffer.segments.erase(buffer.segments.begin() + 1);
+    }
+  }
+#endif
+  trace->dump(time);
+#endif
+}
+
+void TraceWindow::trigger(void) {
+  if(state != WAITING || now < from) return;
+
+#if VM_TRACE
+  printf("Trace triggered\n");
+
+#if VM_TRACE_FST
+  trace->open(file.c_str());
+#else
+  std::string vcd = (format == "vcd")?file:(file + ".vcd");
+  trace->flush();
+  buffer.fd = ::open(vcd.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(buffer.fd < 0) { perror(vcd.c_str()); exit(-1); }
+
+  // write header and pre-trigger history, then continue streaming
+  for(const std::string &seg : buffer.segments)
+    if(::write(buffer.fd, seg.data(), seg.size()) != (ssize_t)seg.size()) {
+      perror("write()");
+      exit(-1);
+    }
+  buffer.segments.clear();
+#endif
+#endif
+
+  state = ACTIVE;
+}
+
+void TraceWindow::stop(void) {
+  if(state != ACTIVE) return;
+  close();
+}
+
+void TraceWindow::close(void) {
+#if VM_TRACE
+  if(!trace) return;
+
+  if(state == WAITING)
+    printf("Trace never triggered, nothing written\n");
+
+#if VM_TRACE_FST
+  if(state == ACTIVE) trace->close();
+#else
+  trace->close();
+#endif
+  delete trace;
+  trace = NULL;
+
+#if !VM_TRACE_FST
+  if(buffer.fd >= 0) {
+    ::close(buffer.fd);
+    buffer.fd = -1;
+
+    if(format == "fst") {
+      std::string cmd = "vcd2fst " + file + ".vcd " + file;
+      if(system(cmd.c_str()) == 0) unlink((file + ".vcd").c_str());
+      else printf("vcd2fst failed, VCD kept in %s.vcd\n", file.c_str());
+    }
+  }
+#endif
+#endif
+
+  state = STOPPED;
+}
@@ -0,0 +1,136 @@
+/*
+  trace.h
+
+  Triggered waveform capture for the verilator testbenches.
+
+  Instead of dumping every tick of a run, tracing can be started and
+  stopped by conditions evaluated by the testbench. While waiting for
+  the trigger a number of ticks is kept in memory so the trace also
+  shows what happened right before the event. Everything is controlled
+  by plusargs:
+
+    +trace=vcd|fst|off      output format, default vcd
+    +tracefile=<name>       output file name
+    +trigger=<cond>         start condition, default: start immediately
+    +trace_stop=<cond>      stop condition
+    +pre=<n>                ticks to keep before the trigger
+    +post=<n>               ticks to trace after the trigger
+    +trace_from=<ms>        start at simulation time
+    +trace_to=<ms>          stop at simulation time
+
+  The available conditions depend on the testbench:
+
+    static TraceWindow trace("floppy_tb");
+    ...
+    trace.open(tb);
+    bool trig_fdc = trace.trigger_param("fdc-cmd");
+    ...
+    tb->eval();
+    if(trig_fdc && trace.waiting() && <fdc command written>) trace.trigger();
+    trace.dump(1000000000000 * simulation_time);
+
+  Times passed to dump() are in ps. The pre-trigger buffer needs a
+  VCD trace. With +trace=fst a model verilated with --trace-fst
+  writes FST directly, otherwise the captured VCD window is converted
+  with vcd2fst from the GTKWave package.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+
+#include "verilated.h"
+#if VM_TRACE
+#if VM_TRACE_FST
+#include "verilated_fst_c.h"
+#else
+#include "verilated_vcd_c.h"
+#endif
+#endif
+
+#if VM_TRACE && !VM_TRACE_FST
+// collects the vcd output in memory until the trigger fires
+class TraceBuffer : public VerilatedVcdFile {
+public:
+  TraceBuffer() : fd(-1) { }
+  bool open(const std::string &name) override;
+  void close() override { }
+  ssize_t write(const char *bufp, ssize_t len) override;
+
+  std::deque<std::string> segments;   // first one is the vcd header
+  int fd;                              // >= 0 once streaming to disk
+};
+#endif
+
+class TraceWindow {
+public:
+  TraceWindow(const char *name);
+  ~TraceWindow() { close(); }
+
+  // parse plusargs and attach to the model
+  template<class M> void open(M *model) {
+    if(!setup()) return;
+#if VM_TRACE
+#if VM_TRACE_FST
+    trace = new VerilatedFstC;
+#else
+    trace = new VerilatedVcdC(&buffer);
+#endif
+    trace->spTrace()->set_time_unit("1ns");
+    trace->spTrace()->set_time_resolution("1ps");
+    model->trace(trace, 99);
+    start();
+#endif
+  }
+
+  void close(void);
+
+  // parameter of the selected trigger/stop condition, "" if the
+  // condition has no parameter and NULL if not selected
+  const char *trigger_param(const char *name) { return match(trigger_cond, name); }
+  const char *stop_param(const char *name) { return match(stop_cond, name); }
+
+  bool waiting(void) { return state == WAITING; }
+  bool active(void) { return state == ACTIVE; }
+  void trigger(void);
+  void stop(void);
+
+  // to be called once per tick
+  void dump(uint64_t time) {
+    if(state > ACTIVE) return;
+    now = time;
+    if(state == WAITING && auto_start && time >= from) trigger();
+    if(state == ACTIVE && (time >= to || (post && !--post))) stop();
+    if(state <= ACTIVE && (pre || state == ACTIVE)) dump_tick(time);
+  }
+
+  // defaults, to be set before open()
+  double from_ms, to_ms;
+
+private:
+  enum { WAITING, ACTIVE, STOPPED, OFF } state;
+
+  bool setup(void);
+  void start(void);
+  void dump_tick(uint64_t time);
+  static const char *match(const std::string &cond, const char *name);
+
+  std::string name, file, format, trigger_cond, stop_cond;
+  bool auto_start;
+  uint64_t now, from, to;
+  unsigned long pre, post, seg_ticks, seg_cnt;
+
+#if VM_TRACE
+#if VM_TRACE_FST
+  VerilatedFstC *trace;
+#else
+  VerilatedVcdC *trace;
+  TraceBuffer buffer;
+#endif
+#endif
+};
+
+#endif // TRACE_H
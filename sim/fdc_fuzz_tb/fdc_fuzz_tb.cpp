@@ -0,0 +1,914 @@
+/*
+  fdc_fuzz_tb.cpp
+
+  Coverage guided fuzzing of fdc1772.v. Random but legal sequences of
+  WD1772 register accesses are run against the fdc: restore, seek and
+  step commands, single and multi sector reads and writes, read
+  address and force interrupt with changing track, sector and side
+  registers, image sizes and write protection. The SD card requests
+  of the fdc are served from an image in memory.
+
+  Every command is checked against what it should have done:
+
+    hang    no interrupt, DRQ, SD request or head step for +timeout ms
+    drq     DRQs differ from 512 per sector or 6 for read address
+    storm   more SD requests than sectors or requests outside of a
+            sector read or write
+    data    sector data or read address reply differ from the image
+            and the head position, sector requested at the wrong LBA
+    status  unexpected status bits or track and sector registers
+
+  The expected results are those of a WD1772: a type I verify reads
+  an ID field of the track under the head and sets Seek Error if it
+  doesn't match the track register, type II commands transfer the
+  sectors of the track under the head and end with RNF if the track
+  register doesn't match it. Where fdc1772.v knowingly simplifies this,
+  its result is counted as a known deviation instead of an error:
+
+    verify     type I verify always succeeds, it's only a delay
+    track-reg  type II commands take the track register as the head
+               position, they neither fail on a mismatch nor read
+               from the track under the head
+
+  Verilated with coverage (the default in the Makefile) the coverage
+  counters are read back after each sequence. A sequence hitting a
+  coverage point for the first time or much more often than any
+  sequence before is kept in a corpus the following sequences are
+  mutated from. Without coverage every sequence is random.
+
+    +iterations=<n>   sequences to run, default 1000
+    +seed=<n>         seed of the generator
+    +timeout=<ms>     fdc time without progress until a command is
+                      considered hung, default 3000
+    +sd_delay=<n>     max. clocks the SD card answers late, default 20000
+    +corpus=<file>    load sequences from file and save the corpus to it
+    +replay=<file>    run the sequences in the file once each
+    +failures=<file>  failing sequences, default fdc_fuzz_tb.fail
+    +coverage=<file>  write the accumulated coverage for verilator_coverage
+    +strict           known deviations fail like any other error
+    +verbose          print every command
+
+  Time is given in fdc time: the floppy runs as if clk8m_en was
+  CLK_EN kHz, so 1 ms are 4*CLK_EN clocks. A failure is reproduced by
+  the same +seed and +iterations, +trigger=iter:<n> traces from the
+  start of sequence n and +trace_stop=fail stops at the first error.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "Vfdc_fuzz_tb.h"
+#include "verilated.h"
+#if VM_COVERAGE
+#include "verilated_cov.h"
+#endif
+
+#include "trace.h"
+#include "bench.h"
+
+#ifndef CLK_EN
+#define CLK_EN 500
+#endif
+
+#define CLOCKS_PER_MS (4*CLK_EN)
+
+static Vfdc_fuzz_tb *tb;
+static TraceWindow trace("fdc_fuzz_tb");
+static SimBench bench("fdc_fuzz_tb", 4000.0*CLK_EN);
+static uint64_t clocks, progress;
+static int timeout_ms = 3000;
+static bool verbose;
+
+// trace conditions: +trigger=iter:<n>, +trace_stop=fail
+static long trig_iter = -1;
+static bool stop_fail = false;
+
+// ---------------- generator ----------------
+static uint64_t rng;
+
+static uint32_t rnd(uint32_t n) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return n?(rng >> 16) % n:0;
+}
+
+// ST images mounted by the generator, the last one is "no disk"
+static const struct {
+  uint32_t size;
+  int spt, sides;
+} images[] = {
+  {  368640,  9, 1 }, {  409600, 10, 1 }, {  737280,  9, 2 }, {  819200, 10, 2 },
+  {  839680, 10, 2 }, {  901120, 11, 2 }, { 1474560, 18, 2 }, {       0,  0, 0 } };
+#define IMAGES (int)(sizeof(images)/sizeof(images[0]))
+#define MAX_IMAGE 1474560
+
+enum { OP_MOUNT, OP_CMD };
+
+struct Op {
+  int kind;
+  int cmd;                 // command byte or image index
+  int track, sector, data; // registers written before the command, -1 = keep
+  int side;                // head selected, or write protection of an image
+  int brk;                 // force interrupt after brk us, 0 = none
+  int sd_delay;            // SD card answers up to sd_delay clocks late
+};
+
+typedef std::vector<Op> Seq;
+#define MAX_OPS 8
+
+static int sd_delay_max = 20000;
+
+// geometry the generator assumes, follows the mounts it emits
+static int gen_image;
+
+static Op gen_mount(void) {
+  Op op = { OP_MOUNT, 0, -1, -1, -1, 0, 0, 0 };
+  op.cmd = rnd(16)?rnd(IMAGES-1):IMAGES-1;
+  op.side = !rnd(4);
+  gen_image = op.cmd;
+  return op;
+}
+
+static Op gen_cmd(void) {
+  Op op = { OP_CMD, 0, -1, -1, -1, 0, 0, 0 };
+  int spt = images[gen_image].spt?images[gen_image].spt:9;
+  int sides = images[gen_image].sides?images[gen_image].sides:1;
+  int tracks = images[gen_image].size?images[gen_image].size/512/spt/sides:80;
+
+  int h = rnd(2)?0x08:0x00;
+  int rate = rnd(4)?0:rnd(4);
+  int verify = rnd(3)?0:0x04;
+  int update = rnd(2)?0x10:0x00;
+  int e = rnd(5)?0:0x04;
+  int m = rnd(10)?0:0x10;
+
+  int r = rnd(100);
+  if(r < 8)       op.cmd = 0x00 | h | verify | rate;
+  else if(r < 26) {
+    op.cmd = 0x10 | h | verify | rate;
+    op.data = rnd(10)?rnd(tracks):rnd(85);
+    if(!rnd(10)) op.track = rnd(tracks);
+  } else if(r < 38) op.cmd = (0x20 << rnd(3)) | update | h | verify | rate;
+  else if(r < 68) op.cmd = 0x80 | m | h | e;
+  else if(r < 80) op.cmd = 0xa0 | m | h | e | rnd(2);
+  else if(r < 92) op.cmd = 0xc0 | h | e;
+  else if(r < 95) op.cmd = (rnd(2)?0xe0:0xf0) | h | e;
+  else            op.cmd = rnd(2)?0xd0:0xd8;
+
+  // sector commands on a random sector of a random track. Multi
+  // sector commands start close to the end of the track
+  if((op.cmd & 0xc0) == 0x80) {
+    if(rnd(3)) op.track = rnd(tracks);
+    op.sector = m?spt - rnd(3):1 + rnd(spt);
+    if(!rnd(30)) op.sector = rnd(2)?0:spt + 1 + rnd(3);
+  }
+  op.side = rnd(sides);
+
+  if((op.cmd & 0xf0) != 0xd0 && !rnd(12))
+    op.brk = 1 + (rnd(2)?rnd(2000):rnd(200000));
+  op.sd_delay = rnd(4)?rnd(64):rnd(sd_delay_max + 1);
+  return op;
+}
+
+static Seq generate(void) {
+  Seq s;
+  if(!rnd(10)) s.push_back(gen_mount());
+  int n = 1 + rnd(MAX_OPS/2);
+  while(n--) s.push_back(gen_cmd());
+  return s;
+}
+
+static Seq mutate(const Seq &src, const std::vector<Seq> &corpus) {
+  Seq s = src;
+  for(int n = 1 + rnd(3); n; n--) {
+    size_t i = rnd(s.size());
+    Op &op = s[i];
+    switch(rnd(7)) {
+    case 0: if(s.size() < MAX_OPS) s.insert(s.begin() + rnd(s.size() + 1), gen_cmd()); break;
+    case 1: if(s.size() > 1) s.erase(s.begin() + i); break;
+    case 2: op = (op.kind == OP_MOUNT)?gen_mount():gen_cmd(); break;
+    case 3: if(op.sector >= 0) op.sector += rnd(2)?1:-1; else op.side ^= 1; break;
+    case 4: op.brk = rnd(2)?0:1 + rnd(200000); break;
+    case 5: op.sd_delay = rnd(sd_delay_max + 1); break;
+    case 6: {
+      // splice the tail of another sequence
+      const Seq &o = corpus[rnd(corpus.size())];
+      s.resize(i + 1);
+      for(size_t j = rnd(o.size()); j < o.size() && s.size() < MAX_OPS; j++)
+	s.push_back(o[j]);
+    } break;
+    }
+  }
+  return s;
+}
+
+// ---------------- text form of sequences ----------------
+// "mount <image> <wp>" or "cmd <hex> <track> <sector> <data> <side>
+// <brk> <sd_delay>", sequences separated by an empty line
+static void seq_write(FILE *f, const Seq &s) {
+  for(const Op &op : s)
+    if(op.kind == OP_MOUNT) fprintf(f, "mount %d %d\n", op.cmd, op.side);
+    else fprintf(f, "cmd %02x %d %d %d %d %d %d\n", op.cmd, op.track, op.sector,
+		 op.data, op.side, op.brk, op.sd_delay);
+  fprintf(f, "\n");
+}
+
+static void seq_load(const char *name, std::vector<Seq> &list) {
+  FILE *f = fopen(name, "r");
+  if(!f) return;
+
+  Seq s;
+  char line[256];
+  while(fgets(line, sizeof(line), f)) {
+    Op op = { OP_CMD, 0, -1, -1, -1, 0, 0, 0 };
+    if(sscanf(line, "mount %d %d", &op.cmd, &op.side) == 2 && op.cmd >= 0 && op.cmd < IMAGES) {
+      op.kind = OP_MOUNT;
+      s.push_back(op);
+    } else if(sscanf(line, "cmd %x %d %d %d %d %d %d", &op.cmd, &op.track, &op.sector,
+		      &op.data, &op.side, &op.brk, &op.sd_delay) == 7)
+      s.push_back(op);
+    else if(line[0] == '\n' && !s.empty()) {
+      list.push_back(s);
+      s.clear();
+    }
+  }
+  if(!s.empty()) list.push_back(s);
+  fclose(f);
+  printf("Loaded %zu sequences from %s\n", list.size(), name);
+}
+
+// ---------------- disk and SD card ----------------
+static struct {
+  int image;
+  bool wp;
+  int spt, sides, tracks;
+  uint8_t data[MAX_IMAGE];
+} disk;
+
+// every sector starts with its lba so misdirected reads stand out
+static void disk_fill(int mount) {
+  for(uint32_t i=0;i<images[disk.image].size;i++)
+    disk.data[i] = ((i & 511) < 4)?(i/512) >> (8*(3-(i & 3))):
+      ((i + mount * 0x9e3779b9u) * 2654435761u) >> 24;
+}
+
+static int disk_byte(uint32_t lba, int i) {
+  uint32_t a = 512*lba + i;
+  return (a < images[disk.image].size)?disk.data[a]:0xff;
+}
+
+struct SdReq {
+  uint32_t lba;
+  bool write;
+  uint8_t data[512];
+};
+
+static struct {
+  enum { IDLE, WAIT, READ, WRITE } state;
+  int delay, max_delay, pos;
+  std::vector<SdReq> reqs;
+} sd;
+
+// called after every rising clock edge
+static void sd_clock(void) {
+  switch(sd.state) {
+  case sd.IDLE:
+    if(tb->sd_rd || tb->sd_wr) {
+      SdReq r;
+      r.lba = tb->sd_lba;
+      r.write = tb->sd_wr;
+      sd.reqs.push_back(r);
+      sd.delay = rnd(sd.max_delay + 1);
+      sd.state = sd.WAIT;
+      progress = clocks;
+    }
+    break;
+
+  case sd.WAIT:
+    if(sd.delay) { sd.delay--; break; }
+    tb->sd_ack = 1;
+    sd.pos = 0;
+    sd.state = sd.reqs.back().write?sd.WRITE:sd.READ;
+    break;
+
+  case sd.READ:
+    if(sd.pos < 512) {
+      tb->sd_buff_addr = sd.pos;
+      tb->sd_dout = disk_byte(sd.reqs.back().lba, sd.pos++);
+      tb->sd_dout_strobe = 1;
+    } else {
+      tb->sd_dout_strobe = 0;
+      tb->sd_ack = 0;
+      sd.state = sd.IDLE;
+    }
+    break;
+
+  case sd.WRITE: {
+    // the fdc's buffer returns the byte one clock after its address
+    SdReq &r = sd.reqs.back();
+    if(sd.pos) r.data[sd.pos-1] = tb->sd_din;
+    if(sd.pos < 512)
+      tb->sd_buff_addr = sd.pos++;
+    else {
+      uint32_t a = 512*r.lba;
+      if(!disk.wp && a + 512 <= images[disk.image].size)
+	memcpy(disk.data + a, r.data, 512);
+      tb->sd_ack = 0;
+      sd.state = sd.IDLE;
+    }
+  } break;
+  }
+}
+
+// ---------------- clock and cpu ----------------
+static void cycle(void) {
+  int step = tb->step;
+
+  tb->clk = 1;
+  tb->eval();
+  bench.cycle();
+  clocks++;
+  sd_clock();
+  if(tb->step && !step) progress = clocks;
+  trace.dump(clocks * (1000000000 / (4 * CLK_EN)));
+
+  tb->clk = 0;
+  tb->eval();
+  trace.dump(clocks * (1000000000 / (4 * CLK_EN)) + 500000000 / (4 * CLK_EN));
+}
+
+static void wait_clk8(void) {
+  cycle();
+  while(!tb->clk8m_en) cycle();
+}
+
+static void cpu_write(int reg, int val) {
+  wait_clk8();
+  tb->cpu_addr = reg;
+  tb->cpu_sel = 1;
+  tb->cpu_rw = 0;
+  tb->cpu_din = val;
+  wait_clk8();
+  tb->cpu_sel = 0;
+}
+
+static int cpu_read(int reg) {
+  wait_clk8();
+  tb->cpu_addr = reg;
+  tb->cpu_sel = 1;
+  tb->cpu_rw = 1;
+  wait_clk8();
+  tb->cpu_sel = 0;
+  return tb->cpu_dout;
+}
+
+static void reset(void) {
+  tb->resetn = 0;
+  for(int i=0;i<16;i++) cycle();
+  tb->resetn = 1;
+  for(int i=0;i<16;i++) cycle();
+}
+
+// ---------------- command checks ----------------
+enum { E_HANG, E_DRQ, E_STORM, E_DATA, E_STATUS, E_COUNT };
+static const char *error_name[E_COUNT] = { "hang", "drq", "storm", "data", "status" };
+static unsigned long errors[E_COUNT];
+static std::string seq_errors;
+
+// checks of a command are collected while it's compared with a model
+// of fdc1772.v's simplifications
+struct Check { int type; std::string msg; };
+static std::vector<Check> *collect;
+
+static void error(int type, const char *fmt, ...) {
+  char msg[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, ap);
+  va_end(ap);
+
+  if(collect) {
+    collect->push_back(Check { type, msg });
+    return;
+  }
+
+  errors[type]++;
+  if(seq_errors.empty()) seq_errors = std::string(error_name[type]) + ": " + msg;
+  if(stop_fail) trace.stop();
+}
+
+// known deviations of fdc1772.v from the WD1772, see above
+enum { DEV_VERIFY, DEV_TRACK_REG, DEV_COUNT };
+static const char *deviation_name[DEV_COUNT] = { "verify", "track-reg" };
+static unsigned long deviations[DEV_COUNT];
+static bool strict;
+
+// count a known deviation, false if it's to be reported as error
+static bool deviation(int dev) {
+  deviations[dev]++;
+  return !strict;
+}
+
+// what the testbench knows about the fdc, -1 = unknown
+static struct {
+  int track, data;
+  int head;          // physical head position
+  int dir;           // last step, 1 = towards track 0
+  size_t reqs;       // SD requests checked
+} fdc;
+
+static const char *cmd_name(int cmd) {
+  static const char *names[16] = {
+    "restore", "seek", "step", "step", "step-in", "step-in", "step-out", "step-out",
+    "read", "read", "write", "write", "read address", "force int", "read track", "write track" };
+  return names[cmd >> 4];
+}
+static std::unordered_map<std::string, unsigned long> cmd_count;
+
+static int clamp(int t) { return (t < 0)?0:(t > 84)?84:t; }
+
+static uint32_t lba(int track, int side, int sector) {
+  return ((disk.spt * (track & 0x7f)) << (disk.sides - 1)) + (side?disk.spt:0) + sector - 1;
+}
+
+static int crc(int c, int val) {
+  c ^= val << 8;
+  for(int i=0;i<8;i++) c = (c & 0x8000)?(c << 1) ^ 0x1021:c << 1;
+  return c & 0xffff;
+}
+
+static void mount(const Op &op) {
+  static int mounts;
+  disk.image = op.cmd;
+  disk.wp = op.side;
+  disk.spt = images[op.cmd].spt;
+  disk.sides = images[op.cmd].sides;
+  disk.tracks = disk.spt?images[op.cmd].size/512/disk.spt/disk.sides:0;
+  disk_fill(++mounts);
+
+  tb->img_size = images[op.cmd].size;
+  tb->img_wp = disk.wp;
+  tb->img_mounted = 1;
+  wait_clk8();
+  tb->img_mounted = 0;
+  if(verbose) printf("  mount %u bytes%s\n", images[op.cmd].size, disk.wp?", write protected":"");
+}
+
+// checks of a finished type II command against the sectors of track
+// id_track, rnf_track if no sector ID matches the track register
+static void check_type2(const Op &op, int status, int sector, int last, int drqs,
+			    const std::vector<uint8_t> &bytes, size_t first, int id_track, bool rnf_track) {
+  int cmd = op.cmd;
+  bool wr = (cmd & 0xe0) == 0xa0;
+  bool present = images[disk.image].size != 0;
+
+  unsigned expect = 0;
+  bool valid = sector >= 1 && sector <= disk.spt;
+  bool rnf = !present || !valid || (cmd & 0x10) || rnf_track;
+  if(present && valid && !rnf_track) expect = (cmd & 0x10)?disk.spt - sector + 1:1;
+  if(wr && disk.wp) { expect = 0; rnf = !present; }
+
+  if(drqs != 512 * (int)expect)
+    error(E_DRQ, "%d DRQs for %u sectors of $%02x (%s)", drqs, expect, cmd, cmd_name(cmd));
+  if(!(status & 0x10) != !rnf)
+    error(E_STATUS, "$%02x (%s) of sector %d status $%02x, RNF wrong", cmd, cmd_name(cmd), sector, status);
+  if(status & 0x04) error(E_STATUS, "$%02x (%s) lost data", cmd, cmd_name(cmd));
+  if(wr && present && !(status & 0x40) != !disk.wp)
+    error(E_STATUS, "$%02x (%s) status $%02x, write protection wrong", cmd, cmd_name(cmd), status);
+
+  int next = (cmd & 0x10)?sector + expect:sector;
+  if(present && last != (next & 0xff))
+    error(E_STATUS, "$%02x (%s) sector register %d, expected %d", cmd, cmd_name(cmd), last, next);
+
+  // one SD request per sector at its lba, the data passed through
+  for(unsigned i=0;i<expect && first+i<sd.reqs.size();i++) {
+    SdReq &r = sd.reqs[first+i];
+    uint32_t l = lba(id_track, op.side, sector + i);
+    if(r.lba != l || r.write != wr) {
+      error(E_DATA, "SD %s of lba %u for %s of track %d side %d sector %d, expected lba %u",
+	    r.write?"write":"read", r.lba, cmd_name(cmd), id_track, op.side, sector + i, l);
+      continue;
+    }
+    for(int j=0;j<512 && 512*i+j < bytes.size();j++) {
+      int b = wr?r.data[j]:disk_byte(l, j);
+      if(bytes[512*i+j] != b) {
+	error(E_DATA, "%s of lba %u: byte %d is $%02x, expected $%02x", cmd_name(cmd), l, j,
+	      wr?b:bytes[512*i+j], wr?bytes[512*i+j]:b);
+	break;
+      }
+    }
+  }
+
+  if(sd.reqs.size() - first > expect)
+    error(E_STORM, "%zu SD requests for %u sectors of $%02x (%s)", sd.reqs.size() - first, expect, cmd, cmd_name(cmd));
+}
+
+static void run_cmd(const Op &op) {
+  int cmd = op.cmd;
+  bool type1 = !(cmd & 0x80);
+  bool rd = (cmd & 0xe0) == 0x80, wr = (cmd & 0xe0) == 0xa0;
+  bool rdaddr = (cmd & 0xf0) == 0xc0, force = (cmd & 0xf0) == 0xd0;
+  bool present = images[disk.image].size != 0;
+  cmd_count[cmd_name(cmd)]++;
+
+  // any request since the last command was done came from nowhere
+  if(sd.reqs.size() != fdc.reqs)
+    error(E_STORM, "%zu SD requests between commands", sd.reqs.size() - fdc.reqs);
+
+  tb->side = !op.side;
+  fdc.track = cpu_read(1);
+  if(op.track >= 0)  { cpu_write(1, op.track); fdc.track = op.track; }
+  if(op.sector >= 0) cpu_write(2, op.sector);
+  if(op.data >= 0)   { cpu_write(3, op.data); fdc.data = op.data; }
+  int sector = cpu_read(2);
+
+  // a transfer of an interrupted command may still be running
+  if(sd.state == sd.IDLE) sd.reqs.clear();
+  size_t first = sd.reqs.size();
+  sd.max_delay = op.sd_delay;
+  std::vector<uint8_t> bytes;
+  int drqs = 0;
+  bool interrupted = false, hung = false;
+
+  cpu_write(0, cmd);
+  uint64_t start = clocks;
+  progress = clocks;
+
+  if(force) {
+    for(int i=0;i<16;i++) wait_clk8();
+    if((cmd & 0x08) && !tb->irq) error(E_STATUS, "no irq after force int $%02x", cmd);
+  } else {
+    while(!tb->irq) {
+      cycle();
+
+      if(tb->drq) {
+	drqs++;
+	progress = clocks;
+	if(wr) {
+	  uint8_t b = rnd(256);
+	  cpu_write(3, b);
+	  fdc.data = b;
+	  bytes.push_back(b);
+	} else
+	  bytes.push_back(cpu_read(3));
+      }
+
+      if(op.brk && clocks - start >= (uint64_t)op.brk * CLOCKS_PER_MS / 1000) {
+	cpu_write(0, 0xd0);
+	for(int i=0;i<16;i++) wait_clk8();
+	interrupted = true;
+	break;
+      }
+
+      if(clocks - progress > (uint64_t)timeout_ms * CLOCKS_PER_MS) {
+	error(E_HANG, "$%02x (%s) made no progress for %d ms", cmd, cmd_name(cmd), timeout_ms);
+	hung = true;
+	break;
+      }
+    }
+  }
+
+  int status = cpu_read(0);
+  double ms = (double)(clocks - start) / CLOCKS_PER_MS;
+  if(verbose)
+    printf("  $%02x %-12s trk %3d sec %2d side %d -> status $%02x, %d drq, %zu sd, %.1f ms%s\n",
+	   cmd, cmd_name(cmd), fdc.track, sector, op.side, status, drqs, sd.reqs.size() - first, ms,
+	   interrupted?", interrupted":"");
+
+  if(hung) {
+    reset();
+    fdc.track = 0;
+    fdc.head = -1;
+    fdc.reqs = sd.reqs.size();
+    return;
+  }
+
+  if(status & 0x01) error(E_STATUS, "$%02x (%s) still busy", cmd, cmd_name(cmd));
+
+  // an interrupted command leaves the head somewhere, only the SD
+  // requests can still be checked
+  unsigned sectors = (drqs + 511) / 512;
+  if(interrupted) {
+    if(type1) fdc.head = -1;
+    if(sd.reqs.size() - first > sectors + 1)
+      error(E_STORM, "%zu SD requests for %u sectors of interrupted $%02x", sd.reqs.size() - first, sectors, cmd);
+    fdc.reqs = sd.reqs.size();
+    return;
+  }
+
+  int track = cpu_read(1);
+
+  // ------ type I: head and track register ------
+  if(type1) {
+    int steps = 0, dir = fdc.dir;
+    if(!present) {
+      if(!(cmd & 0xf0)) fdc.track = 0xff;
+    } else if(!(cmd & 0xf0)) {
+      if(fdc.head != 0) dir = 1;
+      if(fdc.head < 0) dir = -1;
+      fdc.head = fdc.track = 0;
+    } else if((cmd & 0xf0) == 0x10) {
+      if(fdc.data < 0) fdc.head = fdc.track = -1;
+      else if(fdc.track != fdc.data) {
+	dir = (fdc.data < fdc.track)?1:0;
+	steps = fdc.data - fdc.track;
+	fdc.track = fdc.data;
+      }
+    } else {
+      if((cmd & 0xe0) == 0x40) dir = 0;
+      if((cmd & 0xe0) == 0x60) dir = 1;
+      steps = dir?-1:1;
+      if(cmd & 0x10) fdc.track = (fdc.track + steps) & 0xff;
+      if(dir < 0) fdc.head = fdc.track = -1;
+    }
+    if(present && fdc.head >= 0) fdc.head = clamp(fdc.head + steps);
+    fdc.dir = dir;
+
+    // verify finds no ID field with the track register's track if the
+    // head is elsewhere or beyond the last track of the image
+    bool seek_error = !present;
+    bool wd_seek_error = seek_error || ((cmd & 0x04) && fdc.head >= 0 &&
+					(fdc.head != track || fdc.head >= disk.tracks));
+    bool rnf = status & 0x10;
+    if((cmd & 0x04) && present && fdc.head < 0)
+      ;  // head position unknown, both are possible
+    else if(rnf != wd_seek_error && (rnf != seek_error || !deviation(DEV_VERIFY)))
+      error(E_STATUS, "$%02x (%s) status $%02x, seek error wrong with head at %d, track register %d",
+	    cmd, cmd_name(cmd), status, fdc.head, track);
+    if(fdc.head >= 0 && !(status & 0x04) != !!fdc.head)
+      error(E_STATUS, "$%02x (%s) status $%02x, head at track %d", cmd, cmd_name(cmd), status, fdc.head);
+    if(!(status & 0x40) != !disk.wp) error(E_STATUS, "$%02x (%s) status $%02x, write protection wrong", cmd, cmd_name(cmd), status);
+    if(fdc.track >= 0 && track != fdc.track)
+      error(E_STATUS, "$%02x (%s) track register %d, expected %d", cmd, cmd_name(cmd), track, fdc.track);
+  }
+  fdc.track = track;
+
+  // ------ type II: sector reads and writes ------
+  if(rd || wr) {
+    int last = cpu_read(2);
+
+    // the WD1772 only finds sectors whose ID matches the track register
+    // on the track under the head. With the head position unknown the
+    // track register is all there is
+    bool mismatch = present && fdc.head >= 0 && track != fdc.head;
+    std::vector<Check> wd;
+    collect = &wd;
+    check_type2(op, status, sector, last, drqs, bytes, first, mismatch?fdc.head:track, mismatch);
+    collect = NULL;
+
+    if(!wd.empty()) {
+      std::vector<Check> sim;
+      collect = &sim;
+      check_type2(op, status, sector, last, drqs, bytes, first, track, false);
+      collect = NULL;
+
+      if(!mismatch || !sim.empty() || !deviation(DEV_TRACK_REG))
+	for(const Check &c : wd) error(c.type, "%s", c.msg.c_str());
+    }
+  }
+
+  // ------ type III: read address ------
+  if(rdaddr) {
+    if(!present) {
+      if(!(status & 0x10)) error(E_STATUS, "read address without disk status $%02x", status);
+      if(drqs) error(E_DRQ, "%d DRQs for read address without disk", drqs);
+    } else if(drqs != 6)
+      error(E_DRQ, "%d DRQs for read address", drqs);
+    else {
+      // the side byte is the floppy_side input, which is active low
+      // in the ST
+      int c = 0xb230;
+      for(int i=0;i<4;i++) c = crc(c, bytes[i]);
+      if((fdc.head >= 0 && bytes[0] != fdc.head) || bytes[1] != tb->side ||
+	 bytes[2] < 1 || bytes[2] > disk.spt || bytes[3] != 2 || ((bytes[4] << 8) | bytes[5]) != c)
+	error(E_DATA, "read address at track %d returned %02x %02x %02x %02x %02x %02x", fdc.head,
+	      bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5]);
+    }
+  }
+
+  if(!rd && !wr && !rdaddr && drqs)
+    error(E_DRQ, "%d DRQs for $%02x (%s)", drqs, cmd, cmd_name(cmd));
+
+  if(!rd && !wr && sd.reqs.size() != first)
+    error(E_STORM, "%zu SD requests for $%02x (%s)", sd.reqs.size() - first, cmd, cmd_name(cmd));
+  fdc.reqs = sd.reqs.size();
+}
+
+// ---------------- coverage feedback ----------------
+#if VM_COVERAGE
+static char cov_file[] = "/tmp/fdc_fuzz_XXXXXX";
+static std::unordered_map<std::string, size_t> cov_index;
+static std::vector<uint64_t> cov_count;  // counters after the last sequence
+static std::vector<uint8_t> cov_seen;    // hit count classes seen so far
+
+// classes of the hits of a point in one sequence like AFL's: 1, 2, 3,
+// 4-7, 8-31, 32-127 and more
+static uint8_t hit_class(uint64_t n) {
+  return (n >= 128)?0x40:(n >= 32)?0x20:(n >= 8)?0x10:(n >= 4)?0x08:(n == 3)?0x04:(n == 2)?0x02:0x01;
+}
+
+// read back the counters, returns the number of points which were hit
+// in a new class
+static int coverage_update(void) {
+  Verilated::defaultContextp()->coveragep()->write(cov_file);
+  FILE *f = fopen(cov_file, "r");
+  if(!f) { perror(cov_file); exit(-1); }
+
+  int fresh = 0;
+  char *line = NULL;
+  size_t cap = 0;
+  while(getline(&line, &cap, f) > 0) {
+    // C '<point>' <count>
+    char *end = strrchr(line, '\'');
+    if(line[0] != 'C' || end <= line + 2) continue;
+
+    std::string key(line + 3, end - line - 3);
+    auto it = cov_index.find(key);
+    size_t i;
+    if(it != cov_index.end()) i = it->second;
+    else {
+      i = cov_count.size();
+      cov_index.emplace(key, i);
+      cov_count.push_back(0);
+      cov_seen.push_back(0);
+    }
+
+    uint64_t count = strtoull(end + 1, NULL, 10);
+    uint64_t hits = count - cov_count[i];
+    cov_count[i] = count;
+    if(hits && !(cov_seen[i] & hit_class(hits))) {
+      cov_seen[i] |= hit_class(hits);
+      fresh++;
+    }
+  }
+  free(line);
+  fclose(f);
+  return fresh;
+}
+
+static size_t coverage_points(size_t *total) {
+  size_t n = 0;
+  for(uint64_t c : cov_count) if(c) n++;
+  *total = cov_count.size();
+  return n;
+}
+#endif
+
+static int run_seq(const Seq &s, long iter) {
+  unsigned long before = 0;
+  for(int e=0;e<E_COUNT;e++) before += errors[e];
+  seq_errors.clear();
+
+  if(verbose) printf("Sequence %ld:\n", iter);
+  for(const Op &op : s)
+    if(op.kind == OP_MOUNT) mount(op);
+    else run_cmd(op);
+
+  unsigned long after = 0;
+  for(int e=0;e<E_COUNT;e++) after += errors[e];
+  return after - before;
+}
+
+int main(int argc, char **argv) {
+  // Initialize Verilators variables
+  Verilated::commandArgs(argc, argv);
+
+  const char *arg = Verilated::commandArgsPlusMatch("iterations=");
+  long iterations = arg[0]?atol(arg+12):1000;
+  arg = Verilated::commandArgsPlusMatch("seed=");
+  unsigned long seed = arg[0]?strtoul(arg+6, NULL, 0):1;
+  rng = 0x9e3779b97f4a7c15ull * (seed + 1);
+  arg = Verilated::commandArgsPlusMatch("timeout=");
+  if(arg[0]) timeout_ms = atoi(arg+9);
+  arg = Verilated::commandArgsPlusMatch("sd_delay=");
+  if(arg[0]) sd_delay_max = atoi(arg+10);
+  verbose = Verilated::commandArgsPlusMatch("verbose")[0];
+  strict = Verilated::commandArgsPlusMatch("strict")[0];
+
+  std::string corpus_file, failures_file = "fdc_fuzz_tb.fail", coverage_file;
+  arg = Verilated::commandArgsPlusMatch("corpus=");
+  if(arg[0]) corpus_file = arg+8;
+  arg = Verilated::commandArgsPlusMatch("failures=");
+  if(arg[0]) failures_file = arg+10;
+  arg = Verilated::commandArgsPlusMatch("coverage=");
+  if(arg[0]) coverage_file = arg+10;
+
+  std::vector<Seq> corpus, replay;
+  arg = Verilated::commandArgsPlusMatch("replay=");
+  if(arg[0]) {
+    seq_load(arg+8, replay);
+    if(replay.empty()) { printf("No sequences in %s\n", arg+8); exit(-1); }
+    iterations = replay.size();
+  }
+  if(!corpus_file.empty()) seq_load(corpus_file.c_str(), corpus);
+
+#if VM_COVERAGE
+  int fd = mkstemp(cov_file);
+  if(fd < 0) { perror(cov_file); exit(-1); }
+  close(fd);
+#else
+  printf("Built without coverage, sequences are not guided\n");
+#endif
+
+  Verilated::traceEverOn(true);
+
+  // Create an instance of our module under test
+  tb = new Vfdc_fuzz_tb;
+
+  // thousands of sequences are only traced on request
+  trace.from_ms = 1e9;
+  trace.open(tb);
+  const char *p = trace.trigger_param("iter");
+  if(p) trig_iter = atol(p);
+  stop_fail = trace.stop_param("fail") != NULL;
+  bench.start();
+
+  tb->side = 1;
+  reset();
+  memset(&fdc, 0xff, sizeof(fdc));
+  fdc.reqs = 0;
+  Op first = { OP_MOUNT, 2, -1, -1, -1, 0, 0, 0 };
+  mount(first);
+
+  FILE *failures = NULL;
+  unsigned long failed = 0, commands = 0;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  long iter;
+  for(iter=0;iter<iterations;iter++) {
+    gen_image = disk.image;
+    Seq s = !replay.empty()?replay[iter]:
+      (corpus.empty() || !rnd(8))?generate():mutate(corpus[rnd(corpus.size())], corpus);
+
+    if(iter == trig_iter) trace.trigger();
+    int errs = run_seq(s, iter);
+    commands += s.size();
+
+    if(errs) {
+      if(failed++ < 10) printf("Sequence %ld: %s\n", iter, seq_errors.c_str());
+      if(!failures && !(failures = fopen(failures_file.c_str(), "w"))) perror(failures_file.c_str());
+      if(failures) {
+	fprintf(failures, "# sequence %ld, +seed=%lu: %s\n", iter, seed, seq_errors.c_str());
+	seq_write(failures, s);
+      }
+    }
+
+#if VM_COVERAGE
+    int fresh = coverage_update();
+    if(fresh && replay.empty()) corpus.push_back(s);
+    if(!((iter+1) % 500)) {
+      size_t total, hit = coverage_points(&total);
+      printf("Sequence %ld: coverage %zu of %zu points, corpus %zu, %lu failed\n",
+	     iter+1, hit, total, corpus.size(), failed);
+    }
+#endif
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  printf("Ran %ld sequences with %lu commands in %.1f s, %.0f sequences per minute, %.1f s of fdc time\n",
+	 iter, commands, secs, secs?60 * iter / secs:0, (double)clocks / CLOCKS_PER_MS / 1000);
+  printf("Commands:");
+  for(auto &c : cmd_count) printf(" %s %lu,", c.first.c_str(), c.second);
+  printf("\n");
+#if VM_COVERAGE
+  size_t total, hit = coverage_points(&total);
+  printf("Coverage: %zu of %zu points (%.1f%%), corpus %zu sequences\n", hit, total,
+	 total?100.0 * hit / total:0, corpus.size());
+  unlink(cov_file);
+  if(!coverage_file.empty())
+    Verilated::defaultContextp()->coveragep()->write(coverage_file.c_str());
+#endif
+  printf("Errors:");
+  for(int e=0;e<E_COUNT;e++) printf(" %s %lu%s", error_name[e], errors[e], (e < E_COUNT-1)?",":"\n");
+  printf("Known deviations from the WD1772%s:", strict?" (failed)":"");
+  for(int d=0;d<DEV_COUNT;d++) printf(" %s %lu%s", deviation_name[d], deviations[d], (d < DEV_COUNT-1)?",":"\n");
+
+  if(!corpus_file.empty()) {
+    FILE *f = fopen(corpus_file.c_str(), "w");
+    if(!f) perror(corpus_file.c_str());
+    else {
+      for(const Seq &s : corpus) seq_write(f, s);
+      fclose(f);
+    }
+  }
+  if(failures) {
+    fclose(failures);
+    printf("Failing sequences written to %s\n", failures_file.c_str());
+  }
+
+  trace.close();
+  bench.stop();
+
+  printf("%s\n", failed?"FAILED":"PASSED");
+  return failed?1:0;
+}
@@ -0,0 +1,96 @@
+// fdc_fuzz_tb.v
+//
+// fdc1772 on its own for the fuzzer in fdc_fuzz_tb.cpp. The SD card
+// side of the fdc is served directly by the testbench from an image
+// in memory, so a sector is available within a few clocks instead of
+// going through sd_card.v and the MCU.
+//
+// The floppy mechanics derive all timings from CLK_EN, the rate of
+// clk8m_en in kHz. A lower value makes the disk rotate and the head
+// step faster relative to the clock. 500 is the lowest value at which
+// a DD disk still delivers its full data rate.
+
+module fdc_fuzz_tb #(
+  parameter CLK_EN = 500
+) (
+  input 	clk,
+  input 	resetn,
+  output 	clk8m_en,
+
+  // fdc interface
+  input [1:0] 	cpu_addr,
+  input 	cpu_sel,
+  input 	cpu_rw,
+  input [7:0] 	cpu_din,
+  output [7:0] 	cpu_dout,
+
+  output 	irq,
+  output 	drq,
+  output 	step,
+
+  // drive A, side select is active low like the PSG output
+  input 	side,
+  input 	img_mounted,
+  input 	img_wp,
+  input [31:0] 	img_size,
+
+  // sector requests served by the testbench
+  output [31:0] sd_lba,
+  output 	sd_rd,
+  output 	sd_wr,
+  input 	sd_ack,
+  input [8:0] 	sd_buff_addr,
+  input [7:0] 	sd_dout,
+  output [7:0] 	sd_din,
+  input 	sd_dout_strobe
+);
+
+reg [1:0] cnt_8mhz;
+always @(posedge clk)
+  cnt_8mhz <= cnt_8mhz + 2'd1;
+
+assign clk8m_en = cnt_8mhz == 2'd0;
+
+wire [1:0] fdc_sd_rd, fdc_sd_wr;
+assign sd_rd = fdc_sd_rd[0];
+assign sd_wr = fdc_sd_wr[0];
+
+// same setup as in atarist.v with drive A selected
+fdc1772 #( .CLK_EN(CLK_EN) ) fdc1772
+(
+ .clkcpu(clk),
+ .clk8m_en(cnt_8mhz == 2'd2),
+
+ .floppy_drive(2'b10),
+ .floppy_side(side),
+ .floppy_reset(resetn),
+ .floppy_step(step),
+ .floppy_motor(1'b0),
+ .floppy_ready(),
+
+ .irq(irq),
+ .drq(drq),
+
+ .cpu_addr(cpu_addr),
+ .cpu_sel(cpu_sel),
+ .cpu_rw(cpu_rw),
+ .cpu_din(cpu_din),
+ .cpu_dout(cpu_dout),
+
+ .img_type(3'd1),
+ .img_mounted({ 1'b0, img_mounted }),
+ .img_wp({ 1'b1, img_wp }),
+ .img_ds(1'b0),
+ .img_size(img_size),
+
+ .sd_lba(sd_lba),
+ .sd_rd(fdc_sd_rd),
+ .sd_wr(fdc_sd_wr),
+ .sd_ack(sd_ack),
+ .sd_buff_addr(sd_buff_addr),
+ .sd_dout(sd_dout),
+ .sd_din(sd_din),
+ .sd_dout_strobe(sd_dout_strobe)
+);
+
+endmodule
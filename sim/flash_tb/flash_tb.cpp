@@ -1,35 +1,57 @@
+/*
+  flash_tb.cpp
+
+  Self checking test of flash_dspi.v against the C++ flash model. The
+  model's read commands are first checked on their own, then words
+  are read through flash_dspi.v and compared with the flash contents:
+
+    +reads=<n>      random reads, default 1000, followed by as many
+                    sequential ones
+    +seed=<n>       seed of the random addresses
+    +image=<file>   flash contents, default a pseudo random pattern
+    +mhz=<f>        flash clock the throughput is scaled to, default 100
+
+  The flash clock runs at the simulated 32 MHz. The latency of a read
+  from cs to the data being valid is counted in these clocks, which
+  flash_dspi.v also uses on the real device.
+*/
+
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 
 #include "Vflash.h"
 #include "verilated.h"
-#include "verilated_vcd_c.h"
+
+#include "trace.h"
+#include "bench.h"
+#include "spi_flash.h"
 
 static Vflash *tb;
-static VerilatedVcdC *trace;
+static TraceWindow trace("flash");
+static SimBench bench("flash_tb", 32000000);
+static SpiFlashModel flash;
 static double simulation_time;
+static uint64_t clocks;
 
-#define TICKLEN   (1.0/64000000)
+// trace trigger: +trigger=cs
+static bool trig_cs = false;
 
-static uint64_t GetTickCountMs() {
-  struct timespec ts;
-  
-  clock_gettime(CLOCK_MONOTONIC, &ts);
-  return (uint64_t)(ts.tv_nsec / 1000000) + ((uint64_t)ts.tv_sec * 1000ull);
-}
+#define TICKLEN   (1.0/64000000)
 
 void tick(int c) {
-  static uint64_t ticks = 0;
-  
-  tb->clk = c; 
+  tb->clk = c;
   tb->eval();
+  if(c) {
+    bench.cycle();
+    clocks++;
+    flash.clk(tb->mspi_cs, (tb->mspi_di?1:0)|(tb->mspi_do?2:0), tb->mspi_din);
+  }
 
-  if(simulation_time == 0)
-    ticks = GetTickCountMs();
-
-  trace->dump(1000000000000 * simulation_time);
+  if(trig_cs && tb->cs) trace.trigger();
+  trace.dump(1000000000000 * simulation_time);
   simulation_time += TICKLEN;
 }
 
@@ -40,39 +62,193 @@ void run(int ticks) {
   }
 }
 
+// ---------------- model check ----------------
+// drive a read command directly into the model the way a host would:
+// command on IO0, address and mode bits in the command's width, then
+// collect len bytes. With cont set the command byte is skipped
+static void model_read(int cmd, int width, int mode_clks, int dummy, bool cont,
+		       uint32_t addr, int mode, uint8_t *buf, int len) {
+  unsigned char din = 0;
+  int mask = (1 << width) - 1;
+
+  flash.clk(1, 0, din);
+
+  if(!cont)
+    for(int i=7;i>=0;i--)
+      flash.clk(0, (cmd >> i) & 1, din);
+
+  for(int i=24/width-1;i>=0;i--)
+    flash.clk(0, (addr >> (width*i)) & mask, din);
+  for(int i=mode_clks-1;i>=0;i--)
+    flash.clk(0, (mode >> (width*i)) & mask, din);
+  for(int i=0;i<dummy+flash.data_delay;i++)
+    flash.clk(0, 0, din);
+
+  for(int i=0;i<len;i++) {
+    buf[i] = 0;
+    for(int b=0;b<8/width;b++) {
+      flash.clk(0, 0, din);
+      int bits = (width == 1)?((din >> 1) & 1):(din & mask);
+      buf[i] = (buf[i] << width) | bits;
+    }
+  }
+  flash.clk(1, 0, din);
+}
+
+// send a command without address on IO0
+static void model_cmd(const uint8_t *bytes, int len) {
+  unsigned char din = 0;
+
+  flash.clk(1, 0, din);
+  for(int i=0;i<8*len;i++)
+    flash.clk(0, (bytes[i/8] >> (7-(i&7))) & 1, din);
+  flash.clk(1, 0, din);
+}
+
+static int model_check(void) {
+  const struct {
+    int cmd, width, mode_clks, dummy;
+  } cmds[] = {
+    { 0x03, 1, 0, 0 },
+    { 0x0b, 1, 0, flash.dummy_fast },
+    { 0xbb, 2, 4, flash.dummy_dio },
+    { 0xeb, 4, 2, flash.dummy_qio } };
+
+  // quad IO needs the QE bit in status register 2
+  static const uint8_t vwe[] = { 0x50 }, wrsr2[] = { 0x31, 0x02 };
+  model_cmd(vwe, sizeof(vwe));
+  model_cmd(wrsr2, sizeof(wrsr2));
+
+  int errors = 0;
+  for(auto &c : cmds) {
+    // the second read of dual and quad IO runs in continuous read
+    // mode and the third one leaves it again
+    for(int n=0;n<3;n++) {
+      uint8_t buf[16];
+      uint32_t addr = rand() % (flash.size - sizeof(buf));
+      bool cont = c.mode_clks && n > 0;
+      int mode = (n < 2)?0x20:0xff;
+      unsigned long continued = flash.st.continued;
+
+      model_read(c.cmd, c.width, c.mode_clks, c.dummy, cont, addr, mode, buf, sizeof(buf));
+      if(memcmp(buf, flash.mem + addr, sizeof(buf))) {
+	printf("Model: cmd $%02x read at $%06x returned wrong data\n", c.cmd, addr);
+	errors++;
+      }
+      if(cont && flash.st.continued == continued) {
+	printf("Model: cmd $%02x didn't enter continuous read mode\n", c.cmd);
+	errors++;
+      }
+    }
+    if(flash.st.cont) {
+      printf("Model: cmd $%02x didn't leave continuous read mode\n", c.cmd);
+      errors++;
+    }
+  }
+  printf("Model check of $03/$0b/$bb/$eb: %s\n", errors?"FAILED":"ok");
+  return errors;
+}
+
+// ---------------- reads through flash_dspi.v ----------------
+static struct {
+  unsigned long count, errors;
+  uint64_t min, max, sum;
+} lat[2];
+
+// read a word and return its latency in clocks from cs to busy
+// going low again
+static int flash_read(uint32_t address, int type) {
+  tb->address = address;
+  tb->cs = 1;
+  run(1);
+  tb->cs = 0;
+
+  uint64_t start = clocks;
+  while(!tb->busy && clocks - start < 100) run(1);
+  while(tb->busy && clocks - start < 100) run(1);
+  uint64_t t = clocks - start;
+
+  uint32_t a = (2*address) % flash.size;
+  int expected = (flash.mem[a] << 8) | flash.mem[a+1];
+  if(tb->dout != expected || t >= 100) {
+    if(lat[type].errors++ < 10)
+      printf("Read $%06x: got $%04x, expected $%04x\n", address, tb->dout, expected);
+  }
+
+  if(!lat[type].count || t < lat[type].min) lat[type].min = t;
+  if(!lat[type].count || t > lat[type].max) lat[type].max = t;
+  lat[type].sum += t;
+  lat[type].count++;
+
+  // cs needs to be low for two clocks to detect the next rising edge
+  run(2);
+  return t;
+}
+
 int main(int argc, char **argv) {
   // Initialize Verilators variables
   Verilated::commandArgs(argc, argv);
+
+  const char *arg = Verilated::commandArgsPlusMatch("reads=");
+  int reads = arg[0]?atoi(arg+7):1000;
+  arg = Verilated::commandArgsPlusMatch("seed=");
+  srand(arg[0]?atoi(arg+6):1);
+  arg = Verilated::commandArgsPlusMatch("mhz=");
+  double mhz = arg[0]?atof(arg+5):100.0;
+
+  arg = Verilated::commandArgsPlusMatch("image=");
+  if(arg[0]) {
+    if(!flash.load(arg+7)) exit(-1);
+  } else
+    for(size_t i=0;i<flash.size;i++)
+      flash.mem[i] = (i * 2654435761u) >> 13;
+
   Verilated::traceEverOn(true);
-  trace = new VerilatedVcdC;
-  trace->spTrace()->set_time_unit("1ns");
-  trace->spTrace()->set_time_resolution("1ps");
   simulation_time = 0;
-  
+
   // Create an instance of our module under test
   tb = new Vflash;
-	
-  tb->trace(trace, 99);
-  trace->open("flash.vcd");
+
+  trace.open(tb);
+  trig_cs = trace.trigger_param("cs");
+  bench.start();
+
+  int errors = model_check();
+  flash.st.reads = flash.st.continued = flash.st.bytes = 0;
 
   tb->resetn = 0;
   tb->cs = 0;
   run(10);
   tb->resetn = 1;
 
-  run(100);
-  tb->address = 0x80000;
-  tb->cs= 1;
-  run(1);
-  tb->cs= 0;
-  
-  run(100);
-  tb->address = 0x80001;
-  tb->cs= 1;
-  run(1);
-  tb->cs= 0;
+  while(!tb->ready) run(1);
+  run(10);
+
+  // random reads, the first one sends the command byte
+  static const char *type_name[] = { "random", "sequential" };
+  for(int i=0;i<reads;i++)
+    flash_read(rand() & 0x3fffff, 0);
+
+  // sequential reads as done by the CPU fetching code
+  uint32_t address = rand() & 0x3fffff;
+  for(int i=0;i<reads;i++)
+    flash_read(address++ & 0x3fffff, 1);
+
+  printf("Read latency at %.0f MHz flash clock:\n", mhz);
+  printf("  %-12s %8s %8s %8s %8s %10s %8s\n", "reads", "count", "min", "avg", "max", "avg [ns]", "MB/s");
+  for(int t=0;t<2;t++) {
+    if(!lat[t].count) continue;
+    double avg = (double)lat[t].sum / lat[t].count;
+    printf("  %-12s %8lu %8lu %8.1f %8lu %10.1f %8.2f\n", type_name[t], lat[t].count,
+	   (unsigned long)lat[t].min, avg, (unsigned long)lat[t].max,
+	   1000 * avg / mhz, 2 * mhz / avg);
+    errors += lat[t].errors;
+  }
+  flash.report();
+
+  printf("%s\n", errors?"FAILED":"PASSED");
 
-  run(10000);
-  
-  trace->close();
+  trace.close();
+  bench.stop();
+  return errors?1:0;
 }
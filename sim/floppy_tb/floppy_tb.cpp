@@ -1,70 +1,117 @@
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <vector>
 
 #include "Vfloppy_tb.h"
 #include "verilated.h"
-#include "verilated_vcd_c.h"
 
 #include <ff.h>
 #include <diskio.h>
 
+#include "sdcard.h"
+#include "trace.h"
+#include "bench.h"
+#include "eventlog.h"
+
 FATFS fs;
 
 static Vfloppy_tb *tb;
-static VerilatedVcdC *trace;
+static TraceWindow trace("floppy_tb");
+static SimBench bench("floppy_tb", 32000000);
+static EventLog elog("floppy_tb");
 static double simulation_time;
+static SdCardModel *sd;
+
+// +dump=<file> stores the sector data read through the FDC or
+// written to the sd card
+static FILE *dump;
+
+// trace triggers: +trigger=fdc-cmd|sd-cmd:<n>, +trace_stop=fdc-irq|sd-cmd:<n>
+static bool trig_fdc_cmd = false, stop_fdc_irq = false;
+static int trig_sd_cmd = -1, stop_sd_cmd = -1;
 
 #define TICKLEN   (1.0/64000000)
 
-// Calculate CRC7
-// It's a 7 bit CRC with polynomial x^7 + x^3 + 1
-// input:
-//   crcIn - the CRC before (0 for first step)
-//   data - byte for CRC calculation
-// return: the new CRC7
-uint8_t CRC7_one(uint8_t crcIn, uint8_t data) {
-  const uint8_t g = 0x89;
-  uint8_t i;
-
-  crcIn ^= data;
-  for (i = 0; i < 8; i++) {
-    if (crcIn & 0x80) crcIn ^= g;
-    crcIn <<= 1;
-  }
-  
-  return crcIn;
-}
-
-// Calculate CRC16 CCITT
-// It's a 16 bit CRC with polynomial x^16 + x^12 + x^5 + 1
-// input:
-//   crcIn - the CRC before (0 for rist step)
-//   data - byte for CRC calculation
-// return: the CRC16 value
-uint16_t CRC16_one(uint16_t crcIn, uint8_t data) {
-  crcIn  = (uint8_t)(crcIn >> 8)|(crcIn << 8);
-  crcIn ^=  data;
-  crcIn ^= (uint8_t)(crcIn & 0xff) >> 4;
-  crcIn ^= (crcIn << 8) << 4;
-  crcIn ^= ((crcIn & 0xff) << 4) << 1;
-  
-  return crcIn;
+// stage markers of a sector read from the fdc command to its irq
+enum { M_CMD, M_IRQ, M_XLATE, M_SDCMD, M_DATA, M_DRQ, M_LAST_DRQ, M_FDC_IRQ, M_COUNT };
+static const char *marker_name[M_COUNT] = {
+  "fdc command", "sd request irq", "sector translated", "sd command",
+  "first sd data", "first drq", "last drq", "fdc irq" };
+static double marker[M_COUNT];
+static bool marking = false;
+
+// latencies between consecutive markers and of the whole read,
+// +latency=<file> also writes each read's markers as CSV
+static std::vector<double> stage_us[M_COUNT];
+static FILE *latency_csv;
+
+static void mark(int m) {
+  if(marking && marker[m] < 0) marker[m] = simulation_time;
 }
 
-uint8_t getCRC(unsigned char cmd, unsigned long arg) {
-  uint8_t CRC = CRC7_one(0, cmd);
-  for (int i=0; i<4; i++) CRC = CRC7_one(CRC, ((unsigned char*)(&arg))[3-i]);
-  return CRC;
+static void marks_start(void) {
+  for(int m=0;m<M_COUNT;m++) marker[m] = -1;
+  marking = true;
+}
+
+static void marks_done(int track, int sec) {
+  marking = false;
+
+  // stage i ends with marker i, the last "stage" is the total
+  for(int m=1;m<M_COUNT;m++)
+    if(marker[m] >= 0 && marker[m-1] >= 0)
+      stage_us[m].push_back(1e6*(marker[m] - marker[m-1]));
+  if(marker[M_FDC_IRQ] >= 0)
+    stage_us[M_CMD].push_back(1e6*(marker[M_FDC_IRQ] - marker[M_CMD]));
+
+  if(latency_csv) {
+    fprintf(latency_csv, "%d,%d", track, sec);
+    for(int m=1;m<M_COUNT;m++)
+      if(marker[m] >= 0) fprintf(latency_csv, ",%.3f", 1e6*(marker[m] - marker[M_CMD]));
+      else               fprintf(latency_csv, ",");
+    fprintf(latency_csv, "\n");
+  }
 }
 
-uint8_t getCRC_bytes(unsigned char *data, int len) {
-  uint8_t CRC = 0;
-  while(len--) CRC = CRC7_one(CRC, *data++);
-  return CRC;  
+// one histogram per stage with power of two buckets in us
+static void latency_report(void) {
+  if(stage_us[M_CMD].empty()) return;
+
+  printf("Sector read latency over %zu reads:\n", stage_us[M_CMD].size());
+  for(int m=1;m<=M_COUNT;m++) {
+    std::vector<double> &v = stage_us[m % M_COUNT];
+    if(v.empty()) continue;
+
+    double min = v[0], max = v[0], sum = 0;
+    int bucket[32] = { 0 };
+    for(double t : v) {
+      if(t < min) min = t;
+      if(t > max) max = t;
+      sum += t;
+      int b = 0;
+      while(b < 31 && t >= (1u << b)) b++;
+      bucket[b]++;
+    }
+
+    if(m < M_COUNT) printf("%s -> %s", marker_name[m-1], marker_name[m]);
+    else            printf("total");
+    printf(": n=%zu min %.1f avg %.1f max %.1f us\n", v.size(), min, sum/v.size(), max);
+
+    int first = 0, last = 31;
+    while(!bucket[first]) first++;
+    while(!bucket[last]) last--;
+    for(int b=first;b<=last;b++) {
+      printf("  %8u - %8u us |", b?(1u << (b-1)):0, 1u << b);
+      int len = (bucket[b] * 50 + v.size() - 1) / v.size();
+      for(int i=0;i<len;i++) putchar('#');
+      printf(" %d\n", bucket[b]);
+    }
+  }
 }
-  
+
 void hexdump(void *data, int size) {
   int i, b2c;
   int n=0;
@@ -87,302 +134,34 @@ void hexdump(void *data, int size) {
   }
 }
 
-unsigned long long reply(unsigned char cmd, unsigned long arg) {
-  unsigned long r = 0;
-  r |= ((unsigned long long)cmd) << 40;
-  r |= ((unsigned long long)arg) << 8;
-  r |= getCRC(cmd, arg);
-  r |= 1;
-  return r;
+static void sd_written(unsigned long sector, const unsigned char *data) {
+  printf("Data written to card:\n");
+  hexdump((void*)data, 512);
+  if(dump) fwrite(data, 1, 512, dump);
 }
 
-#define OCR  0xc0ff8000  // not busy, CCS=1(SDHC card), all voltage, not dual-voltage card
-#define RCA  0x0013
-
-// total cid respose is 136 bits / 17 bytes
-unsigned char cid[17] = "\x3f" "\x02TMS" "A08G" "\x14\x39\x4a\x67" "\xc7\x00\xe4";
-
-static uint64_t GetTickCountMs() {
-  struct timespec ts;
-  
-  clock_gettime(CLOCK_MONOTONIC, &ts);
-  return (uint64_t)(ts.tv_nsec / 1000000) + ((uint64_t)ts.tv_sec * 1000ull);
+static void sd_command(int cmd, unsigned long arg) {
+  if((cmd == 17 || cmd == 18) && marker[M_XLATE] >= 0) mark(M_SDCMD);
+  if(cmd == trig_sd_cmd) trace.trigger();
+  if(cmd == stop_sd_cmd) trace.stop();
 }
 
 void tick(int c) {
-  static uint64_t ticks = 0;
-  static unsigned long sector = 0xffffffff;
-  static unsigned long long flen;
-  static FILE *fd = NULL;
-  static uint8_t sector_data[520];   // 512 bytes + four 16 bit crcs
-  static long long cmd_in = -1;
-  static long long cmd_out = -1;
-  static unsigned char *cmd_ptr = 0;
-  static int cmd_bits = 0;
-  static unsigned char *dat_ptr = 0;
-  static int dat_bits = 0;
-  static int last_was_acmd = 0;
-  static int write_count = 0;
-  static int write_expect = 0;
-
   tb->clk = c; 
   tb->eval();
+  if(c) bench.cycle();
 
-  static int last_sdclk = -1;
-  
-  if(tb->sdclk != last_sdclk) {
-    // rising sd card clock edge
-    if(tb->sdclk) {
-      
-      // write postamble (ack + busy)
-      int ack_start = 580;
-      int busy_end  = 700;
-      int ack_token = 0b00101000;  // start bit 0, ack ok 010, stopbit 1, busy 000
-      if(write_count < 512) {
-	static unsigned char rbuf[520];
-         if(write_expect < 0) {
-          // wait for first data != 15
-          if(!(tb->sddat & 1))
-            write_expect = 1024+16;  // 1024 * 4 bit + 4 * 16 bit crc
-          
-	 } else if(write_expect > 0) {
-	   if((write_expect-1)&1)
-	     rbuf[519-((write_expect-1)/2)] = tb->sddat << 4;
-	   else
-	     rbuf[519-((write_expect-1)/2)] |= tb->sddat;
-	   
-	   //printf("Write %d %s = %x\n", (write_expect-1)/2,
-	   //	  ((write_expect-1)&1)?"hi":"lo",
-	   //	  rbuf[519-((write_expect-1)/2)]);
-	   
-	   write_expect--;
-	   if(write_expect == 0) {
-
-	    printf("Data written to card:\n");
-	    hexdump(rbuf, 512);
-	    
-            // done with data. verify checksum
-            unsigned short crc[4] = { 0,0,0,0 };
-            unsigned char dbits[4];
-            for(int i=0;i<512;i++) {
-              // calculate the crc for each data line seperately
-              for(int c=0;c<4;c++) {
-                if((i & 3) == 0) dbits[c] = 0;
-                dbits[c] = (dbits[c] << 2) |
-                  ((rbuf[i]&(0x10<<c))?2:0) | ((rbuf[i]&(0x01<<c))?1:0);      
-                if((i & 3) == 3) crc[c] = CRC16_one(crc[c], dbits[c]);
-              }
-            }
-
-            printf("WR DATA CRC = %04x/%04x/%04x/%04x\n",
-                   crc[0], crc[1], crc[2], crc[3]);
-
-            // extract sent crc from last 8 bytes
-            unsigned short s_crc[4] = { 0,0,0,0 };
-            for(int i=0;i<16;i++) {
-              int nibble = (rbuf[512+i/2] >> ((i&1)?0:4)) & 15;
-              s_crc[0] = (s_crc[0] << 1)|((nibble&1)?1:0);
-              s_crc[1] = (s_crc[1] << 1)|((nibble&2)?1:0);
-              s_crc[2] = (s_crc[2] << 1)|((nibble&4)?1:0);
-              s_crc[3] = (s_crc[3] << 1)|((nibble&8)?1:0);            
-            }
-            
-            printf("WR SENT CRC = %04x/%04x/%04x/%04x\n",
-                   s_crc[0], s_crc[1], s_crc[2], s_crc[3]);
-
-            write_count = 512;
-          }
-	}
- 	
-        // printf("WRITE %d = %d\n", write_count, tb->sddat);
-      } else if(write_count < busy_end) {
-        if(write_count < ack_start) tb->sddat_in = 15;
-        else if(write_count < ack_start+8)
-          tb->sddat_in = (ack_token & (0x80>>(write_count-ack_start)))?1:0;
-        else if(write_count < busy_end-1) tb->sddat_in = 0;
-        else                              tb->sddat_in = 15;
-
-        write_count++;
-      }
-    
-      cmd_in = ((cmd_in << 1) | tb->sdcmd) & 0xffffffffffffll;
-      
-      // sending 4 bits
-      if(dat_ptr && dat_bits) {
-        if(dat_bits == 128*8 + 16 + 1 + 1) {
-          // card sends start bit
-          tb->sddat_in = 0;
-          printf("READ-4 START\n");
-        } else if(dat_bits > 1) {
-          if(dat_bits == 128*8 + 16 + 1) printf("READ DATA START\n");
-          if(dat_bits == 1) printf("READ DATA END\n");
-          int nibble = dat_bits&1;   // 1: high nibble, 0: low nibble
-          if(nibble) tb->sddat_in = (*dat_ptr >> 4)&15;
-          else       tb->sddat_in = *dat_ptr++ & 15;
-        } else
-	  tb->sddat_in = 15;
-	
-        dat_bits--;
-      }
-      
-      if(cmd_ptr && cmd_bits) {
-        int bit = 7-((cmd_bits-1) & 7);
-        tb->sdcmd_in = (*cmd_ptr & (0x80>>bit))?1:0;
-        if(bit == 7) cmd_ptr++;
-        cmd_bits--;
-      } else {      
-        tb->sdcmd_in = (cmd_out & (1ll<<47))?1:0;
-        cmd_out = (cmd_out << 1)|1;
-      }
-
-      // check if bit 47 is 0, 46 is 1 and 0 is 1
-      if( !(cmd_in & (1ll<<47)) && (cmd_in & (1ll<<46)) && (cmd_in & (1ll<<0))) {
-        unsigned char cmd  = (cmd_in >> 40) & 0x7f;
-        unsigned long arg  = (cmd_in >>  8) & 0xffffffff;
-        unsigned char crc7 = cmd_in & 0xfe;
-
-        // r1 reply:
-        // bit 7 - 0
-        // bit 6 - parameter error
-        // bit 5 - address error
-        // bit 4 - erase sequence error
-        // bit 3 - com crc error
-        // bit 2 - illegal command
-        // bit 1 - erase reset
-        // bit 0 - in idle state
-
-        if(crc7 == getCRC(cmd, arg)) {
-          printf("%cCMD %2d, ARG %08lx\n", last_was_acmd?'A':' ', cmd & 0x3f, arg);
-          switch(cmd & 0x3f) {
-          case 0:  // Go Idle State
-            break;
-          case 8:  // Send Interface Condition Command
-            cmd_out = reply(8, arg);
-            break;
-          case 55: // Application Specific Command
-            cmd_out = reply(55, 0);
-            break;
-          case 41: // Send Host Capacity Support
-            cmd_out = reply(63, OCR);
-            break;
-          case 2:  // Send CID
-            cid[16] = getCRC_bytes(cid, 16) | 1;  // Adjust CRC
-            cmd_ptr = cid;
-            cmd_bits = 136;
-            break;
-           case 3:  // Send Relative Address
-            cmd_out = reply(3, (RCA<<16) | 0);  // status = 0
-            break;
-          case 7:  // select card
-            cmd_out = reply(7, 0);    // may indicate busy          
-            break;
-          case 6:  // set bus width
-            printf("Set bus width to %ld\n", arg);
-            cmd_out = reply(6, 0);
-            break;
-          case 16: // set block len (should be 512)
-            printf("Set block len to %ld\n", arg);
-            cmd_out = reply(16, 0);    // ok
-            break;
-          case 17:  // read block
-            printf("Request to read single block %ld\n", arg);
-            cmd_out = reply(17, 0);    // ok
-
-            // load sector
-            {
-	      // check for floppy data request
-	      if(!fd) {
-		fd = fopen("sd.img", "rb");
-		if(!fd) { perror("OPEN ERROR"); exit(-1); }
-		fseek(fd, 0, SEEK_END);
-		flen = ftello(fd);
-		printf("Image size is %lld\n", flen);
-		fseek(fd, 0, SEEK_SET);
-	      }
-	      
-              fseek(fd, 512 * arg, SEEK_SET);
-              int items = fread(sector_data, 2, 256, fd);
-              if(items != 256) perror("fread()");
-
-	      // for(int i=0;i<16;i++) printf("%02x ", sector_data[i]);
-              // printf("\n");
-            }
-            {
-              unsigned short crc[4] = { 0,0,0,0 };
-              unsigned char dbits[4];
-              for(int i=0;i<512;i++) {
-                // calculate the crc for each data line seperately
-                for(int c=0;c<4;c++) {
-                  if((i & 3) == 0) dbits[c] = 0;
-                  dbits[c] = (dbits[c] << 2) | ((sector_data[i]&(0x10<<c))?2:0) | ((sector_data[i]&(0x01<<c))?1:0);      
-                  if((i & 3) == 3) crc[c] = CRC16_one(crc[c], dbits[c]);
-                }
-              }
-
-              printf("CRC = %04x/%04x/%04x/%04x\n", crc[0], crc[1], crc[2], crc[3]);
-
-              // append crc's to sector_data
-              for(int i=0;i<8;i++) sector_data[512+i] = 0;
-              for(int i=0;i<16;i++) {
-                int crc_nibble =
-                  ((crc[0] & (0x8000 >> i))?1:0) +
-                  ((crc[1] & (0x8000 >> i))?2:0) +
-                  ((crc[2] & (0x8000 >> i))?4:0) +
-                  ((crc[3] & (0x8000 >> i))?8:0);
-
-                sector_data[512+i/2] |= (i&1)?(crc_nibble):(crc_nibble<<4);
-              }
-            }
-            dat_ptr = sector_data;
-            dat_bits = 128*8 + 16 + 1 + 1;
-	    break;
-            
-          case 24:  // write block
-            printf("Request to write single block %ld\n", arg);
-            write_count = 0;
-	    write_expect = -1;  
-            cmd_out = reply(24, 0);    // ok
-            break;
-            
-          default:
-            printf("unexpected command\n");
-          }
-
-          last_was_acmd = (cmd & 0x3f) == 55;
-          
-          cmd_in = -1;
-        } else
-          printf("CMD %02x, ARG %08lx, CRC7 %02x != %02x!!\n", cmd, arg, crc7, getCRC(cmd, arg));         
-      }      
-    }      
-    last_sdclk = tb->sdclk;
-  }
-  
-
-      
-  if(simulation_time == 0)
-    ticks = GetTickCountMs();
-
-#if 0 // now obsolete sd_fake interface
-  static int last_rdreq = 0;
-  if(c && tb->rdreq) {
-    int s = tb->rdaddr / 256;
-    if(s != sector) {
-      printf("Loading sector %d\n", s);
-      fseek(fd, 512 * s, SEEK_SET);
-      fread(sector_data, 2, 256, fd);
-      sector = s;
-    }
-    
-    //    if(last_rdreq == 0) printf("Read word 0x%lx sector %ld/%ld\n", tb->rdaddr, tb->rdaddr/256, tb->rdaddr & 255);
-    if(tb->rdaddr < flen/2) tb->rddata = sector_data[tb->rdaddr & 255];
-    else                    tb->rddata = 0xa5a5;
+  sd->tick(tb);
 
+  if(trig_fdc_cmd && tb->cpu_sel && !tb->cpu_rw && tb->cpu_addr == 0) trace.trigger();
+  if(stop_fdc_irq && tb->irq) trace.stop();
+  if(marking) {
+    if(tb->sd_irq) mark(M_IRQ);
+    if(marker[M_SDCMD] >= 0 && tb->sddat_in != 15) mark(M_DATA);
+    if(tb->irq) mark(M_FDC_IRQ);
   }
-  last_rdreq = tb->rdreq;
-#endif
-  
-  trace->dump(1000000000000 * simulation_time);
+  elog.now = 1000000000000 * simulation_time;
+  trace.dump(elog.now);
   simulation_time += TICKLEN;
 }
 
@@ -575,6 +354,13 @@ void mcu_write_sector(unsigned long sector, unsigned char *buffer) {
 }
 
 void mcu_poll(int quiet) {
+  // acknowledge the interrupt like the MCU's sysctrl access does
+  if(tb->sd_irq) {
+    tb->sd_iack = 1;
+    run(1);
+    tb->sd_iack = 0;
+  }
+
   // MCU requests sd card status
   unsigned char status = mcu_write_byte(0x01, 1);  
   unsigned char request = mcu_write_byte(0, 0);
@@ -616,24 +402,28 @@ void mcu_poll(int quiet) {
 
     // write sector number to load
     for(int i=0;i<4;i++) mcu_write_byte((dsector >> 8*(3-i))&0xff, 0);    
+    mark(M_XLATE);
   }
 }
 
-void read_sector(int track, int sec) {
+void read_sector(int track, int sec, bool verbose = true) {
   // this poll should return no request to load a sector
-  mcu_poll(0);
+  mcu_poll(!verbose);
   
   // fdc read a sector
   printf("FDC: READ_SECTOR %d/%d\n", track, sec);
   cpu_write(1, track); // track
   cpu_write(2, sec);   // sector
   cpu_write(3, 0x00);  // data 0 ?
+  marks_start();
   cpu_write(0, 0x88);  // read sector, spinup
+  mark(M_CMD);
 
-  wait_ns(1000);
+  // the MCU reacts on the sd card's interrupt
+  for(int t=0;t<1000 && !tb->sd_irq;t++) wait_ns(1000);
 
   // this poll should see a request and handle it
-  mcu_poll(0);
+  mcu_poll(!verbose);
   
   // reading data should generate 512 drq's until a irq is generated
   int i = 0;
@@ -641,15 +431,20 @@ void read_sector(int track, int sec) {
   while(!tb->irq) {
     wait_ns(100);
     if(tb->drq) {
+      mark(M_DRQ);
+      marker[M_LAST_DRQ] = simulation_time;
       int data = cpu_read(3);      
       if(i < 1024) buffer[i] = data;
       i++;
     }
   }
+  marks_done(track, sec);
+
   // read status to clear interrupt
   printf("READ_SECTOR done, read %d bytes, status = %x\n", i, cpu_read(0));
   
-  hexdump(buffer, i);
+  if(verbose) hexdump(buffer, i);
+  if(dump) fwrite(buffer, 1, (i < 1024)?i:1024, dump);
 }
 
 void write_sector(int track, int sec) {  
@@ -764,17 +559,52 @@ int fs_init() {
 int main(int argc, char **argv) {
   // Initialize Verilators variables
   Verilated::commandArgs(argc, argv);
+
+  // +image=<file> is the sd card image, default sd.img
+  const char *arg = Verilated::commandArgsPlusMatch("image=");
+  sd = new SdCardModel(arg[0]?strdup(arg+7):"sd.img");
+
+  // +sidecar keeps sectors written to the sd card in <image>.cow
+  if(Verilated::commandArgsPlusMatch("sidecar")[0])
+    sd->image.use_sidecar();
+
+  // +op=read|write, +track=<n> and +sector=<n> select the fdc command
+  arg = Verilated::commandArgsPlusMatch("op=");
+  bool op_read = arg[0] && !strcmp(arg+4, "read");
+  arg = Verilated::commandArgsPlusMatch("track=");
+  int track = arg[0]?atoi(arg+7):0;
+  arg = Verilated::commandArgsPlusMatch("sector=");
+  int sec = arg[0]?atoi(arg+8):3;
+
+  // +reads=<n> reads n random sectors instead, +seed=<n> varies them
+  arg = Verilated::commandArgsPlusMatch("reads=");
+  int reads = arg[0]?atoi(arg+7):0;
+  arg = Verilated::commandArgsPlusMatch("seed=");
+  srand(arg[0]?atoi(arg+6):1);
+
+  arg = Verilated::commandArgsPlusMatch("dump=");
+  if(arg[0] && !(dump = fopen(arg+6, "wb"))) { perror(arg+6); exit(-1); }
+  arg = Verilated::commandArgsPlusMatch("latency=");
+  if(arg[0]) {
+    if(!(latency_csv = fopen(arg+9, "w"))) { perror(arg+9); exit(-1); }
+    fprintf(latency_csv, "track,sector");
+    for(int m=1;m<M_COUNT;m++) fprintf(latency_csv, ",%s", marker_name[m]);
+    fprintf(latency_csv, "\n");
+  }
   Verilated::traceEverOn(true);
-  trace = new VerilatedVcdC;
-  trace->spTrace()->set_time_unit("1ns");
-  trace->spTrace()->set_time_resolution("1ps");
   simulation_time = 0;
   
   // Create an instance of our module under test
   tb = new Vfloppy_tb;
 	
-  tb->trace(trace, 99);
-  trace->open("floppy_tb.vcd");
+  trace.open(tb);
+  sd->attach(elog);
+  elog.setup();
+  trig_fdc_cmd = trace.trigger_param("fdc-cmd");
+  stop_fdc_irq = trace.stop_param("fdc-irq");
+  if(trace.trigger_param("sd-cmd")) trig_sd_cmd = atoi(trace.trigger_param("sd-cmd"));
+  if(trace.stop_param("sd-cmd"))    stop_sd_cmd = atoi(trace.stop_param("sd-cmd"));
+  bench.start();
 
   tb->reset = 0;
   tb->cpu_addr = 0;
@@ -785,8 +615,11 @@ int main(int argc, char **argv) {
   tb->mcu_dout = 0;
   tb->mcu_start = 0;
   tb->mcu_strobe = 0;
+  tb->sd_iack = 0;
 
   tb->sdcmd_in = 1; tb->sddat_in = 15;  // inputs of sd card
+  sd->write_cb = sd_written;
+  sd->cmd_cb = sd_command;
  
   run(10);
   tb->reset = 1;
@@ -821,8 +654,12 @@ int main(int argc, char **argv) {
 
   wait_ms(40);
 
-  // read_sector(0, 3);  
-  write_sector(0, 3);  
+  if(reads) {
+    // a double sided 720k disk has 80 tracks of 9 sectors per side
+    for(int i=0;i<reads;i++)
+      read_sector(rand() % 80, 1 + rand() % 9, false);
+  } else if(op_read) read_sector(track, sec);
+  else               write_sector(track, sec);
 
   wait_ms(10);
   
@@ -831,5 +668,13 @@ int main(int argc, char **argv) {
 #endif
 #endif
   
-  trace->close();
+  if(sd->crc_errors)
+    printf("%d sector(s) written with bad crc\n", sd->crc_errors);
+  latency_report();
+
+  if(dump) fclose(dump);
+  if(latency_csv) fclose(latency_csv);
+
+  trace.close();
+  bench.stop();
 }
@@ -18,6 +18,10 @@ module floppy_tb(
   input [7:0] 	   mcu_dout,
   output [7:0] 	   mcu_din,
 
+  // sd card request interrupt, acknowledged by the mcu
+  output 	   sd_irq,
+  input 	   sd_iack,
+
   output 	   sdclk,
   output 	   sdcmd,
   input 	   sdcmd_in,
@@ -102,6 +106,9 @@ sd_card #(
 
     .image_mounted(),
     .image_size(),
+
+    .irq(sd_irq),
+    .iack(sd_iack),
 	   
     // user read sector command interface (sync with clk)
     .rstart({1'b0,sd_rd}), 
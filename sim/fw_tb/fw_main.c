@@ -0,0 +1,97 @@
+/*
+  fw_main.c
+
+  Host replacement of the firmware's main.c for fw_tb. It does the
+  same FPGA handshake and runs the same OSD task, but without USB and
+  the flasher, which have no counterpart in the simulation.
+*/
+
+#include <stdio.h>
+
+#include <FreeRTOS.h>
+#include <queue.h>
+#include <timers.h>
+
+#include "bflb_gpio.h"
+#include "bflb_mtimer.h"
+
+#include "menu.h"
+#include "sdc.h"
+#include "sysctrl.h"
+
+struct bflb_device_s *gpio;
+
+// queue to forward events to the OSD task
+QueueHandle_t xQueue = NULL;
+
+static spi_t *spi = NULL;
+
+// usually in usb_host.c. Reading the DB9 state enables its interrupts
+void hid_handle_event(void) {
+  spi_begin(spi);
+  spi_tx_u08(spi, SPI_TARGET_HID);
+  spi_tx_u08(spi, SPI_HID_GET_DB9);
+  spi_tx_u08(spi, 0x00);
+  unsigned char db9 = spi_tx_u08(spi, 0x00);
+  spi_end(spi);
+
+  printf("DB9: %02x\r\n", db9);
+}
+
+static void osd_timer(TimerHandle_t pxTimer) {
+  static long msg = -1;
+  xQueueSendToBack(xQueue, &msg,  ( TickType_t ) 0);
+}
+
+static void osd_task(void *parms) {
+  menu_t *menu;
+  spi_t *spi = (spi_t*)parms;
+
+  printf("OSD task\r\n");
+
+  // switch MCU controlled leds off
+  sys_set_leds(spi, 0x00);
+
+  menu = menu_init(spi);
+  menu_do(menu, 0);
+
+  menu->osd->timer = xTimerCreate("OSD timer", pdMS_TO_TICKS(40), pdTRUE,
+				  NULL, osd_timer);
+  while(1) {
+    long cmd;
+    xQueueReceive( xQueue, &cmd, 0xffffffffUL);
+    menu_do(menu, cmd);
+  }
+}
+
+void fw_main(void *parms) {
+  TaskHandle_t osd_handle;
+
+  gpio = bflb_device_get_by_name("gpio");
+  spi = spi_init();
+
+  printf("Waiting for FPGA to become ready\r\n");
+
+  int fpga_ok, timeout = 500;
+  do {
+    fpga_ok = sys_status_is_valid(spi);
+    if(!fpga_ok) {
+      bflb_mtimer_delay_ms(10);
+      timeout--;
+    }
+  } while(timeout && !fpga_ok);
+
+  if(timeout) {
+    printf("FPGA ready after %dms!\r\n", (500-timeout)*10);
+    sys_set_val(spi, 'R', 3);    // immediately set reset as the config may change
+    sys_set_rgb(spi, 0x000040);  // blue
+  } else {
+    printf("FPGA not ready after 5 seconds!\r\n");
+    sys_set_rgb(spi, 0x400000);  // red
+  }
+
+  xQueue = xQueueCreate(10, sizeof( long ) );
+  xTaskCreate(osd_task, (char *)"osd_task", 4096, spi, configMAX_PRIORITIES-3, &osd_handle);
+
+  vTaskStartScheduler();
+}
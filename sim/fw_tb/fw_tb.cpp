@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+#include "Vfw_tb.h"
+#include "verilated.h"
+
+#include "sdcard.h"
+#include "trace.h"
+#include "bench.h"
+#include "eventlog.h"
+#include "bl616_shim.h"
+
+// the firmware's main() replacement in fw_main.c
+extern "C" void fw_main(void *);
+
+static Vfw_tb *tb;
+static TraceWindow trace("fw_tb");
+static SimBench bench("fw_tb", 32000000);
+static EventLog elog("fw_tb");
+static Bl616Shim mcu(64000000);
+static double simulation_time;
+static SdCardModel *sd;
+
+// +dump=<file> stores the sector data read through the FDC
+static FILE *dump;
+
+// trace triggers: +trigger=fdc-cmd|mcu-irq|sd-cmd:<n>, +trace_stop=fdc-irq|sd-cmd:<n>
+static bool trig_fdc_cmd = false, trig_mcu_irq = false, stop_fdc_irq = false;
+static int trig_sd_cmd = -1, stop_sd_cmd = -1;
+
+#define TICKLEN   (1.0/64000000)
+
+// latency of a sector request of the fdc, split into the time until
+// the firmware takes the interrupt, the time the firmware needs to
+// translate the sector and start the core's sd card access and the
+// time of the sd card access itself
+enum { ST_IRQ, ST_FW, ST_CARD, ST_TOTAL, ST_COUNT };
+static const char *stage_name[ST_COUNT] = {
+  "request to MCU interrupt", "interrupt to sd card start",
+  "sd card access", "total" };
+
+static struct {
+  double min, max, sum;
+  int count;
+} stage[ST_COUNT];
+
+static struct {
+  bool pending;
+  double t_req, t_irq, t_card;
+  uint64_t irq;
+  int last_rw, last_busy, last_done;
+} req;
+
+static void stage_add(int s, double t) {
+  if(!stage[s].count || t < stage[s].min) stage[s].min = t;
+  if(!stage[s].count || t > stage[s].max) stage[s].max = t;
+  stage[s].sum += t;
+  stage[s].count++;
+}
+
+static void latency_track(void) {
+  int rw = tb->sd_rd || tb->sd_wr;
+
+  if(rw && !req.last_rw && !req.pending) {
+    req.pending = true;
+    req.t_req = simulation_time;
+    req.t_irq = req.t_card = -1;
+    req.irq = mcu.last_irq;
+  }
+
+  if(req.pending) {
+    if(req.t_irq < 0 && mcu.last_irq != req.irq)
+      req.t_irq = simulation_time;
+
+    if(req.t_irq >= 0 && req.t_card < 0 && tb->sd_busy && !req.last_busy)
+      req.t_card = simulation_time;
+
+    if(req.t_card >= 0 && tb->sd_done && !req.last_done) {
+      stage_add(ST_IRQ,   req.t_irq - req.t_req);
+      stage_add(ST_FW,    req.t_card - req.t_irq);
+      stage_add(ST_CARD,  simulation_time - req.t_card);
+      stage_add(ST_TOTAL, simulation_time - req.t_req);
+      req.pending = false;
+    }
+  }
+
+  req.last_rw = rw;
+  req.last_busy = tb->sd_busy;
+  req.last_done = tb->sd_done;
+}
+
+static void sd_command(int cmd, unsigned long arg) {
+  if(cmd == trig_sd_cmd) trace.trigger();
+  if(cmd == stop_sd_cmd) trace.stop();
+}
+
+void tick(int c) {
+  static uint64_t last_irq;
+
+  tb->clk = c;
+  tb->eval();
+  if(c) bench.cycle();
+
+  sd->tick(tb);
+  mcu.tick(tb);
+  latency_track();
+
+  if(trig_fdc_cmd && tb->cpu_sel && !tb->cpu_rw && tb->cpu_addr == 0) trace.trigger();
+  if(trig_mcu_irq && mcu.last_irq != last_irq) trace.trigger();
+  if(stop_fdc_irq && tb->irq) trace.stop();
+  last_irq = mcu.last_irq;
+
+  elog.now = 1000000000000 * simulation_time;
+  trace.dump(elog.now);
+  simulation_time += TICKLEN;
+}
+
+void run(int ticks) {
+  for(int i=0;i<ticks;i++) {
+    tick(1);
+    tick(0);
+  }
+}
+
+void wait_ms(int ms) { run(32000*ms); }
+void wait_ns(int ns) { run((32*ns)/1000); }
+
+void wait_clk8() {
+  run(1);
+  while(!tb->clk8m_en) run(1);
+}
+
+void cpu_write(int reg, int val) {
+  wait_clk8();
+
+  tb->cpu_addr = reg;
+  tb->cpu_sel = 1;
+  tb->cpu_rw = 0;
+  tb->cpu_din = val;
+
+  wait_clk8();
+  tb->cpu_sel = 0;
+}
+
+int cpu_read(int reg) {
+  wait_clk8();
+
+  tb->cpu_addr = reg;
+  tb->cpu_sel = 1;
+  tb->cpu_rw = 1;
+
+  wait_clk8();
+  tb->cpu_sel = 0;
+
+  return tb->cpu_dout;
+}
+
+// run until the firmware has mounted the image and released the
+// core's reset, returns false on timeout
+bool wait_boot(int timeout_ms) {
+  bool in_reset = false;
+  for(int ms=0;ms<timeout_ms;ms++) {
+    for(int i=0;i<32000;i++) {
+      run(1);
+      if(tb->system_reset == 3) in_reset = true;
+      if(in_reset && !tb->system_reset) {
+	printf("Firmware released core reset after %.3fms\n", simulation_time*1000);
+	return true;
+      }
+    }
+  }
+  return false;
+}
+
+// read a sector through the fdc, returns the number of bytes read
+int read_sector(int track, int sec, int timeout_ms) {
+  printf("FDC: READ_SECTOR %d/%d\n", track, sec);
+  cpu_write(1, track); // track
+  cpu_write(2, sec);   // sector
+  cpu_write(0, 0x88);  // read sector, spinup
+
+  // the firmware serves the sd card request, reading data should
+  // generate 512 drq's until a irq is generated
+  int i = 0;
+  unsigned char buffer[512];
+  double t_end = simulation_time + timeout_ms / 1000.0;
+  while(!tb->irq && simulation_time < t_end) {
+    wait_ns(100);
+    if(tb->drq) {
+      int data = cpu_read(3);
+      if(i < 512) buffer[i] = data;
+      i++;
+    }
+  }
+  if(!tb->irq) {
+    printf("READ_SECTOR timed out after %d bytes\n", i);
+    return -1;
+  }
+
+  // read status to clear interrupt
+  printf("READ_SECTOR done, read %d bytes, status = %x\n", i, cpu_read(0));
+  if(dump) fwrite(buffer, 1, (i < 512)?i:512, dump);
+  return i;
+}
+
+void report(void) {
+  printf("MCU: %lu SPI transactions, %lu bytes, %lu interrupts\n",
+	 (unsigned long)mcu.spi_transactions, (unsigned long)mcu.spi_bytes,
+	 (unsigned long)mcu.interrupts);
+
+  printf("Sector request latency over %d requests:\n", stage[ST_TOTAL].count);
+  printf("  %-28s %10s %10s %10s\n", "stage [us]", "min", "avg", "max");
+  for(int s=0;s<ST_COUNT;s++) {
+    if(!stage[s].count) continue;
+    printf("  %-28s %10.1f %10.1f %10.1f\n", stage_name[s], 1e6*stage[s].min,
+	   1e6*stage[s].sum/stage[s].count, 1e6*stage[s].max);
+  }
+}
+
+int main(int argc, char **argv) {
+  // Initialize Verilators variables
+  Verilated::commandArgs(argc, argv);
+
+  // +image=<file> is the sd card image, default sd.img. It has to
+  // contain a disk_a.st in its root directory
+  const char *arg = Verilated::commandArgsPlusMatch("image=");
+  sd = new SdCardModel(arg[0]?strdup(arg+7):"sd.img");
+
+  // +track=<n> and +sectors=<n> select the sectors read through the fdc
+  arg = Verilated::commandArgsPlusMatch("track=");
+  int track = arg[0]?atoi(arg+7):0;
+  arg = Verilated::commandArgsPlusMatch("sectors=");
+  int sectors = arg[0]?atoi(arg+9):9;
+
+  // +timeout=<ms> limits the firmware boot and each sector read
+  arg = Verilated::commandArgsPlusMatch("timeout=");
+  int timeout = arg[0]?atoi(arg+9):3000;
+
+  arg = Verilated::commandArgsPlusMatch("dump=");
+  if(arg[0] && !(dump = fopen(arg+6, "wb"))) { perror(arg+6); exit(-1); }
+  Verilated::traceEverOn(true);
+  simulation_time = 0;
+
+  // Create an instance of our module under test
+  tb = new Vfw_tb;
+
+  trace.open(tb);
+  sd->attach(elog);
+  mcu.attach(elog);
+  elog.setup();
+  trig_fdc_cmd = trace.trigger_param("fdc-cmd");
+  trig_mcu_irq = trace.trigger_param("mcu-irq");
+  stop_fdc_irq = trace.stop_param("fdc-irq");
+  if(trace.trigger_param("sd-cmd")) trig_sd_cmd = atoi(trace.trigger_param("sd-cmd"));
+  if(trace.stop_param("sd-cmd"))    stop_sd_cmd = atoi(trace.stop_param("sd-cmd"));
+  bench.start();
+
+  tb->reset = 1;
+  tb->cpu_addr = 0;
+  tb->cpu_sel = 0;
+  tb->cpu_rw = 1;
+  tb->cpu_din = 0;
+  tb->spi_io_ss = 1;
+  tb->spi_io_clk = 0;
+  tb->spi_io_din = 0;
+
+  tb->sdcmd_in = 1; tb->sddat_in = 15;  // inputs of sd card
+  sd->cmd_cb = sd_command;
+
+  run(10);
+  tb->reset = 0;
+
+  // the MCU boots while the FPGA is already running
+  mcu.start(fw_main);
+
+  int failed = 0;
+  if(!wait_boot(timeout)) {
+    printf("Firmware didn't boot within %dms\n", timeout);
+    failed = 1;
+  } else {
+    printf("RESTORE\n");
+    cpu_write(0, 0x0b);  // Restore, Motor on, 6ms
+    while(cpu_read(0) & 0x01) wait_ms(1);  // wait for end of command
+    printf("RESTORE done\n");
+
+    for(int sec=1;sec<=sectors && !failed;sec++)
+      if(read_sector(track, sec, timeout) != 512)
+	failed = 1;
+  }
+
+  report();
+
+  if(dump) fclose(dump);
+
+  trace.close();
+  bench.stop();
+  return failed;
+}
@@ -0,0 +1,206 @@
+// fw_tb.v
+//
+// FPGA side of the MCU co-simulation. The MCU SPI interface, the
+// system control with its interrupt logic, the sd card and the fdc
+// wired as in the Tang Nano 20k top, driven by the real BL616
+// firmware running on the host.
+
+module fw_tb(
+  input 	   clk,
+  input 	   reset,
+  output 	   clk8m_en,
+
+  // fdc interface		 
+  input [1:0] 	   cpu_addr,
+  input 	   cpu_sel,
+  input 	   cpu_rw,
+  input [7:0] 	   cpu_din,
+  output [7:0]     cpu_dout,
+
+  output 	   irq,
+  output 	   drq,
+
+  // SPI connection to the MCU
+  input 	   spi_io_ss,
+  input 	   spi_io_clk,
+  input 	   spi_io_din,
+  output 	   spi_io_dout,
+  output 	   spi_irq_n,
+
+  // state set by the MCU
+  output [1:0]     system_reset,
+  output [23:0]    color,
+
+  // fdc requests and sd card state for the latency measurement
+  output 	   sd_rd,
+  output 	   sd_wr,
+  output 	   sd_busy,
+  output 	   sd_done,
+
+  output 	   sdclk,
+  output 	   sdcmd,
+  input 	   sdcmd_in,
+  output [3:0] 	   sddat,
+  input [3:0] 	   sddat_in
+);
+
+reg [1:0] cnt_8mhz;  
+always @(posedge clk)
+  cnt_8mhz <= cnt_8mhz + 2'd1; 
+
+assign clk8m_en = cnt_8mhz == 2'd0;
+
+wire       mcu_sys_strobe;
+wire       mcu_hid_strobe;
+wire       mcu_osd_strobe;
+wire       mcu_sdc_strobe;
+wire       mcu_start;
+wire [7:0] mcu_data_out;  
+
+wire [7:0] sys_data_out;  
+wire [7:0] sdc_data_out;
+
+mcu_spi mcu (
+        .clk(clk),
+        .reset(reset),
+
+        .spi_io_ss(spi_io_ss),
+        .spi_io_clk(spi_io_clk),
+        .spi_io_din(spi_io_din),
+        .spi_io_dout(spi_io_dout),
+
+        .mcu_sys_strobe(mcu_sys_strobe),
+        .mcu_hid_strobe(mcu_hid_strobe),
+        .mcu_osd_strobe(mcu_osd_strobe),
+        .mcu_sdc_strobe(mcu_sdc_strobe),
+        .mcu_start(mcu_start),
+        .mcu_dout(mcu_data_out),
+        .mcu_sys_din(sys_data_out),
+        .mcu_hid_din(8'h00),
+        .mcu_osd_din(8'h55),
+        .mcu_sdc_din(sdc_data_out)
+        );
+
+wire [7:0] int_ack;
+wire	   sdc_int;
+wire	   sdc_iack = int_ack[3];
+
+sysctrl sysctrl (
+        .clk(clk),
+        .reset(reset),
+
+        .data_in_strobe(mcu_sys_strobe),
+        .data_in_start(mcu_start),
+        .data_in(mcu_data_out),
+        .data_out(sys_data_out),
+
+        .system_chipset(),
+        .system_memory(),
+        .system_video(),
+        .system_reset(system_reset),
+        .system_scanlines(),
+        .system_volume(),
+        .system_wide_screen(),
+        .system_floppy_wprot(),
+        .system_cubase_en(),
+        .system_port_mouse(),
+
+        .int_out_n(spi_irq_n),
+        .int_in( { 4'b0000, sdc_int, 3'b000 }),
+        .int_ack( int_ack ),
+
+        .buttons( 2'b00 ),
+        .leds(),
+        .color(color)
+         );   
+
+wire [7:0]  sd_rd_data;
+wire [7:0]  sd_wr_data;
+wire [31:0] sd_lba;  
+wire [8:0]  sd_byte_index;
+wire	    sd_rd_byte_strobe;
+wire [31:0] sd_img_size;
+wire [3:0]  sd_img_mounted;
+
+fdc1772 #( .FD_NUM(1'b1) ) fdc1772 
+(
+ .clkcpu(clk), // system cpu clock.
+ .clk8m_en(cnt_8mhz == 2'd2),
+
+ // external set signals
+ .floppy_drive(1'b0),
+ .floppy_side(1'b1), 
+ .floppy_reset(!reset && !system_reset[0]),
+ .floppy_step(),
+ .floppy_motor(1'b1),   // not used in ST
+ .floppy_ready(),
+ 
+ // interrupts
+ .irq(irq),
+ .drq(drq), // data request
+ 
+ .cpu_addr(cpu_addr),
+ .cpu_sel(cpu_sel),
+ .cpu_rw(cpu_rw),
+ .cpu_din(cpu_din),
+ .cpu_dout(cpu_dout),
+ 
+ // image reported by the MCU
+ .img_type(3'd1),       // atari st
+ .img_mounted(sd_img_mounted[0]),
+ .img_wp(1'b0),         // write protect
+ .img_ds(1'd0),         // double-sided image (for BBC Micro only)
+ .img_size(sd_img_size),
+
+ .sd_lba(sd_lba),
+ .sd_rd(sd_rd),
+ .sd_wr(sd_wr),
+ .sd_ack(sd_busy),
+ .sd_buff_addr(sd_byte_index),
+ .sd_dout(sd_rd_data),
+ .sd_din(sd_wr_data),
+ .sd_dout_strobe(sd_rd_byte_strobe)
+);
+   
+sd_card #(
+    .CLK_DIV(3'd1),                    // for 32 Mhz clock
+    .SIMULATE(1'b1)
+) sd_card (
+    .rstn(!reset),
+    .clk(clk),
+
+    // SD card signals
+    .sdclk(sdclk),
+    .sdcmd(sdcmd),
+    .sdcmd_in(sdcmd_in),
+    .sddat(sddat),
+    .sddat_in(sddat_in),
+
+    // mcu interface
+    .data_strobe(mcu_sdc_strobe),
+    .data_start(mcu_start),
+    .data_in(mcu_data_out),
+    .data_out(sdc_data_out),
+
+    .image_size(sd_img_size),
+    .image_mounted(sd_img_mounted),
+
+    // interrupt to signal communication request
+    .irq(sdc_int),
+    .iack(sdc_iack),
+	   
+    // user read sector command interface (sync with clk)
+    .rstart({3'b000,sd_rd}), 
+    .wstart({3'b000,sd_wr}), 
+    .rsector(sd_lba),
+    .rbusy(sd_busy),
+    .rdone(sd_done),
+		 
+    // sector data output interface (sync with clk)
+    .inbyte(sd_wr_data),
+    .outen(sd_rd_byte_strobe), // when outen=1, a byte of sector content is read out from outbyte
+    .outaddr(sd_byte_index),   // outaddr from 0 to 511, because the sector size is 512
+    .outbyte(sd_rd_data)       // a byte of sector content
+);
+
+endmodule
@@ -0,0 +1,451 @@
+/*
+  ikbd_tb.cpp
+
+  Latency of the keyboard and mouse path from the MCU to the 68000.
+  Key and relative mouse events are sent over SPI the way the BL616
+  firmware sends them (usb_host.c). An event ends when its scan code
+  or mouse packet can be read from the keyboard ACIA, i.e. when the
+  ACIA raises its interrupt towards the MFP. The CPU side reads every
+  byte right away like the TOS interrupt handler does:
+
+    +keys=<n>        key presses, each followed by its release, default 20
+    +moves=<n>       relative mouse movements, default 10
+    +max_move=<n>    largest movement per axis in counts, default 8
+    +gap=<ms>        minimum time between events, default 20. The
+                     actual gap is up to twice as long so events hit
+                     the IKBD's scan loop at all phases
+    +hold=<ms>       time a key is held down, default 30
+    +boot=<ms>       time the IKBD gets to start up, default 200
+    +timeout=<ms>    time after which an event counts as lost, default 100
+    +spi_mhz=<f>     SPI clock, default 20
+    +seed=<n>        seed of the random events
+    +csv=<file>      per event timestamps
+
+  The latency is broken down at the matrix update in hid.v, the
+  first quadrature step of the mouse, the start bit sent by the IKBD
+  and the ACIA interrupt. All times are in microseconds. The mouse
+  movement is compared by magnitude per axis as the IKBD may split
+  it into several packets.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+#include "Vikbd_tb.h"
+#include "verilated.h"
+
+#include "trace.h"
+#include "bench.h"
+
+static Vikbd_tb *tb;
+static TraceWindow trace("ikbd_tb");
+static SimBench bench("ikbd_tb", 32000000);
+static uint64_t tickcount, clocks;
+
+#define TICKLEN_PS  15625   // 64 MHz half clock ticks
+#define CLK_HZ      32000000.0
+
+// trace trigger: +trigger=event:<n>
+static long trig_event = -1;
+
+static double us(uint64_t c) { return c * 1e6 / CLK_HZ; }
+static uint64_t ms_clocks(double ms) { return ms * CLK_HZ / 1000; }
+
+// ---------------- keys ----------------
+// matrix position as sent by the firmware (atari_st.h) and the scan
+// code IKBD.ROM reports for it
+static const struct {
+  const char *name;
+  uint8_t matrix, code;
+} keys[] = {
+  { "a", 0x54, 0x1e }, { "s", 0x55, 0x1f }, { "d", 0x65, 0x20 },
+  { "f", 0x56, 0x21 }, { "w", 0x35, 0x11 }, { "q", 0x44, 0x10 },
+  { "e", 0x45, 0x12 }, { "r", 0x36, 0x13 }, { "1", 0x24, 0x02 },
+  { "2", 0x15, 0x03 }, { "space", 0x79, 0x39 }, { "return", 0x5b, 0x1c },
+  { "esc", 0x14, 0x01 }, { "tab", 0x34, 0x0f }, { "m", 0x78, 0x32 },
+  { "p", 0x49, 0x19 }
+};
+#define KEYS (sizeof(keys)/sizeof(keys[0]))
+
+// ---------------- SPI master ----------------
+// mode 1 like the BL616: data is set up with the rising edge
+static struct {
+  std::vector<uint8_t> bytes;   // transaction in progress
+  size_t pos;
+  int phase;                    // half bit of current byte, -1 between bytes
+  int wait;                     // ticks to next step
+  int half, gap;                // ticks per half bit and between bytes
+  bool busy;
+} spi;
+
+static void spi_send(std::vector<uint8_t> bytes) {
+  spi.bytes = bytes;
+  spi.pos = 0;
+  spi.phase = -1;
+  spi.wait = spi.gap;
+  spi.busy = true;
+  tb->spi_io_ss = 0;
+}
+
+// called every tick
+static void spi_tick(void) {
+  if(!spi.busy || --spi.wait > 0) return;
+  spi.wait = spi.half;
+
+  if(spi.phase < 0) {
+    if(spi.pos == spi.bytes.size()) {
+      tb->spi_io_ss = 1;
+      spi.busy = false;
+      return;
+    }
+    spi.phase = 0;
+  }
+
+  if(!(spi.phase & 1)) {
+    tb->spi_io_din = (spi.bytes[spi.pos] >> (7 - spi.phase/2)) & 1;
+    tb->spi_io_clk = 1;
+  } else
+    tb->spi_io_clk = 0;
+
+  if(++spi.phase == 16) {
+    spi.phase = -1;
+    spi.pos++;
+    spi.wait = spi.gap;
+  }
+}
+
+// ---------------- events ----------------
+enum { KEY, MOUSE };
+
+struct Event {
+  int type;
+  int key;                   // index into keys[]
+  int code;                  // scan code expected for keys
+  int dx, dy;                // movement for the mouse
+  uint64_t start;            // chip select of the SPI transaction
+  uint64_t matrix;           // last byte taken by hid.v
+  uint64_t quad;             // first quadrature step of the mouse
+  uint64_t tx;               // first start bit of the IKBD
+  uint64_t readable;         // ACIA interrupt of the scan code or packet header
+  uint64_t complete;         // all movement received
+  int got_dx, got_dy;
+  bool done;
+};
+
+static std::vector<Event> events;
+static Event *cur;           // event in progress
+static long last_move = -1;  // mouse packets are accounted to this event
+
+static unsigned long unexpected, lost;
+
+// ---------------- IKBD serial line ----------------
+// 32 MHz / 7812.5 bps
+#define BIT_CLOCKS  4096
+static int last_tx = 1, last_strobe, last_mouse;
+static uint64_t tx_busy_until;
+
+// ---------------- 68000 reading the ACIA ----------------
+static int acia_hold;        // clocks the current access lasts
+static uint64_t irq_at;      // rising edge of the interrupt
+static int last_irq;
+
+// relative mouse packet being received
+static int pkt_left, pkt_dx;
+static uint64_t pkt_start;
+
+static void byte_received(uint8_t byte) {
+  // mouse packet: header $f8-$fb, dx, dy
+  if(pkt_left) {
+    pkt_left--;
+    if(pkt_left == 1) { pkt_dx = (int8_t)byte; return; }
+
+    // packets arriving after the movement is complete still belong
+    // to it, the report lists moves not matching in size
+    if(last_move >= 0) {
+      Event &e = events[last_move];
+      if(!e.readable) e.readable = pkt_start;
+      e.got_dx += pkt_dx;
+      e.got_dy += (int8_t)byte;
+      if(!e.done && abs(e.got_dx) >= abs(e.dx) && abs(e.got_dy) >= abs(e.dy)) {
+	e.complete = irq_at;
+	e.done = true;
+      }
+    } else if(unexpected++ < 10)
+      printf("[%.3f ms] Unexpected mouse packet %d/%d\n", us(clocks)/1000, pkt_dx, (int8_t)byte);
+    return;
+  }
+
+  if((byte & 0xfc) == 0xf8) {
+    pkt_left = 2;
+    pkt_start = irq_at;
+    return;
+  }
+
+  if(cur && cur->type == KEY && !cur->done && byte == cur->code) {
+    cur->readable = cur->complete = irq_at;
+    cur->done = true;
+  } else if(unexpected++ < 10)
+    printf("[%.3f ms] Unexpected byte $%02x from IKBD\n", us(clocks)/1000, byte);
+}
+
+static void acia_access(int rs, int rw, int din) {
+  tb->acia_sel = 1;
+  tb->acia_rs = rs;
+  tb->acia_rw = rw;
+  tb->acia_din = din;
+  // exactly one rising edge of E happens within one E period
+  acia_hold = 40;
+}
+
+// everything watched on the rising clock edge
+static void monitor(void) {
+  if(acia_hold && !--acia_hold) tb->acia_sel = 0;
+
+  if(tb->acia_irq && !last_irq) {
+    irq_at = clocks;
+    // the interrupt handler reads the data register, the byte is
+    // valid while the register is selected
+    acia_access(1, 1, 0);
+    tb->eval();
+    byte_received(tb->acia_dout);
+  }
+  last_irq = tb->acia_irq;
+
+  // start bit of the IKBD, the edges within a byte are skipped
+  bool start_bit = !tb->ikbd_tx && last_tx && clocks >= tx_busy_until;
+  if(start_bit) tx_busy_until = clocks + BIT_CLOCKS * 19 / 2;
+  last_tx = tb->ikbd_tx;
+
+  // each byte taken by hid.v updates the matrix or the mouse counters
+  bool strobe = tb->hid_strobe && !last_strobe;
+  last_strobe = tb->hid_strobe;
+
+  bool quad = tb->mouse != last_mouse;
+  last_mouse = tb->mouse;
+
+  if(!cur) return;
+  if(strobe) cur->matrix = clocks;
+  if(quad && cur->matrix && !cur->quad) cur->quad = clocks;
+  if(start_bit && cur->matrix && !cur->tx) cur->tx = clocks;
+}
+
+static void tick(int c) {
+  tb->clk32 = c;
+  spi_tick();
+  tb->eval();
+  if(c) {
+    bench.cycle();
+    clocks++;
+    monitor();
+  }
+  trace.dump(TICKLEN_PS * tickcount++);
+}
+
+static void run(uint64_t n) {
+  while(n--) { tick(1); tick(0); }
+}
+
+// inject an event and wait until it has been received
+static void event(Event ev, uint64_t timeout) {
+  ev.start = clocks;
+  events.push_back(ev);
+  cur = &events.back();
+  if(trig_event == (long)events.size()-1) trace.trigger();
+
+  // target HID, command keyboard or mouse. The matrix bit is low
+  // while the key is pressed
+  if(ev.type == KEY)
+    spi_send({ 1, 1, (uint8_t)(keys[ev.key].matrix | (ev.code & 0x80)) });
+  else {
+    last_move = events.size()-1;
+    spi_send({ 1, 2, 0, (uint8_t)ev.dx, (uint8_t)ev.dy });
+  }
+
+  while(!cur->done && clocks - cur->start < timeout) run(1);
+  if(!cur->done) {
+    if(lost++ < 10) {
+      if(cur->type == KEY) printf("[%.3f ms] Scan code $%02x lost\n", us(clocks)/1000, cur->code);
+      else printf("[%.3f ms] Mouse move %d/%d lost, got %d/%d\n", us(clocks)/1000,
+		  cur->dx, cur->dy, cur->got_dx, cur->got_dy);
+    }
+  }
+  cur = NULL;
+}
+
+// ---------------- statistics ----------------
+struct Stat {
+  const char *name;
+  unsigned long n;
+  double min, max, sum;
+
+  void add(uint64_t from, uint64_t to) {
+    if(!from || !to || to < from) return;
+    double v = us(to - from);
+    if(!n || v < min) min = v;
+    if(!n || v > max) max = v;
+    sum += v;
+    n++;
+  }
+
+  void print(void) {
+    if(n) printf("  %-26s %6lu %9.1f %9.1f %9.1f\n", name, n, min, sum / n, max);
+  }
+};
+
+static void report(const char *csv_name) {
+  Stat key_stats[] = {
+    { "SPI to matrix" }, { "matrix to IKBD start bit" },
+    { "start bit to ACIA irq" }, { "total" } };
+  Stat mouse_stats[] = {
+    { "SPI to counters" }, { "counters to quadrature" },
+    { "quadrature to start bit" }, { "start bit to ACIA irq" },
+    { "total, first packet" }, { "total, movement complete" } };
+
+  // the IKBD scales and splits movements, a different total is
+  // reported but doesn't fail the run
+  unsigned long mismatch = 0;
+
+  FILE *csv = NULL;
+  if(csv_name) {
+    if(!(csv = fopen(csv_name, "w"))) { perror(csv_name); exit(-1); }
+    fprintf(csv, "event,type,code,dx,dy,start_us,matrix_us,quad_us,tx_us,readable_us,complete_us\n");
+  }
+
+  for(size_t i=0;i<events.size();i++) {
+    const Event &e = events[i];
+    if(csv)
+      fprintf(csv, "%zu,%s,%d,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", i, e.type?"mouse":"key",
+	      e.code, e.dx, e.dy, us(e.start), e.matrix?us(e.matrix):0, e.quad?us(e.quad):0,
+	      e.tx?us(e.tx):0, e.readable?us(e.readable):0, e.complete?us(e.complete):0);
+    if(!e.done) continue;
+
+    if(e.type == KEY) {
+      key_stats[0].add(e.start, e.matrix);
+      key_stats[1].add(e.matrix, e.tx);
+      key_stats[2].add(e.tx, e.readable);
+      key_stats[3].add(e.start, e.readable);
+    } else {
+      mouse_stats[0].add(e.start, e.matrix);
+      mouse_stats[1].add(e.matrix, e.quad);
+      mouse_stats[2].add(e.quad, e.tx);
+      mouse_stats[3].add(e.tx, e.readable);
+      mouse_stats[4].add(e.start, e.readable);
+      mouse_stats[5].add(e.start, e.complete);
+      if(abs(e.got_dx) != abs(e.dx) || abs(e.got_dy) != abs(e.dy)) mismatch++;
+    }
+  }
+  if(csv) fclose(csv);
+
+  printf("Latency in us:\n  %-26s %6s %9s %9s %9s\n", "keys", "count", "min", "avg", "max");
+  for(auto &s : key_stats) s.print();
+  printf("  %-26s\n", "mouse");
+  for(auto &s : mouse_stats) s.print();
+  if(mismatch) printf("%lu mouse moves reported with a different size\n", mismatch);
+  printf("%zu events, %lu lost, %lu unexpected bytes\n", events.size(), lost, unexpected);
+}
+
+int main(int argc, char **argv) {
+  // Initialize Verilators variables
+  Verilated::commandArgs(argc, argv);
+
+  const char *arg = Verilated::commandArgsPlusMatch("keys=");
+  int key_events = arg[0]?atoi(arg+6):20;
+  arg = Verilated::commandArgsPlusMatch("moves=");
+  int moves = arg[0]?atoi(arg+7):10;
+  arg = Verilated::commandArgsPlusMatch("max_move=");
+  int max_move = arg[0]?atoi(arg+10):8;
+  arg = Verilated::commandArgsPlusMatch("gap=");
+  double gap = arg[0]?atof(arg+5):20;
+  arg = Verilated::commandArgsPlusMatch("hold=");
+  double hold = arg[0]?atof(arg+6):30;
+  arg = Verilated::commandArgsPlusMatch("boot=");
+  double boot = arg[0]?atof(arg+6):200;
+  arg = Verilated::commandArgsPlusMatch("timeout=");
+  uint64_t timeout = ms_clocks(arg[0]?atof(arg+9):100);
+  arg = Verilated::commandArgsPlusMatch("spi_mhz=");
+  double spi_mhz = arg[0]?atof(arg+9):20;
+  arg = Verilated::commandArgsPlusMatch("seed=");
+  srand(arg[0]?atoi(arg+6):1);
+  arg = Verilated::commandArgsPlusMatch("csv=");
+  const char *csv_name = arg[0]?arg+5:NULL;
+
+  if(max_move < 1) max_move = 1;
+  if(max_move > 127) max_move = 127;
+
+  // ticks are 64 MHz, the shim in fw_tb rounds the same way
+  spi.half = 2 * CLK_HZ / (2.0 * spi_mhz * 1e6) + 0.5;
+  if(spi.half < 1) spi.half = 1;
+  spi.gap = 7;    // ~100ns
+  printf("SPI clock %.2f MHz\n", 2 * CLK_HZ / (2.0 * spi.half) / 1e6);
+
+  Verilated::traceEverOn(true);
+
+  // Create an instance of our module under test
+  tb = new Vikbd_tb;
+
+  // the run takes seconds of simulated time, it's only traced on request
+  trace.from_ms = 1e9;
+  trace.open(tb);
+  const char *p = trace.trigger_param("event");
+  if(p) trig_event = atol(p);
+  bench.start();
+
+  tb->reset = 1;
+  tb->spi_io_ss = 1;
+  tb->spi_io_clk = 0;
+  tb->spi_io_din = 0;
+  tb->acia_sel = 0;
+  run(100);
+  tb->reset = 0;
+
+  // like TOS: master reset, then 8N1 at 7812.5 bps with rx interrupt
+  run(100);
+  acia_access(0, 0, 0x03);
+  run(100);
+  acia_access(0, 0, 0x96);
+  run(100);
+
+  // bytes sent by the IKBD while starting up are reported as unexpected
+  run(ms_clocks(boot));
+  unexpected = 0;
+
+  // keys and mouse movements in random order
+  int keys_left = key_events, moves_left = moves;
+  while(keys_left || moves_left) {
+    run(ms_clocks(gap * (1.0 + rand() / (RAND_MAX + 1.0))));
+
+    Event ev;
+    memset(&ev, 0, sizeof(ev));
+    if(rand() % (keys_left + moves_left) < keys_left) {
+      keys_left--;
+      ev.type = KEY;
+      ev.key = rand() % KEYS;
+      ev.code = keys[ev.key].code;
+      event(ev, timeout);
+
+      run(ms_clocks(hold));
+      ev.code |= 0x80;    // release
+      event(ev, timeout);
+    } else {
+      moves_left--;
+      ev.type = MOUSE;
+      do {
+	ev.dx = rand() % (2*max_move + 1) - max_move;
+	ev.dy = rand() % (2*max_move + 1) - max_move;
+      } while(!ev.dx && !ev.dy);
+      event(ev, timeout);
+    }
+  }
+  run(ms_clocks(gap));
+
+  report(csv_name);
+
+  trace.close();
+  bench.stop();
+
+  bool failed = lost || unexpected;
+  printf("%s\n", failed?"FAILED":"PASSED");
+  return failed?1:0;
+}
@@ -0,0 +1,155 @@
+// ====================================================================
+//
+// ikbd_tb.v
+//
+// Keyboard and mouse input path from the MCU's SPI to the 68000:
+// mcu_spi.v -> hid.v -> ikbd.sv (HD63701 running IKBD.ROM) -> acia.v.
+// Wired like top.sv and atarist.v. The SPI master and the CPU reading
+// the ACIA are in ikbd_tb.cpp.
+//
+//============================================================================
+
+module ikbd_tb (
+    input	 clk32,
+    input	 reset,
+
+    // SPI from the MCU
+    input	 spi_io_ss,
+    input	 spi_io_clk,
+    input	 spi_io_din,
+    output	 spi_io_dout,
+
+    // 68000 side of the keyboard ACIA at $fffc00
+    input	 acia_sel,
+    input	 acia_rs,
+    input	 acia_rw,
+    input [7:0]	 acia_din,
+    output [7:0] acia_dout,
+    output	 acia_irq, // to the MFP's GPIP4
+
+    // points the latency is broken down at
+    output	 hid_strobe,
+    output [5:0] mouse,
+    output	 ikbd_tx
+   );
+
+wire       mcu_hid_strobe, mcu_start;
+wire [7:0] mcu_data_out, hid_data_out;
+
+assign hid_strobe = mcu_hid_strobe;
+
+mcu_spi mcu (
+        .clk(clk32),
+        .reset(reset),
+
+        .spi_io_ss(spi_io_ss),
+        .spi_io_clk(spi_io_clk),
+        .spi_io_din(spi_io_din),
+        .spi_io_dout(spi_io_dout),
+
+        .mcu_sys_strobe(),
+        .mcu_hid_strobe(mcu_hid_strobe),
+        .mcu_osd_strobe(),
+        .mcu_sdc_strobe(),
+        .mcu_start(mcu_start),
+        .mcu_dout(mcu_data_out),
+        .mcu_sys_din(8'h00),
+        .mcu_hid_din(hid_data_out),
+        .mcu_osd_din(8'h55),
+        .mcu_sdc_din(8'h00)
+        );
+
+// The keyboard matrix is maintained inside HID
+wire [7:0] keyboard[14:0];
+
+wire [14:0] keyboard_matrix_out;
+wire [7:0] keyboard_matrix_in =
+	      (!keyboard_matrix_out[0]?keyboard[0]:8'hff)&
+	      (!keyboard_matrix_out[1]?keyboard[1]:8'hff)&
+	      (!keyboard_matrix_out[2]?keyboard[2]:8'hff)&
+	      (!keyboard_matrix_out[3]?keyboard[3]:8'hff)&
+	      (!keyboard_matrix_out[4]?keyboard[4]:8'hff)&
+	      (!keyboard_matrix_out[5]?keyboard[5]:8'hff)&
+	      (!keyboard_matrix_out[6]?keyboard[6]:8'hff)&
+	      (!keyboard_matrix_out[7]?keyboard[7]:8'hff)&
+	      (!keyboard_matrix_out[8]?keyboard[8]:8'hff)&
+	      (!keyboard_matrix_out[9]?keyboard[9]:8'hff)&
+	      (!keyboard_matrix_out[10]?keyboard[10]:8'hff)&
+	      (!keyboard_matrix_out[11]?keyboard[11]:8'hff)&
+	      (!keyboard_matrix_out[12]?keyboard[12]:8'hff)&
+	      (!keyboard_matrix_out[13]?keyboard[13]:8'hff)&
+	      (!keyboard_matrix_out[14]?keyboard[14]:8'hff);
+
+hid hid (
+        .clk(clk32),
+        .reset(reset),
+
+        .data_in_strobe(mcu_hid_strobe),
+        .data_in_start(mcu_start),
+        .data_in(mcu_data_out),
+        .data_out(hid_data_out),
+
+        .db9_port(6'b000000),
+        .irq(),
+        .iack(1'b0),
+
+        .mouse(mouse),
+        .keyboard(keyboard),
+        .joystick0(),
+        .joystick1()
+         );
+
+// generate 2Mhz IKBD clock from 32 MHz
+reg [3:0]   clk_div_ikbd;
+wire        clk_2 = clk_div_ikbd[3];
+
+always @(posedge clk32)
+  clk_div_ikbd <= clk_div_ikbd + 4'd1;
+
+reg         ikbd_reset;
+always @(posedge clk_2) ikbd_reset <= reset;
+
+wire ikbd_rx;
+
+ikbd ikbd (
+	.clk(clk_2),
+	.res(ikbd_reset),
+
+	.tx(ikbd_tx),
+	.rx(ikbd_rx),
+
+	.matrix_out(keyboard_matrix_out),
+	.matrix_in(keyboard_matrix_in),
+
+	.caps_lock(),
+
+	// the HID mouse is on the first port like in top.sv
+	.joystick0({mouse[5:4], mouse[0], mouse[1], mouse[2], mouse[3]}),
+	.joystick1(5'b00000)
+);
+
+// the 68000's E clock, 32 MHz / 40
+reg [5:0] e_cnt;
+always @(posedge clk32)
+  e_cnt <= (e_cnt == 6'd39)?6'd0:e_cnt + 6'd1;
+wire cpu_E = e_cnt < 6'd16;
+
+acia kbd_acia (
+	.clk      ( clk32              ),
+	.E        ( cpu_E              ),
+	.reset    ( reset              ),
+	.din      ( acia_din           ),
+	.sel      ( acia_sel           ),
+	.rs       ( acia_rs            ),
+	.rw       ( acia_rw            ),
+	.dout     ( acia_dout          ),
+	.irq      ( acia_irq           ),
+
+	.rxtxclk_sel( 1'b0             ),
+	.dout_strobe(                  ),
+
+	.rx       ( ikbd_tx            ),
+	.tx       ( ikbd_rx            )
+);
+
+endmodule
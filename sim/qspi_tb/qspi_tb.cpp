@@ -0,0 +1,239 @@
+/*
+  qspi_tb.cpp
+
+  ROM access latency of flash_dspi.v and flash_qspi.v. Both
+  controllers get the same sequence of ROM fetches, each one talks to
+  its own flash model. A fetch is a rising edge of cs coming from the
+  32 MHz domain, its latency is counted in 32 MHz cycles until busy is
+  low and dout holds the data:
+
+    +reads=<n>       number of fetches, default 10000
+    +run=<n>         average length of sequential runs in words, default 8
+    +gap=<n>         32 MHz cycles from one fetch to the next, default 16
+                     which is one bus cycle of the 8 MHz 68000
+    +ratio=<n>       flash clocks per 32 MHz cycle, default 3
+    +seed=<n>        seed of the random jumps
+    +addr_file=<f>   replay word addresses from a file, one hex address
+                     per line, instead of random runs
+    +image=<file>    ROM image loaded at $100000, default a pseudo random
+                     pattern
+
+  The data returned is compared with the flash contents, the
+  testbench exits with an error if any fetch returned wrong data or
+  timed out.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+#include "Vqspi_tb.h"
+#include "verilated.h"
+
+#include "trace.h"
+#include "bench.h"
+#include "spi_flash.h"
+
+static Vqspi_tb *tb;
+static TraceWindow trace("qspi_tb");
+static SimBench bench("qspi_tb", 32000000);
+static uint64_t tickcount;
+static int ratio = 3;
+
+// trace trigger: +trigger=cs
+static bool trig_cs = false;
+
+// the ROM starts at $100000 in flash, i.e. at word address $80000
+#define ROM_BASE   0x80000
+#define ROM_WORDS  0x20000
+
+// per controller state of the fetch in progress and the results
+struct Controller {
+  const char *name;
+  SpiFlashModel flash;
+
+  bool pending;
+  int edges;             // flash clocks since the fetch was started
+  int cycles;            // 32 MHz cycles until done
+  bool saw_busy;
+
+  unsigned long count, hits, errors, timeouts;
+  unsigned long min, max, sum;
+  unsigned long hist[16];
+};
+
+static Controller ctl[2];
+enum { DSPI, QSPI };
+
+static void flash_edge(void) {
+  ctl[DSPI].flash.clk(tb->d_mspi_cs, (tb->d_mspi_di?1:0)|(tb->d_mspi_do?2:0), tb->d_mspi_din);
+  ctl[QSPI].flash.clk(tb->q_mspi_cs, (tb->q_mspi_di?1:0)|(tb->q_mspi_do?2:0)|
+		      (tb->q_mspi_wp?4:0)|(tb->q_mspi_hold?8:0), tb->q_mspi_din);
+
+  // the controllers see cs after two clocks. If busy isn't set then,
+  // the word was taken from the prefetch buffer
+  for(int i=0;i<2;i++) {
+    Controller &c = ctl[i];
+    if(!c.pending) continue;
+
+    bool busy = i?tb->q_busy:tb->d_busy;
+    if(busy) c.saw_busy = true;
+    if(++c.edges >= 2 && !busy) {
+      c.pending = false;
+      c.cycles = (c.edges + ratio - 1) / ratio;
+    }
+  }
+}
+
+// one 32 MHz cycle with ratio flash clocks
+static void cycle(void) {
+  for(int i=0;i<2*ratio;i++) {
+    tb->flash_clk = !tb->flash_clk;
+    tb->eval();
+    if(tb->flash_clk) flash_edge();
+
+    if(trig_cs && tb->cs) trace.trigger();
+    trace.dump(tickcount++ * 1000000 / (64 * ratio));
+  }
+  bench.cycle();
+}
+
+static void result(Controller &c, uint32_t addr, int dout) {
+  uint32_t a = (2*addr) % c.flash.size;
+  int expected = (c.flash.mem[a] << 8) | c.flash.mem[a+1];
+
+  if(c.pending) {
+    if(c.timeouts++ < 10) printf("%s: fetch of $%06x timed out\n", c.name, addr);
+    c.pending = false;
+    return;
+  }
+
+  if(dout != expected && c.errors++ < 10)
+    printf("%s: fetch of $%06x returned $%04x, expected $%04x\n", c.name, addr, dout, expected);
+
+  if(!c.count || c.cycles < (int)c.min) c.min = c.cycles;
+  if(!c.count || c.cycles > (int)c.max) c.max = c.cycles;
+  c.sum += c.cycles;
+  c.hist[(c.cycles < 15)?c.cycles:15]++;
+  if(!c.saw_busy) c.hits++;
+  c.count++;
+}
+
+// one rom fetch as done by the chipset: cs is raised for half of the
+// bus cycle, the data is checked at the end of it
+static void fetch(uint32_t addr, int gap) {
+  tb->address = addr;
+  tb->cs = 1;
+  for(auto &c : ctl) {
+    c.pending = true;
+    c.edges = 0;
+    c.saw_busy = false;
+  }
+
+  for(int i=0;i<gap;i++) {
+    if(i == gap/2) tb->cs = 0;
+    cycle();
+  }
+
+  result(ctl[DSPI], addr, tb->d_dout);
+  result(ctl[QSPI], addr, tb->q_dout);
+}
+
+static void report(void) {
+  printf("ROM fetch latency in 32 MHz cycles, flash clock %d MHz:\n", 32*ratio);
+  printf("  %-12s %8s %8s %8s %8s %8s %8s\n", "controller", "fetches", "min", "avg", "max", "buffered", "errors");
+  for(auto &c : ctl) {
+    if(!c.count) continue;
+    printf("  %-12s %8lu %8lu %8.2f %8lu %7.1f%% %8lu\n", c.name, c.count, c.min,
+	   (double)c.sum / c.count, c.max, 100.0 * c.hits / c.count, c.errors + c.timeouts);
+  }
+
+  printf("Latency histogram:\n  %-12s", "cycles");
+  for(int i=0;i<16;i++) printf(i<15?"%6d":"   >14", i);
+  printf("\n");
+  for(auto &c : ctl) {
+    printf("  %-12s", c.name);
+    for(int i=0;i<16;i++) printf("%6lu", c.hist[i]);
+    printf("\n");
+  }
+
+  for(auto &c : ctl) {
+    printf("%s ", c.name);
+    c.flash.report();
+  }
+}
+
+int main(int argc, char **argv) {
+  // Initialize Verilators variables
+  Verilated::commandArgs(argc, argv);
+
+  const char *arg = Verilated::commandArgsPlusMatch("reads=");
+  int reads = arg[0]?atoi(arg+7):10000;
+  arg = Verilated::commandArgsPlusMatch("run=");
+  int run = arg[0]?atoi(arg+5):8;
+  arg = Verilated::commandArgsPlusMatch("gap=");
+  int gap = arg[0]?atoi(arg+5):16;
+  arg = Verilated::commandArgsPlusMatch("ratio=");
+  if(arg[0]) ratio = atoi(arg+7);
+  arg = Verilated::commandArgsPlusMatch("seed=");
+  srand(arg[0]?atoi(arg+6):1);
+
+  FILE *addr_file = NULL;
+  arg = Verilated::commandArgsPlusMatch("addr_file=");
+  if(arg[0] && !(addr_file = fopen(arg+11, "r"))) { perror(arg+11); exit(-1); }
+
+  ctl[DSPI].name = "flash_dspi";
+  ctl[QSPI].name = "flash_qspi";
+
+  arg = Verilated::commandArgsPlusMatch("image=");
+  for(auto &c : ctl) {
+    if(arg[0]) {
+      if(!c.flash.load(arg+7, 2*ROM_BASE)) exit(-1);
+    } else
+      for(size_t i=0;i<c.flash.size;i++)
+	c.flash.mem[i] = (i * 2654435761u) >> 13;
+  }
+
+  Verilated::traceEverOn(true);
+
+  // Create an instance of our module under test
+  tb = new Vqspi_tb;
+
+  trace.open(tb);
+  trig_cs = trace.trigger_param("cs");
+  bench.start();
+
+  tb->resetn = 0;
+  tb->cs = 0;
+  tb->address = 0;
+  for(int i=0;i<10;i++) cycle();
+  tb->resetn = 1;
+
+  while(!tb->d_ready || !tb->q_ready) cycle();
+  for(int i=0;i<100;i++) cycle();
+
+  uint32_t addr = ROM_BASE;
+  for(int i=0;i<reads;i++) {
+    if(addr_file) {
+      char line[64];
+      if(!fgets(line, sizeof(line), addr_file)) break;
+      addr = strtoul(line, NULL, 16) & 0x3fffff;
+    } else if(!(rand() % run))
+      addr = ROM_BASE + rand() % ROM_WORDS;
+    else
+      addr = ROM_BASE + (addr + 1 - ROM_BASE) % ROM_WORDS;
+
+    fetch(addr, gap);
+  }
+  if(addr_file) fclose(addr_file);
+
+  report();
+
+  trace.close();
+  bench.stop();
+
+  int failed = 0;
+  for(auto &c : ctl) failed += c.errors + c.timeouts;
+  printf("%s\n", failed?"FAILED":"PASSED");
+  return failed?1:0;
+}
@@ -0,0 +1,74 @@
+// qspi_tb.v
+//
+// ROM fetches through the DSPI and the QSPI flash controllers side by
+// side. Both get the same requests, the flash chips behind them are
+// simulated in C++.
+
+module qspi_tb(
+  input 	   flash_clk,
+  input 	   resetn,
+
+  // rom request from the 32 MHz domain
+  input [21:0] 	   address,
+  input 	   cs,
+
+  // flash_dspi.v
+  output 	   d_ready,
+  output 	   d_busy,
+  output [15:0]    d_dout,
+  output 	   d_mspi_cs,
+  inout 	   d_mspi_di,
+  inout 	   d_mspi_hold,
+  inout 	   d_mspi_wp,
+  inout 	   d_mspi_do,
+  input [1:0] 	   d_mspi_din,
+
+  // flash_qspi.v
+  output 	   q_ready,
+  output 	   q_busy,
+  output [15:0]    q_dout,
+  output 	   q_mspi_cs,
+  inout 	   q_mspi_di,
+  inout 	   q_mspi_hold,
+  inout 	   q_mspi_wp,
+  inout 	   q_mspi_do,
+  input [3:0] 	   q_mspi_din
+);
+
+flash flash_dspi (
+    .clk(flash_clk),
+    .resetn(resetn),
+    .ready(d_ready),
+    .busy(d_busy),
+
+    .address(address),
+    .cs(cs),
+    .dout(d_dout),
+
+    .mspi_din(d_mspi_din),
+    .mspi_cs(d_mspi_cs),
+    .mspi_di(d_mspi_di),
+    .mspi_hold(d_mspi_hold),
+    .mspi_wp(d_mspi_wp),
+    .mspi_do(d_mspi_do)
+);
+
+flash_qspi flash_qspi (
+    .clk(flash_clk),
+    .resetn(resetn),
+    .ready(q_ready),
+    .busy(q_busy),
+
+    .address(address),
+    .cs(cs),
+    .dout(q_dout),
+
+    .mspi_din(q_mspi_din),
+    .mspi_cs(q_mspi_cs),
+    .mspi_di(q_mspi_di),
+    .mspi_hold(q_mspi_hold),
+    .mspi_wp(q_mspi_wp),
+    .mspi_do(q_mspi_do)
+);
+
+endmodule
@@ -2,13 +2,29 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <vector>
 
 #include "Vste_tb.h"
 #include "verilated.h"
-#include "verilated_vcd_c.h"
+
+#include "trace.h"
+#include "bench.h"
+#include "checkpoint.h"
+#include "eventlog.h"
+#include "m68k_profiler.h"
+
+#ifdef SDL_VIEW
+#include "sdl_view.h"
+static SdlView view("ram_tb");
+static bool sdl;
+#endif
 
 static Vste_tb *tb;
-static VerilatedVcdC *trace;
+static TraceWindow trace("ste_tb");
+static SimBench bench("ram_tb", 32000000);
+static Checkpoint ckpt("ram_tb");
+static EventLog elog("ram_tb");
+static M68kProfiler prof;
 static double simulation_time;
 static int tos_is_192k = 0;
 
@@ -16,16 +32,25 @@ static int tos_is_192k = 0;
 
 #define TICKLEN   (1.0/64000000)
 
-// run for 100ms
-#define TRACESTART   .2
-#define TRACEEND     (TRACESTART + 0.1)
+// run for 300ms and trace the last 100ms unless +trigger/+trace_from say otherwise
+#define TRACESTART   200
+#define RUNTIME      .3
 
-static uint64_t GetTickCountMs() {
-  struct timespec ts;
-  
-  clock_gettime(CLOCK_MONOTONIC, &ts);
-  return (uint64_t)(ts.tv_nsec / 1000000) + ((uint64_t)ts.tv_sec * 1000ull);
-}
+// +runtime=<ms> overrides RUNTIME, e.g. for shorter benchmark runs
+static double runtime = RUNTIME;
+
+// trace trigger: +trigger=addr:<hex> on a cpu access to that address
+static int trig_addr = -1;
+
+// bus events recorded in ram_tb.evl, see eventlog.h
+static const int ev_rom_read  = elog.define("rom", "CPU ROM read at 0x%08x = 0x%04x");
+static const int ev_mfp       = elog.define("io",  "MFP at 0x%08x");
+static const int ev_fdc       = elog.define("io",  "FDC at 0x%08x");
+static const int ev_rtc       = elog.define("io",  "RTC at 0x%08x");
+static const int ev_acia      = elog.define("io",  "6850 at 0x%08x");
+static const int ev_snd       = elog.define("io",  "SNDCS at 0x%08x");
+static const int ev_ram_read  = elog.define("ram", "CPU ram read at 0x%08x = 0x%04x");
+static const int ev_ram_write = elog.define("ram", "CPU ram write at 0x%08x = 0x%04x");
 
 static unsigned char ram[4*1024*1024];
 void initram() {
@@ -43,32 +68,137 @@ void initrom() {
     tos_is_192k = 1;
 }
 
+/* normaly it doesn't matter who and why is accessing memory. But when
+   tracing it may be useful to know whether it's CPU or video. This is what
+   the cycle counter is trying to keep track of.*/
+static int cycle = -1;
+static int old_addr = 0xffffff;
+
+/* +busstats[=<file>] collects the use of the memory slots and the wait
+   states of the CPU per video frame and writes them as CSV time series.
+   Every 500ns memory cycle consists of a CPU slot, which may also be
+   used by DMA, and a video slot, used by the shifter and for refresh.
+   Wait states are counted for CPU accesses to RAM only, from AS to
+   DTACK in 8 MHz cycles beyond the fastest RAM access. As the CPU
+   regularly hits its slot, that one has no wait states. ROM, I/O and
+   autovector cycles differ in length without being slowed down */
+#define DTACK_MAX 64
+struct BusFrame {
+  double start_ms;
+  unsigned long clocks;
+  unsigned long cpu_slots, cpu, dma;
+  unsigned long video_slots, video, refresh;
+  unsigned long cpu_cycles, ram_cycles;   // all cpu bus cycles and those to RAM
+  unsigned long dtack[DTACK_MAX];         // RAM cycles by clocks from AS to DTACK
+};
+
+static const char *busstats;
+static std::vector<BusFrame> bus_frames;
+static int as_len, dtack_len = -1, last_vsync;
+static bool ram_cycle;
+static int dtack_min = DTACK_MAX;
+
+static unsigned long wait_states(const BusFrame &f) {
+  unsigned long waits = 0;
+  for(int d=dtack_min;d<DTACK_MAX;d++) waits += f.dtack[d] * ((d - dtack_min + 2) / 4);
+  return waits;
+}
+
+static void bus_stats(void) {
+  // a new frame starts with the vsync
+  if(bus_frames.empty() || (!tb->VSYNC_N && last_vsync))
+    bus_frames.push_back(BusFrame { 1000*simulation_time });
+  last_vsync = tb->VSYNC_N;
+
+  BusFrame &f = bus_frames.back();
+  f.clocks++;
+
+  if(!tb->AS_N) {
+    as_len++;
+    if(!tb->RAM_N) ram_cycle = true;
+    if(!tb->DTACK_N && dtack_len < 0) dtack_len = (as_len < DTACK_MAX)?as_len:DTACK_MAX-1;
+  } else if(as_len) {
+    f.cpu_cycles++;
+    if(ram_cycle && dtack_len >= 0) {
+      f.ram_cycles++;
+      f.dtack[dtack_len]++;
+      if(dtack_len < dtack_min) dtack_min = dtack_len;
+    }
+    as_len = 0;
+    dtack_len = -1;
+    ram_cycle = false;
+  }
+
+  if(tb->MHZ4_EN && cycle >= 0) {
+    bool ras = !tb->RAS0_N || !tb->RAS1_N;
+    bool cas = !tb->CAS0L_N || !tb->CAS0H_N || !tb->CAS1L_N || !tb->CAS1H_N;
+    if(cycle == 2) {
+      f.cpu_slots++;
+      if(ras && cas) {
+	if(tb->bus_free) f.cpu++;
+	else             f.dma++;
+      }
+    } else {
+      f.video_slots++;
+      if(ras && cas) f.video++;
+      else if(ras)   f.refresh++;
+    }
+  }
+}
+
+static double pct(unsigned long a, unsigned long b) { return b?100.0*a/b:0; }
+
+static void bus_stats_write(void) {
+  FILE *out = fopen(busstats, "w");
+  if(!out) { perror(busstats); return; }
+
+  // a wait state is one 8 MHz cycle, counted for RAM cycles only
+  fprintf(out, "frame,time_ms,clocks,cpu_slots,cpu,dma,video_slots,video,refresh,"
+	  "cpu_cycles,ram_cycles,wait_states,cpu_pct,dma_pct,video_pct,refresh_pct\n");
+  BusFrame t = { 0 };
+  for(size_t i=0;i<bus_frames.size();i++) {
+    BusFrame &f = bus_frames[i];
+    fprintf(out, "%zu,%.3f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.2f,%.2f,%.2f,%.2f\n",
+	    i, f.start_ms, f.clocks, f.cpu_slots, f.cpu, f.dma, f.video_slots, f.video, f.refresh,
+	    f.cpu_cycles, f.ram_cycles, wait_states(f), pct(f.cpu, f.cpu_slots), pct(f.dma, f.cpu_slots),
+	    pct(f.video, f.video_slots), pct(f.refresh, f.video_slots));
+
+    t.cpu_slots += f.cpu_slots; t.cpu += f.cpu; t.dma += f.dma;
+    t.video_slots += f.video_slots; t.video += f.video; t.refresh += f.refresh;
+    t.cpu_cycles += f.cpu_cycles; t.ram_cycles += f.ram_cycles;
+    for(int d=0;d<DTACK_MAX;d++) t.dtack[d] += f.dtack[d];
+  }
+  fclose(out);
+
+  printf("Bus use over %zu frames written to %s:\n", bus_frames.size(), busstats);
+  printf("  CPU slots: %.1f%% CPU, %.1f%% DMA\n", pct(t.cpu, t.cpu_slots), pct(t.dma, t.cpu_slots));
+  printf("  video slots: %.1f%% video, %.1f%% refresh\n", pct(t.video, t.video_slots), pct(t.refresh, t.video_slots));
+  if(t.ram_cycles)
+    printf("  %lu CPU bus cycles, %lu to RAM with %.2f wait states on average\n", t.cpu_cycles,
+	   t.ram_cycles, (double)wait_states(t) / t.ram_cycles);
+}
+
 void tick(int c) {
-  static int old_addr = 0xffffff;
-  static uint64_t ticks = 0;
-  
   // A[0] must never be 1
   if(tb->A & 1) { printf("A[0] must never be 1\n"); exit(-1); }
   
   tb->clk32 = c; 
   tb->eval();
+  if(c) bench.cycle();
+  if(c) prof.tick(tb);
   
   if(c && !tb->BERR_N) printf("Bus error\n");
-  
-  if(simulation_time == 0)
-    ticks = GetTickCountMs();
-  
-  // after one simulated millisecond calculate real time */
-  if(simulation_time >= 0.001 && ticks) {
-    ticks = GetTickCountMs() - ticks;
-    printf("Speed factor = %lu\n", ticks);
-    ticks = 0;
-  }
-  
-  // trace after
-#ifdef TRACESTART
-  if(simulation_time > TRACESTART) trace->dump(1000000000000 * simulation_time);
+
+#ifdef SDL_VIEW
+  // 16 MHz pixels, i.e. two per ST low resolution pixel
+  static int pix_cnt = 0;
+  if(sdl && c && (pix_cnt++ & 1))
+    view.pixel(tb->HSYNC_N, tb->VSYNC_N, tb->R * 17, tb->G * 17, tb->B * 17);
 #endif
+  
+  if(trig_addr >= 0 && tb->A == trig_addr && tb->MHZ4_EN) trace.trigger();
+  elog.now = 1000000000000 * simulation_time;
+  trace.dump(elog.now);
   simulation_time += TICKLEN;
   
   // each tick is 1/64 us ot 15,625ns as we are simulating a 32 MHz clock
@@ -76,25 +206,20 @@ void tick(int c) {
     // rom access
     tb->ROM_DOUT = (rom[(tb->A) & 0x3ffff] * 256) + rom[((tb->A) + 1)& 0x3ffff];
     
-    if(tb->MHZ4_EN)
-      printf("@%.3f CPU ROM read at 0x%08x = 0x%04x\n", 1000*simulation_time, tb->A, tb->ROM_DOUT);
+    if(tb->MHZ4_EN) elog.log(ev_rom_read, tb->A, tb->ROM_DOUT);
   }
   
   if(c && tb->MHZ4_EN) {
-    if(!tb->MFPCS_N) printf("@%.3f MFP at 0x%08x\n", 1000*simulation_time, tb->A);
-    if(!tb->FCS_N)   printf("@%.3f FDC at 0x%08x\n", 1000*simulation_time, tb->A);
-    if(!tb->RTCCS_N) printf("@%.3f RTC at 0x%08x\n", 1000*simulation_time, tb->A);
-    if(tb->N6850)    printf("@%.3f 6850 at 0x%08x\n", 1000*simulation_time, tb->A);
-    if(tb->SNDCS)    printf("@%.3f SNDCS at 0x%08x\n", 1000*simulation_time, tb->A);
+    if(!tb->MFPCS_N) elog.log(ev_mfp, tb->A);
+    if(!tb->FCS_N)   elog.log(ev_fdc, tb->A);
+    if(!tb->RTCCS_N) elog.log(ev_rtc, tb->A);
+    if(tb->N6850)    elog.log(ev_acia, tb->A);
+    if(tb->SNDCS)    elog.log(ev_snd, tb->A);
     // if(!tb->) printf("\n");
   }
   
-  /* normaly it doesn't matter who and why is accessing memory. But when
-     tracing it may be useful to know whether it's CPU or video. This is what
-     the cycle counter is trying to keep track of.*/
-  
-  static int cycle = -1;
   if(cycle >= 0 && c && tb->MHZ8_EN1) cycle = (cycle+1)&3;
+  if(c && busstats) bus_stats();
   
   // max 4 MB RAM
   if (c && (!tb->RAS0_N || !tb->RAS1_N) && tb->ram_a < 0x200000) {
@@ -107,7 +232,7 @@ void tick(int c) {
 	if(tb->we_n) {
 	  tb->mdin = (ram[tb->ram_a<<1] * 256) + ram[(tb->ram_a<<1) + 1];
 	  if(cycle == 2) {
-	    printf("@%.3f CPU ram read at 0x%08x = 0x%04x\n", 1000*simulation_time, tb->ram_a<<1, tb->mdin);
+	    elog.log(ev_ram_read, tb->ram_a<<1, tb->mdin);
 	  } else {
 	    // printf("@%.3f VID ram read at 0x%08x = 0x%04x\n", 1000*simulation_time, tb->ram_a<<1, tb->mdin);
 	    
@@ -115,7 +240,7 @@ void tick(int c) {
 	} else {
 	  // we expect to see ram writes always in cycle 2 as video never writes
 	  if(cycle >= 0 && cycle != 2) { printf("unexpected write cycle\n"); exit(-1); }
-	  printf("@%.3f CPU ram write at 0x%08x = 0x%04x\n", 1000*simulation_time, tb->ram_a<<1, tb->mdout);
+	  elog.log(ev_ram_write, tb->ram_a<<1, tb->mdout);
 	  
 	  if((tb->ram_a<<1) == 0x44c) printf("sshiftmd h = %04x\n", tb->mdout);
 	  if((tb->ram_a<<1) == 0x42e) printf("phystop h = %04x\n", tb->mdout);
@@ -178,50 +303,86 @@ void dump() {
   }
 }
 
+static void simulate(void) {
+  /* run for a while */
+  while(simulation_time<runtime && tb->HALTED_N) {
+    tick(1);
+    tick(0);
+    ckpt.poll(tb, 1000*simulation_time);
+#ifdef SDL_VIEW
+    if(sdl && view.closed()) break;
+#endif
+  }
+  
+  if(!tb->HALTED_N)
+    printf("CPU halted\n");
+  
+  printf("stopped after %.3fms\n", 1000*simulation_time);
+}
+
 int main(int argc, char **argv) {
   initrom();  
   initram();
   
   // Initialize Verilators variables
   Verilated::commandArgs(argc, argv);
+  const char *arg = Verilated::commandArgsPlusMatch("runtime=");
+  if(arg[0]) runtime = atof(arg + 9) / 1000;
+
+  // +sdl shows the video live until the window is closed
+  if(Verilated::commandArgsPlusMatch("sdl")[0]) {
+#ifdef SDL_VIEW
+    sdl = true;
+    if(!arg[0]) runtime = 1e6;
+#else
+    printf("Built without SDL, ignoring +sdl\n");
+#endif
+  }
+
+  // +save_at=<ms> / +restore=<file>, e.g. to skip the boot
+  ckpt.args(argc, argv);
+  ckpt.add(ram, sizeof(ram));
+  ckpt.add(rom, sizeof(rom));
+  ckpt.add(tos_is_192k);
+  ckpt.add(simulation_time);
+  ckpt.add(cycle);
+  ckpt.add(old_addr);
+
   // Verilated::debug(1);
   Verilated::traceEverOn(true);
-  trace = new VerilatedVcdC;
-  trace->spTrace()->set_time_unit("1ns");
-  trace->spTrace()->set_time_resolution("1ps");
   simulation_time = 0;
   
   // Create an instance of our module under test
   tb = new Vste_tb;
   tb->tos192k = tos_is_192k;
   
-  tb->trace(trace, 99);
-  trace->open("ste_tb.vcd");
+  trace.from_ms = TRACESTART;
+  trace.open(tb);
+  elog.setup();
+  prof.setup(argc, argv);
+  arg = Verilated::commandArgsPlusMatch("busstats");
+  if(arg[0]) busstats = strdup((arg[9] == '=')?arg+10:"busstats.csv");
+  if(trace.trigger_param("addr")) trig_addr = strtol(trace.trigger_param("addr"), NULL, 16);
   
-  // apply reset and power-on for a while */
-  tb->resb = 0; tb->porb = 0;
-  for(int i=0;i<10;i++) { tick(1); tick(0); }
-  tb->resb = 1; tb->porb = 1;
-  
-  /* run for a while */
-  while(
-#ifdef TRACEEND
-	simulation_time<TRACEEND &&
-#endif
-	tb->HALTED_N) {
-    tick(1);
-    tick(0);
-    
+  if(!ckpt.restore(tb)) {
+    // apply reset and power-on for a while */
+    tb->resb = 0; tb->porb = 0;
+    for(int i=0;i<10;i++) { tick(1); tick(0); }
+    tb->resb = 1; tb->porb = 1;
   }
-  
-  if(!tb->HALTED_N)
-    printf("CPU halted\n");
-  
-  printf("stopped after %.3fms\n", 1000*simulation_time);
-  
+  bench.start();
+
+#ifdef SDL_VIEW
+  if(sdl) view.run(simulate);
+  else
+#endif
+    simulate();
   dump();
   
-  trace->close();
+  trace.close();
+  bench.stop();
+  prof.report();
+  if(busstats) bus_stats_write();
   
   /* dump ram content to disk */
   FILE *rd = fopen("ramdump.bin", "wb");
@@ -1,375 +1,58 @@
 #include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 
 #include "Vsd_rw.h"
 #include "verilated.h"
-#include "verilated_vcd_c.h"
 
-#define BIT4    // send/receive 4bits data
+#include "sdcard.h"
+#include "sd_crc.h"
+#include "trace.h"
+#include "bench.h"
+#include "eventlog.h"
 
 static Vsd_rw *tb;
-static VerilatedVcdC *trace;
+static TraceWindow trace("sdc_tb");
+static SimBench bench("sdc_tb", 32000000);
+static EventLog elog("sdc_tb");
 static double simulation_time;
 
 #define TICKLEN   (1.0/64000000)
 
-#ifndef BIT4
-uint8_t sector_data[514];   // 512 bytes + one 16 bit crc
-#else
-uint8_t sector_data[520];   // 512 bytes + four 16 bit crcs
-#endif
-
-// https://github.com/LonelyWolf/stm32/blob/master/stm32l-dosfs/sdcard.c
-
-// Calculate CRC7
-// It's a 7 bit CRC with polynomial x^7 + x^3 + 1
-// input:
-//   crcIn - the CRC before (0 for first step)
-//   data - byte for CRC calculation
-// return: the new CRC7
-uint8_t CRC7_one(uint8_t crcIn, uint8_t data) {
-  const uint8_t g = 0x89;
-  uint8_t i;
-
-  crcIn ^= data;
-  for (i = 0; i < 8; i++) {
-    if (crcIn & 0x80) crcIn ^= g;
-    crcIn <<= 1;
-  }
-  
-  return crcIn;
-}
+static SdCardModel *sd;
 
-// Calculate CRC16 CCITT
-// It's a 16 bit CRC with polynomial x^16 + x^12 + x^5 + 1
-// input:
-//   crcIn - the CRC before (0 for rist step)
-//   data - byte for CRC calculation
-// return: the CRC16 value
-uint16_t CRC16_one(uint16_t crcIn, uint8_t data) {
-  crcIn  = (uint8_t)(crcIn >> 8)|(crcIn << 8);
-  crcIn ^=  data;
-  crcIn ^= (uint8_t)(crcIn & 0xff) >> 4;
-  crcIn ^= (crcIn << 8) << 4;
-  crcIn ^= ((crcIn & 0xff) << 4) << 1;
-  
-  return crcIn;
-}
+// +dump=<file> stores the sector read by the core
+static unsigned char sector_buf[512];
 
-uint8_t getCRC(unsigned char cmd, unsigned long arg) {
-  uint8_t CRC = CRC7_one(0, cmd);
-  for (int i=0; i<4; i++) CRC = CRC7_one(CRC, ((unsigned char*)(&arg))[3-i]);
-  return CRC;
-}
+// trace triggers: +trigger=sd-cmd:<n>, +trace_stop=sd-cmd:<n>
+static int trig_sd_cmd = -1, stop_sd_cmd = -1;
 
-uint8_t getCRC_bytes(unsigned char *data, int len) {
-  uint8_t CRC = 0;
-  while(len--) CRC = CRC7_one(CRC, *data++);
-  return CRC;  
-}
-  
-unsigned long long reply(unsigned char cmd, unsigned long arg) {
-  unsigned long r = 0;
-  r |= ((unsigned long long)cmd) << 40;
-  r |= ((unsigned long long)arg) << 8;
-  r |= getCRC(cmd, arg);
-  r |= 1;
-  return r;
+static void sd_command(int cmd, unsigned long arg) {
+  if(cmd == trig_sd_cmd) trace.trigger();
+  if(cmd == stop_sd_cmd) trace.stop();
 }
 
-#define OCR  0xc0ff8000  // not busy, CCS=1(SDHC card), all voltage, not dual-voltage card
-#define RCA  0x0013
-
-// total cid respose is 136 bits / 17 bytes
-unsigned char cid[17] = "\x3f" "\x02TMS" "A08G" "\x14\x39\x4a\x67" "\xc7\x00\xe4";
-
-int rw_state = 0;
-
 void tick(int c) {
-  static long long cmd_in = -1;
-  static long long cmd_out = -1;
-  static unsigned char *cmd_ptr = 0;
-  static int cmd_bits = 0;
-  static unsigned char *dat_ptr = 0;
-  static int dat_bits = 0;
-  static int last_was_acmd = 0;
-  static int write_count = 0;
-  static int write_expect = 0;
-  
   tb->clk = c; 
   tb->eval();
+  if(c) bench.cycle();
   
   if(c) {
     // data byte to be written to sd card
     if(tb->inen)
       tb->inbyte = 0xff ^ tb->outaddr;
   }
+
+  // sector data read by the core
+  if(c && tb->outen) sector_buf[tb->outaddr] = tb->outbyte;
+
+  sd->tick(tb);
   
-  static int last_sdclk = -1;
-  if(tb->sdclk != last_sdclk) {
-    // rising sd card clock edge
-    if(tb->sdclk) {
-      static unsigned char rbuf[520];
-      
-      // write postamble (ack + busy)
-      int ack_start = 580;
-      int busy_end  = 700;
-      int ack_token = 0b00101000;  // start bit 0, ack ok 010, stopbit 1, busy 000
-      if(write_count < 512) {
-	if(write_expect < 0) {
-	  // wait for first data != 15
-	  if(!(tb->sddat & 1))
-	    write_expect = 1024+16;  // 1024 * 4 bit + 4 * 16 bit crc
-	  
-	} else if(write_expect > 0) {
-	  if((write_expect-1)&1)
-	    rbuf[519-((write_expect-1)/2)] = tb->sddat << 4;
-	  else
-	    rbuf[519-((write_expect-1)/2)] |= tb->sddat;
-
-	  //	  printf("Write %d %s = %x\n", (write_expect-1)/2,
-	  //		 ((write_expect-1)&1)?"hi":"lo",
-	  //		 rbuf[519-((write_expect-1)/2)]);
-	  
-	  write_expect--;
-	  if(write_expect == 0) {
-	    // done with data. verify checksum
-	    unsigned short crc[4] = { 0,0,0,0 };
-	    unsigned char dbits[4];
-	    for(int i=0;i<512;i++) {
-	      // calculate the crc for each data line seperately
-	      for(int c=0;c<4;c++) {
-		if((i & 3) == 0) dbits[c] = 0;
-		dbits[c] = (dbits[c] << 2) |
-		  ((rbuf[i]&(0x10<<c))?2:0) | ((rbuf[i]&(0x01<<c))?1:0);      
-		if((i & 3) == 3) crc[c] = CRC16_one(crc[c], dbits[c]);
-	      }
-	    }
-
-	    printf("WR DATA CRC = %04x/%04x/%04x/%04x\n",
-		   crc[0], crc[1], crc[2], crc[3]);
-
-	    // extract sent crc from last 8 bytes
-	    unsigned short s_crc[4] = { 0,0,0,0 };
-	    for(int i=0;i<16;i++) {
-	      int nibble = (rbuf[512+i/2] >> ((i&1)?0:4)) & 15;
-	      s_crc[0] = (s_crc[0] << 1)|((nibble&1)?1:0);
-	      s_crc[1] = (s_crc[1] << 1)|((nibble&2)?1:0);
-	      s_crc[2] = (s_crc[2] << 1)|((nibble&4)?1:0);
-	      s_crc[3] = (s_crc[3] << 1)|((nibble&8)?1:0);	      
-	    }
-	    
-	    printf("WR SENT CRC = %04x/%04x/%04x/%04x\n",
-		   s_crc[0], s_crc[1], s_crc[2], s_crc[3]);
-
-	    write_count = 512;
-	  }
-	}
-	
-	// printf("WRITE %d = %d\n", write_count, tb->sddat);	
-      } else if(write_count < busy_end) {
-	if(write_count < ack_start) tb->sddat_in = 15;
-	else if(write_count < ack_start+8)
-	  tb->sddat_in = (ack_token & (0x80>>(write_count-ack_start)))?1:0;
-	else if(write_count < busy_end-1) tb->sddat_in = 0;
-	else                              tb->sddat_in = 15;
-	
-	write_count++;
-      }
-    
-      cmd_in = ((cmd_in << 1) | tb->sdcmd) & 0xffffffffffffll;      
-
-#ifndef BIT4
-      if(dat_ptr && dat_bits) {
-	if(dat_bits == 512*8 + 16 + 1 + 1) {
-	  // card sends start bit
-	  tb->sddat_in = 0;
-	  printf("READ START\n");
-	} else if(dat_bits > 1) {
-	  int bit = 7-((dat_bits-2) & 7);
-	  tb->sddat_in = (*dat_ptr & (0x80>>bit))?1:0;
-	  if(bit == 7) dat_ptr++;
-	} else
-	  tb->sddat_in = 15;
-	
-	dat_bits--;
-      }
-#else
-      // sending 4 bits
-      if(dat_ptr && dat_bits) {
-	if(dat_bits == 128*8 + 16 + 1 + 1) {
-	  // card sends start bit
-	  tb->sddat_in = 0;
-	  printf("READ-4 START\n");
-	} else if(dat_bits > 1) {
-	  int nibble = dat_bits&1;   // 1: high nibble, 0: low nibble
-	  if(nibble) tb->sddat_in = (*dat_ptr >> 4)&15;
-	  else       tb->sddat_in = *dat_ptr++ & 15;
-	} else
-	  tb->sddat_in = 15;
-	dat_bits--;
-      }
-#endif
-      
-      if(cmd_ptr && cmd_bits) {
-	int bit = 7-((cmd_bits-1) & 7);
-	tb->sdcmd_in = (*cmd_ptr & (0x80>>bit))?1:0;
-	if(bit == 7) cmd_ptr++;
-	cmd_bits--;
-      } else {      
-	tb->sdcmd_in = (cmd_out & (1ll<<47))?1:0;
-	cmd_out = (cmd_out << 1)|1;
-      }
-      
-#if 0
-      { static int bcnt = 0;
-	if(cmd_in) printf("cmd_in %d %llx\r\n", bcnt++, cmd_in);
-	else bcnt = 0;
-      }
-#endif
-      
-      // check if bit 47 is 0, 46 is 1 and 0 is 1
-      if( !(cmd_in & (1ll<<47)) && (cmd_in & (1ll<<46)) && (cmd_in & (1ll<<0))) {
-	unsigned char cmd  = (cmd_in >> 40) & 0x7f;
-	unsigned long arg  = (cmd_in >>  8) & 0xffffffff;
-	unsigned char crc7 = cmd_in & 0xfe;
-
-	// r1 reply:
-	// bit 7 - 0
-	// bit 6 - parameter error
-	// bit 5 - address error
-	// bit 4 - erase sequence error
-	// bit 3 - com crc error
-	// bit 2 - illegal command
-	// bit 1 - erase reset
-	// bit 0 - in idle state
-	
-	if(crc7 == getCRC(cmd, arg)) {
-	  printf("%cCMD %2d, ARG %08lx\n", last_was_acmd?'A':' ', cmd & 0x3f, arg);
-	  switch(cmd & 0x3f) {
-	  case 0:  // Go Idle State
-	    break;
-	  case 8:  // Send Interface Condition Command
-	    cmd_out = reply(8, arg);
-	    break;
-	  case 55: // Application Specific Command
-	    cmd_out = reply(55, 0);
-	    break;
-	  case 41: // Send Host Capacity Support
-	    cmd_out = reply(63, OCR);
-	    break;
-	  case 2:  // Send CID
-	    cid[16] = getCRC_bytes(cid, 16) | 1;  // Adjust CRC
-	    cmd_ptr = cid;
-	    cmd_bits = 136;
-	    break;
-	  case 3:  // Send Relative Address
-	    cmd_out = reply(3, (RCA<<16) | 0);	// status = 0
-	    break;
-	  case 7:  // select card
-	    cmd_out = reply(7, 0);    // may indicate busy	    
-	    break;
-	  case 6:  // set bus width
-	    printf("Set bus width to %ld\n", arg);
-	    cmd_out = reply(6, 0);
-	    break;
-	  case 16: // set block len (should be 512)
-	    printf("Set block len to %ld\n", arg);
-	    cmd_out = reply(16, 0);    // ok
-	    break;
-	  case 17:  // read block
-	    printf("Request to read single block %ld\n", arg);
-	    tb->rstart = 0;
-	    cmd_out = reply(17, 0);    // ok
-	    if(rw_state != 1) {
-	      printf("unexpected read state\n");
-	      // exit(-1);
-	    }	    
-	    rw_state = 2;
-
-	    // load sector
-	    {
-	      FILE *fd = fopen("disk_a.st", "rb");
-	      if(!fd) { perror("OPEN ERROR"); exit(-1); }	    
-	      fseek(fd, 512 * arg, SEEK_SET);
-	      int items = fread(sector_data, 2, 256, fd);
-	      if(items != 256) perror("fread()");
-
-	      for(int i=0;i<16;i++) printf("%02x ", sector_data[i]);
-	      printf("\n");
-	      
-	      fclose(fd);
-	    }
-
-#ifndef BIT4
-	    {
-	      unsigned short crc = 0;
-	      for(int i=0;i<512;i++)
-		crc = CRC16_one(crc, sector_data[i]);
-
-	      printf("CRC = %04x\n", crc);
-	      sector_data[512] = crc >> 8;
-	      sector_data[513] = crc & 0xff;
-	    }
-	    dat_ptr = sector_data;
-	    dat_bits = 512*8 + 16 + 1 + 1;
-#else
-	    {
-	      unsigned short crc[4] = { 0,0,0,0 };
-	      unsigned char dbits[4];
-	      for(int i=0;i<512;i++) {
-		// calculate the crc for each data line seperately
-		for(int c=0;c<4;c++) {
-		  if((i & 3) == 0) dbits[c] = 0;
-		  dbits[c] = (dbits[c] << 2) | ((sector_data[i]&(0x10<<c))?2:0) | ((sector_data[i]&(0x01<<c))?1:0);      
-		  if((i & 3) == 3) crc[c] = CRC16_one(crc[c], dbits[c]);
-		}
-	      }
-		
-	      printf("CRC = %04x/%04x/%04x/%04x\n", crc[0], crc[1], crc[2], crc[3]);
-
-	      // append crc's to sector_data
-	      for(int i=0;i<8;i++) sector_data[512+i] = 0;
-	      for(int i=0;i<16;i++) {
-		int crc_nibble =
-		  ((crc[0] & (0x8000 >> i))?1:0) +
-		  ((crc[1] & (0x8000 >> i))?2:0) +
-		  ((crc[2] & (0x8000 >> i))?4:0) +
-		  ((crc[3] & (0x8000 >> i))?8:0);
-
-		sector_data[512+i/2] |= (i&1)?(crc_nibble):(crc_nibble<<4);
-	      }
-	    }
-	    dat_ptr = sector_data;
-	    dat_bits = 128*8 + 16 + 1 + 1;
-#endif	    
-	    break;
-	    
-	  case 24:  // write block
-	    printf("Request to write single block %ld\n", arg);
-	    tb->wstart = 0;
-	    write_expect = -1;  
-	    write_count = 0;
-	    cmd_out = reply(24, 0);    // ok
-	    break;
-	    
-	  default:
-	    printf("unexpected command\n");
-	  }
-
-	  last_was_acmd = (cmd & 0x3f) == 55;
-	  
-	  cmd_in = -1;
-	} else
-	  printf("CMD %02x, ARG %08lx, CRC7 %02x != %02x!!\n", cmd, arg, crc7, getCRC(cmd, arg));	  
-      }      
-    }      
-    last_sdclk = tb->sdclk;
-  }
-  
-  trace->dump(1000000000000 * simulation_time);
+  elog.now = 1000000000000 * simulation_time;
+  trace.dump(elog.now);
   simulation_time += TICKLEN;
 }
 
@@ -416,20 +99,269 @@ void hexdump(void *data, int size) {
   }
 }
 
+// ---------------- multi block transfers ----------------
+// sd_rw.v only issues CMD17/CMD24. The multi block commands of the
+// card model are checked by driving its pins directly while the core
+// is idle
+
+static struct {
+  int cmd, dat;                   // driven by the host
+  unsigned char cmd_in, dat_in;   // driven by the card
+
+  // receiver of read blocks running on every clock
+  bool rx_on;
+  int rx_pos;                     // nibble, -1 = waiting for start bit
+  unsigned long rx_sector;
+  int rx_blocks;
+  uint8_t rx_buf[520];
+
+  int busy;                       // clocks dat0 was low
+} host;
+
+static int failures;
+
+static bool check(bool ok, const char *fmt, ...) {
+  if(ok) return true;
+  va_list args;
+  va_start(args, fmt);
+  printf("FAIL: ");
+  vprintf(fmt, args);
+  printf("\n");
+  va_end(args);
+  failures++;
+  return false;
+}
+
+static void host_block_received(void) {
+  unsigned long sector = host.rx_sector + host.rx_blocks;
+  check(!memcmp(host.rx_buf, sd->image.read(sector), 512), "sector %lu read with wrong data", sector);
+  check(sd_crc16x4(host.rx_buf, 512) == sd_crc16x4_load(host.rx_buf+512), "sector %lu read with wrong crc", sector);
+  host.rx_blocks++;
+}
+
+// one sd clock, the card samples and drives its outputs on the rising edge
+static void host_clk(void) {
+  sd->tick(0, host.cmd, host.dat, host.cmd_in, host.dat_in);
+  sd->tick(1, host.cmd, host.dat, host.cmd_in, host.dat_in);
+  simulation_time += 2*TICKLEN;
+  elog.now = 1000000000000 * simulation_time;
+
+  if(!(host.dat_in & 1)) host.busy++;
+
+  // start bit, 1024 data and 16 crc nibbles, end bit
+  if(!host.rx_on) return;
+  if(host.rx_pos < 0) {
+    if(!host.dat_in) host.rx_pos = 0;
+  } else if(host.rx_pos < 2*520) {
+    uint8_t *b = host.rx_buf + (host.rx_pos >> 1);
+    if(!(host.rx_pos++ & 1)) *b = host.dat_in << 4;
+    else                     *b |= host.dat_in & 15;
+  } else {
+    check(host.dat_in == 15, "no end bit after sector %lu", host.rx_sector + host.rx_blocks);
+    host_block_received();
+    host.rx_pos = -1;
+  }
+}
+
+static void host_idle(int clocks) {
+  while(clocks--) host_clk();
+}
+
+// send a command and return the argument of its 48 bit response
+static long host_cmd(int cmd, uint32_t arg) {
+  uint8_t c[6] = { (uint8_t)(0x40 | cmd), (uint8_t)(arg >> 24), (uint8_t)(arg >> 16),
+		   (uint8_t)(arg >> 8), (uint8_t)arg, 0 };
+  c[5] = sd_crc7(c, 5) | 1;
+  for(int i=0;i<48;i++) {
+    host.cmd = (c[i>>3] >> (7-(i&7))) & 1;
+    host_clk();
+  }
+  host.cmd = 1;
+
+  for(int n=0;n<64 && host.cmd_in;n++) host_clk();
+  if(!check(!host.cmd_in, "no response to CMD%d", cmd)) return -1;
+
+  uint8_t r[6] = { 0 };
+  for(int i=0;i<48;i++) {
+    r[i>>3] |= host.cmd_in << (7-(i&7));
+    host_clk();
+  }
+  check((r[0] & 0x3f) == cmd, "response %d to CMD%d", r[0] & 0x3f, cmd);
+  check(r[5] == (sd_crc7(r, 5) | 1), "bad crc in response to CMD%d", cmd);
+  return ((uint32_t)r[1] << 24) | (r[2] << 16) | (r[3] << 8) | r[4];
+}
+
+// send a data block and return the crc status token, -1 if none came
+static int host_write_block(const uint8_t *data, bool bad_crc) {
+  uint8_t buf[520];
+  memcpy(buf, data, 512);
+  sd_crc16x4_store(sd_crc16x4(data, 512), buf+512);
+  if(bad_crc) buf[519] ^= 1;
+
+  // Nwr, start bit, data and crc nibbles, end bit
+  host_idle(2);
+  host.dat = 0;
+  host_clk();
+  for(int i=0;i<2*520;i++) {
+    host.dat = (i & 1)?(buf[i>>1] & 15):(buf[i>>1] >> 4);
+    host_clk();
+  }
+  host.dat = 15;
+  host_clk();
+
+  // token on dat0: start bit, three status bits, end bit
+  for(int n=0;n<200 && (host.dat_in & 1);n++) host_clk();
+  if(!check(!(host.dat_in & 1), "no crc status token")) return -1;
+  int token = 0;
+  for(int i=0;i<5;i++) {
+    token = (token << 1) | (host.dat_in & 1);
+    host_clk();
+  }
+
+  // busy until the block is programmed
+  int busy = 0;
+  while(!(host.dat_in & 1) && busy < 100000) { host_clk(); busy++; }
+  check(busy > 0 && (host.dat_in & 1), "busy after write %d clocks", busy);
+  return token;
+}
+
+#define TOKEN_ACCEPTED   0b00101
+#define TOKEN_CRC_ERROR  0b01011
+
+static void test_pattern(uint8_t *data, int seed) {
+  for(int i=0;i<512;i++) data[i] = i * 7 + seed * 31;
+}
+
+// CMD18 ended by CMD12 while the fourth block is being sent
+static void test_read_stop(unsigned long sector) {
+  printf("CMD18 at sector %lu, CMD12 after 3 blocks\n", sector);
+  host.rx_on = true;
+  host.rx_pos = -1;
+  host.rx_sector = sector;
+  host.rx_blocks = 0;
+
+  host_cmd(18, sector);
+  for(int n=0;n<10000 && host.rx_blocks < 3;n++) host_clk();
+  check(host.rx_blocks == 3, "%d blocks read instead of 3", host.rx_blocks);
+
+  unsigned long blocks = sd->blocks_read;
+  host_cmd(12, 0);
+  host.rx_on = false;
+
+  // the lines are released and no further block is sent
+  int driven = 0;
+  for(int i=0;i<2000;i++) {
+    host_clk();
+    if(host.dat_in != 15) driven++;
+  }
+  check(!driven, "data lines driven for %d clocks after CMD12", driven);
+  check(sd->blocks_read == blocks, "blocks sent after CMD12");
+}
+
+// CMD23 block count followed by CMD18, no CMD12 needed
+static void test_read_count(unsigned long sector) {
+  printf("CMD23 with 2 blocks, CMD18 at sector %lu\n", sector);
+  host.rx_on = true;
+  host.rx_pos = -1;
+  host.rx_sector = sector;
+  host.rx_blocks = 0;
+
+  host_cmd(23, 2);
+  host_cmd(18, sector);
+  host_idle(5000);
+  host.rx_on = false;
+  check(host.rx_blocks == 2, "%d blocks read instead of 2", host.rx_blocks);
+}
+
+// CMD23 block count followed by CMD25
+static void test_write_count(unsigned long sector) {
+  printf("CMD23 with 3 blocks, CMD25 at sector %lu\n", sector);
+  uint8_t data[3][512], after[512];
+  memcpy(after, sd->image.read(sector+3), 512);
+  unsigned long written = sd->blocks_written;
+
+  host_cmd(23, 3);
+  host_cmd(25, sector);
+  for(int b=0;b<3;b++) {
+    test_pattern(data[b], b);
+    int token = host_write_block(data[b], false);
+    check(token == TOKEN_ACCEPTED, "block %d: crc status %d", b, token);
+  }
+
+  // the card is idle again, further start bits are ignored
+  host_idle(2000);
+  for(int b=0;b<3;b++)
+    check(!memcmp(sd->image.read(sector+b), data[b], 512), "sector %lu not written", sector+b);
+  check(!memcmp(sd->image.read(sector+3), after, 512), "sector %lu written", sector+3);
+  check(sd->blocks_written - written == 3, "%lu blocks written instead of 3", sd->blocks_written - written);
+}
+
+// CMD25 ended by CMD12, the second block has a bad crc
+static void test_write_stop(unsigned long sector) {
+  printf("CMD25 at sector %lu, bad crc in block 1, CMD12\n", sector);
+  uint8_t data[2][512], old[512];
+  memcpy(old, sd->image.read(sector+1), 512);
+  int crc_errors = sd->crc_errors;
+
+  host_cmd(25, sector);
+  test_pattern(data[0], 10);
+  test_pattern(data[1], 11);
+  int token = host_write_block(data[0], false);
+  check(token == TOKEN_ACCEPTED, "block 0: crc status %d", token);
+  token = host_write_block(data[1], true);
+  check(token == TOKEN_CRC_ERROR, "block 1: crc status %d instead of crc error", token);
+  check(sd->crc_errors == crc_errors + 1, "crc error not counted");
+
+  // CMD12 is answered with busy on dat0 (R1b)
+  host.busy = 0;
+  host_cmd(12, 0);
+  for(int n=0;n<10000 && !(host.dat_in & 1);n++) host_clk();
+  check(host.busy > 0 && (host.dat_in & 1), "no busy after CMD12");
+
+  check(!memcmp(sd->image.read(sector), data[0], 512), "sector %lu not written", sector);
+  check(!memcmp(sd->image.read(sector+1), old, 512), "sector %lu written despite crc error", sector+1);
+}
+
+static bool test_multi_block(unsigned long sector) {
+  host.cmd = 1;
+  host.dat = 15;
+  host.cmd_in = 1;
+  host.dat_in = 15;
+  host_idle(100);
+
+  test_read_stop(sector);
+  test_read_count(sector+4);
+  test_write_count(sector+8);
+  test_write_stop(sector+12);
+
+  printf("Multi block transfers %s\n", failures?"FAILED":"PASSED");
+  return !failures;
+}
+
 int main(int argc, char **argv) {
   // Initialize Verilators variables
   Verilated::commandArgs(argc, argv);
+
+  // +image=<file> and +sector=<n> select what's read and written
+  const char *arg = Verilated::commandArgsPlusMatch("image=");
+  sd = new SdCardModel(arg[0]?strdup(arg+7):"disk_a.st");
+  arg = Verilated::commandArgsPlusMatch("sector=");
+  unsigned long sector = arg[0]?strtoul(arg+8, NULL, 0):100;
+  arg = Verilated::commandArgsPlusMatch("dump=");
+  const char *dump = arg[0]?strdup(arg+6):NULL;
   Verilated::traceEverOn(true);
-  trace = new VerilatedVcdC;
-  trace->spTrace()->set_time_unit("1ns");
-  trace->spTrace()->set_time_resolution("1ps");
   simulation_time = 0;
 
   // Create an instance of our module under test
   tb = new Vsd_rw;
 	
-  tb->trace(trace, 99);
-  trace->open("sdc_tb.vcd");
+  trace.open(tb);
+  sd->attach(elog);
+  elog.setup();
+  if(trace.trigger_param("sd-cmd")) trig_sd_cmd = atoi(trace.trigger_param("sd-cmd"));
+  if(trace.stop_param("sd-cmd"))    stop_sd_cmd = atoi(trace.stop_param("sd-cmd"));
+  sd->cmd_cb = sd_command;
+  bench.start();
 
   // reset
   tb->rstn = 0; run(10); tb->rstn = 1; run(10);
@@ -446,20 +378,25 @@ int main(int argc, char **argv) {
 
   printf("Requesting read ...\n");
   tb->rstart = 1;
-  tb->sector = 100;
-  rw_state = 1;
+  tb->sector = sector;
   // wait for busy
   while(!tb->rbusy) tick(1);
   tb->rstart = 0;
   while(tb->card_stat != 8) run(1);
   printf("read done\n");
 
+  if(dump) {
+    FILE *file = fopen(dump, "wb");
+    if(!file) { perror(dump); exit(-1); }
+    fwrite(sector_buf, 1, sizeof(sector_buf), file);
+    fclose(file);
+  }
+
   wait_ms(1);
 
   printf("Requesting write ...\n");
   tb->wstart = 1;
-  tb->sector = 100;
-  rw_state = 1;
+  tb->sector = sector;
   // wait for busy
   while(!tb->rbusy) tick(1);
   tb->wstart = 0;
@@ -469,5 +406,12 @@ int main(int argc, char **argv) {
   
   wait_ms(5);
   
-  trace->close();
+  if(sd->crc_errors)
+    printf("%d sector(s) written with bad crc\n", sd->crc_errors);
+
+  bool ok = test_multi_block(sector);
+
+  trace.close();
+  bench.stop();
+  return ok?0:1;
 }
@@ -4,17 +4,33 @@
 #include <iomanip>
 #include "Vste_tb.h"
 #include "verilated.h"
-#include "verilated_vcd_c.h"
 
-// #define MONO
-// #define NTSC  // undef for PAL
+#include "trace.h"
+#include "bench.h"
+#include "checkpoint.h"
+#include "frame_capture.h"
+#include "sdram.h"
+#include "spi_flash.h"
+
+#ifdef SDL_VIEW
+#include "sdl_view.h"
+static SdlView view("video_tb");
+static bool sdl;
+#endif
 
 static Vste_tb *tb;
-static VerilatedVcdC *trace;
-static int tickcount;
+static TraceWindow trace("gstmcu");
+static SimBench bench("video_tb", 32000000);
+static Checkpoint ckpt("video_tb");
+static FrameCapture capture("video");
+static SdramModel sdram;
+static SpiFlashModel flash;
+static uint64_t tickcount;
+
+#define TICKLEN_PS  15625   // 64 MHz half clock ticks
 
-static unsigned char ram[4*1024*1024];
-static unsigned char rom[8*1024*1024];  // 8 MB spi flash
+// requesters the sdram accesses are accounted to
+enum { SRC_COPY, SRC_VIDEO };
 
 // dummy data for on screen display
 char dummy_dir[][17] = {
@@ -27,26 +43,53 @@ char dummy_dir[][17] = {
   "test data!      ",
   "DISK_B   ST     " };
 
+// video mode selected by +mode=pal|ntsc|mono
+enum { PAL, NTSC, MONO };
+static int mode = PAL;
+static const char *mode_names[] = { "pal", "ntsc", "mono" };
+
+// mode a checkpoint was saved in, only compared with +mode on restore
+static int ckpt_mode;
+
+// frame rates as 8 MHz / (clocks per line * lines)
+static const int mode_fps[][2] = { { 15625, 313 }, { 2000000, 33401 }, { 250000, 3507 } };
+
+// give up capturing if no frame completes within this many clocks
+#define CAPTURE_TIMEOUT  (32000*100)
+static bool capture_failed;
+
 void initrom() {
-  for(int i=0;i<sizeof(ram);i++) ram[i] = i;
-  
   // load ram into into space at 2 MB
-#ifdef MONO
-  FILE *file=fopen("mono32k.bin", "rb");
-#else
-  FILE *file=fopen("vmem32k.bin", "rb");
-#endif
-  if(!file) { perror("opening mono/vmem32k.bin"); exit(-1); }
-  fread(rom+0x200000, 32, 1000, file);
-  fclose(file);
+  if(!flash.load((mode == MONO)?"mono32k.bin":"vmem32k.bin", 0x200000)) exit(-1);
+  flash.verbose = 1;
+}
+
+// expand the 6 bit scandoubler output to 8 bit
+static inline uint8_t c8(int v) { return (v<<2)|(v>>4); }
+
+// feed one pixel to the frame capture, the same in all video modes so
+// e.g. a coloured OSD over a mono screen is kept
+static void capture_pixel(void) {
+  capture.pixel(tb->HSYNC_N, tb->VSYNC_N, c8(tb->R), c8(tb->G), c8(tb->B));
 }
 
+static void capture_off(void) { }
+static void (*capture_fn)(void) = capture_off;
+
 void tick(int c) {
   tb->clk32 = c;
   tb->flash_clk = c;
 
   tb->eval();
-  trace->dump(tickcount++);
+  if(c) bench.cycle();
+  trace.dump(TICKLEN_PS * tickcount++);
+
+  if(c) capture_fn();
+
+#ifdef SDL_VIEW
+  if(sdl && c)
+    view.pixel(tb->HSYNC_N, tb->VSYNC_N, tb->R << 2, tb->G << 2, tb->B << 2);
+#endif
 
   // input [7:0]  dir_chr,
   
@@ -54,215 +97,161 @@ void tick(int c) {
   if(tb->osd_dir_row <= 6)
     tb->osd_dir_chr = dummy_dir[tb->osd_dir_row][tb->osd_dir_col];
   
-  // ------------ handle spi flash -------------------	
-  // process spi on rising edge of spi clk
-  static int spi_clk = 0;
-  
-  if(tb->flash_clk && !spi_clk) {
-    
-    static int spi_state = -1;
-    static int spi_dspi = 0;
-    if( spi_state == -1 && tb->mspi_cs == 0) {
-      if(spi_dspi) spi_state = 8;
-      else         spi_state = 0;
-    } else if(tb->mspi_cs == 1)
-      spi_state = -1;
-    
-    if(spi_state != -1) {
-      static int spi_cmd, spi_addr, spi_m;
-
-      if(spi_state == 8 && spi_cmd == 0xbb)
-	spi_dspi = 1;
-      
-      if(spi_state < 8) 
-	spi_cmd = ((spi_cmd << 1)|(tb->mspi_di?1:0)) & 0xff;
-      if(spi_state >= 8 && spi_state < 20) {
-	// on dspi the address bits come on di _and_ do
-	int b0 = tb->mspi_di?1:0;
-	int b1 = tb->mspi_do?2:0;
-	spi_addr = ((spi_addr << 2)|(b0+b1)) & 0xffffff;
-      }
-      if(spi_state >= 20 && spi_state < 24) {
-	int b0 = tb->mspi_di?1:0;
-	int b1 = tb->mspi_do?2:0;
-	spi_m = ((spi_m << 2)|(b0+b1)) & 0xff;
-      }
-      
-      if(spi_state == 23) printf("SPI cmd $%02x, addr %08x, M=%02x\n", spi_cmd, spi_addr, spi_m);
-      
-      // return rom data
-      if(spi_state >= 25) {
-	int byte = rom[spi_addr + ((spi_state-25)/4)];
-	tb->mspi_din = (byte >> (2*(3-((spi_state-25) & 3)))) & 0x03;
-      }
-      
-      spi_state++;
-    }
+  flash.tick(tb);
+  sdram.tick(tb);
+}
+
+// The test sequence in main() is written in absolute clock cycles. A
+// run restored from a checkpoint thus skips the steps done before the
+// checkpoint was taken
+static int64_t restored_at = -1;
+
+// run up to the given clock cycle, true if the step there is to be done
+static bool at(uint64_t cycle) {
+  while(tickcount < 2*cycle) {
+    tick(1); tick(0);
+    ckpt.poll(tb, tickcount * TICKLEN_PS / 1e9);
+  }
+  return (int64_t)cycle >= restored_at;
+}
+
+static void simulate(void) {
+  if(at(0)) {
+    tb->osd_dir_len = 7;
+    tb->resb = 0;
+    tb->porb = 0;  // 0=cold, 1=warm boot
   }
-  spi_clk = tb->flash_clk;
   
-  // emulate SDRAM
-  if(c && !tb->sd_cs) {
-    static int addr;
-    
-    if(!tb->sd_ras && tb->sd_cas) {
-      addr = (tb->sd_ba<<21) + (tb->sd_addr<<10);
-    }
-    
-    if(tb->sd_ras && !tb->sd_cas) {
-      addr += (tb->sd_addr&0xff)<<2;
-      
-      // handle writes
-      if(!tb->sd_we) {
-	printf("WRITE %x = %x\n", addr, tb->sd_data);
-	if(!(tb->sd_dqm & 1)) ram[addr+3] = (tb->sd_data >>  0) & 0xff;
-	if(!(tb->sd_dqm & 2)) ram[addr+2] = (tb->sd_data >>  8) & 0xff;
-	if(!(tb->sd_dqm & 4)) ram[addr+1] = (tb->sd_data >> 16) & 0xff;
-	if(!(tb->sd_dqm & 8)) ram[addr+0] = (tb->sd_data >> 24) & 0xff;
-      } else {
-	// handle reads
-	tb->sd_data_in = (ram[addr+0]<<24)+(ram[addr+1]<<16)+(ram[addr+2]<<8)+(ram[addr+3]<<0);
-	printf("READ %x = %x\n", addr, tb->sd_data_in);
-      }
-    }
+  if(at(1)) {
+    tb->VMA_N = 1;
+    tb->MFPINT_N = 1;
+    tb->BR_N = 1;
+  
+    tb->FC0 = 0;
+    tb->FC1 = 1;
+    tb->FC2 = 1;
   }
-}
+  
+  if(at(101)) tb->porb = 1;
+  if(at(201)) tb->resb = 1;
+
+  // copy 32k ram takes 32000*16 cycles
+  const uint64_t ram_loaded = 201 + 32000*16;
+  if(at(ram_loaded)) {
+    printf("RAM loaded\n");
+    sdram.source = SRC_VIDEO;
 
-void dump() {
-  int vsync = 0, hsync = 0;
-  unsigned short rgb;
-  FILE *file = NULL;
-  int line = -1;
-  int pix = -1;
+    // make OSD appear
+    tb->osd_btn_in = 2;
+  }
+  if(at(ram_loaded + 100000)) tb->osd_btn_in = 0;
   
-  printf("--- dumping image ---\n");
-	
-  while(1) {
-    if (!tb->VSYNC_N && vsync) {
-      printf("VSYNC\n");
-      if(!file) {
-	file = fopen("video.rgb", "wb");
-	line = 0;
-      } else {
-	fclose(file);
-	return;
+#ifdef SDL_VIEW
+  // keep running, F12 and return are the OSD buttons
+  if(sdl) {
+    while(!view.closed()) {
+      at(tickcount/2 + 32000);
+      SdlView::Event ev;
+      while(view.input(ev)) {
+	if(ev.type != SdlView::Event::KEY) continue;
+	int bit = (ev.code == 0x45)?2:(ev.code == 0x28)?1:0;
+	if(ev.pressed) tb->osd_btn_in |= bit;
+	else           tb->osd_btn_in &= ~bit;
       }
     }
-   
-    pix++;
-    if (tb->HSYNC_N && !hsync) {
-      line++;
-      pix = 0;
-    }
-
-#ifdef MONO
-    #define COLS 640
-    #define ROWS 400
-    #define COL1ST  149
-    #define ROW1ST  38
-#else
-#ifdef NTSC
-    #define COLS 848
-    #define ROWS 484
-    #define COL1ST  73
-    #define ROW1ST  40
-#else
-    #define COLS 832
-    #define ROWS 566
-    #define COL1ST  82
-    #define ROW1ST  58
-#endif
+    return;
+  }
 #endif
-    
-    vsync = tb->VSYNC_N;
-    hsync = tb->HSYNC_N;
+
+  // +frames=<n> frames from here on, see frame_capture.h
+  at(ram_loaded + 1200000);
+  capture_fn = capture_pixel;
+  uint64_t last_frame = tickcount;
+  int seen = capture.seen;
+  while(!capture.done()) {
     tick(1); tick(0);
-    if(file) {
-      // the scandoubler outputs no blanking signal ...      
-      if(/* tb->BLANK_N */ line >= ROW1ST && line < ROW1ST+ROWS && pix >= COL1ST && pix < COL1ST+COLS) {
-	rgb = ((tb->R>>2)*256) + ((tb->G>>2)*16) + (tb->B>>2);
-	fwrite(&rgb, 1, sizeof(rgb), file);
-      }
+
+    if(capture.seen != seen) {
+      seen = capture.seen;
+      last_frame = tickcount;
+    } else if(tickcount - last_frame > 2*CAPTURE_TIMEOUT) {
+      printf("No video frame for %d ms, stopping the capture\n", CAPTURE_TIMEOUT/32000);
+      capture_failed = true;
+      break;
     }
   }
+  capture_fn = capture_off;
+
+  for(int i=0;i<10000;i++) {
+    tick(1); tick(0);
+  }
 }
 
 int main(int argc, char **argv) {
-  initrom();
-
   // Initialize Verilators variables
   Verilated::commandArgs(argc, argv);
+
+  const char *arg = Verilated::commandArgsPlusMatch("mode=");
+  if(arg[0]) {
+    for(mode=0;mode<3 && strcmp(arg+6, mode_names[mode]);mode++);
+    if(mode == 3) { printf("Unknown video mode %s\n", arg+6); exit(-1); }
+  }
+  printf("Video mode %s\n", mode_names[mode]);
+
+  initrom();
   Verilated::traceEverOn(true);
-  trace = new VerilatedVcdC;
   tickcount = 0;
 
-  memset(ram, 0x55, 4*1024*1024);
-  
-  // Create an instance of our module under test
-  tb = new Vste_tb;
-  tb->trace(trace, 99);
-  trace->open("gstmcu.vcd");
-
-#ifdef MONO
-  tb->mono_detect = 0;  // 1 - color, 0 - mono
+  // +sdl shows the video live until the window is closed
+  if(Verilated::commandArgsPlusMatch("sdl")[0]) {
+#ifdef SDL_VIEW
+    sdl = true;
 #else
-  tb->mono_detect = 1;
-  
-#ifdef NTSC
-  tb->ntsc = 1;
-#else
-  tb->ntsc = 0;
-#endif
+    printf("Built without SDL, ignoring +sdl\n");
 #endif
-
-  tb->osd_dir_len = 7;
-  tb->resb = 0;
-  tb->porb = 0;  // 0=cold, 1=warm boot
-  tick(1);
-  tick(0);
-  
-  tb->VMA_N = 1;
-  tb->MFPINT_N = 1;
-  tb->BR_N = 1;
-  
-  tb->FC0 = 0;
-  tb->FC1 = 1;
-  tb->FC2 = 1;
-  
-  for(int i=0;i<100;i++) {
-    tick(1); tick(0);
-  }
-  
-  tb->porb = 1;
-  
-  for(int i=0;i<100;i++) {
-    tick(1); tick(0);
   }
+
+  memset(sdram.mem, 0x55, sdram.size);
+  sdram.source_name(SRC_COPY, "copy");
+  sdram.source_name(SRC_VIDEO, "video");
+
+  // +save_at=<ms> / +restore=<file>, e.g. to skip the ram copy
+  ckpt.args(argc, argv);
+  ckpt.add(sdram.mem, sdram.size);
+  ckpt.add(sdram.st);
+  ckpt.add(sdram.source);
+  ckpt.add(flash.mem, flash.size);
+  ckpt.add(flash.st);
+  ckpt.add(tickcount);
+  ckpt_mode = mode;
+  ckpt.add(ckpt_mode);
   
-  tb->resb = 1;
+  // Create an instance of our module under test
+  tb = new Vste_tb;
+  trace.open(tb);
+  capture.setup(mode_fps[mode][0], mode_fps[mode][1]);
 
-  // copy 32k ram takes 32000*16 cycles
-  for(int i=0;i<32000*16;i++) {
-    tick(1); tick(0);
-  }
+  tb->mono_detect = (mode == MONO)?0:1;  // 1 - color, 0 - mono
+  tb->ntsc = (mode == NTSC)?1:0;
 
-  printf("RAM loaded\n");
+  if(ckpt.restore(tb)) {
+    if(ckpt_mode != mode) {
+      printf("Checkpoint was saved in video mode %s, not %s\n", mode_names[ckpt_mode], mode_names[mode]);
+      exit(-1);
+    }
+    restored_at = tickcount/2;
+  }
+  bench.start();
 
-  // make OSD appear
-  tb->osd_btn_in = 2;
-  for(int i=0;i<100000;i++) { tick(1); tick(0); }  
-  tb->osd_btn_in = 0;
-  for(int i=0;i<100000;i++) { tick(1); tick(0); }
-  
-#if 1
-  for(int i=0;i<1000000;i++) {
-    tick(1); tick(0);
-	}
-  dump();
+#ifdef SDL_VIEW
+  if(sdl) view.run(simulate);
+  else
 #endif
+    simulate();
 
-  for(int i=0;i<10000;i++) {
-    tick(1); tick(0);
-  }
-  trace->close();
+  trace.close();
+  bench.stop();
+  capture.close();
+  sdram.report();
+  return capture_failed?1:0;
 }
@@ -0,0 +1,224 @@
+//
+// flash_qspi.v - reading W25Q64FV, 64MBit spi flash
+//
+// Drop-in variant of flash_dspi.v running the flash in QSPI/IO
+// mode using the "fast read quad IO" command. Address, mode bits
+// and data use all four IO lines. The "Continuous Read Mode" is
+// enabled in the first read so later reads skip the command byte
+// and take 17 clocks for a random 16 bit word compared to 25 clocks
+// in DSPI mode.
+//
+// After a word has been delivered the flash keeps streaming the
+// following words into a small prefetch buffer until it's full. A
+// sequential fetch found in the buffer is served within the two
+// clocks needed to detect the request, the buffer is refilled in
+// the background once it's half empty.
+//
+// Quad IO needs the QE bit of the flash, which is set in its volatile
+// status register during init. This turns WP and HOLD into IO2 and
+// IO3.
+//
+// To use it instead of flash_dspi.v instantiate flash_qspi instead of
+// flash in top.sv and replace flash_dspi.v in the project.
+
+module flash_qspi #(
+ parameter DEPTH = 4              // words in prefetch buffer, power of 2 >= 2
+) (
+ input		   clk,
+ input		   resetn,
+ output		   ready,
+
+ // chipset read interface
+ input [21:0]	   address, // 16 bit word address
+ input		   cs,
+ output reg [15:0] dout,
+
+ // interface to the chip
+ output		   mspi_cs,
+ inout		   mspi_di,   // IO0
+ inout		   mspi_hold, // IO3
+ inout		   mspi_wp,   // IO2
+ inout		   mspi_do,   // IO1
+
+`ifdef VERILATOR
+ input [3:0]	   mspi_din,
+`endif
+
+ output reg	   busy
+);
+
+localparam AW = $clog2(DEPTH);
+
+// use "fast read quad IO" command
+wire [7:0] CMD_RD_QIO = 8'heb;
+
+// M(5:4) = 1,0 -> “Continuous Read Mode”
+wire [7:0] M = 8'b0010_0000;
+
+// 8 command clocks, 6 address and 2 mode clocks, 4 dummy clocks and
+// data is sampled one clock after it has been driven by the flash
+localparam [4:0] S_MODE = 5'd15;
+localparam [4:0] S_DATA = 5'd21;
+
+// ------------------------------- init -------------------------------
+// 1) 16 clocks with all IOs high make sure any continuous read mode is
+//    left and the flash is in a known state
+// 2) "write enable for volatile status register"
+// 3) "write status register 2" with QE set
+reg [6:0] istep;
+assign ready = istep[6];
+
+// the init runs in slots of 8 clocks with the flash deselected in
+// between
+wire [2:0] slot = istep[5:3];
+wire init_ones = (slot == 3'd1 || slot == 3'd2);
+wire [7:0] init_byte = (slot == 3'd4)?8'h50:(slot == 3'd6)?8'h31:8'h02;
+wire init_cs = !(init_ones || slot == 3'd4 || slot == 3'd6 || slot == 3'd7);
+
+// ------------------------------- reads ------------------------------
+reg	   qspi_mode;      // continuous read mode enabled
+reg	   mspi_cs_r;
+reg [4:0]  state;          // clock within current read, stays at S_DATA
+reg [1:0]  nib;            // nibble within current data word
+reg [11:0] shift;
+reg [21:0] stream_addr;    // word currently read from flash
+
+// prefetch buffer holding count words starting at head. Words are
+// stored at their address modulo DEPTH
+reg [15:0] buffer [DEPTH-1:0];
+reg [21:0] head;
+reg [AW:0] count;
+
+assign mspi_cs = ready?mspi_cs_r:init_cs;
+
+wire [23:0] byte_addr = { 1'b0, stream_addr, 1'b0 };
+wire [3:0] qspi_out =
+		  (state== 5'd8)?byte_addr[23:20]:
+		  (state== 5'd9)?byte_addr[19:16]:
+		  (state==5'd10)?byte_addr[15:12]:
+		  (state==5'd11)?byte_addr[11:8]:
+		  (state==5'd12)?byte_addr[7:4]:
+		  (state==5'd13)?byte_addr[3:0]:
+		  (state==5'd14)?M[7:4]:
+		  M[3:0];
+
+// IO2/IO3 stay high while not used for quad IO, IO1 is only driven
+// during the init and the address phase
+wire [3:0] output_en =
+	   !ready?(init_ones?4'b1111:4'b1101):
+	   mspi_cs_r?4'b1101:
+	   (state < 5'd8)?4'b1101:
+	   (state <= S_MODE)?4'b1111:4'b0000;
+
+wire [3:0] data_out =
+	   !ready?((init_ones || init_cs)?4'b1111:{ 3'b111, init_byte[3'd7-istep[2:0]] }):
+	   mspi_cs_r?4'b1111:
+	   (state < 5'd8)?{ 3'b111, CMD_RD_QIO[3'd7-state[2:0]] }:
+	   qspi_out;
+
+assign mspi_di   = output_en[0]?data_out[0]:1'bz;
+assign mspi_do   = output_en[1]?data_out[1]:1'bz;
+assign mspi_wp   = output_en[2]?data_out[2]:1'bz;
+assign mspi_hold = output_en[3]?data_out[3]:1'bz;
+
+`ifdef VERILATOR
+wire [3:0] qspi_in = mspi_din;
+`else
+wire [3:0] qspi_in = { mspi_hold, mspi_wp, mspi_do, mspi_di };
+`endif
+
+// a request is handled in the clock it's detected in
+reg	   csD, csD2;
+reg [21:0] req_addr;
+wire	   req_new = csD && !csD2 && !busy;
+wire	   pending = req_new || busy;
+wire [21:0] raddr = req_new?address:req_addr;
+
+wire [21:0] offset = raddr - head;
+wire	    hit = (offset < count);
+wire	    in_flight = !mspi_cs_r && raddr == stream_addr;
+wire	    word_done = !mspi_cs_r && state == S_DATA && nib == 2'd3;
+wire [15:0] word = { shift, qspi_in };
+
+always @(posedge clk or negedge resetn) begin
+   if(!resetn) begin
+      istep <= 7'd0;
+      qspi_mode <= 1'b0;
+      mspi_cs_r <= 1'b1;
+      busy <= 1'b0;
+      csD <= 1'b0;
+      csD2 <= 1'b0;
+      state <= 5'd0;
+      nib <= 2'd0;
+      head <= 22'd0;
+      count <= 0;
+   end else begin
+      csD <= cs;     // bring cs into local clock domain
+      csD2 <= csD;   // delay to detect rising edge
+
+      if(!ready)
+        istep <= istep + 7'd1;
+      else begin
+        if(req_new) begin
+            req_addr <= address;
+            busy <= 1'b1;
+        end
+
+        // run the read in progress
+        if(!mspi_cs_r) begin
+            if(state != S_DATA) state <= state + 5'd1;
+            else begin
+                nib <= nib + 2'd1;
+                shift <= word[11:0];
+            end
+
+            // mode bits have been sent
+            if(state == S_MODE)
+                qspi_mode <= 1'b1;
+        end
+
+        if(word_done) begin
+            stream_addr <= stream_addr + 22'd1;
+
+            if(pending && in_flight) begin
+                // the requested word arrives, pass it on directly
+                dout <= word;
+                busy <= 1'b0;
+                head <= stream_addr + 22'd1;
+                count <= 0;
+            end else begin
+                buffer[stream_addr[AW-1:0]] <= word;
+                count <= count + 1'd1;
+                // stop once the buffer is full
+                if(count == DEPTH-1) mspi_cs_r <= 1'b1;
+            end
+        end else if(pending && hit) begin
+            // word is in prefetch buffer, drop all words before it
+            dout <= buffer[raddr[AW-1:0]];
+            busy <= 1'b0;
+            head <= raddr + 22'd1;
+            count <= count - offset[AW:0] - 1'd1;
+        end else if(pending && !in_flight) begin
+            // miss, start a new read. A read in progress is aborted once
+            // its mode bits have been sent to stay in continuous mode
+            if(mspi_cs_r) begin
+                mspi_cs_r <= 1'b0;
+                state <= qspi_mode?5'd8:5'd0;
+                nib <= 2'd0;
+                stream_addr <= raddr;
+                head <= raddr;
+                count <= 0;
+            end else if(state > S_MODE)
+                mspi_cs_r <= 1'b1;
+        end else if(!pending && mspi_cs_r && count <= DEPTH/2) begin
+            // refill the prefetch buffer behind the words it holds
+            mspi_cs_r <= 1'b0;
+            state <= qspi_mode?5'd8:5'd0;
+            nib <= 2'd0;
+            stream_addr <= head + count;
+        end
+      end
+   end
+end
+
+endmodule